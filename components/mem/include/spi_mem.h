@@ -7,6 +7,7 @@
  * Driver to access memory chip (23LC1024, and similar) using the SPI bus.
  */
 
+#include "freertos/FreeRTOS.h"
 #include "driver/spi_master.h"
 
 typedef enum spi_mem_mode_t {
@@ -27,6 +28,17 @@ typedef struct spi_mem_config_t {
 	int number_of_bytes_page;
 } spi_mem_config_t;
 
+/**
+ * SPI transactions.
+ */
+typedef struct spi_mem_statistics_t {
+	uint64_t count;
+	/** Total time, including the wait for the bus. */
+	uint64_t time_us;
+	/** Longest transaction. */
+	uint32_t max_us;
+} spi_mem_statistics_t;
+
 /**
  * Even though this data is 'public'.
  * Do not shoot yourself in the foot by changing this data.
@@ -40,6 +52,8 @@ typedef struct spi_mem_t {
 	int total_bytes;
 	int number_of_pages;
 	int number_of_bytes_page;
+	spi_mem_statistics_t statistics;
+	portMUX_TYPE statistics_mux;
 } spi_mem_t;
 
 typedef struct spi_mem_t *spi_mem_handle_t;
@@ -57,6 +71,13 @@ void spi_mem_begin(spi_mem_config_t config, spi_mem_handle_t *handle);
  */
 void spi_mem_end(spi_mem_handle_t handle);
 
+/**
+ * @brief Get the SPI transaction statistics.
+ * @param handle Component handle.
+ * @param statistics Target of the statistics.
+ */
+void spi_mem_get_statistics(spi_mem_handle_t handle, spi_mem_statistics_t *statistics);
+
 /**
  * @brief READ 0000 0011 0x03 Read data from memory array beginning at selected address.
  * Read memory one byte at a time.
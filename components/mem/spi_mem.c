@@ -2,6 +2,7 @@
 #include "spi_mem.h"
 #include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 
 static const char* TAG = "spi_mem";
@@ -47,6 +48,28 @@ static void spi_mem_remove_command(spi_mem_handle_t handle) {
 	ESP_LOGD(TAG, "<spi_mem_remove_command");
 }
 
+/**
+ * Transmit and keep statistics.
+ */
+static void spi_mem_transmit(spi_mem_handle_t handle, spi_device_handle_t device, spi_transaction_t *transaction) {
+	int64_t start_us = esp_timer_get_time();
+	ESP_ERROR_CHECK(spi_device_transmit(device, transaction));
+	uint32_t time_us = esp_timer_get_time() - start_us;
+	portENTER_CRITICAL(&handle->statistics_mux);
+	handle->statistics.count++;
+	handle->statistics.time_us += time_us;
+	if (time_us > handle->statistics.max_us) {
+		handle->statistics.max_us = time_us;
+	}
+	portEXIT_CRITICAL(&handle->statistics_mux);
+}
+
+void spi_mem_get_statistics(spi_mem_handle_t handle, spi_mem_statistics_t *statistics) {
+	portENTER_CRITICAL(&handle->statistics_mux);
+	*statistics = handle->statistics;
+	portEXIT_CRITICAL(&handle->statistics_mux);
+}
+
 void spi_mem_begin(spi_mem_config_t config, spi_mem_handle_t *handle) {
 	ESP_LOGD(TAG, ">spi_mem_begin");
 	ESP_LOGD(TAG, "host: %d", config.host);
@@ -66,6 +89,8 @@ void spi_mem_begin(spi_mem_config_t config, spi_mem_handle_t *handle) {
 	spi_mem->total_bytes = config.total_bytes;
 	spi_mem->number_of_pages = config.number_of_pages;
 	spi_mem->number_of_bytes_page = config.number_of_bytes_page;
+	memset(&spi_mem->statistics, 0, sizeof(spi_mem_statistics_t));
+	vPortCPUInitializeMutex(&spi_mem->statistics_mux);
 
 	spi_mem_add_command(spi_mem);
 	spi_mem_add_data(spi_mem);
@@ -91,7 +116,7 @@ uint8_t spi_mem_read_byte(spi_mem_handle_t handle, uint32_t address) {
 	transaction.addr = address;
 	transaction.flags = SPI_TRANS_USE_RXDATA;
 	transaction.length = 8;
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_data, &transaction));
+	spi_mem_transmit(handle, handle->device_data, &transaction);
 	ESP_LOGV(TAG, "<spi_mem_read_byte");
 	return transaction.rx_data[0];
 }
@@ -111,7 +136,7 @@ void spi_mem_read(spi_mem_handle_t handle, uint32_t address, uint32_t length, ui
 	transaction.flags = 0;
 	transaction.length = length * 8;
 	transaction.rx_buffer = data;
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_data, &transaction));
+	spi_mem_transmit(handle, handle->device_data, &transaction);
 	ESP_LOGV(TAG, "<spi_mem_read");
 }
 
@@ -124,7 +149,7 @@ void spi_mem_write_byte(spi_mem_handle_t handle, uint32_t address, uint8_t data)
 	transaction.flags = SPI_TRANS_USE_TXDATA;
 	transaction.length = 8;
 	transaction.tx_data[0] = data;
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_data, &transaction));
+	spi_mem_transmit(handle, handle->device_data, &transaction);
 	ESP_LOGV(TAG, "<spi_mem_write_byte");
 }
 
@@ -143,7 +168,7 @@ void spi_mem_write(spi_mem_handle_t handle, uint32_t address, uint32_t length, u
 	transaction.flags = 0;
 	transaction.length = 8 * length;
 	transaction.tx_buffer = data;
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_data, &transaction));
+	spi_mem_transmit(handle, handle->device_data, &transaction);
 	ESP_LOGV(TAG, "<spi_mem_write");
 }
 
@@ -155,7 +180,7 @@ void spi_mem_enter_dual_io_access(spi_mem_handle_t handle) {
 	transaction.length = 8;
 	transaction.tx_data[0] = 0x3B;
 	// uses rx_data, the contents will be empty
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_command, &transaction));
+	spi_mem_transmit(handle, handle->device_command, &transaction);
 	ESP_LOGD(TAG, "<spi_mem_enter_dual_io_access");
 }
 
@@ -167,7 +192,7 @@ void spi_mem_enter_quad_io_access(spi_mem_handle_t handle) {
 	transaction.length = 8;
 	transaction.tx_data[0] = 0x38;
 	// uses rx_data, the contents will be empty
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_command, &transaction));
+	spi_mem_transmit(handle, handle->device_command, &transaction);
 	ESP_LOGD(TAG, "<spi_mem_enter_quad_io_access");
 }
 
@@ -179,7 +204,7 @@ void spi_mem_reset_io_access(spi_mem_handle_t handle) {
 	transaction.length = 8;
 	transaction.tx_data[0] = 0xFF;
 	// uses rx_data, the contents will be empty
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_command, &transaction));
+	spi_mem_transmit(handle, handle->device_command, &transaction);
 	ESP_LOGD(TAG, "<spi_mem_reset_io_access");
 }
 
@@ -191,7 +216,7 @@ spi_mem_mode_t spi_mem_read_mode_register(spi_mem_handle_t handle) {
 	transaction.length = 16;
 	transaction.tx_data[0] = 0x05;
 	// uses rx_data, the contents will be in the second byte
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_command, &transaction));
+	spi_mem_transmit(handle, handle->device_command, &transaction);
 	uint8_t mode = transaction.rx_data[1];
 	ESP_LOGD(TAG, "<spi_mem_read_mode_register 0x%02x", mode);
 	return mode;
@@ -206,6 +231,6 @@ void spi_mem_write_mode_register(spi_mem_handle_t handle, spi_mem_mode_t mode) {
 	transaction.tx_data[0] = 0x01;
 	transaction.tx_data[1] = mode;
 	// uses rx_data, the contents will be empty
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_command, &transaction));
+	spi_mem_transmit(handle, handle->device_command, &transaction);
 	ESP_LOGD(TAG, "<spi_mem_write_mode_register");
 }
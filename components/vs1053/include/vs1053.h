@@ -10,8 +10,19 @@
 /**
  * @file
  * Driver to access VLSI VS1053b functions using the SPI bus.
+ *
+ * The control (SCI) and data (SDI) interfaces share the bus and both wait
+ * for DREQ. Only the task that feeds the decoder writes registers directly.
+ * Other tasks queue their writes (vs1053_set_volume), the feeding task
+ * applies them between data transfers (vs1053_service). The queue holds one
+ * write per register and does not lock: a newer write to a register replaces
+ * the one still waiting, so a fast turning volume knob costs one write per
+ * data transfer at most. Queued writes to different registers are applied in
+ * register order, not in the order they were queued.
  */
 
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
 #include "driver/spi_master.h"
 
 /** Mode control, rw, 0x4000, 80 CLKI */
@@ -81,6 +92,9 @@
 /** Bit 15: Input clock range (0:12..13MHz,1:24..26MHz) */
 #define VS1053_SM_CLK_RANGE		(0x80)
 
+/** Number of registers. */
+#define VS1053_SCI_COUNT (16)
+
 /** Maximum data size accepted when DREQ active */
 #define VS1053_MAX_DATA_SIZE (32)
 
@@ -94,6 +108,32 @@ typedef struct vs1053_config_t {
 	int rst_io_num;
 } vs1053_config_t;
 
+/**
+ * SPI transactions of one device.
+ */
+typedef struct vs1053_spi_statistics_t {
+	uint64_t count;
+	/** Total time, including the wait for the bus. */
+	uint64_t time_us;
+	/** Longest transaction. */
+	uint32_t max_us;
+} vs1053_spi_statistics_t;
+
+/**
+ * Register write queue.
+ */
+typedef struct vs1053_queue_statistics_t {
+	/** Registers with a write waiting. */
+	uint32_t depth;
+	/** Writes queued, and writes replaced by a newer one before they were applied. */
+	uint32_t queue_count;
+	uint32_t coalesce_count;
+	/** Writes applied, and the time from queueing to writing, total and longest. */
+	uint32_t write_count;
+	uint64_t wait_us;
+	uint32_t wait_max_us;
+} vs1053_queue_statistics_t;
+
 /**
  * Even though this data is 'public'.
  * Do not shoot yourself in the foot by changing this data.
@@ -108,10 +148,39 @@ typedef struct vs1053_t {
 	int xdcs_io_num;
 	int dreq_io_num;
 	int rst_io_num;
+	vs1053_spi_statistics_t control_statistics;
+	vs1053_spi_statistics_t data_statistics;
+	portMUX_TYPE statistics_mux;
+	/** Queued register writes, a bit per register, changed by compare and set only. */
+	volatile uint32_t queue_pending;
+	/** Latest value and time of the first queued write (low 32 bits of esp_timer_get_time) per register. */
+	volatile uint16_t queue_value[VS1053_SCI_COUNT];
+	volatile uint32_t queue_time_us[VS1053_SCI_COUNT];
+	/** Queue counters, changed by compare and set only. */
+	volatile uint32_t queue_count;
+	volatile uint32_t coalesce_count;
+	/** Service counters, protected by statistics_mux. */
+	uint32_t write_count;
+	uint64_t wait_us;
+	uint32_t wait_max_us;
 } vs1053_t;
 
 typedef struct vs1053_t *vs1053_handle_t;
 
+/**
+ * Decoder status registers.
+ */
+typedef struct vs1053_status_t {
+	/** Stream header data, depends on the format (MP3: bitrate, sample rate, channels). */
+	uint16_t hdat0;
+	/** Stream format (MP3: sync word 0xFFE0-0xFFFF). */
+	uint16_t hdat1;
+	/** Sample rate (bits 15-1, in steps of 2 Hz) and stereo (bit 0). */
+	uint16_t audata;
+	/** Decode time in seconds. */
+	uint16_t decode_time;
+} vs1053_status_t;
+
 /**
  * @brief Begin using this component.
  */
@@ -135,12 +204,23 @@ void vs1053_decode(vs1053_handle_t handle, uint8_t *data, uint8_t length);
  */
 void vs1053_decode_long(vs1053_handle_t handle, uint8_t *data, uint16_t length);
 /**
- * @brief End stream. Sends an empty data chunk to the decoder.
+ * @brief End stream. Sends the decoder its end fill byte, so it plays the last samples.
  * @param handle Component handle.
  */
 void vs1053_decode_end(vs1053_handle_t handle);
 /**
- * @brief Set volume.
+ * @brief Stop decoding the stream, without playing what the decoder holds.
+ * Sets SM_CANCEL and sends end fill bytes until the decoder clears it, then
+ * 2052 end fill bytes to flush the decoder, after which HDAT0 and HDAT1 are zero.
+ * Falls back to a soft reset when it does not clear within 2048 bytes, or when
+ * HDAT0 or HDAT1 is not zero after the flush.
+ * The next stream can be sent afterwards.
+ * @param handle Component handle.
+ * @return True when cancelled, false when reset.
+ */
+bool vs1053_cancel(vs1053_handle_t handle);
+/**
+ * @brief Set volume, queued from any task and applied by vs1053_service.
  * The channel volume sets the attenuation from the maximum volume level in 0.5 dB steps.
  * Thus, maximum volume is 0x0000 and total silence is 0xFEFE.
  * Setting SCI_VOL to 0xFFFF will activate analog powerdown mode.
@@ -151,6 +231,38 @@ void vs1053_decode_end(vs1053_handle_t handle);
  * @param right Right channel volume.
  */
 void vs1053_set_volume(vs1053_handle_t handle, uint8_t left, uint8_t right);
+/**
+ * @brief Apply the queued register writes.
+ * Only from the task that feeds the decoder, between data transfers.
+ * @param handle Component handle.
+ * @return Number of registers written.
+ */
+uint32_t vs1053_service(vs1053_handle_t handle);
+/**
+ * @brief Get the register write queue statistics.
+ * @param handle Component handle.
+ * @param statistics Target of the statistics.
+ */
+void vs1053_get_queue_statistics(vs1053_handle_t handle, vs1053_queue_statistics_t *statistics);
+/**
+ * @brief Read the decoder status registers.
+ * @param handle Component handle.
+ * @param status Target of the status.
+ */
+void vs1053_get_status(vs1053_handle_t handle, vs1053_status_t *status);
+/**
+ * @brief Name of the stream format.
+ * @param hdat1 HDAT1 register value.
+ * @return Format name.
+ */
+const char *vs1053_format_name(uint16_t hdat1);
+/**
+ * @brief Get the SPI transaction statistics.
+ * @param handle Component handle.
+ * @param control Target of the control (SCI) statistics.
+ * @param data Target of the data (SDI) statistics.
+ */
+void vs1053_get_statistics(vs1053_handle_t handle, vs1053_spi_statistics_t *control, vs1053_spi_statistics_t *data);
 void vs1053_wake(vs1053_handle_t handle);
 void vs1053_soft_reset(vs1053_handle_t handle);
 
@@ -9,17 +9,18 @@
 #include "freertos/task.h"
 #include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 #include "driver/gpio.h"
 
 static const char* TAG = "dsp";
 
-static const uint8_t VS1053_EMPTY_DATA[] = { //
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //
-				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //
-				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //
-				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00  //
-		};
+/** Address in WRAM of the byte to send after a stream, see endFillByte in the datasheet. */
+#define VS1053_WRAM_END_FILL_BYTE (0x1E06)
+/** Fill bytes to send after a stream, before the next one. */
+#define VS1053_END_FILL_LENGTH (2052)
+/** Fill bytes to send before a cancel is given up on. */
+#define VS1053_CANCEL_MAX_LENGTH (2048)
 
 static void vs1053_begin_control_start(vs1053_handle_t handle) {
 	ESP_LOGD(TAG, ">vs1053_begin_control_start");
@@ -68,6 +69,30 @@ static void vs1053_end_data(vs1053_handle_t handle) {
 	ESP_LOGD(TAG, "<vs1053_end_data");
 }
 
+/**
+ * Transmit and keep statistics.
+ */
+static void vs1053_transmit(vs1053_handle_t handle, spi_device_handle_t device, spi_transaction_t *transaction,
+		vs1053_spi_statistics_t *statistics) {
+	int64_t start_us = esp_timer_get_time();
+	ESP_ERROR_CHECK(spi_device_transmit(device, transaction));
+	uint32_t time_us = esp_timer_get_time() - start_us;
+	portENTER_CRITICAL(&handle->statistics_mux);
+	statistics->count++;
+	statistics->time_us += time_us;
+	if (time_us > statistics->max_us) {
+		statistics->max_us = time_us;
+	}
+	portEXIT_CRITICAL(&handle->statistics_mux);
+}
+
+void vs1053_get_statistics(vs1053_handle_t handle, vs1053_spi_statistics_t *control, vs1053_spi_statistics_t *data) {
+	portENTER_CRITICAL(&handle->statistics_mux);
+	*control = handle->control_statistics;
+	*data = handle->data_statistics;
+	portEXIT_CRITICAL(&handle->statistics_mux);
+}
+
 static void vs1053_wait_dreq(vs1053_handle_t handle) {
 	while (gpio_get_level(handle->dreq_io_num) == 0)
 		;
@@ -86,7 +111,7 @@ static void vs1053_write_register(vs1053_handle_t handle, uint8_t addressbyte, u
 	vs1053_spi_transaction.tx_data[1] = addressbyte;
 	vs1053_spi_transaction.tx_data[2] = highbyte;
 	vs1053_spi_transaction.tx_data[3] = lowbyte;
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_control, &vs1053_spi_transaction));
+	vs1053_transmit(handle, handle->device_control, &vs1053_spi_transaction, &handle->control_statistics);
 
 	// wait for dsp ready after command
 	vs1053_wait_dreq(handle);
@@ -94,6 +119,26 @@ static void vs1053_write_register(vs1053_handle_t handle, uint8_t addressbyte, u
 	ESP_LOGD(TAG, "<vs1053_write_register");
 }
 
+/**
+ * Suppress the urge to make this function public. Write a specific function with a nice name.
+ */
+static uint16_t vs1053_read_register(vs1053_handle_t handle, uint8_t addressbyte) {
+	spi_transaction_t vs1053_spi_transaction;
+	memset(&vs1053_spi_transaction, 0, sizeof(vs1053_spi_transaction));
+	vs1053_spi_transaction.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+	vs1053_spi_transaction.length = 32;
+	vs1053_spi_transaction.tx_data[0] = 0x03;
+	vs1053_spi_transaction.tx_data[1] = addressbyte;
+	vs1053_transmit(handle, handle->device_control, &vs1053_spi_transaction, &handle->control_statistics);
+
+	// wait for dsp ready after command
+	vs1053_wait_dreq(handle);
+
+	uint16_t value = (vs1053_spi_transaction.rx_data[2] << 8) | vs1053_spi_transaction.rx_data[3];
+	ESP_LOGV(TAG, "vs1053_read_register 0x%02x 0x%04x", addressbyte, value);
+	return value;
+}
+
 void vs1053_decode(vs1053_handle_t handle, uint8_t *data, uint8_t length) {
 	ESP_ERROR_CHECK(length > VS1053_MAX_DATA_SIZE ? ESP_ERR_INVALID_SIZE : ESP_OK);
 	// create transaction
@@ -105,7 +150,7 @@ void vs1053_decode(vs1053_handle_t handle, uint8_t *data, uint8_t length) {
 	// wait for ready for data
 	vs1053_wait_dreq(handle);
 	// transmit
-	ESP_ERROR_CHECK(spi_device_transmit(handle->device_data, &vs1053_spi_transaction));
+	vs1053_transmit(handle, handle->device_data, &vs1053_spi_transaction, &handle->data_statistics);
 }
 
 void vs1053_decode_long(vs1053_handle_t handle, uint8_t *data, uint16_t length) {
@@ -122,29 +167,196 @@ void vs1053_decode_long(vs1053_handle_t handle, uint8_t *data, uint16_t length)
 	ESP_LOGV(TAG, "<vs1053_decode_long");
 }
 
-/** TODO: determine the correct 'empty' value first (see endFillByte in the datasheet) */
+/**
+ * Fill a data chunk with the byte the decoder wants after a stream.
+ */
+static void vs1053_end_fill(vs1053_handle_t handle, uint8_t *fill) {
+	vs1053_write_register(handle, VS1053_SCI_WRAMADDR, VS1053_WRAM_END_FILL_BYTE >> 8,
+			VS1053_WRAM_END_FILL_BYTE & 0xFF);
+	uint8_t end_fill_byte = vs1053_read_register(handle, VS1053_SCI_WRAM) & 0xFF;
+	ESP_LOGD(TAG, "end_fill_byte: 0x%02x", end_fill_byte);
+	memset(fill, end_fill_byte, VS1053_MAX_DATA_SIZE);
+}
+
+/**
+ * Send the end fill bytes that flush the decoder, from a filled data chunk.
+ */
+static void vs1053_send_end_fill(vs1053_handle_t handle, uint8_t *fill) {
+	for (uint32_t sent = 0; sent < VS1053_END_FILL_LENGTH; sent += VS1053_MAX_DATA_SIZE) {
+		uint32_t length = VS1053_END_FILL_LENGTH - sent;
+		vs1053_decode(handle, fill, length > VS1053_MAX_DATA_SIZE ? VS1053_MAX_DATA_SIZE : length);
+	}
+}
+
 void vs1053_decode_end(vs1053_handle_t handle) {
 	ESP_LOGD(TAG, ">vs1053_decode_end");
-	vs1053_decode(handle, (uint8_t *) &VS1053_EMPTY_DATA[0], sizeof(VS1053_EMPTY_DATA));
+	uint8_t fill[VS1053_MAX_DATA_SIZE];
+	vs1053_end_fill(handle, fill);
+	vs1053_send_end_fill(handle, fill);
 	ESP_LOGD(TAG, "<vs1053_decode_end");
 }
 
+bool vs1053_cancel(vs1053_handle_t handle) {
+	ESP_LOGD(TAG, ">vs1053_cancel");
+	uint8_t fill[VS1053_MAX_DATA_SIZE];
+	vs1053_end_fill(handle, fill);
+	uint16_t mode = vs1053_read_register(handle, VS1053_SCI_MODE);
+	vs1053_write_register(handle, VS1053_SCI_MODE, mode >> 8, (mode & 0xFF) | VS1053_SM_CANCEL);
+	// the decoder clears the bit when it stopped, it needs data to get there
+	bool cancelled = false;
+	for (uint32_t sent = 0; sent < VS1053_CANCEL_MAX_LENGTH && !cancelled; sent += VS1053_MAX_DATA_SIZE) {
+		vs1053_decode(handle, fill, VS1053_MAX_DATA_SIZE);
+		cancelled = (vs1053_read_register(handle, VS1053_SCI_MODE) & VS1053_SM_CANCEL) == 0;
+	}
+	if (cancelled) {
+		// stopped, flush the decoder before HDAT0 and HDAT1 read zero
+		vs1053_send_end_fill(handle, fill);
+	}
+	if (cancelled && (vs1053_read_register(handle, VS1053_SCI_HDAT0) != 0
+			|| vs1053_read_register(handle, VS1053_SCI_HDAT1) != 0)) {
+		// stopped, but not clean
+		cancelled = false;
+	}
+	if (!cancelled) {
+		ESP_LOGW(TAG, "cancel failed, reset");
+		vs1053_soft_reset(handle);
+	}
+	ESP_LOGD(TAG, "<vs1053_cancel %d", cancelled);
+	return cancelled;
+}
+
+/**
+ * Change the pending bits atomically, from any task.
+ * @return Pending bits before the change.
+ */
+static uint32_t vs1053_queue_update(vs1053_handle_t handle, uint32_t set, uint32_t clear) {
+	while (1) {
+		uint32_t previous = handle->queue_pending;
+		uint32_t found = (previous | set) & ~clear;
+		uxPortCompareSet(&handle->queue_pending, previous, &found);
+		if (found == previous) {
+			return previous;
+		}
+	}
+}
+
+static void vs1053_queue_increment(volatile uint32_t *counter) {
+	while (1) {
+		uint32_t previous = *counter;
+		uint32_t found = previous + 1;
+		uxPortCompareSet(counter, previous, &found);
+		if (found == previous) {
+			return;
+		}
+	}
+}
+
+/**
+ * Suppress the urge to make this function public. Write a specific function with a nice name.
+ * The value is stored before the pending bit is set, and read after it is cleared, no write is lost.
+ */
+static void vs1053_queue_register(vs1053_handle_t handle, uint8_t addressbyte, uint16_t value) {
+	uint32_t bit = 1 << addressbyte;
+	handle->queue_value[addressbyte] = value;
+	if ((handle->queue_pending & bit) == 0) {
+		handle->queue_time_us[addressbyte] = esp_timer_get_time();
+	}
+	uint32_t previous = vs1053_queue_update(handle, bit, 0);
+	vs1053_queue_increment(&handle->queue_count);
+	if (previous & bit) {
+		// replaced the waiting write
+		vs1053_queue_increment(&handle->coalesce_count);
+	}
+}
+
 void vs1053_set_volume(vs1053_handle_t handle, uint8_t left, uint8_t right) {
-	vs1053_write_register(handle, VS1053_SCI_VOL, left, right);
+	vs1053_queue_register(handle, VS1053_SCI_VOL, (left << 8) | right);
+}
+
+uint32_t vs1053_service(vs1053_handle_t handle) {
+	if (handle->queue_pending == 0) {
+		return 0;
+	}
+	uint32_t pending = vs1053_queue_update(handle, 0, UINT32_MAX);
+	uint32_t written = 0;
+	for (uint8_t addressbyte = 0; addressbyte < VS1053_SCI_COUNT; addressbyte++) {
+		if (pending & (1 << addressbyte)) {
+			uint16_t value = handle->queue_value[addressbyte];
+			uint32_t wait_us = (uint32_t) esp_timer_get_time() - handle->queue_time_us[addressbyte];
+			vs1053_write_register(handle, addressbyte, value >> 8, value & 0xFF);
+			written++;
+			portENTER_CRITICAL(&handle->statistics_mux);
+			handle->write_count++;
+			handle->wait_us += wait_us;
+			if (wait_us > handle->wait_max_us) {
+				handle->wait_max_us = wait_us;
+			}
+			portEXIT_CRITICAL(&handle->statistics_mux);
+		}
+	}
+	return written;
+}
+
+void vs1053_get_queue_statistics(vs1053_handle_t handle, vs1053_queue_statistics_t *statistics) {
+	uint32_t pending = handle->queue_pending;
+	statistics->depth = 0;
+	for (uint8_t addressbyte = 0; addressbyte < VS1053_SCI_COUNT; addressbyte++) {
+		statistics->depth += (pending >> addressbyte) & 1;
+	}
+	statistics->queue_count = handle->queue_count;
+	statistics->coalesce_count = handle->coalesce_count;
+	portENTER_CRITICAL(&handle->statistics_mux);
+	statistics->write_count = handle->write_count;
+	statistics->wait_us = handle->wait_us;
+	statistics->wait_max_us = handle->wait_max_us;
+	portEXIT_CRITICAL(&handle->statistics_mux);
+}
+
+void vs1053_get_status(vs1053_handle_t handle, vs1053_status_t *status) {
+	status->hdat0 = vs1053_read_register(handle, VS1053_SCI_HDAT0);
+	status->hdat1 = vs1053_read_register(handle, VS1053_SCI_HDAT1);
+	status->audata = vs1053_read_register(handle, VS1053_SCI_AUDATA);
+	status->decode_time = vs1053_read_register(handle, VS1053_SCI_DECODE_TIME);
+}
+
+const char *vs1053_format_name(uint16_t hdat1) {
+	if (hdat1 >= 0xFFE0) {
+		return "mp3";
+	}
+	switch (hdat1) {
+	case 0x0000:
+		return "none";
+	case 0x7665:
+		return "wav";
+	case 0x4154:
+	case 0x4144:
+	case 0x4D34:
+		return "aac";
+	case 0x574D:
+		return "wma";
+	case 0x4F67:
+		return "ogg";
+	case 0x664C:
+		return "flac";
+	case 0x4D54:
+		return "midi";
+	default:
+		return "unknown";
+	}
 }
 
 void vs1053_wake(vs1053_handle_t handle) {
 	ESP_LOGD(TAG, ">vs1053_wake");
 	// Setting SCI_VOL to 0xFFFF will activate analog power down mode.
-	vs1053_set_volume(handle, 0xFF, 0xFF);
+	vs1053_write_register(handle, VS1053_SCI_VOL, 0xFF, 0xFF);
 	// Select slow sample rate (10Hz Mono)
 	vs1053_write_register(handle, VS1053_SCI_AUDATA, 0, 10);
 	// Switch on the analog parts
-	vs1053_set_volume(handle, 0xFE, 0xFE);
+	vs1053_write_register(handle, VS1053_SCI_VOL, 0xFE, 0xFE);
 	// Select low sample rate (8KHz Mono)
 	vs1053_write_register(handle, VS1053_SCI_AUDATA, 31, 64);
 	// Set initial volume (80 = -40dB)
-	vs1053_set_volume(handle, 80, 80);
+	vs1053_write_register(handle, VS1053_SCI_VOL, 80, 80);
 	ESP_LOGD(TAG, "<vs1053_wake");
 }
 
@@ -190,6 +402,15 @@ void vs1053_begin(vs1053_config_t config, vs1053_handle_t *handle) {
 	vs1053->xdcs_io_num = config.xdcs_io_num;
 	vs1053->dreq_io_num = config.dreq_io_num;
 	vs1053->rst_io_num = config.rst_io_num;
+	memset(&vs1053->control_statistics, 0, sizeof(vs1053_spi_statistics_t));
+	memset(&vs1053->data_statistics, 0, sizeof(vs1053_spi_statistics_t));
+	vPortCPUInitializeMutex(&vs1053->statistics_mux);
+	vs1053->queue_pending = 0;
+	vs1053->queue_count = 0;
+	vs1053->coalesce_count = 0;
+	vs1053->write_count = 0;
+	vs1053->wait_us = 0;
+	vs1053->wait_max_us = 0;
 
 	gpio_pad_select_gpio(config.dreq_io_num);
 	gpio_set_direction(config.dreq_io_num, GPIO_MODE_INPUT);
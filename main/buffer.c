@@ -1,24 +1,47 @@
 // The author disclaims copyright to this source code.
 #include "buffer.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "sdkconfig.h"
 
 static const char* TAG = "buffer";
 
+/** Data was pulled or discarded, room for a push. */
+#define BUFFER_PULLED_BIT BIT0
+/** Data was pushed, data for a pull. */
+#define BUFFER_PUSHED_BIT BIT1
+/** Data was pushed, data for a cursor. Never cleared on exit, all cursors wake up. */
+#define BUFFER_WRITTEN_BIT BIT2
+
 void buffer_log(buffer_handle_t handle) {
 	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
 	ESP_LOGD(TAG, ">buffer_log");
 	ESP_LOGD(TAG, "handle: %p", handle);
 	ESP_LOGD(TAG, "spi_mem_handle: %p", handle->spi_mem_handle);
+	ESP_LOGD(TAG, "base: %u", handle->base);
 	ESP_LOGD(TAG, "size: %d", handle->size);
 	ESP_LOGD(TAG, "mask: 0x%04x", handle->mask);
 	ESP_LOGD(TAG, "buffer_read_addr: %d", handle->read_addr);
 	ESP_LOGD(TAG, "buffer_write_addr: %d", handle->write_addr);
 	ESP_LOGD(TAG, "mutex: %p", handle->mutex);
-	ESP_LOGD(TAG, "pull_bytes: %u", handle->pull_bytes);
-	ESP_LOGD(TAG, "push_bytes: %u", handle->push_bytes);
-	ESP_LOGD(TAG, "pull_count: %u", handle->pull_count);
-	ESP_LOGD(TAG, "push_count: %u", handle->push_count);
+	ESP_LOGD(TAG, "pull_bytes: %llu", handle->pull_bytes);
+	ESP_LOGD(TAG, "push_bytes: %llu", handle->push_bytes);
+	ESP_LOGD(TAG, "pull_count: %llu", handle->pull_count);
+	ESP_LOGD(TAG, "push_count: %llu", handle->push_count);
+	if (handle->frame_index != NULL) {
+		ESP_LOGD(TAG, "frame_count: %u", handle->frame_index->frame_count);
+		ESP_LOGD(TAG, "frames_indexed: %u", frame_index_count(handle->frame_index));
+		ESP_LOGD(TAG, "sync_lost_count: %u", handle->frame_index->sync_lost_count);
+		ESP_LOGD(TAG, "duration_ms: %u", (uint32_t) (handle->frame_index->duration_us / 1000));
+	}
+	ESP_LOGD(TAG, "overflow_policy: %d", handle->overflow_policy);
+	ESP_LOGD(TAG, "underrun_policy: %d", handle->underrun_policy);
+	ESP_LOGD(TAG, "block_ms: %u", handle->block_ms);
+	ESP_LOGD(TAG, "overflow_count: %llu", handle->overflow_count);
+	ESP_LOGD(TAG, "overflow_bytes: %llu", handle->overflow_bytes);
+	ESP_LOGD(TAG, "underrun_count: %llu", handle->underrun_count);
+	ESP_LOGD(TAG, "underrun_bytes: %llu", handle->underrun_bytes);
+	ESP_LOGD(TAG, "block_count: %llu", handle->block_count);
 	ESP_LOGD(TAG, "<buffer_log");
 	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
 }
@@ -41,30 +64,333 @@ uint32_t buffer_free(buffer_handle_t handle) {
 	return free;
 }
 
-void buffer_push(buffer_handle_t handle, uint8_t *data, uint32_t length) {
+/**
+ * Write memory at a buffer address, in two parts when the region wraps.
+ * Mutex must be taken.
+ */
+static void buffer_mem_write(buffer_handle_t handle, uint32_t addr, uint32_t length, uint8_t *data) {
+	uint32_t current = addr & handle->mask;
+	uint32_t first = handle->size - current;
+	if (length > first) {
+		spi_mem_write(handle->spi_mem_handle, handle->base + current, first, data);
+		spi_mem_write(handle->spi_mem_handle, handle->base, length - first, data + first);
+	} else {
+		spi_mem_write(handle->spi_mem_handle, handle->base + current, length, data);
+	}
+}
+
+/**
+ * Read memory at a buffer address, in two parts when the region wraps.
+ * Mutex must be taken.
+ */
+static void buffer_mem_read(buffer_handle_t handle, uint32_t addr, uint32_t length, uint8_t *data) {
+	uint32_t current = addr & handle->mask;
+	uint32_t first = handle->size - current;
+	if (length > first) {
+		spi_mem_read(handle->spi_mem_handle, handle->base + current, first, data);
+		spi_mem_read(handle->spi_mem_handle, handle->base, length - first, data + first);
+	} else {
+		spi_mem_read(handle->spi_mem_handle, handle->base + current, length, data);
+	}
+}
+
+/**
+ * Wait until there is room (pulled_bit) or data (pushed_bit) for a transfer of length bytes.
+ * Mutex must be taken, it is given while waiting.
+ * @return Room or data available after waiting, less than length on timeout.
+ */
+static uint32_t buffer_wait_locked(buffer_handle_t handle, EventBits_t bit, uint32_t length, uint32_t wait_ms) {
+	TickType_t timeout = wait_ms / portTICK_PERIOD_MS;
+	TickType_t start = xTaskGetTickCount();
+	uint32_t used = handle->write_addr - handle->read_addr;
+	uint32_t room = (bit == BUFFER_PULLED_BIT ? handle->size - used : used);
+	while (room < length) {
+		TickType_t elapsed = xTaskGetTickCount() - start;
+		if (elapsed >= timeout) {
+			break;
+		}
+		// cleared under the mutex, so a transfer on the other side can not be missed
+		xEventGroupClearBits(handle->events, bit);
+		assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+		xEventGroupWaitBits(handle->events, bit, pdTRUE, pdTRUE, timeout - elapsed);
+		assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+		used = handle->write_addr - handle->read_addr;
+		room = (bit == BUFFER_PULLED_BIT ? handle->size - used : used);
+	}
+	return room;
+}
+
+/**
+ * Move the read address forward, at least length bytes and up to a frame start when possible.
+ * Mutex must be taken.
+ */
+static uint32_t buffer_discard_locked(buffer_handle_t handle, uint32_t length) {
+	uint32_t available = handle->write_addr - handle->read_addr;
+	uint32_t target = handle->read_addr + (length > available ? available : length);
+	if (handle->frame_index != NULL) {
+		uint32_t frame_addr;
+		if (frame_index_find(handle->frame_index, target, &frame_addr)) {
+			target = frame_addr;
+		}
+	}
+	uint32_t discarded = target - handle->read_addr;
+	handle->read_addr = target;
+	if (handle->frame_index != NULL) {
+		frame_index_consume(handle->frame_index, handle->read_addr);
+	}
+	if (discarded > 0) {
+		xEventGroupSetBits(handle->events, BUFFER_PULLED_BIT);
+	}
+	return discarded;
+}
+
+uint32_t buffer_push(buffer_handle_t handle, uint8_t *data, uint32_t length) {
 	ESP_LOGV(TAG, ">buffer_push");
 	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
-	assert(length <= (handle->size - (handle->write_addr - handle->read_addr)));
-	uint32_t current = handle->write_addr & handle->mask;
-	spi_mem_write(handle->spi_mem_handle, current, length, data);
-	handle->write_addr = (handle->write_addr + length);
-	handle->push_bytes += length;
-	handle->push_count++;
+	uint32_t free = handle->size - (handle->write_addr - handle->read_addr);
+	uint32_t dropped = 0;
+	if (length > free) {
+		switch (handle->overflow_policy) {
+		case BUFFER_POLICY_BLOCK:
+			handle->block_count++;
+			free = buffer_wait_locked(handle, BUFFER_PULLED_BIT, length, handle->block_ms);
+			break;
+		case BUFFER_POLICY_DROP_NEWEST:
+			free = 0;
+			break;
+		case BUFFER_POLICY_DROP_OLDEST:
+			if (length > handle->size) {
+				// only the newest part can ever fit
+				dropped = length - handle->size;
+				data += dropped;
+				length = handle->size;
+			}
+			dropped += buffer_discard_locked(handle, length - free);
+			free = handle->size - (handle->write_addr - handle->read_addr);
+			break;
+		case BUFFER_POLICY_PARTIAL:
+			break;
+		}
+		if (length > free) {
+			// drop what does not fit
+			dropped += length - free;
+			length = free;
+		}
+		if (dropped > 0) {
+			// a wait that made room is counted as a block only
+			handle->overflow_count++;
+			handle->overflow_bytes += dropped;
+			ESP_LOGV(TAG, "overflow %u", dropped);
+		}
+	}
+	if (length > 0) {
+		buffer_mem_write(handle, handle->write_addr, length, data);
+		if (handle->frame_index != NULL) {
+			frame_index_parse(handle->frame_index, handle->write_addr, data, length);
+		}
+		handle->write_addr = (handle->write_addr + length);
+		handle->push_bytes += length;
+		handle->push_count++;
+		xEventGroupSetBits(handle->events, BUFFER_PUSHED_BIT | BUFFER_WRITTEN_BIT);
+	}
 	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
 	ESP_LOGV(TAG, "<buffer_push");
+	return length;
 }
 
-void buffer_pull(buffer_handle_t handle, uint32_t length, uint8_t *data) {
+uint32_t buffer_pull(buffer_handle_t handle, uint32_t length, uint8_t *data) {
 	ESP_LOGV(TAG, ">buffer_pull");
 	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
-	assert(length <= (handle->write_addr - handle->read_addr));
-	uint32_t current = (handle->read_addr) & handle->mask;
-	spi_mem_read(handle->spi_mem_handle, current, length, data);
-	handle->read_addr = (handle->read_addr + length);
-	handle->pull_bytes += length;
-	handle->pull_count++;
+	uint32_t available = handle->write_addr - handle->read_addr;
+	if (length > available) {
+		if (handle->underrun_policy == BUFFER_POLICY_BLOCK) {
+			handle->block_count++;
+			available = buffer_wait_locked(handle, BUFFER_PUSHED_BIT, length, handle->block_ms);
+		}
+		if (length > available) {
+			handle->underrun_count++;
+			handle->underrun_bytes += length - available;
+			ESP_LOGV(TAG, "underrun %u", length - available);
+			length = available;
+		}
+	}
+	if (length > 0) {
+		buffer_mem_read(handle, handle->read_addr, length, data);
+		handle->read_addr = (handle->read_addr + length);
+		if (handle->frame_index != NULL) {
+			frame_index_consume(handle->frame_index, handle->read_addr);
+		}
+		handle->pull_bytes += length;
+		handle->pull_count++;
+		xEventGroupSetBits(handle->events, BUFFER_PULLED_BIT);
+	}
 	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
 	ESP_LOGV(TAG, "<buffer_pull");
+	return length;
+}
+
+uint32_t buffer_duration_ms(buffer_handle_t handle) {
+	ESP_LOGV(TAG, ">buffer_duration_ms");
+	uint32_t duration_ms = 0;
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	if (handle->frame_index != NULL) {
+		duration_ms = handle->frame_index->duration_us / 1000;
+	}
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	ESP_LOGV(TAG, "<buffer_duration_ms");
+	return duration_ms;
+}
+
+uint32_t buffer_discard(buffer_handle_t handle, uint32_t length) {
+	ESP_LOGV(TAG, ">buffer_discard");
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	uint32_t discarded = buffer_discard_locked(handle, length);
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	ESP_LOGV(TAG, "<buffer_discard %u", discarded);
+	return discarded;
+}
+
+uint32_t buffer_resync(buffer_handle_t handle) {
+	ESP_LOGD(TAG, ">buffer_resync");
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	uint32_t skipped = 0;
+	if (handle->frame_index != NULL) {
+		skipped = buffer_discard_locked(handle, 0);
+	}
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	ESP_LOGD(TAG, "<buffer_resync %u", skipped);
+	return skipped;
+}
+
+uint32_t buffer_cut(buffer_handle_t handle) {
+	ESP_LOGD(TAG, ">buffer_cut");
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	uint32_t removed = 0;
+	uint32_t frame_addr;
+	if (handle->frame_index != NULL && frame_index_cut(handle->frame_index, &frame_addr)) {
+		// never remove what was already read
+		if ((int32_t) (frame_addr - handle->read_addr) < 0) {
+			frame_addr = handle->read_addr;
+		}
+		removed = handle->write_addr - frame_addr;
+		handle->write_addr = frame_addr;
+	}
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	ESP_LOGD(TAG, "<buffer_cut %u", removed);
+	return removed;
+}
+
+void buffer_swap(buffer_handle_t handle, buffer_handle_t other) {
+	ESP_LOGD(TAG, ">buffer_swap");
+	// always lock in the same order
+	buffer_handle_t first = (handle < other ? handle : other);
+	buffer_handle_t second = (handle < other ? other : handle);
+	assert(xSemaphoreTake(first->mutex, portMAX_DELAY) == pdTRUE);
+	assert(xSemaphoreTake(second->mutex, portMAX_DELAY) == pdTRUE);
+	struct buffer_t audio = *handle;
+	handle->base = other->base;
+	handle->size = other->size;
+	handle->mask = other->mask;
+	handle->read_addr = other->read_addr;
+	handle->write_addr = other->write_addr;
+	handle->frame_index = other->frame_index;
+	other->base = audio.base;
+	other->size = audio.size;
+	other->mask = audio.mask;
+	other->read_addr = audio.read_addr;
+	other->write_addr = audio.write_addr;
+	other->frame_index = audio.frame_index;
+	// whoever waits has to look again
+	xEventGroupSetBits(handle->events, BUFFER_PULLED_BIT | BUFFER_PUSHED_BIT | BUFFER_WRITTEN_BIT);
+	xEventGroupSetBits(other->events, BUFFER_PULLED_BIT | BUFFER_PUSHED_BIT | BUFFER_WRITTEN_BIT);
+	assert(xSemaphoreGive(second->mutex) == pdTRUE);
+	assert(xSemaphoreGive(first->mutex) == pdTRUE);
+	ESP_LOGD(TAG, "<buffer_swap %u %u", handle->base, other->base);
+}
+
+/**
+ * First frame at or after an address, the address itself when not found.
+ * Mutex must be taken.
+ */
+static uint32_t buffer_frame_locked(buffer_handle_t handle, uint32_t addr) {
+	uint32_t frame_addr;
+	if (handle->frame_index != NULL && frame_index_find(handle->frame_index, addr, &frame_addr)) {
+		return frame_addr;
+	}
+	return addr;
+}
+
+/**
+ * Move a cursor that points to data not (or no longer) in the buffer.
+ * Mutex must be taken.
+ * @return Bytes available at the cursor.
+ */
+static uint32_t buffer_cursor_available_locked(buffer_handle_t handle, buffer_cursor_t *cursor) {
+	uint32_t behind = handle->write_addr - cursor->addr;
+	if ((int32_t) behind < 0) {
+		// data removed by a cut or reset
+		cursor->addr = handle->write_addr;
+		behind = 0;
+	} else if (behind > handle->size) {
+		// overwritten, skip well ahead to avoid skipping again soon
+		uint32_t target = handle->read_addr;
+		if (handle->write_addr - target > handle->size / 2) {
+			target = handle->write_addr - handle->size / 2;
+		}
+		target = buffer_frame_locked(handle, target);
+		cursor->skip_count++;
+		cursor->skip_bytes += target - cursor->addr;
+		ESP_LOGV(TAG, "cursor skip %u", target - cursor->addr);
+		cursor->addr = target;
+		behind = handle->write_addr - target;
+	}
+	return behind;
+}
+
+void buffer_cursor_begin(buffer_handle_t handle, buffer_cursor_t *cursor) {
+	ESP_LOGD(TAG, ">buffer_cursor_begin");
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	cursor->addr = buffer_frame_locked(handle, handle->read_addr);
+	cursor->read_bytes = 0;
+	cursor->skip_count = 0;
+	cursor->skip_bytes = 0;
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	ESP_LOGD(TAG, "<buffer_cursor_begin %u", cursor->addr);
+}
+
+uint32_t buffer_wait_free(buffer_handle_t handle, uint32_t length, uint32_t wait_ms) {
+	ESP_LOGV(TAG, ">buffer_wait_free");
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	uint32_t free = buffer_wait_locked(handle, BUFFER_PULLED_BIT, length, wait_ms);
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	ESP_LOGV(TAG, "<buffer_wait_free");
+	return free;
+}
+
+uint32_t buffer_cursor_read(buffer_handle_t handle, buffer_cursor_t *cursor, uint32_t length, uint8_t *data,
+		uint32_t wait_ms) {
+	ESP_LOGV(TAG, ">buffer_cursor_read");
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	uint32_t available = buffer_cursor_available_locked(handle, cursor);
+	if (available == 0 && wait_ms > 0) {
+		// cleared under the mutex, so a push can not be missed
+		xEventGroupClearBits(handle->events, BUFFER_WRITTEN_BIT);
+		assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+		xEventGroupWaitBits(handle->events, BUFFER_WRITTEN_BIT, pdFALSE, pdTRUE, wait_ms / portTICK_PERIOD_MS);
+		assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+		available = buffer_cursor_available_locked(handle, cursor);
+	}
+	if (length > available) {
+		length = available;
+	}
+	if (length > 0) {
+		buffer_mem_read(handle, cursor->addr, length, data);
+		cursor->addr += length;
+		cursor->read_bytes += length;
+	}
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	ESP_LOGV(TAG, "<buffer_cursor_read");
+	return length;
 }
 
 static bool buffer_is_power_of_two(uint32_t size) {
@@ -74,12 +400,19 @@ static bool buffer_is_power_of_two(uint32_t size) {
 void buffer_begin(buffer_config_t config, buffer_handle_t *handle) {
 	ESP_LOGD(TAG, ">buffer_begin");
 	ESP_LOGD(TAG, "spi_mem_handle: %p", config.spi_mem_handle);
+	ESP_LOGD(TAG, "base: %u", config.base);
 	ESP_LOGD(TAG, "size: %d", config.size);
+	ESP_LOGD(TAG, "frame_index_entries: %d", config.frame_index_entries);
+	ESP_LOGD(TAG, "overflow_policy: %d", config.overflow_policy);
+	ESP_LOGD(TAG, "underrun_policy: %d", config.underrun_policy);
+	ESP_LOGD(TAG, "block_ms: %u", config.block_ms);
 
 	assert(buffer_is_power_of_two(config.size));
+	assert(config.underrun_policy == BUFFER_POLICY_BLOCK || config.underrun_policy == BUFFER_POLICY_PARTIAL);
 
 	buffer_handle_t buffer_handle = malloc(sizeof(struct buffer_t));
 	buffer_handle->spi_mem_handle = config.spi_mem_handle;
+	buffer_handle->base = config.base;
 	buffer_handle->size = config.size;
 	buffer_handle->mask = config.size - 1;
 	buffer_handle->read_addr = 0;
@@ -90,8 +423,24 @@ void buffer_begin(buffer_config_t config, buffer_handle_t *handle) {
 	buffer_handle->pull_count = 0;
 	buffer_handle->mutex = xSemaphoreCreateMutex();
 	assert(buffer_handle->mutex != NULL);
+	buffer_handle->events = xEventGroupCreate();
+	assert(buffer_handle->events != NULL);
+	buffer_handle->overflow_policy = config.overflow_policy;
+	buffer_handle->underrun_policy = config.underrun_policy;
+	buffer_handle->block_ms = config.block_ms;
+	buffer_handle->overflow_count = 0;
+	buffer_handle->overflow_bytes = 0;
+	buffer_handle->underrun_count = 0;
+	buffer_handle->underrun_bytes = 0;
+	buffer_handle->block_count = 0;
+	buffer_handle->frame_index = NULL;
+	if (config.frame_index_entries > 0) {
+		frame_index_config_t frame_index_config;
+		frame_index_config.entries = config.frame_index_entries;
+		frame_index_begin(frame_index_config, &buffer_handle->frame_index);
+	}
 
-	// in sequential mode memory addressing will wrap like the buffer does
+	// sequential mode, transfers that wrap around the region are split
 	spi_mem_write_mode_register(buffer_handle->spi_mem_handle, SPI_MEM_MODE_SEQUENTIAL);
 
 	*handle = buffer_handle;
@@ -101,18 +450,38 @@ void buffer_begin(buffer_config_t config, buffer_handle_t *handle) {
 
 void buffer_end(buffer_handle_t handle) {
 	ESP_LOGD(TAG, ">buffer_end");
-	spi_mem_end(handle->spi_mem_handle);
+	// the memory may be shared, it is ended by whoever began it
 	handle->spi_mem_handle = NULL;
 	handle->read_addr = 0;
 	handle->write_addr = 0;
 	vSemaphoreDelete(handle->mutex);
 	handle->mutex = NULL;
+	vEventGroupDelete(handle->events);
+	handle->events = NULL;
+	if (handle->frame_index != NULL) {
+		frame_index_end(handle->frame_index);
+		handle->frame_index = NULL;
+	}
 	handle->pull_bytes = 0;
 	handle->push_bytes = 0;
 	free(handle);
 	ESP_LOGD(TAG, "<buffer_end");
 }
 
+void buffer_get_counters(buffer_handle_t handle, buffer_counters_t *counters) {
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	counters->push_bytes = handle->push_bytes;
+	counters->pull_bytes = handle->pull_bytes;
+	counters->push_count = handle->push_count;
+	counters->pull_count = handle->pull_count;
+	counters->overflow_count = handle->overflow_count;
+	counters->overflow_bytes = handle->overflow_bytes;
+	counters->underrun_count = handle->underrun_count;
+	counters->underrun_bytes = handle->underrun_bytes;
+	counters->block_count = handle->block_count;
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+}
+
 void buffer_reset(buffer_handle_t handle) {
 	ESP_LOGD(TAG, ">buffer_reset");
 	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
@@ -122,6 +491,15 @@ void buffer_reset(buffer_handle_t handle) {
 	handle->pull_bytes = 0;
 	handle->push_count = 0;
 	handle->pull_count = 0;
+	handle->overflow_count = 0;
+	handle->overflow_bytes = 0;
+	handle->underrun_count = 0;
+	handle->underrun_bytes = 0;
+	handle->block_count = 0;
+	if (handle->frame_index != NULL) {
+		frame_index_reset(handle->frame_index);
+	}
+	xEventGroupSetBits(handle->events, BUFFER_PULLED_BIT);
 	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
 	ESP_LOGD(TAG, "<buffer_reset");
 }
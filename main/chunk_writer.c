@@ -0,0 +1,96 @@
+// The author disclaims copyright to this source code.
+#include "chunk_writer.h"
+#include <string.h>
+
+static const char CHUNK_WRITER_HEX[] = "0123456789abcdef";
+static const char CHUNK_WRITER_LAST_CHUNK[] = "0\r\n\r\n";
+
+/**
+ * Output the buffer.
+ * @param more False for the last output.
+ */
+static void chunk_writer_flush(chunk_writer_t *writer, bool more) {
+	char *data = &writer->buffer[CHUNK_WRITER_HEADER_LENGTH];
+	uint32_t length = writer->length;
+	if (writer->chunked) {
+		if (length > 0) {
+			// chunk size in front of the data, CRLF after
+			data -= CHUNK_WRITER_HEADER_LENGTH;
+			for (int i = 0; i < 4; i++) {
+				data[i] = CHUNK_WRITER_HEX[(length >> (12 - 4 * i)) & 0x0F];
+			}
+			data[4] = '\r';
+			data[5] = '\n';
+			length += CHUNK_WRITER_HEADER_LENGTH;
+			data[length++] = '\r';
+			data[length++] = '\n';
+		}
+		if (!more) {
+			memcpy(&data[length], CHUNK_WRITER_LAST_CHUNK, sizeof(CHUNK_WRITER_LAST_CHUNK) - 1);
+			length += sizeof(CHUNK_WRITER_LAST_CHUNK) - 1;
+		}
+	}
+	if (!writer->failed && (length > 0 || !more)) {
+		writer->failed = !writer->output(writer->context, data, length, more);
+	}
+	writer->length = 0;
+}
+
+void chunk_writer_put(chunk_writer_t *writer, char c) {
+	if (writer->length == CHUNK_WRITER_BUFFER_LENGTH) {
+		chunk_writer_flush(writer, true);
+	}
+	writer->buffer[CHUNK_WRITER_HEADER_LENGTH + writer->length++] = c;
+}
+
+void chunk_writer_write(chunk_writer_t *writer, const char *data, uint32_t length) {
+	while (length > 0) {
+		if (writer->length == CHUNK_WRITER_BUFFER_LENGTH) {
+			chunk_writer_flush(writer, true);
+		}
+		uint32_t room = CHUNK_WRITER_BUFFER_LENGTH - writer->length;
+		uint32_t span = length > room ? room : length;
+		memcpy(&writer->buffer[CHUNK_WRITER_HEADER_LENGTH + writer->length], data, span);
+		writer->length += span;
+		data += span;
+		length -= span;
+	}
+}
+
+void chunk_writer_text(chunk_writer_t *writer, const char *text) {
+	chunk_writer_write(writer, text, strlen(text));
+}
+
+void chunk_writer_uint(chunk_writer_t *writer, uint64_t value) {
+	char digits[20];
+	int count = 0;
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+	while (count > 0) {
+		chunk_writer_put(writer, digits[--count]);
+	}
+}
+
+void chunk_writer_int(chunk_writer_t *writer, int64_t value) {
+	if (value < 0) {
+		chunk_writer_put(writer, '-');
+		chunk_writer_uint(writer, -(uint64_t) value);
+	} else {
+		chunk_writer_uint(writer, value);
+	}
+}
+
+void chunk_writer_start(chunk_writer_t *writer, bool chunked, chunk_writer_output_t output, void *context) {
+	writer->output = output;
+	writer->context = context;
+	writer->chunked = chunked;
+	writer->failed = false;
+	writer->length = 0;
+}
+
+bool chunk_writer_finish(chunk_writer_t *writer) {
+	chunk_writer_flush(writer, false);
+	return !writer->failed;
+}
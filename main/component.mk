@@ -3,7 +3,20 @@
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
-# Embed file as binary
-# extern const uint8_t index_html_start[] asm("_binary_index_html_start");
-# extern const uint8_t index_html_end[]   asm("_binary_index_html_end");
-COMPONENT_EMBED_FILES := index.html jquery-3.2.1.slim.min.js
\ No newline at end of file
+ifdef CONFIG_WEB_SERVER_ASSETS_EMBEDDED
+# Web server assets, compressed with precomputed headers, see www_assets.h
+# Generated in the component build directory.
+WWW_ASSETS_TOOL := $(PROJECT_PATH)/tools/www_assets.py
+WWW_ASSETS := $(COMPONENT_PATH)/index.html $(COMPONENT_PATH)/jquery-3.2.1.slim.min.js
+
+COMPONENT_EXTRA_CLEAN := www_assets_data.h
+
+www_assets.o: www_assets_data.h
+www_assets.o: CPPFLAGS += -I$(COMPONENT_BUILD_DIR)
+
+www_assets_data.h: $(WWW_ASSETS) $(WWW_ASSETS_TOOL)
+	$(PYTHON) $(WWW_ASSETS_TOOL) $@ \
+		--asset / $(COMPONENT_PATH)/index.html "text/html; charset=utf-8" "no-cache" \
+		--asset /jquery-3.2.1.slim.min.js $(COMPONENT_PATH)/jquery-3.2.1.slim.min.js "application/javascript" "max-age=31536000, immutable"
+endif
+# Otherwise the assets are served from the www partition, see the www target in the project Makefile.
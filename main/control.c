@@ -0,0 +1,168 @@
+// The author disclaims copyright to this source code.
+#include "control.h"
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "json_reader.h"
+#include "player.h"
+
+static const char* TAG = "control";
+
+static const char *CONTROL_COMMAND_NAMES[CONTROL_COUNT] = { "volume", "mute", "select", "next", "previous", "reset" };
+static const char *CONTROL_RESULT_NAMES[CONTROL_RESULT_COUNT] = { "ok", "malformed", "unknown", "invalid" };
+
+const char *control_command_name(control_command_type_t type) {
+	return type < CONTROL_COUNT ? CONTROL_COMMAND_NAMES[type] : "?";
+}
+
+control_result_t control_parse(const char *json, uint32_t length, int64_t received_us, control_command_t *command) {
+	json_token_t tokens[CONTROL_MAX_TOKENS];
+	int32_t count = json_reader_parse(json, length, tokens, CONTROL_MAX_TOKENS);
+	if (count < 0 || tokens[0].type != JSON_TOKEN_OBJECT) {
+		return CONTROL_MALFORMED;
+	}
+	int32_t name = json_reader_member(json, tokens, 0, "command");
+	if (name < 0 || tokens[name].type != JSON_TOKEN_STRING) {
+		return CONTROL_MALFORMED;
+	}
+	int type = 0;
+	while (type < CONTROL_COUNT && !json_reader_equals(json, &tokens[name], CONTROL_COMMAND_NAMES[type])) {
+		type++;
+	}
+	if (type == CONTROL_COUNT) {
+		return CONTROL_UNKNOWN;
+	}
+	command->type = type;
+	command->value = 0;
+	command->received_us = received_us;
+	int32_t value = json_reader_member(json, tokens, 0, "value");
+	switch (command->type) {
+	case CONTROL_VOLUME:
+	case CONTROL_SELECT:
+		if (value < 0 || !json_reader_uint(json, &tokens[value], &command->value)) {
+			return CONTROL_INVALID;
+		}
+		break;
+	case CONTROL_MUTE: {
+		bool mute;
+		if (value < 0 || !json_reader_bool(&tokens[value], &mute)) {
+			return CONTROL_INVALID;
+		}
+		command->value = mute;
+		break;
+	}
+	default:
+		break;
+	}
+	return CONTROL_OK;
+}
+
+/**
+ * Favorite next to the selected one, wraps around.
+ */
+static bool control_step(control_handle_t handle, int32_t step) {
+	uint32_t count = favorites_count(handle->favorites_handle);
+	if (count == 0) {
+		return false;
+	}
+	uint32_t selected = favorites_selected(handle->favorites_handle, NULL);
+	return favorites_select(handle->favorites_handle, (selected + count + step) % count);
+}
+
+control_result_t control_execute(control_handle_t handle, const control_command_t *command) {
+	ESP_LOGD(TAG, ">control_execute %s %u", control_command_name(command->type), command->value);
+	bool executed;
+	switch (command->type) {
+	case CONTROL_VOLUME:
+		executed = command->value <= PLAYER_VOLUME_MAX;
+		if (executed) {
+			player_set_volume(command->value, command->received_us);
+		}
+		break;
+	case CONTROL_MUTE:
+		player_set_mute(command->value != 0, command->received_us);
+		executed = true;
+		break;
+	case CONTROL_SELECT:
+		executed = favorites_select(handle->favorites_handle, command->value);
+		break;
+	case CONTROL_NEXT:
+		executed = control_step(handle, 1);
+		break;
+	case CONTROL_PREVIOUS:
+		executed = control_step(handle, -1);
+		break;
+	case CONTROL_RESET:
+		buffer_discard(handle->buffer_handle, buffer_available(handle->buffer_handle));
+		executed = true;
+		break;
+	default:
+		executed = false;
+		break;
+	}
+	uint32_t latency_us = esp_timer_get_time() - command->received_us;
+	portENTER_CRITICAL(&handle->mux);
+	if (executed) {
+		handle->count[command->type]++;
+		handle->latency_us[command->type] += latency_us;
+		if (latency_us > handle->latency_max_us[command->type]) {
+			handle->latency_max_us[command->type] = latency_us;
+		}
+	} else {
+		handle->error_count++;
+	}
+	portEXIT_CRITICAL(&handle->mux);
+	ESP_LOGD(TAG, "<control_execute %d, latency_us: %u", executed, latency_us);
+	return executed ? CONTROL_OK : CONTROL_INVALID;
+}
+
+void control_write_result(json_writer_t *writer, const control_command_t *command, control_result_t result) {
+	json_writer_object_start(writer, NULL);
+	if (command != NULL) {
+		json_writer_string(writer, "command", control_command_name(command->type));
+	}
+	json_writer_string(writer, "result", result < CONTROL_RESULT_COUNT ? CONTROL_RESULT_NAMES[result] : "?");
+	json_writer_object_end(writer);
+}
+
+void control_refused(control_handle_t handle) {
+	portENTER_CRITICAL(&handle->mux);
+	handle->error_count++;
+	portEXIT_CRITICAL(&handle->mux);
+}
+
+void control_get_statistics(control_handle_t handle, control_statistics_t *statistics) {
+	portENTER_CRITICAL(&handle->mux);
+	for (int type = 0; type < CONTROL_COUNT; type++) {
+		statistics->count[type] = handle->count[type];
+		statistics->latency_us[type] = handle->latency_us[type];
+		statistics->latency_max_us[type] = handle->latency_max_us[type];
+	}
+	statistics->error_count = handle->error_count;
+	portEXIT_CRITICAL(&handle->mux);
+}
+
+void control_begin(control_config_t config, control_handle_t *handle) {
+	ESP_LOGD(TAG, ">control_begin");
+	ESP_LOGD(TAG, "favorites_handle: %p", config.favorites_handle);
+	ESP_LOGD(TAG, "buffer_handle: %p", config.buffer_handle);
+
+	control_handle_t control_handle = malloc(sizeof(struct control_t));
+	assert(control_handle != NULL);
+	memset(control_handle, 0, sizeof(struct control_t));
+	control_handle->favorites_handle = config.favorites_handle;
+	control_handle->buffer_handle = config.buffer_handle;
+	vPortCPUInitializeMutex(&control_handle->mux);
+
+	*handle = control_handle;
+
+	ESP_LOGD(TAG, "<control_begin");
+}
+
+void control_end(control_handle_t handle) {
+	ESP_LOGD(TAG, ">control_end");
+	free(handle);
+	ESP_LOGD(TAG, "<control_end");
+}
@@ -0,0 +1,476 @@
+// The author disclaims copyright to this source code.
+#include "dns_cache.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "lwip/err.h"
+#include "lwip/dns.h"
+
+static const char* TAG = "dns_cache";
+
+#define DNS_CACHE_NAMESPACE "dns_cache"
+#define DNS_CACHE_PORT (53)
+#define DNS_CACHE_QUERY_TIMEOUT_MS (2000)
+/** Largest response over UDP. */
+#define DNS_CACHE_MESSAGE_MAX_LENGTH (512)
+#define DNS_CACHE_HEADER_LENGTH (12)
+#define DNS_CACHE_TYPE_A (1)
+#define DNS_CACHE_TYPE_CNAME (5)
+#define DNS_CACHE_CLASS_IN (1)
+/** Time to live bounds: not too many queries, not too old. */
+#define DNS_CACHE_TTL_MIN_S (30)
+#define DNS_CACHE_TTL_MAX_S (86400)
+/** Time to live when lwIP resolved the address, it does not tell. */
+#define DNS_CACHE_TTL_LWIP_S (300)
+/** Wait after a failed query. */
+#define DNS_CACHE_RETRY_US (10000000)
+/** Check for addresses to refresh. */
+#define DNS_CACHE_TASK_MS (5000)
+
+/**
+ * Address as kept in NVS, the host tells whether the favorite changed.
+ */
+typedef struct dns_cache_record_t {
+	ip_addr_t addr;
+	char host[DNS_CACHE_HOST_MAX_LENGTH];
+} dns_cache_record_t;
+
+static uint16_t dns_cache_get16(const uint8_t *data) {
+	return (data[0] << 8) | data[1];
+}
+
+static uint32_t dns_cache_get32(const uint8_t *data) {
+	return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+/**
+ * Skip a (compressed) name.
+ * @return Offset after the name, 0 when invalid.
+ */
+static uint32_t dns_cache_skip_name(const uint8_t *data, uint32_t length, uint32_t offset) {
+	while (offset < length) {
+		uint8_t label = data[offset];
+		if (label == 0) {
+			return offset + 1;
+		}
+		if ((label & 0xC0) == 0xC0) {
+			// pointer ends the name
+			return offset + 2 <= length ? offset + 2 : 0;
+		}
+		if ((label & 0xC0) != 0) {
+			return 0;
+		}
+		offset += 1 + label;
+	}
+	return 0;
+}
+
+/**
+ * Match the uncompressed name at the offset with the host, case insensitive.
+ * @return Offset after the name, 0 when it is another name.
+ */
+static uint32_t dns_cache_match_name(const uint8_t *data, uint32_t length, uint32_t offset, const char *host) {
+	const char *label = host;
+	while (offset < length) {
+		uint8_t label_length = data[offset++];
+		if (label_length == 0) {
+			return *label == 0 ? offset : 0;
+		}
+		if ((label_length & 0xC0) != 0 || offset + label_length > length
+				|| strncasecmp((const char *) &data[offset], label, label_length) != 0
+				|| (label[label_length] != '.' && label[label_length] != 0)) {
+			return 0;
+		}
+		offset += label_length;
+		label += label_length + (label[label_length] == '.' ? 1 : 0);
+	}
+	return 0;
+}
+
+bool dns_cache_parse(const uint8_t *data, uint32_t length, const char *host, uint16_t id, uint8_t address[4],
+		uint32_t *ttl_s) {
+	if (length < DNS_CACHE_HEADER_LENGTH || dns_cache_get16(data) != id) {
+		return false;
+	}
+	// a response, without error
+	if ((data[2] & 0x80) == 0 || (data[3] & 0x0F) != 0) {
+		return false;
+	}
+	uint16_t questions = dns_cache_get16(&data[4]);
+	uint16_t answers = dns_cache_get16(&data[6]);
+	// the question repeated: the answer to this query
+	if (questions != 1) {
+		return false;
+	}
+	uint32_t offset = dns_cache_match_name(data, length, DNS_CACHE_HEADER_LENGTH, host);
+	if (offset == 0 || offset + 4 > length || dns_cache_get16(&data[offset]) != DNS_CACHE_TYPE_A
+			|| dns_cache_get16(&data[offset + 2]) != DNS_CACHE_CLASS_IN) {
+		return false;
+	}
+	offset += 4;
+	uint32_t ttl = UINT32_MAX;
+	for (uint16_t i = 0; i < answers; i++) {
+		offset = dns_cache_skip_name(data, length, offset);
+		if (offset == 0 || offset + 10 > length) {
+			return false;
+		}
+		uint16_t type = dns_cache_get16(&data[offset]);
+		uint16_t class = dns_cache_get16(&data[offset + 2]);
+		uint32_t answer_ttl = dns_cache_get32(&data[offset + 4]);
+		uint16_t rdlength = dns_cache_get16(&data[offset + 8]);
+		offset += 10;
+		if (offset + rdlength > length) {
+			return false;
+		}
+		if (class == DNS_CACHE_CLASS_IN && (type == DNS_CACHE_TYPE_CNAME || type == DNS_CACHE_TYPE_A)) {
+			// an alias expires as soon as its address
+			ttl = answer_ttl < ttl ? answer_ttl : ttl;
+			if (type == DNS_CACHE_TYPE_A && rdlength == 4) {
+				memcpy(address, &data[offset], 4);
+				*ttl_s = ttl;
+				return true;
+			}
+		}
+		offset += rdlength;
+	}
+	return false;
+}
+
+/**
+ * Query for the A record, recursion desired.
+ * @return Number of bytes, 0 when the host does not fit.
+ */
+static uint32_t dns_cache_build_query(uint8_t *query, uint32_t size, const char *host, uint16_t id) {
+	static const uint8_t header[] = { 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	uint32_t host_length = strlen(host);
+	if (DNS_CACHE_HEADER_LENGTH + host_length + 2 + 4 > size) {
+		return 0;
+	}
+	query[0] = id >> 8;
+	query[1] = id & 0xFF;
+	memcpy(&query[2], header, sizeof(header));
+	uint32_t offset = DNS_CACHE_HEADER_LENGTH;
+	const char *label = host;
+	while (*label != 0) {
+		const char *dot = strchr(label, '.');
+		uint32_t label_length = (dot == NULL ? strlen(label) : dot - label);
+		if (label_length == 0 || label_length > 63) {
+			return 0;
+		}
+		query[offset++] = label_length;
+		memcpy(&query[offset], label, label_length);
+		offset += label_length;
+		label += label_length + (dot == NULL ? 0 : 1);
+	}
+	query[offset++] = 0;
+	query[offset++] = 0;
+	query[offset++] = DNS_CACHE_TYPE_A;
+	query[offset++] = 0;
+	query[offset++] = DNS_CACHE_CLASS_IN;
+	return offset;
+}
+
+/**
+ * Ask the name server, learn the time to live.
+ */
+static bool dns_cache_query(dns_cache_handle_t handle, const char *host, ip_addr_t *addr, uint32_t *ttl_s) {
+	ESP_LOGD(TAG, ">dns_cache_query %s", host);
+	portENTER_CRITICAL(&handle->mux);
+	handle->query_count++;
+	portEXIT_CRITICAL(&handle->mux);
+
+	const ip_addr_t *server = dns_getserver(0);
+	uint8_t message[DNS_CACHE_MESSAGE_MAX_LENGTH];
+	uint16_t id = esp_random() & 0xFFFF;
+	uint32_t length = dns_cache_build_query(message, sizeof(message), host, id);
+	if (server == NULL || ip_addr_isany(server) || length == 0) {
+		return false;
+	}
+	struct netconn *conn = netconn_new(NETCONN_UDP);
+	if (conn == NULL) {
+		ESP_LOGE(TAG, "netconn_new failed");
+		return false;
+	}
+	netconn_set_recvtimeout(conn, DNS_CACHE_QUERY_TIMEOUT_MS);
+	bool found = false;
+	struct netbuf *netbuf = netbuf_new();
+	// connected, only datagrams from the name server are received
+	if (netbuf != NULL && netbuf_ref(netbuf, message, length) == ERR_OK
+			&& netconn_connect(conn, server, DNS_CACHE_PORT) == ERR_OK && netconn_send(conn, netbuf) == ERR_OK) {
+		struct netbuf *response;
+		if (netconn_recv(conn, &response) == ERR_OK) {
+			uint32_t response_length = netbuf_copy(response, message, sizeof(message));
+			uint8_t address[4];
+			found = dns_cache_parse(message, response_length, host, id, address, ttl_s);
+			if (found) {
+				IP_ADDR4(addr, address[0], address[1], address[2], address[3]);
+			}
+			netbuf_delete(response);
+		}
+	}
+	if (netbuf != NULL) {
+		netbuf_delete(netbuf);
+	}
+	netconn_delete(conn);
+	ESP_LOGD(TAG, "<dns_cache_query %d", found);
+	return found;
+}
+
+/**
+ * Host of a stream URL: scheme://host[:port][/path]
+ */
+static void dns_cache_url_host(const char *url, char *host) {
+	const char *start = strstr(url, "://");
+	start = (start == NULL ? url : start + 3);
+	size_t length = strcspn(start, ":/");
+	if (length >= DNS_CACHE_HOST_MAX_LENGTH) {
+		length = 0;
+	}
+	memcpy(host, start, length);
+	host[length] = 0;
+}
+
+/**
+ * @return Index of the entry of the host, -1 when not cached.
+ */
+static int dns_cache_find(dns_cache_handle_t handle, const char *host) {
+	for (int i = 0; i < handle->count; i++) {
+		if (strcasecmp(handle->entries[i].host, host) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void dns_cache_key(uint32_t index, char *key) {
+	key[0] = 'f';
+	key[1] = '0' + index;
+	key[2] = 0;
+}
+
+static void dns_cache_store(dns_cache_handle_t handle, uint32_t index, const dns_cache_record_t *record) {
+	nvs_handle nvs;
+	if (nvs_open(DNS_CACHE_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+		ESP_LOGE(TAG, "nvs_open failed");
+		return;
+	}
+	char key[3];
+	dns_cache_key(index, key);
+	size_t length = offsetof(dns_cache_record_t, host) + strlen(record->host) + 1;
+	if (nvs_set_blob(nvs, key, record, length) == ESP_OK && nvs_commit(nvs) == ESP_OK) {
+		portENTER_CRITICAL(&handle->mux);
+		handle->persist_count++;
+		portEXIT_CRITICAL(&handle->mux);
+	} else {
+		ESP_LOGE(TAG, "nvs_set_blob failed: %s", key);
+	}
+	nvs_close(nvs);
+}
+
+static void dns_cache_load(dns_cache_handle_t handle) {
+	nvs_handle nvs;
+	if (nvs_open(DNS_CACHE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+		// nothing stored yet
+		return;
+	}
+	for (uint32_t i = 0; i < handle->count; i++) {
+		dns_cache_entry_t *entry = &handle->entries[i];
+		dns_cache_record_t record;
+		memset(&record, 0, sizeof(record));
+		size_t length = sizeof(record);
+		char key[3];
+		dns_cache_key(i, key);
+		if (nvs_get_blob(nvs, key, &record, &length) == ESP_OK && length > offsetof(dns_cache_record_t, host)
+				&& strncmp(record.host, entry->host, sizeof(record.host)) == 0) {
+			entry->addr = record.addr;
+			entry->valid = true;
+			ESP_LOGI(TAG, "last good: %s %s", entry->host, ipaddr_ntoa(&entry->addr));
+		}
+	}
+	nvs_close(nvs);
+}
+
+/**
+ * Resolve the host of an entry and update the entry, without holding the mutex.
+ */
+static bool dns_cache_refresh(dns_cache_handle_t handle, uint32_t index) {
+	dns_cache_record_t record;
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	strcpy(record.host, handle->entries[index].host);
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+
+	uint32_t ttl_s;
+	bool found = dns_cache_query(handle, record.host, &record.addr, &ttl_s);
+	if (!found) {
+		// the name server may be unreachable directly, lwIP knows more (hosts, other servers)
+		found = netconn_gethostbyname(record.host, &record.addr) == ERR_OK;
+		ttl_s = DNS_CACHE_TTL_LWIP_S;
+	}
+	int64_t now_us = esp_timer_get_time();
+	bool changed = false;
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	dns_cache_entry_t *entry = &handle->entries[index];
+	if (found) {
+		ttl_s = ttl_s < DNS_CACHE_TTL_MIN_S ? DNS_CACHE_TTL_MIN_S : ttl_s > DNS_CACHE_TTL_MAX_S ? DNS_CACHE_TTL_MAX_S : ttl_s;
+		changed = !entry->valid || !ip_addr_cmp(&entry->addr, &record.addr);
+		entry->addr = record.addr;
+		entry->valid = true;
+		entry->ttl_s = ttl_s;
+		entry->expire_us = now_us + ttl_s * 1000000LL;
+		// refresh ahead, when a quarter of the time to live is left
+		entry->refresh_us = entry->expire_us - ttl_s * 250000LL;
+	} else {
+		entry->refresh_us = now_us + DNS_CACHE_RETRY_US;
+	}
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+
+	if (found) {
+		ESP_LOGD(TAG, "resolved: %s %s ttl %u", record.host, ipaddr_ntoa(&record.addr), ttl_s);
+	} else {
+		ESP_LOGW(TAG, "not resolved: %s", record.host);
+		portENTER_CRITICAL(&handle->mux);
+		handle->error_count++;
+		portEXIT_CRITICAL(&handle->mux);
+	}
+	if (changed && handle->persist) {
+		dns_cache_store(handle, index, &record);
+	}
+	return found;
+}
+
+bool dns_cache_resolve(dns_cache_handle_t handle, const char *host, ip_addr_t *addr, bool *cached) {
+	ESP_LOGD(TAG, ">dns_cache_resolve %s", host);
+	*cached = false;
+	if (ipaddr_aton(host, addr)) {
+		*cached = true;
+		return true;
+	}
+	int index = -1;
+	if (handle != NULL) {
+		assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+		index = dns_cache_find(handle, host);
+		if (index >= 0 && handle->entries[index].valid) {
+			dns_cache_entry_t *entry = &handle->entries[index];
+			*addr = entry->addr;
+			*cached = true;
+			bool stale = esp_timer_get_time() >= entry->expire_us;
+			portENTER_CRITICAL(&handle->mux);
+			if (stale) {
+				handle->stale_count++;
+			} else {
+				handle->hit_count++;
+			}
+			portEXIT_CRITICAL(&handle->mux);
+		}
+		assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+		if (*cached) {
+			ESP_LOGD(TAG, "<dns_cache_resolve cached");
+			return true;
+		}
+		portENTER_CRITICAL(&handle->mux);
+		handle->miss_count++;
+		portEXIT_CRITICAL(&handle->mux);
+	}
+	bool found;
+	if (index >= 0) {
+		found = dns_cache_refresh(handle, index);
+		assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+		*addr = handle->entries[index].addr;
+		assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	} else {
+		err_t err = netconn_gethostbyname(host, addr);
+		found = err == ERR_OK;
+		if (!found) {
+			ESP_LOGE(TAG, "netconn_gethostbyname %s error: %d", host, err);
+		}
+	}
+	ESP_LOGD(TAG, "<dns_cache_resolve %d", found);
+	return found;
+}
+
+void dns_cache_invalidate(dns_cache_handle_t handle, const char *host) {
+	if (handle == NULL) {
+		return;
+	}
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	int index = dns_cache_find(handle, host);
+	if (index >= 0) {
+		ESP_LOGI(TAG, "invalidate: %s", host);
+		handle->entries[index].valid = false;
+		handle->entries[index].refresh_us = 0;
+	}
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+}
+
+void dns_cache_get_statistics(dns_cache_handle_t handle, dns_cache_statistics_t *statistics) {
+	portENTER_CRITICAL(&handle->mux);
+	statistics->hit_count = handle->hit_count;
+	statistics->stale_count = handle->stale_count;
+	statistics->miss_count = handle->miss_count;
+	statistics->query_count = handle->query_count;
+	statistics->error_count = handle->error_count;
+	statistics->persist_count = handle->persist_count;
+	portEXIT_CRITICAL(&handle->mux);
+}
+
+void dns_cache_task(void *pvParameters) {
+	ESP_LOGI(TAG, ">dns_cache_task");
+
+	dns_cache_handle_t handle = (dns_cache_handle_t) pvParameters;
+	ESP_LOGD(TAG, "handle: %p", handle);
+
+	while (1) {
+		for (uint32_t i = 0; i < handle->count; i++) {
+			assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+			dns_cache_entry_t *entry = &handle->entries[i];
+			bool due = entry->host[0] != 0 && esp_timer_get_time() >= entry->refresh_us;
+			assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+			if (due) {
+				dns_cache_refresh(handle, i);
+			}
+		}
+		vTaskDelay(DNS_CACHE_TASK_MS / portTICK_PERIOD_MS);
+	}
+	// should never be reached
+}
+
+void dns_cache_begin(dns_cache_config_t config, dns_cache_handle_t *handle) {
+	ESP_LOGD(TAG, ">dns_cache_begin");
+	ESP_LOGD(TAG, "favorites_handle: %p", config.favorites_handle);
+	ESP_LOGD(TAG, "persist: %d", config.persist);
+
+	dns_cache_handle_t dns_cache_handle = malloc(sizeof(struct dns_cache_t));
+	assert(dns_cache_handle != NULL);
+	memset(dns_cache_handle, 0, sizeof(struct dns_cache_t));
+	dns_cache_handle->favorites_handle = config.favorites_handle;
+	dns_cache_handle->persist = config.persist;
+	dns_cache_handle->count = favorites_count(config.favorites_handle);
+	for (uint32_t i = 0; i < dns_cache_handle->count; i++) {
+		dns_cache_url_host(favorites_get(config.favorites_handle, i)->url, dns_cache_handle->entries[i].host);
+	}
+	if (config.persist) {
+		dns_cache_load(dns_cache_handle);
+	}
+	dns_cache_handle->mutex = xSemaphoreCreateMutex();
+	assert(dns_cache_handle->mutex != NULL);
+	vPortCPUInitializeMutex(&dns_cache_handle->mux);
+
+	*handle = dns_cache_handle;
+
+	ESP_LOGD(TAG, "<dns_cache_begin");
+}
+
+void dns_cache_end(dns_cache_handle_t handle) {
+	ESP_LOGD(TAG, ">dns_cache_end");
+	vSemaphoreDelete(handle->mutex);
+	free(handle);
+	ESP_LOGD(TAG, "<dns_cache_end");
+}
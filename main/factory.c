@@ -53,10 +53,30 @@ void factory_dsp_create(vs1053_handle_t *handle) {
 
 void factory_buffer_create(spi_mem_handle_t spi_mem_handle, uint32_t size, buffer_handle_t *handle) {
 	ESP_LOGD(TAG, ">factory_buffer_create");
+	ESP_LOGD(TAG, "CONFIG_BUFFER_FRAME_INDEX_ENTRIES: %d", CONFIG_BUFFER_FRAME_INDEX_ENTRIES);
+	ESP_LOGD(TAG, "CONFIG_BUFFER_BLOCK_MS: %d", CONFIG_BUFFER_BLOCK_MS);
 
 	buffer_config_t configuration;
 	configuration.spi_mem_handle = spi_mem_handle;
+	// the play buffer starts at the bottom of the memory
+	configuration.base = 0;
 	configuration.size = size;
+	configuration.frame_index_entries = CONFIG_BUFFER_FRAME_INDEX_ENTRIES;
+#if CONFIG_BUFFER_OVERFLOW_BLOCK
+	configuration.overflow_policy = BUFFER_POLICY_BLOCK;
+#elif CONFIG_BUFFER_OVERFLOW_DROP_NEWEST
+	configuration.overflow_policy = BUFFER_POLICY_DROP_NEWEST;
+#elif CONFIG_BUFFER_OVERFLOW_PARTIAL
+	configuration.overflow_policy = BUFFER_POLICY_PARTIAL;
+#else
+	configuration.overflow_policy = BUFFER_POLICY_DROP_OLDEST;
+#endif
+#if CONFIG_BUFFER_UNDERRUN_BLOCK
+	configuration.underrun_policy = BUFFER_POLICY_BLOCK;
+#else
+	configuration.underrun_policy = BUFFER_POLICY_PARTIAL;
+#endif
+	configuration.block_ms = CONFIG_BUFFER_BLOCK_MS;
 
 	buffer_begin(configuration, handle);
 	buffer_log(*handle);
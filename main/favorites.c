@@ -0,0 +1,103 @@
+// The author disclaims copyright to this source code.
+#include "favorites.h"
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "favorites";
+
+static void favorites_add(favorites_handle_t handle, const char *name, uint32_t name_length, const char *url,
+		uint32_t url_length) {
+	if (handle->count == FAVORITES_MAX_COUNT) {
+		ESP_LOGW(TAG, "too many favorites, ignored: %.*s", url_length, url);
+		return;
+	}
+	if (url_length == 0 || url_length >= FAVORITES_URL_MAX_LENGTH) {
+		ESP_LOGW(TAG, "invalid url, ignored: %.*s", url_length, url);
+		return;
+	}
+	favorite_t *favorite = &handle->entries[handle->count++];
+	if (name_length >= FAVORITES_NAME_MAX_LENGTH) {
+		name_length = FAVORITES_NAME_MAX_LENGTH - 1;
+	}
+	memcpy(favorite->name, name, name_length);
+	favorite->name[name_length] = 0;
+	memcpy(favorite->url, url, url_length);
+	favorite->url[url_length] = 0;
+	ESP_LOGD(TAG, "favorite %u: %s %s", handle->count - 1, favorite->name, favorite->url);
+}
+
+/**
+ * name|url;name|url, without a name the url is the name.
+ */
+static void favorites_parse(favorites_handle_t handle, const char *list) {
+	while (*list != 0) {
+		uint32_t length = strcspn(list, ";");
+		const char *separator = memchr(list, '|', length);
+		if (separator == NULL) {
+			favorites_add(handle, list, length, list, length);
+		} else {
+			favorites_add(handle, list, separator - list, separator + 1, length - (separator + 1 - list));
+		}
+		list += length;
+		if (*list == ';') {
+			list++;
+		}
+	}
+}
+
+uint32_t favorites_count(favorites_handle_t handle) {
+	return handle->count;
+}
+
+const favorite_t *favorites_get(favorites_handle_t handle, uint32_t index) {
+	return index < handle->count ? &handle->entries[index] : NULL;
+}
+
+bool favorites_select(favorites_handle_t handle, uint32_t index) {
+	if (index >= handle->count) {
+		return false;
+	}
+	portENTER_CRITICAL(&handle->mux);
+	handle->selected = index;
+	handle->select_count++;
+	portEXIT_CRITICAL(&handle->mux);
+	ESP_LOGI(TAG, "selected: %u %s", index, handle->entries[index].name);
+	return true;
+}
+
+uint32_t favorites_selected(favorites_handle_t handle, uint32_t *select_count) {
+	portENTER_CRITICAL(&handle->mux);
+	uint32_t selected = handle->selected;
+	if (select_count != NULL) {
+		*select_count = handle->select_count;
+	}
+	portEXIT_CRITICAL(&handle->mux);
+	return selected;
+}
+
+void favorites_begin(favorites_config_t config, favorites_handle_t *handle) {
+	ESP_LOGD(TAG, ">favorites_begin");
+	ESP_LOGD(TAG, "url: %s", config.url);
+	ESP_LOGD(TAG, "list: %s", config.list);
+
+	favorites_handle_t favorites_handle = malloc(sizeof(struct favorites_t));
+	assert(favorites_handle != NULL);
+	memset(favorites_handle, 0, sizeof(struct favorites_t));
+	vPortCPUInitializeMutex(&favorites_handle->mux);
+	if (config.url[0] != 0) {
+		favorites_add(favorites_handle, "Default", strlen("Default"), config.url, strlen(config.url));
+	}
+	favorites_parse(favorites_handle, config.list);
+
+	*handle = favorites_handle;
+
+	ESP_LOGD(TAG, "<favorites_begin");
+}
+
+void favorites_end(favorites_handle_t handle) {
+	ESP_LOGD(TAG, ">favorites_end");
+	free(handle);
+	ESP_LOGD(TAG, "<favorites_end");
+}
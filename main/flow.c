@@ -0,0 +1,75 @@
+// The author disclaims copyright to this source code.
+#include "flow.h"
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "flow";
+
+/**
+ * Buffer level of a watermark, in bytes.
+ */
+static uint32_t flow_level(flow_handle_t handle, uint32_t percent) {
+	return (uint32_t) (((uint64_t) handle->buffer_handle->size * percent) / 100);
+}
+
+bool flow_wait(flow_handle_t handle, uint32_t wait_ms) {
+	if (!handle->throttled) {
+		if (buffer_available(handle->buffer_handle) < flow_level(handle, handle->high_percent)) {
+			return true;
+		}
+		ESP_LOGD(TAG, "throttle");
+		portENTER_CRITICAL(&handle->mux);
+		handle->throttled = true;
+		handle->throttle_us = esp_timer_get_time();
+		handle->throttle_count++;
+		portEXIT_CRITICAL(&handle->mux);
+	}
+	uint32_t room = handle->buffer_handle->size - flow_level(handle, handle->low_percent);
+	if (buffer_wait_free(handle->buffer_handle, room, wait_ms) < room) {
+		return false;
+	}
+	ESP_LOGD(TAG, "resume");
+	portENTER_CRITICAL(&handle->mux);
+	handle->throttled = false;
+	handle->throttled_us += esp_timer_get_time() - handle->throttle_us;
+	portEXIT_CRITICAL(&handle->mux);
+	return true;
+}
+
+void flow_get_statistics(flow_handle_t handle, flow_statistics_t *statistics) {
+	int64_t now_us = esp_timer_get_time();
+	portENTER_CRITICAL(&handle->mux);
+	statistics->throttled = handle->throttled;
+	statistics->throttle_count = handle->throttle_count;
+	statistics->throttled_us = handle->throttled_us + (handle->throttled ? now_us - handle->throttle_us : 0);
+	portEXIT_CRITICAL(&handle->mux);
+}
+
+void flow_begin(flow_config_t config, flow_handle_t *handle) {
+	ESP_LOGD(TAG, ">flow_begin");
+	ESP_LOGD(TAG, "buffer_handle: %p", config.buffer_handle);
+	ESP_LOGD(TAG, "high_percent: %u", config.high_percent);
+	ESP_LOGD(TAG, "low_percent: %u", config.low_percent);
+	assert(config.low_percent < config.high_percent && config.high_percent <= 100);
+
+	flow_handle_t flow_handle = malloc(sizeof(struct flow_t));
+	assert(flow_handle != NULL);
+	memset(flow_handle, 0, sizeof(struct flow_t));
+	flow_handle->buffer_handle = config.buffer_handle;
+	flow_handle->high_percent = config.high_percent;
+	flow_handle->low_percent = config.low_percent;
+	vPortCPUInitializeMutex(&flow_handle->mux);
+
+	*handle = flow_handle;
+
+	ESP_LOGD(TAG, "<flow_begin");
+}
+
+void flow_end(flow_handle_t handle) {
+	ESP_LOGD(TAG, ">flow_end");
+	free(handle);
+	ESP_LOGD(TAG, "<flow_end");
+}
@@ -0,0 +1,336 @@
+// The author disclaims copyright to this source code.
+#include "frame_index.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "frame_index";
+
+/** MPEG audio bitrate in kbps, [MPEG 1, MPEG 2 and 2.5][layer I, II, III][bitrate index]. */
+static const uint16_t FRAME_INDEX_MPEG_BITRATE[2][3][15] = { //
+		{ //
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 }, //
+				{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 }, //
+				{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 } //
+		}, { //
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 }, //
+				{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }, //
+				{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 } //
+		} //
+};
+
+/** MPEG 1 audio sample rate, halved for MPEG 2, quartered for MPEG 2.5. */
+static const uint32_t FRAME_INDEX_MPEG_SAMPLE_RATE[3] = { 44100, 48000, 32000 };
+
+/** ADTS sample rate by sampling frequency index. */
+static const uint32_t FRAME_INDEX_ADTS_SAMPLE_RATE[13] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+		16000, 12000, 11025, 8000, 7350 };
+
+/** Header result: invalid. */
+#define FRAME_INDEX_INVALID (-1)
+/** Header result: valid so far, need more bytes. */
+#define FRAME_INDEX_INCOMPLETE (0)
+
+typedef struct frame_index_frame_t {
+	uint32_t length;
+	uint32_t duration_us;
+	uint32_t bitrate;
+	uint32_t sample_rate;
+} frame_index_frame_t;
+
+/**
+ * Check MPEG audio header, as far as available.
+ *  AAAAAAAA AAABBCCD EEEEFFGH IIJJKLMM
+ *  A sync, B version, C layer, D protection, E bitrate, F sample rate, G padding, ..., M emphasis
+ */
+static int frame_index_check_mpeg(const uint8_t *header, uint32_t length, frame_index_frame_t *frame) {
+	uint32_t version = (header[1] >> 3) & 0x03;
+	uint32_t layer = (header[1] >> 1) & 0x03;
+	// version 1 and layer 0 are reserved
+	if (version == 1 || layer == 0) {
+		return FRAME_INDEX_INVALID;
+	}
+	if (length < 3) {
+		return FRAME_INDEX_INCOMPLETE;
+	}
+	uint32_t bitrate_index = header[2] >> 4;
+	uint32_t sample_rate_index = (header[2] >> 2) & 0x03;
+	uint32_t padding = (header[2] >> 1) & 0x01;
+	// free format can not be indexed, 15 is invalid, 3 is reserved
+	if (bitrate_index == 0 || bitrate_index == 15 || sample_rate_index == 3) {
+		return FRAME_INDEX_INVALID;
+	}
+	if (length < 4) {
+		return FRAME_INDEX_INCOMPLETE;
+	}
+	// emphasis 2 is reserved
+	if ((header[3] & 0x03) == 0x02) {
+		return FRAME_INDEX_INVALID;
+	}
+
+	bool mpeg1 = (version == 3);
+	// layer I=3, II=2, III=1
+	uint32_t layer_index = 3 - layer;
+	frame->bitrate = FRAME_INDEX_MPEG_BITRATE[mpeg1 ? 0 : 1][layer_index][bitrate_index] * 1000;
+	frame->sample_rate = FRAME_INDEX_MPEG_SAMPLE_RATE[sample_rate_index] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+	uint32_t samples;
+	if (layer_index == 0) {
+		samples = 384;
+		frame->length = (12 * frame->bitrate / frame->sample_rate + padding) * 4;
+	} else {
+		samples = (layer_index == 2 && !mpeg1) ? 576 : 1152;
+		frame->length = (samples / 8) * frame->bitrate / frame->sample_rate + padding;
+	}
+	frame->duration_us = (uint64_t) samples * 1000000 / frame->sample_rate;
+	return 4;
+}
+
+/**
+ * Check AAC ADTS header, as far as available.
+ *  AAAAAAAA AAAABCCD EEFFFFGH HHIJKLMM MMMMMMMM MMMOOOOO OOOOOOPP
+ *  A sync, B id, C layer, D protection absent, E profile, F sample rate, ..., M frame length, P raw data blocks
+ */
+static int frame_index_check_adts(const uint8_t *header, uint32_t length, frame_index_frame_t *frame) {
+	if (length < 3) {
+		return FRAME_INDEX_INCOMPLETE;
+	}
+	uint32_t sample_rate_index = (header[2] >> 2) & 0x0F;
+	if (sample_rate_index >= sizeof(FRAME_INDEX_ADTS_SAMPLE_RATE) / sizeof(FRAME_INDEX_ADTS_SAMPLE_RATE[0])) {
+		return FRAME_INDEX_INVALID;
+	}
+	if (length < 6) {
+		return FRAME_INDEX_INCOMPLETE;
+	}
+	frame->length = ((header[3] & 0x03) << 11) | (header[4] << 3) | (header[5] >> 5);
+	if (frame->length < 7) {
+		return FRAME_INDEX_INVALID;
+	}
+	if (length < 7) {
+		return FRAME_INDEX_INCOMPLETE;
+	}
+	uint32_t samples = 1024 * ((header[6] & 0x03) + 1);
+	frame->sample_rate = FRAME_INDEX_ADTS_SAMPLE_RATE[sample_rate_index];
+	frame->duration_us = (uint64_t) samples * 1000000 / frame->sample_rate;
+	frame->bitrate = (uint64_t) frame->length * 8 * frame->sample_rate / samples;
+	return 7;
+}
+
+/**
+ * Check frame header, as far as available.
+ * @return Header length when complete and valid, FRAME_INDEX_INCOMPLETE or FRAME_INDEX_INVALID.
+ */
+static int frame_index_check(const uint8_t *header, uint32_t length, frame_index_frame_t *frame) {
+	if (header[0] != 0xFF) {
+		return FRAME_INDEX_INVALID;
+	}
+	if (length < 2) {
+		return FRAME_INDEX_INCOMPLETE;
+	}
+	if ((header[1] & 0xE0) != 0xE0) {
+		return FRAME_INDEX_INVALID;
+	}
+	int result;
+	if ((header[1] & 0xF6) == 0xF0) {
+		// 12-bit sync and layer 0
+		result = frame_index_check_adts(header, length, frame);
+	} else {
+		result = frame_index_check_mpeg(header, length, frame);
+	}
+	if (result > 0 && frame->length < result) {
+		return FRAME_INDEX_INVALID;
+	}
+	return result;
+}
+
+static void frame_index_push(frame_index_handle_t handle, uint32_t addr, uint32_t duration_us) {
+	if (handle->tail - handle->head > handle->mask) {
+		// full, forget the oldest
+		handle->duration_us -= handle->entries[handle->head & handle->mask].duration_us;
+		handle->head++;
+		handle->overflow_count++;
+	}
+	frame_index_entry_t *entry = &handle->entries[handle->tail & handle->mask];
+	entry->addr = addr;
+	entry->duration_us = duration_us;
+	handle->duration_us += duration_us;
+	handle->tail++;
+	handle->frame_count++;
+}
+
+static bool frame_index_pop_newest(frame_index_handle_t handle, uint32_t *addr) {
+	if (handle->tail == handle->head) {
+		return false;
+	}
+	handle->tail--;
+	frame_index_entry_t *entry = &handle->entries[handle->tail & handle->mask];
+	handle->duration_us -= entry->duration_us;
+	*addr = entry->addr;
+	return true;
+}
+
+/** Drop the first header byte and everything up to the next sync byte. */
+static void frame_index_slide(frame_index_handle_t handle) {
+	do {
+		handle->header_length--;
+		handle->header_addr++;
+		memmove(&handle->header[0], &handle->header[1], handle->header_length);
+	} while (handle->header_length > 0 && handle->header[0] != 0xFF);
+}
+
+/**
+ * A header byte was added, check the header collected so far.
+ */
+static void frame_index_header(frame_index_handle_t handle) {
+	frame_index_frame_t frame;
+	int result = frame_index_check(handle->header, handle->header_length, &frame);
+	while (result == FRAME_INDEX_INVALID) {
+		if (handle->synced) {
+			// no header where one was expected, do not trust the previous frame
+			uint32_t addr;
+			frame_index_pop_newest(handle, &addr);
+			handle->synced = false;
+			handle->sync_lost_count++;
+			ESP_LOGD(TAG, "sync lost at %u", handle->header_addr);
+		}
+		frame_index_slide(handle);
+		if (handle->header_length == 0) {
+			return;
+		}
+		result = frame_index_check(handle->header, handle->header_length, &frame);
+	}
+	if (result == FRAME_INDEX_INCOMPLETE) {
+		return;
+	}
+	if (!handle->synced) {
+		ESP_LOGD(TAG, "sync at %u, %u bps, %u Hz", handle->header_addr, frame.bitrate, frame.sample_rate);
+	}
+	frame_index_push(handle, handle->header_addr, frame.duration_us);
+	handle->bitrate = frame.bitrate;
+	handle->sample_rate = frame.sample_rate;
+	handle->skip = frame.length - handle->header_length;
+	handle->header_length = 0;
+	handle->synced = true;
+}
+
+void frame_index_parse(frame_index_handle_t handle, uint32_t addr, const uint8_t *data, uint32_t length) {
+	uint32_t i = 0;
+	while (i < length) {
+		if (handle->skip > 0) {
+			// frame contents
+			uint32_t skip = length - i > handle->skip ? handle->skip : length - i;
+			handle->skip -= skip;
+			i += skip;
+			continue;
+		}
+		if (handle->header_length == 0) {
+			if (!handle->synced) {
+				// search sync byte
+				const uint8_t *sync = memchr(&data[i], 0xFF, length - i);
+				if (sync == NULL) {
+					return;
+				}
+				i = sync - data;
+			}
+			handle->header_addr = addr + i;
+		}
+		handle->header[handle->header_length++] = data[i++];
+		frame_index_header(handle);
+	}
+}
+
+void frame_index_consume(frame_index_handle_t handle, uint32_t read_addr) {
+	while (handle->head != handle->tail) {
+		frame_index_entry_t *entry = &handle->entries[handle->head & handle->mask];
+		if ((int32_t) (entry->addr - read_addr) >= 0) {
+			break;
+		}
+		handle->duration_us -= entry->duration_us;
+		handle->head++;
+	}
+}
+
+bool frame_index_find(frame_index_handle_t handle, uint32_t addr, uint32_t *frame_addr) {
+	// entries are ordered by address, binary search
+	uint32_t low = handle->head;
+	uint32_t high = handle->tail;
+	while (low != high) {
+		uint32_t middle = low + (high - low) / 2;
+		if ((int32_t) (handle->entries[middle & handle->mask].addr - addr) < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if (low == handle->tail) {
+		return false;
+	}
+	*frame_addr = handle->entries[low & handle->mask].addr;
+	return true;
+}
+
+bool frame_index_cut(frame_index_handle_t handle, uint32_t *frame_addr) {
+	bool cut = false;
+	if (handle->skip > 0) {
+		// last frame is incomplete
+		cut = frame_index_pop_newest(handle, frame_addr);
+	} else if (handle->header_length > 0) {
+		// next header is incomplete
+		*frame_addr = handle->header_addr;
+		cut = true;
+	}
+	handle->skip = 0;
+	handle->header_length = 0;
+	handle->synced = false;
+	return cut;
+}
+
+uint32_t frame_index_count(frame_index_handle_t handle) {
+	return handle->tail - handle->head;
+}
+
+void frame_index_reset(frame_index_handle_t handle) {
+	ESP_LOGD(TAG, ">frame_index_reset");
+	handle->head = 0;
+	handle->tail = 0;
+	handle->duration_us = 0;
+	handle->skip = 0;
+	handle->header_length = 0;
+	handle->header_addr = 0;
+	handle->synced = false;
+	handle->bitrate = 0;
+	handle->sample_rate = 0;
+	ESP_LOGD(TAG, "<frame_index_reset");
+}
+
+static bool frame_index_is_power_of_two(uint32_t size) {
+	return (size != 0) && ((size & (size - 1)) == 0);
+}
+
+void frame_index_begin(frame_index_config_t config, frame_index_handle_t *handle) {
+	ESP_LOGD(TAG, ">frame_index_begin");
+	ESP_LOGD(TAG, "entries: %u", config.entries);
+
+	assert(frame_index_is_power_of_two(config.entries));
+
+	frame_index_handle_t frame_index_handle = malloc(sizeof(struct frame_index_t));
+	assert(frame_index_handle != NULL);
+	memset(frame_index_handle, 0, sizeof(struct frame_index_t));
+	frame_index_handle->entries = malloc(config.entries * sizeof(frame_index_entry_t));
+	assert(frame_index_handle->entries != NULL);
+	frame_index_handle->mask = config.entries - 1;
+	frame_index_reset(frame_index_handle);
+
+	*handle = frame_index_handle;
+
+	ESP_LOGD(TAG, "<frame_index_begin");
+}
+
+void frame_index_end(frame_index_handle_t handle) {
+	ESP_LOGD(TAG, ">frame_index_end");
+	free(handle->entries);
+	handle->entries = NULL;
+	free(handle);
+	ESP_LOGD(TAG, "<frame_index_end");
+}
@@ -53,8 +53,8 @@ static void hello_push_hello() {
 			p += transfer;
 			remainder -= transfer;
 		} else {
-			// wait for available space
-			vTaskDelay(1 / portTICK_PERIOD_MS);
+			// wait for available space, woken by the player
+			buffer_wait_free(hello_buffer_handle, remainder > DMA_MAX_LENGTH ? DMA_MAX_LENGTH : remainder, 1000);
 		}
 	}
 	ESP_LOGD(TAG, "<hello_push_hello");
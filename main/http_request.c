@@ -0,0 +1,191 @@
+// The author disclaims copyright to this source code.
+#include "http_request.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "http_request";
+
+static const char HTTP_REQUEST_VERSION[] = "HTTP/1.";
+static const char HTTP_REQUEST_CONNECTION[] = "Connection";
+static const char HTTP_REQUEST_CONTENT_LENGTH[] = "Content-Length";
+static const char HTTP_REQUEST_ACCEPT_ENCODING[] = "Accept-Encoding";
+static const char HTTP_REQUEST_IF_NONE_MATCH[] = "If-None-Match";
+
+void http_request_reset(http_request_t *request) {
+	request->state = HTTP_REQUEST_STATE_REQUEST_LINE;
+	request->line_length = 0;
+	request->line_overflow = false;
+	request->body_remaining = 0;
+	request->method[0] = 0;
+	request->path[0] = 0;
+	request->query[0] = 0;
+	request->version_minor = 0;
+	request->keep_alive = false;
+	request->content_length = 0;
+	request->accept_gzip = false;
+	request->if_none_match[0] = 0;
+	request->body[0] = 0;
+	request->body_length = 0;
+	request->body_overflow = false;
+}
+
+/**
+ * Request-Line = Method SP Request-URI SP HTTP-Version
+ */
+static bool http_request_parse_request_line(http_request_t *request) {
+	char *method = request->line;
+	char *uri = strchr(method, ' ');
+	if (uri == NULL) {
+		return false;
+	}
+	*uri++ = 0;
+	char *version = strchr(uri, ' ');
+	if (version == NULL) {
+		return false;
+	}
+	*version++ = 0;
+	if (strncmp(version, HTTP_REQUEST_VERSION, sizeof(HTTP_REQUEST_VERSION) - 1) != 0) {
+		return false;
+	}
+	uint32_t uri_length = strcspn(uri, "?");
+	const char *query = (uri[uri_length] == '?' ? &uri[uri_length + 1] : "");
+	if (strlen(method) >= HTTP_REQUEST_METHOD_MAX_LENGTH || uri_length >= HTTP_REQUEST_PATH_MAX_LENGTH
+			|| strlen(query) >= HTTP_REQUEST_QUERY_MAX_LENGTH) {
+		return false;
+	}
+	strcpy(request->method, method);
+	memcpy(request->path, uri, uri_length);
+	request->path[uri_length] = 0;
+	strcpy(request->query, query);
+	request->version_minor = atoi(version + sizeof(HTTP_REQUEST_VERSION) - 1);
+	// persistent by default since HTTP/1.1
+	request->keep_alive = request->version_minor >= 1;
+	return true;
+}
+
+/**
+ * message-header = field-name ":" [ field-value ]
+ */
+static bool http_request_parse_header(http_request_t *request) {
+	char *value = strchr(request->line, ':');
+	if (value == NULL) {
+		return false;
+	}
+	*value++ = 0;
+	value += strspn(value, " \t");
+	if (strcasecmp(request->line, HTTP_REQUEST_CONNECTION) == 0) {
+		if (strcasecmp(value, "close") == 0) {
+			request->keep_alive = false;
+		} else if (strcasecmp(value, "keep-alive") == 0) {
+			request->keep_alive = true;
+		}
+	} else if (strcasecmp(request->line, HTTP_REQUEST_CONTENT_LENGTH) == 0) {
+		request->content_length = strtoul(value, NULL, 10);
+	} else if (strcasecmp(request->line, HTTP_REQUEST_ACCEPT_ENCODING) == 0) {
+		request->accept_gzip = (strstr(value, "gzip") != NULL);
+	} else if (strcasecmp(request->line, HTTP_REQUEST_IF_NONE_MATCH) == 0) {
+		// a list of entity tags, only the start is kept
+		strncpy(request->if_none_match, value, HTTP_REQUEST_IF_NONE_MATCH_MAX_LENGTH);
+		request->if_none_match[HTTP_REQUEST_IF_NONE_MATCH_MAX_LENGTH - 1] = 0;
+	}
+	return true;
+}
+
+/**
+ * A complete line was collected.
+ */
+static http_request_result_t http_request_parse_line(http_request_t *request) {
+	request->line[request->line_length] = 0;
+	if (request->state == HTTP_REQUEST_STATE_REQUEST_LINE) {
+		if (request->line_length == 0) {
+			// robustness: ignore empty lines before the request line
+			return HTTP_REQUEST_INCOMPLETE;
+		}
+		if (request->line_overflow || !http_request_parse_request_line(request)) {
+			ESP_LOGE(TAG, "bad request line: %s", request->line);
+			return HTTP_REQUEST_ERROR;
+		}
+		request->state = HTTP_REQUEST_STATE_HEADER;
+	} else if (request->line_length == 0 && !request->line_overflow) {
+		// end of header
+		request->body_remaining = request->content_length;
+		request->state = (request->body_remaining > 0 ? HTTP_REQUEST_STATE_BODY : HTTP_REQUEST_STATE_COMPLETE);
+	} else if (!request->line_overflow && !http_request_parse_header(request)) {
+		ESP_LOGE(TAG, "bad header: %s", request->line);
+		return HTTP_REQUEST_ERROR;
+	}
+	return request->state == HTTP_REQUEST_STATE_COMPLETE ? HTTP_REQUEST_COMPLETE : HTTP_REQUEST_INCOMPLETE;
+}
+
+uint32_t http_request_parse(http_request_t *request, const uint8_t *data, uint32_t length,
+		http_request_result_t *result) {
+	*result = HTTP_REQUEST_INCOMPLETE;
+	uint32_t consumed = 0;
+	while (consumed < length && *result == HTTP_REQUEST_INCOMPLETE) {
+		if (request->state == HTTP_REQUEST_STATE_BODY) {
+			uint32_t span = length - consumed > request->body_remaining ? request->body_remaining : length - consumed;
+			uint32_t room = HTTP_REQUEST_BODY_MAX_LENGTH - 1 - request->body_length;
+			uint32_t kept = span > room ? room : span;
+			memcpy(&request->body[request->body_length], data + consumed, kept);
+			request->body_length += kept;
+			request->body[request->body_length] = 0;
+			request->body_overflow |= kept < span;
+			request->body_remaining -= span;
+			consumed += span;
+			if (request->body_remaining == 0) {
+				request->state = HTTP_REQUEST_STATE_COMPLETE;
+				*result = HTTP_REQUEST_COMPLETE;
+			}
+		} else if (request->state == HTTP_REQUEST_STATE_COMPLETE) {
+			// reset before parsing the next request
+			break;
+		} else {
+			// collect up to the end of the line
+			const uint8_t *end = memchr(data + consumed, '\n', length - consumed);
+			uint32_t span = (end == NULL ? length : end - data) - consumed;
+			uint32_t room = HTTP_REQUEST_LINE_MAX_LENGTH - 1 - request->line_length;
+			if (span > room) {
+				request->line_overflow = true;
+			}
+			memcpy(&request->line[request->line_length], data + consumed, span > room ? room : span);
+			request->line_length += span > room ? room : span;
+			consumed += span;
+			if (end != NULL) {
+				consumed++;
+				// CRLF, be lenient and accept LF
+				if (request->line_length > 0 && request->line[request->line_length - 1] == '\r') {
+					request->line_length--;
+				}
+				*result = http_request_parse_line(request);
+				request->line_length = 0;
+				request->line_overflow = false;
+			}
+		}
+	}
+	return consumed;
+}
+
+bool http_request_query_value(const http_request_t *request, const char *name, char *value, uint32_t size) {
+	uint32_t name_length = strlen(name);
+	const char *parameter = request->query;
+	while (*parameter != 0) {
+		uint32_t length = strcspn(parameter, "&");
+		if (length > name_length && strncmp(parameter, name, name_length) == 0 && parameter[name_length] == '=') {
+			uint32_t value_length = length - name_length - 1;
+			if (value_length >= size) {
+				return false;
+			}
+			memcpy(value, &parameter[name_length + 1], value_length);
+			value[value_length] = 0;
+			return true;
+		}
+		parameter += length;
+		if (*parameter == '&') {
+			parameter++;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,143 @@
+// The author disclaims copyright to this source code.
+#include "icy.h"
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "icy";
+
+static const char ICY_STREAM_TITLE[] = "StreamTitle='";
+static const char ICY_STREAM_TITLE_END[] = "';";
+
+static void icy_set_title(icy_handle_t handle, const char *title, uint32_t length) {
+	if (length >= ICY_TITLE_MAX_LENGTH) {
+		length = ICY_TITLE_MAX_LENGTH - 1;
+	}
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	if ((strncmp(handle->title, title, length) != 0) || (handle->title[length] != 0)) {
+		memcpy(handle->title, title, length);
+		handle->title[length] = 0;
+		handle->title_count++;
+		ESP_LOGI(TAG, "title: %s", handle->title);
+	}
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+}
+
+/**
+ * Parse a complete metadata block.
+ * Only the stream title is of interest.
+ */
+static void icy_parse(icy_handle_t handle) {
+	handle->meta[handle->meta_length] = 0;
+	ESP_LOGV(TAG, "meta: %s", handle->meta);
+	char *title = strstr(handle->meta, ICY_STREAM_TITLE);
+	if (title != NULL) {
+		title += sizeof(ICY_STREAM_TITLE) - 1;
+		// the title itself may contain quotes, look for the field separator
+		char *end = strstr(title, ICY_STREAM_TITLE_END);
+		uint32_t length = (end == NULL ? strlen(title) : end - title);
+		icy_set_title(handle, title, length);
+	}
+}
+
+uint32_t icy_demux(icy_handle_t handle, uint8_t *data, uint32_t length, uint8_t **audio, uint32_t *audio_length) {
+	*audio = NULL;
+	*audio_length = 0;
+
+	if (handle->metaint == 0) {
+		// no metadata at all
+		*audio = data;
+		*audio_length = length;
+		handle->audio_bytes += length;
+		return length;
+	}
+
+	uint32_t consumed = 0;
+	while (consumed < length) {
+		uint32_t remainder = length - consumed;
+		if (handle->audio_remaining > 0) {
+			// audio, return the span without copying
+			uint32_t span = remainder > handle->audio_remaining ? handle->audio_remaining : remainder;
+			*audio = data + consumed;
+			*audio_length = span;
+			handle->audio_remaining -= span;
+			handle->audio_bytes += span;
+			return consumed + span;
+		}
+		if (!handle->meta_active) {
+			// length byte
+			handle->meta_remaining = data[consumed] * 16;
+			handle->meta_length = 0;
+			handle->meta_active = true;
+			handle->meta_bytes++;
+			consumed++;
+		} else {
+			// metadata text, keep what fits for parsing
+			uint32_t span = remainder > handle->meta_remaining ? handle->meta_remaining : remainder;
+			uint32_t room = ICY_META_MAX_LENGTH - handle->meta_length;
+			memcpy(&handle->meta[handle->meta_length], data + consumed, span > room ? room : span);
+			handle->meta_length += span > room ? room : span;
+			handle->meta_remaining -= span;
+			handle->meta_bytes += span;
+			consumed += span;
+		}
+		if (handle->meta_active && handle->meta_remaining == 0) {
+			// block complete (an empty block means no change)
+			if (handle->meta_length > 0) {
+				icy_parse(handle);
+			}
+			handle->meta_active = false;
+			handle->meta_count++;
+			handle->audio_remaining = handle->metaint;
+		}
+	}
+	return consumed;
+}
+
+uint32_t icy_title(icy_handle_t handle, char *title, uint32_t size) {
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	strncpy(title, handle->title, size);
+	title[size - 1] = 0;
+	uint32_t count = handle->title_count;
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	return count;
+}
+
+void icy_reset(icy_handle_t handle, uint32_t metaint) {
+	ESP_LOGD(TAG, ">icy_reset %u", metaint);
+	handle->metaint = metaint;
+	handle->audio_remaining = metaint;
+	handle->meta_remaining = 0;
+	handle->meta_active = false;
+	handle->meta_length = 0;
+	handle->audio_bytes = 0;
+	handle->meta_bytes = 0;
+	handle->meta_count = 0;
+	icy_set_title(handle, "", 0);
+	ESP_LOGD(TAG, "<icy_reset");
+}
+
+void icy_begin(icy_config_t config, icy_handle_t *handle) {
+	ESP_LOGD(TAG, ">icy_begin");
+	ESP_LOGD(TAG, "metaint: %u", config.metaint);
+
+	icy_handle_t icy_handle = malloc(sizeof(struct icy_t));
+	assert(icy_handle != NULL);
+	memset(icy_handle, 0, sizeof(struct icy_t));
+	icy_handle->mutex = xSemaphoreCreateMutex();
+	assert(icy_handle->mutex != NULL);
+	icy_reset(icy_handle, config.metaint);
+
+	*handle = icy_handle;
+
+	ESP_LOGD(TAG, "<icy_begin");
+}
+
+void icy_end(icy_handle_t handle) {
+	ESP_LOGD(TAG, ">icy_end");
+	vSemaphoreDelete(handle->mutex);
+	handle->mutex = NULL;
+	free(handle);
+	ESP_LOGD(TAG, "<icy_end");
+}
@@ -5,9 +5,30 @@
 /**
  * @file
  * Ring buffer.
+ *
+ * The buffer occupies a region of the memory, several buffers can share
+ * one memory. Two buffers can swap their regions, the audio moves without
+ * being copied.
  */
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "spi_mem.h"
+#include "frame_index.h"
+
+/**
+ * What to do when a push does not fit (overflow) or a pull finds too little data (underrun).
+ */
+typedef enum buffer_policy_t {
+	/** Wait up to block_ms for room or data, then transfer what is possible. */
+	BUFFER_POLICY_BLOCK = 0,
+	/** Overflow only: drop the data pushed. */
+	BUFFER_POLICY_DROP_NEWEST,
+	/** Overflow only: discard the oldest data, up to a frame start when indexed. */
+	BUFFER_POLICY_DROP_OLDEST,
+	/** Transfer what is possible right away. */
+	BUFFER_POLICY_PARTIAL,
+} buffer_policy_t;
 
 /**
  * Even though this data is 'public'.
@@ -15,21 +36,49 @@
  */
 struct buffer_t {
 	spi_mem_handle_t spi_mem_handle;
+	/** Start of the region in the memory. */
+	uint32_t base;
 	uint32_t size;
 	uint32_t mask;
 	uint32_t read_addr;
 	uint32_t write_addr;
 	SemaphoreHandle_t mutex;
-	uint32_t push_bytes;
-	uint32_t pull_bytes;
-	uint32_t push_count;
-	uint32_t pull_count;
+	/** Counters only grow (64 bit does not wrap), except on reset. Read with buffer_get_counters. */
+	uint64_t push_bytes;
+	uint64_t pull_bytes;
+	uint64_t push_count;
+	uint64_t pull_count;
+	/** Audio frame boundaries, NULL when not indexed. */
+	frame_index_handle_t frame_index;
+	buffer_policy_t overflow_policy;
+	buffer_policy_t underrun_policy;
+	uint32_t block_ms;
+	/** Wakes up blocked pushes and pulls. */
+	EventGroupHandle_t events;
+	/** Number of pushes that did not fit and bytes dropped because of it. */
+	uint64_t overflow_count;
+	uint64_t overflow_bytes;
+	/** Number of pulls that found too little data and bytes missing. */
+	uint64_t underrun_count;
+	uint64_t underrun_bytes;
+	/** Number of transfers that had to wait. */
+	uint64_t block_count;
 };
 
 typedef struct buffer_config_t {
 	spi_mem_handle_t spi_mem_handle;
+	/** Start of the region in the memory, the buffer uses base up to base + size. */
+	uint32_t base;
 	/** buffer algorithm only works when size is a power of two. */
 	uint32_t size;
+	/** Number of audio frames indexed (power of two), 0 to disable the frame index. */
+	uint32_t frame_index_entries;
+	/** Policy when pushed data does not fit. */
+	buffer_policy_t overflow_policy;
+	/** Policy when there is not enough data to pull, BUFFER_POLICY_BLOCK or BUFFER_POLICY_PARTIAL. */
+	buffer_policy_t underrun_policy;
+	/** Longest wait of the blocking policy. */
+	uint32_t block_ms;
 } buffer_config_t;
 
 typedef struct buffer_t *buffer_handle_t;
@@ -57,20 +106,136 @@ uint32_t buffer_free(buffer_handle_t handle);
 
 /**
  * @brief Push a number of bytes into the buffer.
+ * When the data does not fit the overflow policy decides what is dropped.
  * @param handle  Buffer handle.
  * @param data Source of data.
  * @param length Number of bytes.
+ * @return Number of bytes pushed.
  */
-void buffer_push(buffer_handle_t handle, uint8_t *data, uint32_t length);
+uint32_t buffer_push(buffer_handle_t handle, uint8_t *data, uint32_t length);
 
 /**
  * @brief Pull a number of bytes from the buffer.
- *
+ * When there is not enough data the underrun policy decides how long to wait.
  * @param handle Buffer handle.
  * @param length Number of bytes.
  * @param data Target of data.
+ * @return Number of bytes pulled.
+ */
+uint32_t buffer_pull(buffer_handle_t handle, uint32_t length, uint8_t *data);
+
+/**
+ * @brief Play time of the audio in the buffer.
+ * Only frames found by the frame index are counted.
+ * @param handle Buffer handle.
+ * @return Milliseconds, 0 when there is no frame index.
+ */
+uint32_t buffer_duration_ms(buffer_handle_t handle);
+
+/**
+ * @brief Discard audio from the read side of the buffer.
+ * When a frame index exists, the discard is extended up to the start of the next frame.
+ * @param handle Buffer handle.
+ * @param length Minimum number of bytes to discard.
+ * @return Number of bytes discarded.
+ */
+uint32_t buffer_discard(buffer_handle_t handle, uint32_t length);
+
+/**
+ * @brief Skip to the first complete frame after the read address.
+ * Use when the data read so far did not decode.
+ * @param handle Buffer handle.
+ * @return Number of bytes skipped.
+ */
+uint32_t buffer_resync(buffer_handle_t handle);
+
+/**
+ * @brief Remove an incomplete frame from the write side of the buffer.
+ * Use to end the stream cleanly, for example on a station change.
+ * @param handle Buffer handle.
+ * @return Number of bytes removed.
+ */
+uint32_t buffer_cut(buffer_handle_t handle);
+
+/**
+ * @brief Exchange the audio of two buffers: region, size, content and frame index.
+ * Counters and policies stay with the buffer.
+ * The size changes with the region: a percentage of the size (flow watermarks)
+ * is a percentage of the other size afterwards.
+ * Cursors of both buffers continue at the write address or skip, as after a reset.
+ * @param handle Buffer handle.
+ * @param other Other buffer handle, in the same memory.
+ */
+void buffer_swap(buffer_handle_t handle, buffer_handle_t other);
+
+/**
+ * @brief Wait until length bytes can be pushed, without pushing.
+ * For producers that hold back instead of pushing into a full buffer.
+ * @param handle Buffer handle.
+ * @param length Number of bytes.
+ * @param wait_ms Longest wait.
+ * @return Number of bytes that can be pushed, less than length on timeout.
+ */
+uint32_t buffer_wait_free(buffer_handle_t handle, uint32_t length, uint32_t wait_ms);
+
+/**
+ * Read position of an extra reader, for example a relay listener.
+ * Cursors never hold back pushes: data already pulled stays readable until
+ * it is overwritten. A cursor that falls that far behind skips forward to a
+ * frame start, at the read address or halfway the buffer, whichever is newer.
+ */
+typedef struct buffer_cursor_t {
+	/** Buffer address of the next byte to read. */
+	uint32_t addr;
+	/** Number of bytes read. */
+	uint64_t read_bytes;
+	/** Number of times and bytes skipped because the data was overwritten. */
+	uint32_t skip_count;
+	uint64_t skip_bytes;
+} buffer_cursor_t;
+
+/**
+ * @brief Start a cursor at the first frame at or after the read address.
+ * @param handle Buffer handle.
+ * @param cursor Cursor to start.
+ */
+void buffer_cursor_begin(buffer_handle_t handle, buffer_cursor_t *cursor);
+
+/**
+ * @brief Read data at a cursor, up to what was pushed so far.
+ * Does not change what buffer_pull returns.
+ * @param handle Buffer handle.
+ * @param cursor Cursor, moved forward.
+ * @param length Maximum number of bytes.
+ * @param data Target of data.
+ * @param wait_ms Longest wait for data to be pushed, when there is none.
+ * @return Number of bytes read.
+ */
+uint32_t buffer_cursor_read(buffer_handle_t handle, buffer_cursor_t *cursor, uint32_t length, uint8_t *data,
+		uint32_t wait_ms);
+
+/**
+ * Consistent copy of the buffer counters.
+ */
+typedef struct buffer_counters_t {
+	uint64_t push_bytes;
+	uint64_t pull_bytes;
+	uint64_t push_count;
+	uint64_t pull_count;
+	uint64_t overflow_count;
+	uint64_t overflow_bytes;
+	uint64_t underrun_count;
+	uint64_t underrun_bytes;
+	uint64_t block_count;
+} buffer_counters_t;
+
+/**
+ * @brief Get the counters.
+ * 64 bit values are not read in one go, the copy is made under the buffer mutex.
+ * @param handle Buffer handle.
+ * @param counters Target of the counters.
  */
-void buffer_pull(buffer_handle_t handle, uint32_t length, uint8_t *data);
+void buffer_get_counters(buffer_handle_t handle, buffer_counters_t *counters);
 
 /**
  * @brief Begin buffer usage.
@@ -80,7 +245,7 @@ void buffer_pull(buffer_handle_t handle, uint32_t length, uint8_t *data);
 void buffer_begin(buffer_config_t config, buffer_handle_t *handle);
 
 /**
- * @brief End buffer usage.
+ * @brief End buffer usage, the memory is not ended.
  * @param handle Buffer handle.
  */
 void buffer_end(buffer_handle_t handle);
@@ -0,0 +1,85 @@
+// The author disclaims copyright to this source code.
+#ifndef _CHUNK_WRITER_H_
+#define _CHUNK_WRITER_H_
+
+/**
+ * @file
+ * Buffered response writer.
+ *
+ * Content is written into a small buffer that is handed to the output
+ * function whenever it is full, nothing is allocated. With chunked transfer
+ * encoding each buffer is sent as one chunk, the chunk framing is written
+ * into room reserved around the data (no extra copy). The last chunk is
+ * followed by the terminating zero length chunk.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Data bytes per output. */
+#define CHUNK_WRITER_BUFFER_LENGTH (256)
+/** Chunk size (4 hex digits, leading zeros allowed) CRLF */
+#define CHUNK_WRITER_HEADER_LENGTH (6)
+/** CRLF after the chunk data, and the last chunk 0 CRLF CRLF */
+#define CHUNK_WRITER_TRAILER_LENGTH (7)
+
+/**
+ * Output function.
+ * @param context Output context.
+ * @param data Data to write, only valid during the call.
+ * @param length Number of bytes.
+ * @param more True when more output follows.
+ * @return False on failure, further output is suppressed.
+ */
+typedef bool (*chunk_writer_output_t)(void *context, const char *data, uint32_t length, bool more);
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+typedef struct chunk_writer_t {
+	chunk_writer_output_t output;
+	void *context;
+	bool chunked;
+	bool failed;
+	/** Data bytes in the buffer. */
+	uint32_t length;
+	char buffer[CHUNK_WRITER_HEADER_LENGTH + CHUNK_WRITER_BUFFER_LENGTH + CHUNK_WRITER_TRAILER_LENGTH];
+} chunk_writer_t;
+
+/**
+ * @brief Start the content.
+ * @param writer Writer.
+ * @param chunked Use chunked transfer encoding.
+ * @param output Output function.
+ * @param context Output context.
+ */
+void chunk_writer_start(chunk_writer_t *writer, bool chunked, chunk_writer_output_t output, void *context);
+
+/**
+ * @brief Finish the content, output what is left.
+ * @param writer Writer.
+ * @return False when the output failed.
+ */
+bool chunk_writer_finish(chunk_writer_t *writer);
+
+void chunk_writer_put(chunk_writer_t *writer, char c);
+void chunk_writer_write(chunk_writer_t *writer, const char *data, uint32_t length);
+
+/**
+ * @brief Write a zero terminated string as is.
+ * @param writer Writer.
+ * @param text Text.
+ */
+void chunk_writer_text(chunk_writer_t *writer, const char *text);
+
+/**
+ * @brief Write a number in decimal.
+ * printf does not do 64 bit in every C library, and may allocate.
+ * @param writer Writer.
+ * @param value Number.
+ */
+void chunk_writer_uint(chunk_writer_t *writer, uint64_t value);
+void chunk_writer_int(chunk_writer_t *writer, int64_t value);
+
+#endif
@@ -0,0 +1,157 @@
+// The author disclaims copyright to this source code.
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+/**
+ * @file
+ * Player control commands, shared by the WebSocket and the HTTP interface.
+ *
+ * A command is a JSON object:
+ *     {"command":"volume","value":40}
+ *     {"command":"mute","value":true}
+ *     {"command":"select","value":2}
+ *     {"command":"next"}, {"command":"previous"}
+ *     {"command":"reset"} drops what is buffered, the player buffers again
+ * The text is tokenized in place (see json_reader.h), nothing is allocated.
+ * Other members are ignored.
+ *
+ * Every command carries the time it was received. The time until it took
+ * effect is measured: volume and mute when handed to the player (the player
+ * measures up to the decoder register write, see player.h), the others when
+ * executed. The result is answered as:
+ *     {"command":"volume","result":"ok"}
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "buffer.h"
+#include "favorites.h"
+#include "json_writer.h"
+
+/** Most tokens in a command. */
+#define CONTROL_MAX_TOKENS (16)
+
+typedef enum control_command_type_t {
+	CONTROL_VOLUME = 0,
+	CONTROL_MUTE,
+	CONTROL_SELECT,
+	CONTROL_NEXT,
+	CONTROL_PREVIOUS,
+	CONTROL_RESET,
+	CONTROL_COUNT,
+} control_command_type_t;
+
+typedef enum control_result_t {
+	CONTROL_OK = 0,
+	/** Not a JSON object with a command. */
+	CONTROL_MALFORMED,
+	/** Command not known. */
+	CONTROL_UNKNOWN,
+	/** Value missing or out of range. */
+	CONTROL_INVALID,
+	CONTROL_RESULT_COUNT,
+} control_result_t;
+
+typedef struct control_command_t {
+	control_command_type_t type;
+	/** Volume, mute (0 or 1) or favorite index. */
+	uint32_t value;
+	/** Time the command was received (esp_timer_get_time). */
+	int64_t received_us;
+} control_command_t;
+
+typedef struct control_config_t {
+	/** Stations to select. */
+	favorites_handle_t favorites_handle;
+	/** Buffer to reset. */
+	buffer_handle_t buffer_handle;
+} control_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct control_t {
+	favorites_handle_t favorites_handle;
+	buffer_handle_t buffer_handle;
+	/** Counters, only grow. */
+	uint32_t count[CONTROL_COUNT];
+	uint32_t error_count;
+	uint64_t latency_us[CONTROL_COUNT];
+	uint32_t latency_max_us[CONTROL_COUNT];
+	portMUX_TYPE mux;
+};
+
+typedef struct control_t *control_handle_t;
+
+typedef struct control_statistics_t {
+	/** Commands executed. */
+	uint32_t count[CONTROL_COUNT];
+	/** Commands refused. */
+	uint32_t error_count;
+	/** Time from receiving to executing, total and longest. */
+	uint64_t latency_us[CONTROL_COUNT];
+	uint32_t latency_max_us[CONTROL_COUNT];
+} control_statistics_t;
+
+/**
+ * @brief Begin using the control.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void control_begin(control_config_t config, control_handle_t *handle);
+
+/**
+ * @brief End using the control.
+ * @param handle Component handle.
+ */
+void control_end(control_handle_t handle);
+
+/**
+ * @brief Parse a command.
+ * @param json Command text, not terminated.
+ * @param length Text length.
+ * @param received_us Time the command was received.
+ * @param command Target of the command.
+ * @return CONTROL_OK when it is a command, the value is not checked yet.
+ */
+control_result_t control_parse(const char *json, uint32_t length, int64_t received_us, control_command_t *command);
+
+/**
+ * @brief Execute a command.
+ * @param handle Component handle.
+ * @param command Parsed command.
+ * @return CONTROL_OK, or CONTROL_INVALID when the value is out of range.
+ */
+control_result_t control_execute(control_handle_t handle, const control_command_t *command);
+
+/**
+ * @brief Write the answer to a command.
+ * @param writer Writer.
+ * @param command Command, NULL when it was not understood.
+ * @param result Result.
+ */
+void control_write_result(json_writer_t *writer, const control_command_t *command, control_result_t result);
+
+/**
+ * @brief Count a command that was refused before it was executed.
+ * @param handle Component handle.
+ */
+void control_refused(control_handle_t handle);
+
+/**
+ * @brief Get the statistics.
+ * @param handle Component handle.
+ * @param statistics Target of the statistics.
+ */
+void control_get_statistics(control_handle_t handle, control_statistics_t *statistics);
+
+/**
+ * @brief Name of a command.
+ * @param type Command.
+ * @return Name.
+ */
+const char *control_command_name(control_command_type_t type);
+
+#endif
@@ -0,0 +1,144 @@
+// The author disclaims copyright to this source code.
+#ifndef _DNS_CACHE_H_
+#define _DNS_CACHE_H_
+
+/**
+ * @file
+ * Host name cache of the favorite stations.
+ *
+ * Addresses are resolved with a query of our own, to learn the time to
+ * live (TTL) lwIP does not tell. A background task refreshes an address
+ * before it expires, a connect finds it ready. An expired address is still
+ * used when the refresh failed, until a connect to it fails.
+ *
+ * The last good address per favorite is kept in NVS: after startup the
+ * first connect does not wait for the name server (warm-up) while the
+ * task refreshes the address. An address is written only when it changed.
+ *
+ * Hosts that are no favorite are resolved by lwIP (with its own cache).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/api.h"
+#include "favorites.h"
+
+/** Including terminating zero. */
+#define DNS_CACHE_HOST_MAX_LENGTH (FAVORITES_URL_MAX_LENGTH)
+
+typedef struct dns_cache_config_t {
+	/** Hosts to cache, one entry per favorite. */
+	favorites_handle_t favorites_handle;
+	/** Keep the last good addresses in NVS. */
+	bool persist;
+} dns_cache_config_t;
+
+typedef struct dns_cache_entry_t {
+	char host[DNS_CACHE_HOST_MAX_LENGTH];
+	ip_addr_t addr;
+	/** An address is known (resolved, or loaded from NVS). */
+	bool valid;
+	/** Time the address expires, 0 when loaded from NVS (expired). */
+	int64_t expire_us;
+	/** Time to live of the address. */
+	uint32_t ttl_s;
+	/** Time of the next refresh, before the address expires or after a failed query. */
+	int64_t refresh_us;
+} dns_cache_entry_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct dns_cache_t {
+	favorites_handle_t favorites_handle;
+	bool persist;
+	dns_cache_entry_t entries[FAVORITES_MAX_COUNT];
+	uint32_t count;
+	/** Protects the entries, never held during a query. */
+	SemaphoreHandle_t mutex;
+	/** Counters, only grow. */
+	uint32_t hit_count;
+	uint32_t stale_count;
+	uint32_t miss_count;
+	uint32_t query_count;
+	uint32_t error_count;
+	uint32_t persist_count;
+	portMUX_TYPE mux;
+};
+
+typedef struct dns_cache_t *dns_cache_handle_t;
+
+typedef struct dns_cache_statistics_t {
+	/** Resolved from the cache, still valid. */
+	uint32_t hit_count;
+	/** Resolved from the cache, expired (or loaded from NVS). */
+	uint32_t stale_count;
+	/** Had to wait for the name server. */
+	uint32_t miss_count;
+	/** Queries sent, and queries without an address. */
+	uint32_t query_count;
+	uint32_t error_count;
+	/** Addresses written to NVS. */
+	uint32_t persist_count;
+} dns_cache_statistics_t;
+
+/**
+ * @brief Begin using the cache, the last good addresses are loaded from NVS.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void dns_cache_begin(dns_cache_config_t config, dns_cache_handle_t *handle);
+
+/**
+ * @brief End using the cache, after the task stopped.
+ * @param handle Component handle.
+ */
+void dns_cache_end(dns_cache_handle_t handle);
+
+/**
+ * @brief Resolve a host name.
+ * @param handle Component handle, NULL to resolve by lwIP only.
+ * @param host Host name or address.
+ * @param addr Target of the address.
+ * @param cached Set when the address came from the cache, without waiting.
+ * @return False when the host is unknown.
+ */
+bool dns_cache_resolve(dns_cache_handle_t handle, const char *host, ip_addr_t *addr, bool *cached);
+
+/**
+ * @brief Forget the cached address, a connect to it failed.
+ * The next resolve waits for the name server.
+ * @param handle Component handle, may be NULL.
+ * @param host Host name.
+ */
+void dns_cache_invalidate(dns_cache_handle_t handle, const char *host);
+
+/**
+ * @brief Find the address in a name server response.
+ * @param data Response.
+ * @param length Number of bytes.
+ * @param host Host name queried, the response repeats it as its only question.
+ * @param id Identification of the query.
+ * @param address Target of the IPv4 address, network order.
+ * @param ttl_s Target of the time to live, the lowest along the answers used.
+ * @return False when the response has no address, or answers another question.
+ */
+bool dns_cache_parse(const uint8_t *data, uint32_t length, const char *host, uint16_t id, uint8_t address[4],
+		uint32_t *ttl_s);
+
+/**
+ * @brief Get the statistics.
+ * @param handle Component handle.
+ * @param statistics Target of the statistics.
+ */
+void dns_cache_get_statistics(dns_cache_handle_t handle, dns_cache_statistics_t *statistics);
+
+/**
+ * FreeRTOS DNS cache task, refreshes the addresses. The parameter is the handle.
+ */
+void dns_cache_task(void *pvParameters);
+
+#endif
@@ -0,0 +1,95 @@
+// The author disclaims copyright to this source code.
+#ifndef _FAVORITES_H_
+#define _FAVORITES_H_
+
+/**
+ * @file
+ * Favorite radio stations.
+ *
+ * The list is fixed at startup. One favorite is selected to play, the
+ * reader follows the selection. Every selection is counted, selecting the
+ * same favorite again restarts it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+#define FAVORITES_MAX_COUNT (8)
+/** Including terminating zero. */
+#define FAVORITES_NAME_MAX_LENGTH (32)
+/** Including terminating zero. */
+#define FAVORITES_URL_MAX_LENGTH (256)
+
+typedef struct favorite_t {
+	char name[FAVORITES_NAME_MAX_LENGTH];
+	char url[FAVORITES_URL_MAX_LENGTH];
+} favorite_t;
+
+typedef struct favorites_config_t {
+	/** First favorite, stream URL. */
+	const char *url;
+	/** More favorites: name|url;name|url, may be empty. */
+	const char *list;
+} favorites_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct favorites_t {
+	favorite_t entries[FAVORITES_MAX_COUNT];
+	uint32_t count;
+	uint32_t selected;
+	uint32_t select_count;
+	portMUX_TYPE mux;
+};
+
+typedef struct favorites_t *favorites_handle_t;
+
+/**
+ * @brief Begin using the favorites.
+ * The first favorite is selected.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void favorites_begin(favorites_config_t config, favorites_handle_t *handle);
+
+/**
+ * @brief End using the favorites.
+ * @param handle Component handle.
+ */
+void favorites_end(favorites_handle_t handle);
+
+/**
+ * @brief Number of favorites.
+ * @param handle Component handle.
+ * @return Number of favorites.
+ */
+uint32_t favorites_count(favorites_handle_t handle);
+
+/**
+ * @brief Get a favorite, the list does not change.
+ * @param handle Component handle.
+ * @param index Favorite index.
+ * @return Favorite, NULL when out of range.
+ */
+const favorite_t *favorites_get(favorites_handle_t handle, uint32_t index);
+
+/**
+ * @brief Select the favorite to play.
+ * @param handle Component handle.
+ * @param index Favorite index.
+ * @return False when out of range.
+ */
+bool favorites_select(favorites_handle_t handle, uint32_t index);
+
+/**
+ * @brief Selected favorite.
+ * @param handle Component handle.
+ * @param select_count Number of selections so far, may be NULL.
+ * @return Favorite index.
+ */
+uint32_t favorites_selected(favorites_handle_t handle, uint32_t *select_count);
+
+#endif
@@ -0,0 +1,91 @@
+// The author disclaims copyright to this source code.
+#ifndef _FLOW_H_
+#define _FLOW_H_
+
+/**
+ * @file
+ * Flow control from the network into the buffer.
+ *
+ * Above the high watermark the receiver stops calling netconn_recv. The
+ * data stays in lwIP, unacknowledged by the application, and the TCP
+ * receive window closes: the server stops sending. Below the low watermark
+ * receiving resumes and the window opens again. Between the watermarks the
+ * state does not change (hysteresis), so the window opens in large steps.
+ *
+ * Leave room for a full TCP window above the high watermark: what was
+ * received is always pushed at once and its pbufs are freed right away.
+ *
+ * Watermarks are a percentage of the buffer size, they follow the buffer
+ * when its region is swapped.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "buffer.h"
+
+typedef struct flow_config_t {
+	buffer_handle_t buffer_handle;
+	/** Stop receiving at this buffer level (percentage of the size). */
+	uint32_t high_percent;
+	/** Resume receiving at this buffer level (percentage of the size), below the high watermark. */
+	uint32_t low_percent;
+} flow_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct flow_t {
+	buffer_handle_t buffer_handle;
+	uint32_t high_percent;
+	uint32_t low_percent;
+	/** Receiving stopped since throttle_us. */
+	bool throttled;
+	int64_t throttle_us;
+	/** Counters, only grow. */
+	uint32_t throttle_count;
+	uint64_t throttled_us;
+	portMUX_TYPE mux;
+};
+
+typedef struct flow_t *flow_handle_t;
+
+typedef struct flow_statistics_t {
+	bool throttled;
+	/** Times receiving stopped. */
+	uint32_t throttle_count;
+	/** Time receiving was stopped, including the current stop. */
+	uint64_t throttled_us;
+} flow_statistics_t;
+
+/**
+ * @brief Begin using flow control.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void flow_begin(flow_config_t config, flow_handle_t *handle);
+
+/**
+ * @brief End using flow control.
+ * @param handle Component handle.
+ */
+void flow_end(flow_handle_t handle);
+
+/**
+ * @brief Check before receiving, wait while receiving is stopped.
+ * Call from the receiving task only.
+ * @param handle Component handle.
+ * @param wait_ms Longest wait, to check for other work in between.
+ * @return True to receive, false when still stopped after waiting.
+ */
+bool flow_wait(flow_handle_t handle, uint32_t wait_ms);
+
+/**
+ * @brief Get the statistics.
+ * @param handle Component handle.
+ * @param statistics Target of the statistics.
+ */
+void flow_get_statistics(flow_handle_t handle, flow_statistics_t *statistics);
+
+#endif
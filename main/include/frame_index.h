@@ -0,0 +1,136 @@
+// The author disclaims copyright to this source code.
+#ifndef _FRAME_INDEX_H_
+#define _FRAME_INDEX_H_
+
+/**
+ * @file
+ * Audio frame boundary index.
+ *
+ * Parses the audio stream while it is pushed into the ring buffer and remembers
+ * where each frame starts and how long it plays. Supported frame headers:
+ *
+ * - MPEG audio (layer I, II, III; MPEG 1, 2 and 2.5), 11-bit sync 0xFFE.
+ * - AAC ADTS, 12-bit sync 0xFFF and layer 0.
+ *
+ * A frame is accepted when its header is valid. The next header is expected
+ * exactly one frame length further. When it is not found the sync is lost,
+ * the last frame is considered corrupt and removed, and the parser searches
+ * byte by byte for the next valid header.
+ *
+ * The index only holds frames that start at or after the read address. When
+ * the index is full the oldest frames are forgotten.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Longest frame header (ADTS), MPEG audio needs 4 bytes. */
+#define FRAME_INDEX_HEADER_MAX_LENGTH (7)
+
+typedef struct frame_index_entry_t {
+	/** Buffer address of the first byte of the frame header. */
+	uint32_t addr;
+	/** Play time of the frame. */
+	uint32_t duration_us;
+} frame_index_entry_t;
+
+typedef struct frame_index_config_t {
+	/** Number of index entries, must be a power of two. */
+	uint32_t entries;
+} frame_index_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct frame_index_t {
+	frame_index_entry_t *entries;
+	uint32_t mask;
+	/** Oldest entry. */
+	uint32_t head;
+	/** Next entry to write. */
+	uint32_t tail;
+	/** Sum of the duration of all indexed frames. */
+	uint64_t duration_us;
+	/** Bytes to skip to reach the next frame header. */
+	uint32_t skip;
+	/** Header bytes collected so far. */
+	uint8_t header[FRAME_INDEX_HEADER_MAX_LENGTH];
+	uint32_t header_length;
+	/** Buffer address of header[0]. */
+	uint32_t header_addr;
+	bool synced;
+	/** Number of times sync was lost. */
+	uint32_t sync_lost_count;
+	/** Number of frames indexed. */
+	uint32_t frame_count;
+	/** Number of frames forgotten because the index was full. */
+	uint32_t overflow_count;
+	/** Characteristics of the last frame found. */
+	uint32_t bitrate;
+	uint32_t sample_rate;
+};
+
+typedef struct frame_index_t *frame_index_handle_t;
+
+/**
+ * @brief Begin using the frame index.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void frame_index_begin(frame_index_config_t config, frame_index_handle_t *handle);
+
+/**
+ * @brief End using the frame index.
+ * @param handle Component handle.
+ */
+void frame_index_end(frame_index_handle_t handle);
+
+/**
+ * @brief Forget all frames and search for sync.
+ * @param handle Component handle.
+ */
+void frame_index_reset(frame_index_handle_t handle);
+
+/**
+ * @brief Parse data written into the buffer.
+ * @param handle Component handle.
+ * @param addr Buffer address of the first byte.
+ * @param data Data written.
+ * @param length Number of bytes.
+ */
+void frame_index_parse(frame_index_handle_t handle, uint32_t addr, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief Forget frames that start before the read address.
+ * @param handle Component handle.
+ * @param read_addr Buffer read address.
+ */
+void frame_index_consume(frame_index_handle_t handle, uint32_t read_addr);
+
+/**
+ * @brief Find the first frame that starts at or after an address.
+ * @param handle Component handle.
+ * @param addr Buffer address.
+ * @param frame_addr Frame start found.
+ * @return True when found.
+ */
+bool frame_index_find(frame_index_handle_t handle, uint32_t addr, uint32_t *frame_addr);
+
+/**
+ * @brief Remove the last frame when it is not completely written yet.
+ * Parsing restarts with a search for sync.
+ * @param handle Component handle.
+ * @param frame_addr Start of the removed frame.
+ * @return True when a frame was removed.
+ */
+bool frame_index_cut(frame_index_handle_t handle, uint32_t *frame_addr);
+
+/**
+ * @brief Number of frames indexed.
+ * @param handle Component handle.
+ * @return Number of frames.
+ */
+uint32_t frame_index_count(frame_index_handle_t handle);
+
+#endif
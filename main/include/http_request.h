@@ -0,0 +1,106 @@
+// The author disclaims copyright to this source code.
+#ifndef _HTTP_REQUEST_H_
+#define _HTTP_REQUEST_H_
+
+/**
+ * @file
+ * Incremental HTTP request parser.
+ *
+ * Data is fed as it arrives, the request may be split anywhere. Parsing
+ * stops at the end of a request, the remaining data belongs to the next
+ * (pipelined) request. Only the fields the web server needs are kept.
+ * Header lines that are too long are ignored, a request line that is too
+ * long is an error. The start of a request body is kept, the rest is
+ * skipped.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Longest request line or header line kept, including terminating zero. */
+#define HTTP_REQUEST_LINE_MAX_LENGTH (256)
+#define HTTP_REQUEST_METHOD_MAX_LENGTH (8)
+#define HTTP_REQUEST_PATH_MAX_LENGTH (128)
+#define HTTP_REQUEST_QUERY_MAX_LENGTH (64)
+#define HTTP_REQUEST_IF_NONE_MATCH_MAX_LENGTH (64)
+/** Longest request body kept, including terminating zero. */
+#define HTTP_REQUEST_BODY_MAX_LENGTH (128)
+
+typedef enum http_request_result_t {
+	/** More data needed. */
+	HTTP_REQUEST_INCOMPLETE = 0,
+	/** Request complete, fields are valid. */
+	HTTP_REQUEST_COMPLETE,
+	/** Malformed request, the connection can not be used anymore. */
+	HTTP_REQUEST_ERROR,
+} http_request_result_t;
+
+typedef enum http_request_state_t {
+	HTTP_REQUEST_STATE_REQUEST_LINE = 0,
+	HTTP_REQUEST_STATE_HEADER,
+	HTTP_REQUEST_STATE_BODY,
+	HTTP_REQUEST_STATE_COMPLETE,
+} http_request_state_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+typedef struct http_request_t {
+	http_request_state_t state;
+	/** Line being collected. */
+	char line[HTTP_REQUEST_LINE_MAX_LENGTH];
+	uint32_t line_length;
+	/** Line did not fit. */
+	bool line_overflow;
+	/** Body bytes still to receive. */
+	uint32_t body_remaining;
+	char method[HTTP_REQUEST_METHOD_MAX_LENGTH];
+	/** Request-URI, without the query. */
+	char path[HTTP_REQUEST_PATH_MAX_LENGTH];
+	/** Query without '?', empty when absent. */
+	char query[HTTP_REQUEST_QUERY_MAX_LENGTH];
+	/** HTTP/1.x */
+	uint8_t version_minor;
+	/** Connection persists after the response. */
+	bool keep_alive;
+	uint32_t content_length;
+	/** Accept-Encoding includes gzip. */
+	bool accept_gzip;
+	/** If-None-Match entity tags, empty when absent. */
+	char if_none_match[HTTP_REQUEST_IF_NONE_MATCH_MAX_LENGTH];
+	/** Start of the body, terminated. */
+	char body[HTTP_REQUEST_BODY_MAX_LENGTH];
+	uint32_t body_length;
+	/** Body did not fit. */
+	bool body_overflow;
+} http_request_t;
+
+/**
+ * @brief Prepare for the next request.
+ * @param request Request.
+ */
+void http_request_reset(http_request_t *request);
+
+/**
+ * @brief Parse received data.
+ * @param request Request.
+ * @param data Received data.
+ * @param length Number of bytes.
+ * @param result Parse result.
+ * @return Number of bytes consumed, less than length when the request completed early.
+ */
+uint32_t http_request_parse(http_request_t *request, const uint8_t *data, uint32_t length,
+		http_request_result_t *result);
+
+/**
+ * @brief Find a parameter in the query (name=value&name=value), the value is not decoded.
+ * @param request Complete request.
+ * @param name Parameter name.
+ * @param value Target of the value.
+ * @param size Size of the target, including terminating zero.
+ * @return False when absent or too long.
+ */
+bool http_request_query_value(const http_request_t *request, const char *name, char *value, uint32_t size);
+
+#endif
@@ -0,0 +1,105 @@
+// The author disclaims copyright to this source code.
+#ifndef _ICY_H_
+#define _ICY_H_
+
+/**
+ * @file
+ * Shoutcast/Icecast (ICY) in-stream metadata demultiplexer.
+ *
+ * When a client asks for metadata (request header 'Icy-MetaData: 1') the server
+ * interleaves a metadata block after every 'icy-metaint' bytes of audio.
+ * A metadata block starts with one length byte (block length divided by 16),
+ * followed by the text, padded with zeros:
+ *
+ *      StreamTitle='Artist - Title';StreamUrl='';
+ *
+ * The demultiplexer does not copy audio. It returns the audio parts as spans
+ * into the data offered, which may be cut at arbitrary places (netbuf boundaries).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/** Metadata kept for parsing, longer blocks are truncated (maximum on the wire is 255*16). */
+#define ICY_META_MAX_LENGTH (512)
+/** Maximum stream title length, including terminating zero. */
+#define ICY_TITLE_MAX_LENGTH (128)
+
+typedef struct icy_config_t {
+	/** Number of audio bytes between metadata blocks. Use 0 for a stream without metadata. */
+	uint32_t metaint;
+} icy_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct icy_t {
+	uint32_t metaint;
+	/** Audio bytes left before the next metadata block. */
+	uint32_t audio_remaining;
+	/** Metadata bytes left in the current block. */
+	uint32_t meta_remaining;
+	/** Inside a metadata block (length byte consumed). */
+	bool meta_active;
+	/** Metadata bytes collected for parsing. */
+	uint32_t meta_length;
+	char meta[ICY_META_MAX_LENGTH + 1];
+	/** Protects the title, it is read by other tasks. */
+	SemaphoreHandle_t mutex;
+	char title[ICY_TITLE_MAX_LENGTH];
+	/** Incremented on every title change. */
+	uint32_t title_count;
+	uint32_t audio_bytes;
+	uint32_t meta_bytes;
+	uint32_t meta_count;
+};
+
+typedef struct icy_t *icy_handle_t;
+
+/**
+ * @brief Begin using the demultiplexer.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void icy_begin(icy_config_t config, icy_handle_t *handle);
+
+/**
+ * @brief End using the demultiplexer.
+ * @param handle Component handle.
+ */
+void icy_end(icy_handle_t handle);
+
+/**
+ * @brief Restart demultiplexing, for a new stream.
+ * The stream title is cleared.
+ * @param handle Component handle.
+ * @param metaint Number of audio bytes between metadata blocks, 0 when none.
+ */
+void icy_reset(icy_handle_t handle, uint32_t metaint);
+
+/**
+ * @brief Consume stream data, up to and including the next span of audio.
+ * Metadata at the start of the data is consumed and parsed.
+ * Call repeatedly until all data is consumed.
+ * @param handle Component handle.
+ * @param data Stream data.
+ * @param length Number of stream bytes.
+ * @param audio Start of audio found, points into data.
+ * @param audio_length Number of audio bytes found, can be 0.
+ * @return Number of stream bytes consumed.
+ */
+uint32_t icy_demux(icy_handle_t handle, uint8_t *data, uint32_t length, uint8_t **audio, uint32_t *audio_length);
+
+/**
+ * @brief Copy the current stream title.
+ * @param handle Component handle.
+ * @param title Target for the zero terminated title.
+ * @param size Size of the target.
+ * @return The title change count, to detect changes.
+ */
+uint32_t icy_title(icy_handle_t handle, char *title, uint32_t size);
+
+#endif
@@ -0,0 +1,111 @@
+// The author disclaims copyright to this source code.
+#ifndef _JITTER_H_
+#define _JITTER_H_
+
+/**
+ * @file
+ * Adaptive jitter buffer target.
+ *
+ * Decides how much audio (play time) to buffer before playing starts or
+ * resumes. While data arrives at the stream rate, a gap in the arrivals
+ * drains the buffer by the length of the gap. The target therefore covers:
+ *
+ * - The largest recent arrival gap (peak), which slowly decays.
+ * - The mean gap plus four times its mean deviation, both running averages.
+ * - A boost for every underrun the player reports, which slowly decays
+ *   when no underrun happens for a while.
+ *
+ * The target stays within the configured bounds. Changes are logged with
+ * their cause.
+ */
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+typedef struct jitter_config_t {
+	/** Lower bound of the target. */
+	uint32_t min_ms;
+	/** Upper bound of the target, typically what fits in the buffer. */
+	uint32_t max_ms;
+	/** Target extension per underrun. */
+	uint32_t underrun_ms;
+} jitter_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct jitter_t {
+	uint32_t min_ms;
+	uint32_t max_ms;
+	uint32_t underrun_ms;
+	SemaphoreHandle_t mutex;
+	/** Time of the last arrival, 0 before the first. */
+	int64_t arrival_us;
+	/** Running average of the arrival gap. */
+	uint32_t gap_us;
+	/** Running average of the deviation from the average gap. */
+	uint32_t deviation_us;
+	/** Largest recent gap. */
+	uint32_t peak_us;
+	/** Extension because of underruns. */
+	uint32_t boost_us;
+	int64_t underrun_us;
+	uint32_t arrival_count;
+	uint32_t underrun_count;
+	uint32_t target_ms;
+	/** Target as last logged. */
+	uint32_t logged_ms;
+};
+
+typedef struct jitter_t *jitter_handle_t;
+
+/**
+ * @brief Begin using the jitter buffer target.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void jitter_begin(jitter_config_t config, jitter_handle_t *handle);
+
+/**
+ * @brief End using the jitter buffer target.
+ * @param handle Component handle.
+ */
+void jitter_end(jitter_handle_t handle);
+
+/**
+ * @brief Forget the history, the target returns to the lower bound.
+ * @param handle Component handle.
+ */
+void jitter_reset(jitter_handle_t handle);
+
+/**
+ * @brief Report arrival of stream data.
+ * @param handle Component handle.
+ * @param now_us Time of arrival (esp_timer_get_time).
+ */
+void jitter_arrival(jitter_handle_t handle, int64_t now_us);
+
+/**
+ * @brief Report that the receiver held back on purpose (flow control).
+ * The gap until the next arrival says nothing about the network and is not measured.
+ * @param handle Component handle.
+ */
+void jitter_pause(jitter_handle_t handle);
+
+/**
+ * @brief Report that the player ran out of data.
+ * @param handle Component handle.
+ * @param now_us Time of the underrun (esp_timer_get_time).
+ */
+void jitter_underrun(jitter_handle_t handle, int64_t now_us);
+
+/**
+ * @brief Current target.
+ * @param handle Component handle.
+ * @return Play time to buffer before playing.
+ */
+uint32_t jitter_target_ms(jitter_handle_t handle);
+
+#endif
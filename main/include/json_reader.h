@@ -0,0 +1,101 @@
+// The author disclaims copyright to this source code.
+#ifndef _JSON_READER_H_
+#define _JSON_READER_H_
+
+/**
+ * @file
+ * In place JSON tokenizer.
+ *
+ * The document is split into tokens that point into the text, nothing is
+ * copied or allocated, the caller provides room for the tokens. Strings are
+ * checked but not unescaped, compare them with json_reader_equals. Each
+ * token knows where its descendants end, so a value is skipped without
+ * looking at it.
+ *
+ *     {"command":"volume","value":40}
+ *     0 object, size 2
+ *     1 string command
+ *     2 string volume
+ *     3 string value
+ *     4 number 40
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Deepest nesting of objects and arrays. */
+#define JSON_READER_MAX_DEPTH (8)
+
+/** Parse errors. */
+#define JSON_READER_MALFORMED (-1)
+#define JSON_READER_TOO_MANY_TOKENS (-2)
+#define JSON_READER_TOO_DEEP (-3)
+
+typedef enum json_token_type_t {
+	JSON_TOKEN_OBJECT = 0,
+	JSON_TOKEN_ARRAY,
+	JSON_TOKEN_STRING,
+	JSON_TOKEN_NUMBER,
+	JSON_TOKEN_TRUE,
+	JSON_TOKEN_FALSE,
+	JSON_TOKEN_NULL,
+} json_token_type_t;
+
+typedef struct json_token_t {
+	json_token_type_t type;
+	/** Text of the token in the document, strings without the quotes. */
+	uint32_t start;
+	uint32_t length;
+	/** Members of an object (key and value pairs), elements of an array. */
+	uint32_t size;
+	/** Index of the token after this one and its descendants. */
+	uint32_t next;
+} json_token_t;
+
+/**
+ * @brief Tokenize a document.
+ * @param json Document, not terminated.
+ * @param length Document length.
+ * @param tokens Target of the tokens, the document is the first.
+ * @param count Number of tokens available.
+ * @return Number of tokens, or a JSON_READER_* error.
+ */
+int32_t json_reader_parse(const char *json, uint32_t length, json_token_t *tokens, uint32_t count);
+
+/**
+ * @brief Compare a token with a text, strings without unescaping.
+ * @param json Document.
+ * @param token Token.
+ * @param text Terminated text.
+ * @return True when equal.
+ */
+bool json_reader_equals(const char *json, const json_token_t *token, const char *text);
+
+/**
+ * @brief Find the value of an object member.
+ * @param json Document.
+ * @param tokens Tokens.
+ * @param object Index of the object token.
+ * @param key Member name.
+ * @return Index of the value token, -1 when absent.
+ */
+int32_t json_reader_member(const char *json, const json_token_t *tokens, uint32_t object, const char *key);
+
+/**
+ * @brief Value of a number token that is a whole, non-negative and 32 bit.
+ * @param json Document.
+ * @param token Token.
+ * @param value Target of the value.
+ * @return False when it is not.
+ */
+bool json_reader_uint(const char *json, const json_token_t *token, uint32_t *value);
+
+/**
+ * @brief Value of a true or false token.
+ * @param token Token.
+ * @param value Target of the value.
+ * @return False when it is neither.
+ */
+bool json_reader_bool(const json_token_t *token, bool *value);
+
+#endif
@@ -0,0 +1,78 @@
+// The author disclaims copyright to this source code.
+#ifndef _JSON_WRITER_H_
+#define _JSON_WRITER_H_
+
+/**
+ * @file
+ * Streaming JSON writer.
+ *
+ * The document is written through a chunk writer, nothing is allocated
+ * (see chunk_writer.h for the output and the chunked transfer encoding).
+ *
+ * Commas and nesting are tracked by the writer, the caller only writes keys
+ * and values. Keys are NULL inside arrays and at the top level.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chunk_writer.h"
+
+/** Deepest nesting of objects and arrays. */
+#define JSON_WRITER_MAX_DEPTH (32)
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+typedef struct json_writer_t {
+	chunk_writer_t chunk_writer;
+	/** Current nesting level. */
+	uint32_t depth;
+	/** Bit per level, a value was written at that level (a comma is needed). */
+	uint32_t values;
+} json_writer_t;
+
+/**
+ * @brief Start a document.
+ * @param writer Writer.
+ * @param chunked Use chunked transfer encoding.
+ * @param output Output function.
+ * @param context Output context.
+ */
+void json_writer_start(json_writer_t *writer, bool chunked, chunk_writer_output_t output, void *context);
+
+/**
+ * @brief Finish the document, output what is left.
+ * @param writer Writer.
+ * @return False when the output failed.
+ */
+bool json_writer_finish(json_writer_t *writer);
+
+/**
+ * @brief Start an object.
+ * @param writer Writer.
+ * @param key Member name, NULL when not in an object.
+ */
+void json_writer_object_start(json_writer_t *writer, const char *key);
+void json_writer_object_end(json_writer_t *writer);
+
+/**
+ * @brief Start an array.
+ * @param writer Writer.
+ * @param key Member name, NULL when not in an object.
+ */
+void json_writer_array_start(json_writer_t *writer, const char *key);
+void json_writer_array_end(json_writer_t *writer);
+
+/**
+ * @brief Write a string, escaped as needed.
+ * @param writer Writer.
+ * @param key Member name, NULL when not in an object.
+ * @param value Zero terminated string (UTF-8).
+ */
+void json_writer_string(json_writer_t *writer, const char *key, const char *value);
+void json_writer_uint(json_writer_t *writer, const char *key, uint64_t value);
+void json_writer_int(json_writer_t *writer, const char *key, int64_t value);
+void json_writer_bool(json_writer_t *writer, const char *key, bool value);
+
+#endif
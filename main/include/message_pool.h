@@ -0,0 +1,74 @@
+// The author disclaims copyright to this source code.
+#ifndef _MESSAGE_POOL_H_
+#define _MESSAGE_POOL_H_
+
+/**
+ * @file
+ * Fixed pool of equally sized message buffers.
+ *
+ * All buffers are allocated once, when the pool begins. Taking and giving a
+ * buffer passes a pointer through a FreeRTOS queue and never touches the
+ * heap, so messages can be passed between tasks without malloc and free.
+ */
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+typedef struct message_pool_config_t {
+	/** Number of buffers. */
+	uint32_t count;
+	/** Bytes in each buffer. */
+	uint32_t size;
+} message_pool_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct message_pool_t {
+	uint32_t count;
+	uint32_t size;
+	/** One allocation for all buffers. */
+	uint8_t *buffers;
+	/** Buffers not taken. */
+	QueueHandle_t free_queue;
+};
+
+typedef struct message_pool_t *message_pool_handle_t;
+
+/**
+ * @brief Begin using the pool, allocates all buffers.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void message_pool_begin(message_pool_config_t config, message_pool_handle_t *handle);
+
+/**
+ * @brief End using the pool, every buffer must have been given back.
+ * @param handle Component handle.
+ */
+void message_pool_end(message_pool_handle_t handle);
+
+/**
+ * @brief Take a buffer.
+ * @param handle Component handle.
+ * @param wait_ms Time to wait for a buffer to be given back.
+ * @return Buffer of size bytes, NULL when none is available in time.
+ */
+uint8_t *message_pool_take(message_pool_handle_t handle, uint32_t wait_ms);
+
+/**
+ * @brief Give a buffer back.
+ * @param handle Component handle.
+ * @param buffer Buffer taken from this pool.
+ */
+void message_pool_give(message_pool_handle_t handle, uint8_t *buffer);
+
+/**
+ * @brief Number of buffers available.
+ * @param handle Component handle.
+ */
+uint32_t message_pool_available(message_pool_handle_t handle);
+
+#endif
@@ -0,0 +1,95 @@
+// The author disclaims copyright to this source code.
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+/**
+ * @file
+ * Metrics in Prometheus text format, for central monitoring.
+ * https://prometheus.io/docs/instrumenting/exposition_formats/
+ *
+ * Counters are 64 bit and only grow (a restart resets them). Each source is
+ * copied under its own lock, which is held only for the copy. Rendering
+ * allocates nothing and is cheap enough to scrape every few seconds.
+ */
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "chunk_writer.h"
+#include "buffer.h"
+#include "vs1053.h"
+#include "jitter.h"
+#include "relay.h"
+#include "control.h"
+#include "prefetch.h"
+#include "flow.h"
+#include "dns_cache.h"
+
+/** Tasks watched for their stack usage. */
+#define METRICS_MAX_TASKS (16)
+
+typedef struct metrics_config_t {
+	buffer_handle_t buffer_handle;
+	vs1053_handle_t vs1053_handle;
+	/** Adaptive player target, NULL when not used. */
+	jitter_handle_t jitter_handle;
+	/** Audio relay, NULL when not used. */
+	relay_handle_t relay_handle;
+	/** Player control, NULL when not used. */
+	control_handle_t control_handle;
+	/** Prefetcher, NULL when not used. */
+	prefetch_handle_t prefetch_handle;
+	/** Reader flow control, NULL when not used. */
+	flow_handle_t flow_handle;
+	/** Host name cache, NULL when not used. */
+	dns_cache_handle_t dns_cache_handle;
+} metrics_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct metrics_t {
+	buffer_handle_t buffer_handle;
+	vs1053_handle_t vs1053_handle;
+	jitter_handle_t jitter_handle;
+	relay_handle_t relay_handle;
+	control_handle_t control_handle;
+	prefetch_handle_t prefetch_handle;
+	flow_handle_t flow_handle;
+	dns_cache_handle_t dns_cache_handle;
+	TaskHandle_t tasks[METRICS_MAX_TASKS];
+	uint32_t task_count;
+	portMUX_TYPE mux;
+};
+
+typedef struct metrics_t *metrics_handle_t;
+
+/**
+ * @brief Begin using the metrics.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void metrics_begin(metrics_config_t config, metrics_handle_t *handle);
+
+/**
+ * @brief End using the metrics.
+ * @param handle Component handle.
+ */
+void metrics_end(metrics_handle_t handle);
+
+/**
+ * @brief Watch the stack usage of a task, the task must never end.
+ * @param handle Component handle.
+ * @param task Task.
+ */
+void metrics_add_task(metrics_handle_t handle, TaskHandle_t task);
+
+/**
+ * @brief Write all metrics.
+ * @param handle Component handle.
+ * @param writer Target of the text.
+ */
+void metrics_write(metrics_handle_t handle, chunk_writer_t *writer);
+
+#endif
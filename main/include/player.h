@@ -5,16 +5,140 @@
 /**
  * @file
  * FreeRTOS Player task.
+ *
+ * The player waits until enough audio is buffered before it starts feeding
+ * the decoder (prebuffering). When the buffer runs empty it stops feeding
+ * until enough audio is buffered again (underrun). The thresholds are
+ * measured in bytes or in milliseconds of play time (requires the frame
+ * index). A full buffer always reaches the threshold.
+ *
+ * With a jitter buffer target both thresholds follow the target, and
+ * underruns are reported to it.
+ *
+ * The player owns the decoder. Volume and mute changes are applied by the
+ * player task before every chunk written to the decoder, so a change reaches
+ * the DAC within one chunk period. The time from the request to the
+ * register write is measured. The decoder status is read by the player task
+ * once a second while playing.
+ *
+ * On a station switch the reader flushes the buffer and the player cancels
+ * the decoder (SM_CANCEL), it falls back to a soft reset only when the
+ * decoder does not stop. The player prebuffers the next station. The time
+ * from the request until the decoder accepts the next station is measured,
+ * and until the first data of the next station reaches the decoder
+ * (time to audio).
  */
 
+#include <stdbool.h>
 #include "buffer.h"
 #include "vs1053.h"
+#include "jitter.h"
+
+/** Maximum volume, each step down attenuates 1 dB, 0 is silent. */
+#define PLAYER_VOLUME_MAX (100)
+
+typedef enum player_state_t {
+	/** Nothing to play. */
+	PLAYER_STATE_IDLE = 0,
+	/** Buffering up to the start threshold. */
+	PLAYER_STATE_PREBUFFERING,
+	/** Feeding the decoder. */
+	PLAYER_STATE_PLAYING,
+	/** Buffer ran empty, refilling up to the resume threshold. */
+	PLAYER_STATE_UNDERRUN,
+	PLAYER_STATE_COUNT,
+} player_state_t;
 
 typedef struct player_config_t {
 	buffer_handle_t buffer_handle;
 	vs1053_handle_t vs1053_handle;
+	/** Buffer level to start playing. */
+	uint32_t start_threshold;
+	/** Buffer level to resume playing after an underrun. */
+	uint32_t resume_threshold;
+	/** Thresholds in milliseconds of play time, otherwise bytes. */
+	bool threshold_ms;
+	/** Adaptive thresholds (milliseconds), NULL to use the fixed thresholds. */
+	jitter_handle_t jitter_handle;
+	/** Initial volume (0-PLAYER_VOLUME_MAX). */
+	uint8_t volume;
 } player_config_t;
 
+typedef struct player_statistics_t {
+	player_state_t state;
+	/** Number of times each state was entered. */
+	uint32_t count[PLAYER_STATE_COUNT];
+	/** Time spent in each state, including the current state up to now. */
+	uint64_t time_us[PLAYER_STATE_COUNT];
+	/** Volume and mute changes written to the decoder, time from request to register write. */
+	uint32_t volume_write_count;
+	uint64_t volume_latency_us;
+	uint32_t volume_latency_max_us;
+	/** Station switches, switches that needed a decoder reset, time from request until the decoder is ready. */
+	uint32_t switch_count;
+	uint32_t switch_reset_count;
+	uint64_t switch_us;
+	uint32_t switch_max_us;
+	/** Station switches that reached the decoder, time from request until the first data of the next station. */
+	uint32_t switch_audio_count;
+	uint64_t switch_audio_us;
+	uint32_t switch_audio_max_us;
+	/** Time from startup until the first audio reached the decoder, 0 before. */
+	uint32_t first_audio_us;
+} player_statistics_t;
+
 void player_task(void *pvParameters);
 
+/**
+ * @brief Get the state and the state statistics.
+ * @param statistics Target of the statistics.
+ */
+void player_get_statistics(player_statistics_t *statistics);
+
+/**
+ * @brief Name of a state.
+ * @param state Player state.
+ * @return Name.
+ */
+const char *player_state_name(player_state_t state);
+
+/**
+ * @brief Set the volume, applied by the player task.
+ * @param volume Volume (0-PLAYER_VOLUME_MAX).
+ * @param request_us Time of the request (esp_timer_get_time), 0 when not measured.
+ */
+void player_set_volume(uint8_t volume, int64_t request_us);
+
+/**
+ * @brief Get the volume.
+ * @return Volume (0-PLAYER_VOLUME_MAX).
+ */
+uint8_t player_get_volume();
+
+/**
+ * @brief Silence the output, keeping the volume, applied by the player task.
+ * @param mute Silent.
+ * @param request_us Time of the request (esp_timer_get_time), 0 when not measured.
+ */
+void player_set_mute(bool mute, int64_t request_us);
+
+/**
+ * @brief Get the mute.
+ * @return Silent.
+ */
+bool player_get_mute();
+
+/**
+ * @brief Stop playing the current station, applied by the player task.
+ * Call after the buffer was flushed.
+ * @param request_us Time of the request (esp_timer_get_time).
+ */
+void player_switch(int64_t request_us);
+
+/**
+ * @brief Get the decoder status as last read.
+ * @param status Target of the status.
+ */
+void player_get_decoder_status(vs1053_status_t *status);
+
 #endif
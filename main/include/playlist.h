@@ -0,0 +1,125 @@
+// The author disclaims copyright to this source code.
+#ifndef _PLAYLIST_H_
+#define _PLAYLIST_H_
+
+/**
+ * @file
+ * Playlist (M3U, PLS) of a station: the mirror streams to choose from.
+ *
+ * The playlist is parsed while it is received, line by line, without
+ * keeping the file. Stream URLs (M3U) and FileN= entries (PLS) become
+ * candidates, anything else is skipped. HLS (M3U8) is not supported.
+ *
+ * Candidates are ranked by what was observed of them: fewest failures,
+ * then the highest throughput while playing (a tenth apart at least),
+ * then the shortest time to the first byte, then the playlist order.
+ * Not tried yet ranks after measured.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stream.h"
+#include "dns_cache.h"
+
+/** Candidates kept, the rest of the playlist is skipped. */
+#define PLAYLIST_MAX_CANDIDATES (8)
+/** Candidate not selected. */
+#define PLAYLIST_NONE (UINT32_MAX)
+/** Longest line, a PLS key (File99=) and a stream URL. */
+#define PLAYLIST_LINE_MAX_LENGTH (STREAM_URL_MAX_LENGTH + 8)
+
+typedef struct playlist_candidate_t {
+	char url[STREAM_URL_MAX_LENGTH];
+	/** Time from connect to the first byte, 0 when not measured. */
+	uint32_t connect_us;
+	/** Received while playing, bytes per second, 0 when not measured. */
+	uint32_t throughput;
+	/** Connects that failed, streams that ended or were too slow. */
+	uint32_t failure_count;
+} playlist_candidate_t;
+
+typedef struct playlist_t {
+	playlist_candidate_t candidates[PLAYLIST_MAX_CANDIDATES];
+	uint32_t count;
+	/** Candidate selected, PLAYLIST_NONE before. */
+	uint32_t active;
+	/** Line being parsed, skipped when it does not fit. */
+	char line[PLAYLIST_LINE_MAX_LENGTH + 1];
+	uint32_t line_length;
+	bool line_overflow;
+} playlist_t;
+
+/**
+ * @brief Forget the candidates, prepare to parse.
+ * @param playlist Playlist.
+ */
+void playlist_reset(playlist_t *playlist);
+
+/**
+ * @brief Check the URL for a playlist: the path ends in .m3u or .pls.
+ * @param url URL.
+ * @return True when a playlist.
+ */
+bool playlist_is_url(const char *url);
+
+/**
+ * @brief Check the content type for a playlist.
+ * @param content_type Value of the Content-Type header, up to the end of the header.
+ * @return True when a playlist.
+ */
+bool playlist_is_content_type(const char *content_type);
+
+/**
+ * @brief Parse a piece of the playlist, arbitrary boundaries.
+ * @param playlist Playlist.
+ * @param data Received data.
+ * @param length Number of bytes.
+ */
+void playlist_parse(playlist_t *playlist, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief End of the playlist, parse the last line.
+ * @param playlist Playlist.
+ */
+void playlist_parse_end(playlist_t *playlist);
+
+/**
+ * @brief Fetch and parse the playlist.
+ * @param dns_cache_handle Host name cache, may be NULL.
+ * @param url Playlist URL parts.
+ * @param response Response header, used while fetching.
+ * @param playlist Target of the candidates.
+ * @return False when there are no candidates.
+ */
+bool playlist_fetch(dns_cache_handle_t dns_cache_handle, const stream_url_t *url, stream_response_t *response,
+		playlist_t *playlist);
+
+/**
+ * @brief Select the best ranked candidate.
+ * @param playlist Playlist with candidates.
+ * @param failover Select another candidate than the active one, when there is another one.
+ * @return Index of the candidate, now active.
+ */
+uint32_t playlist_select(playlist_t *playlist, bool failover);
+
+/**
+ * @brief The active candidate delivered its first byte.
+ * @param playlist Playlist.
+ * @param connect_us Time from connect to the first byte.
+ */
+void playlist_connected(playlist_t *playlist, uint32_t connect_us);
+
+/**
+ * @brief The active candidate failed, it ranks lower.
+ * @param playlist Playlist.
+ */
+void playlist_failed(playlist_t *playlist);
+
+/**
+ * @brief Throughput of the active candidate while playing, averaged.
+ * @param playlist Playlist.
+ * @param throughput Bytes per second.
+ */
+void playlist_throughput(playlist_t *playlist, uint32_t throughput);
+
+#endif
@@ -0,0 +1,140 @@
+// The author disclaims copyright to this source code.
+#ifndef _PREFETCH_H_
+#define _PREFETCH_H_
+
+/**
+ * @file
+ * FreeRTOS Prefetch task.
+ *
+ * Keeps connections to the favorites next to the selected one (previous
+ * and next) and buffers the latest seconds of each in a region of the
+ * memory of its own. When one of them is selected the reader takes over
+ * the connection and swaps the prefetched audio into the play buffer (see
+ * buffer_swap), the player only has to cancel the decoder and finds enough
+ * audio to start right away.
+ *
+ * Prefetched streams are requested without in-stream metadata, the title
+ * is unknown until the reader reconnects. Every prefetched stream costs the
+ * bandwidth of a stream.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "buffer.h"
+#include "favorites.h"
+#include "stream.h"
+#include "playlist.h"
+
+/** Previous and next favorite. */
+#define PREFETCH_SLOTS (2)
+/** Slot not in use. */
+#define PREFETCH_NONE (UINT32_MAX)
+
+typedef struct prefetch_config_t {
+	favorites_handle_t favorites_handle;
+	/** Memory shared with the play buffer. */
+	spi_mem_handle_t spi_mem_handle;
+	/** Regions of the slots: base + slot * size. */
+	uint32_t base;
+	/** Size of a region, power of two. */
+	uint32_t size;
+	/** Number of audio frames indexed per slot (power of two). */
+	uint32_t frame_index_entries;
+	/** Host name cache, may be NULL. */
+	dns_cache_handle_t dns_cache_handle;
+} prefetch_config_t;
+
+typedef struct prefetch_slot_t {
+	/** Favorite prefetched, PREFETCH_NONE when not in use. */
+	uint32_t favorite;
+	buffer_handle_t buffer_handle;
+	/** Connection, NULL when not connected. */
+	stream_conn_handle_t conn;
+	stream_response_t response;
+	/** Mirrors of the favorite when it is a playlist, handed over with the connection. */
+	playlist_t playlist;
+	/** The favorite answered with a playlist, fetch it before connecting again. */
+	bool resolve_pending;
+	/** Time of the last data, and of the next attempt to connect. */
+	int64_t receive_us;
+	int64_t retry_us;
+} prefetch_slot_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct prefetch_t {
+	favorites_handle_t favorites_handle;
+	dns_cache_handle_t dns_cache_handle;
+	prefetch_slot_t slots[PREFETCH_SLOTS];
+	/** Selection the reader has taken over (or not), until then the selected slot is kept. */
+	uint32_t taken_select_count;
+	/** Protects the slots, taken while receiving. */
+	SemaphoreHandle_t mutex;
+	/** Counters, only grow. */
+	uint32_t hit_count;
+	uint32_t miss_count;
+	uint32_t connect_count;
+	uint32_t error_count;
+	portMUX_TYPE mux;
+};
+
+typedef struct prefetch_t *prefetch_handle_t;
+
+typedef struct prefetch_statistics_t {
+	/** Selections served from a slot, and selections that had to connect. */
+	uint32_t hit_count;
+	uint32_t miss_count;
+	/** Connections made, and connections lost or refused. */
+	uint32_t connect_count;
+	uint32_t error_count;
+	/** Play time buffered per slot. */
+	uint32_t duration_ms[PREFETCH_SLOTS];
+} prefetch_statistics_t;
+
+/**
+ * @brief Begin using the prefetcher, the slot buffers are created.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void prefetch_begin(prefetch_config_t config, prefetch_handle_t *handle);
+
+/**
+ * @brief End using the prefetcher, after the task stopped.
+ * @param handle Component handle.
+ */
+void prefetch_end(prefetch_handle_t handle);
+
+/**
+ * @brief Take over a prefetched favorite.
+ * On success the audio of the slot is swapped into the buffer and the
+ * connection belongs to the caller, the response header was read, the
+ * stream has no metadata. The mirrors come along: the caller does not have to
+ * fetch the playlist before it plays.
+ * @param handle Component handle.
+ * @param favorite Favorite selected.
+ * @param select_count Selection (see favorites_selected).
+ * @param buffer_handle Play buffer, same memory as the slots.
+ * @param conn Target of the connection.
+ * @param playlist Target of the mirrors, the active one connected, no candidates when not a playlist.
+ * @return False when the favorite is not prefetched, nothing changed.
+ */
+bool prefetch_take(prefetch_handle_t handle, uint32_t favorite, uint32_t select_count, buffer_handle_t buffer_handle,
+		stream_conn_handle_t *conn, playlist_t *playlist);
+
+/**
+ * @brief Get the statistics.
+ * @param handle Component handle.
+ * @param statistics Target of the statistics.
+ */
+void prefetch_get_statistics(prefetch_handle_t handle, prefetch_statistics_t *statistics);
+
+/**
+ * FreeRTOS Prefetch task, the parameter is the handle.
+ */
+void prefetch_task(void *pvParameters);
+
+#endif
@@ -0,0 +1,77 @@
+// The author disclaims copyright to this source code.
+#ifndef _READER_H_
+#define _READER_H_
+
+/**
+ * @file
+ * FreeRTOS Reader task.
+ * Read a radio station stream (http, https) from the network and push the audio into the buffer.
+ * In-stream metadata is removed before it reaches the buffer.
+ * The selected favorite is played, a new selection switches the stream
+ * and discards the buffered audio of the previous one. A prefetched
+ * favorite is taken over instead, with its audio (see prefetch.h).
+ * While the buffer is full the reader stops receiving (see flow.h).
+ * When a stream stalls a spare connection is made while the buffered audio
+ * still plays, it takes over when the stalled connection is given up.
+ * A favorite may be a playlist (M3U, PLS) of mirrors (see playlist.h).
+ * When the buffer drains because the mirror sends slower than the decoder
+ * plays, the next mirror is connected before the buffer runs empty.
+ */
+
+#include "buffer.h"
+#include "icy.h"
+#include "jitter.h"
+#include "favorites.h"
+#include "prefetch.h"
+#include "flow.h"
+#include "dns_cache.h"
+
+/** Maximum length of the stream URL, including terminating zero. */
+#define READER_URL_MAX_LENGTH (FAVORITES_URL_MAX_LENGTH)
+
+typedef struct reader_config_t {
+	buffer_handle_t buffer_handle;
+	icy_handle_t icy_handle;
+	/** Receives the arrival times, may be NULL. */
+	jitter_handle_t jitter_handle;
+	/** Stream URLs: http[s]://host[:port]/path */
+	favorites_handle_t favorites_handle;
+	/** Prefetched neighbours of the selected favorite, may be NULL. */
+	prefetch_handle_t prefetch_handle;
+	/** Flow control, NULL to rely on the overflow policy of the buffer. */
+	flow_handle_t flow_handle;
+	/** Host name cache, may be NULL. */
+	dns_cache_handle_t dns_cache_handle;
+} reader_config_t;
+
+typedef struct reader_statistics_t {
+	/** Time from connect to the first byte, by origin of the address. */
+	uint32_t first_byte_cached_count;
+	uint64_t first_byte_cached_us;
+	uint32_t first_byte_lookup_count;
+	uint64_t first_byte_lookup_us;
+	/** Last time from connect to the first byte, 0 before. */
+	uint32_t first_byte_last_us;
+	/** Spare connections made while a stream stalled, and taken over. */
+	uint32_t spare_count;
+	uint32_t spare_use_count;
+	/** Switches to another mirror because the stream was slower than the decoder. */
+	uint32_t failover_count;
+	/** Buffered audio at a failover: last, least, and the sum. */
+	uint32_t failover_level_last_ms;
+	uint32_t failover_level_min_ms;
+	uint64_t failover_level_ms_total;
+	/** Mirrors in the playlist of the selected favorite (0 when not a playlist), and the one playing. */
+	uint32_t mirror_count;
+	uint32_t mirror_active;
+} reader_statistics_t;
+
+/**
+ * @brief Get the statistics.
+ * @param statistics Target of the statistics.
+ */
+void reader_get_statistics(reader_statistics_t *statistics);
+
+void reader_task(void *pvParameters);
+
+#endif
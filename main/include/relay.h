@@ -0,0 +1,114 @@
+// The author disclaims copyright to this source code.
+#ifndef _RELAY_H_
+#define _RELAY_H_
+
+/**
+ * @file
+ * Audio relay.
+ *
+ * Serves the buffered station stream to other clients on the network, so the
+ * station is fetched from the internet only once. Each listener reads from
+ * the buffer with its own cursor (see buffer_cursor_read), the player is
+ * never held back. A listener that falls behind skips forward to a frame
+ * start; after too many skips it is dropped.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "buffer.h"
+
+/** Bytes read from the buffer and written to a listener at once. */
+#define RELAY_CHUNK_LENGTH (1024)
+
+/**
+ * Write audio to a listener.
+ * @param context Listener context.
+ * @param data Audio.
+ * @param length Number of bytes.
+ * @return False when the listener is gone.
+ */
+typedef bool (*relay_output_t)(void *context, const uint8_t *data, uint32_t length);
+
+typedef struct relay_config_t {
+	/** Source of the audio. */
+	buffer_handle_t buffer_handle;
+	/** Number of listeners served at the same time. */
+	uint8_t max_listeners;
+	/** Drop a listener that skipped this often, 0 to never drop. */
+	uint32_t max_skips;
+	/** Drop a listener when no audio arrives for this long. */
+	uint32_t idle_timeout_ms;
+} relay_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct relay_t {
+	buffer_handle_t buffer_handle;
+	uint8_t max_listeners;
+	uint32_t max_skips;
+	uint32_t idle_timeout_ms;
+	/** Listeners served now. */
+	uint8_t listeners;
+	/** Counters, only grow. */
+	uint32_t listen_count;
+	uint32_t drop_count;
+	uint32_t skip_count;
+	uint64_t skip_bytes;
+	uint64_t send_bytes;
+	portMUX_TYPE mux;
+};
+
+typedef struct relay_t *relay_handle_t;
+
+/**
+ * Consistent copy of the relay counters.
+ */
+typedef struct relay_statistics_t {
+	uint8_t listeners;
+	uint32_t listen_count;
+	uint32_t drop_count;
+	uint32_t skip_count;
+	uint64_t skip_bytes;
+	uint64_t send_bytes;
+} relay_statistics_t;
+
+/**
+ * @brief Begin using the relay.
+ * @param config Configuration.
+ * @param handle Created handle.
+ */
+void relay_begin(relay_config_t config, relay_handle_t *handle);
+
+/**
+ * @brief End using the relay.
+ * @param handle Component handle.
+ */
+void relay_end(relay_handle_t handle);
+
+/**
+ * @brief Claim a place for a new listener.
+ * @param handle Component handle.
+ * @return False when the listener limit is reached.
+ */
+bool relay_join(relay_handle_t handle);
+
+/**
+ * @brief Serve a listener that joined, until it is gone or dropped.
+ * The place of the listener is released when done.
+ * @param handle Component handle.
+ * @param output Output function.
+ * @param context Output context.
+ */
+void relay_serve(relay_handle_t handle, relay_output_t output, void *context);
+
+/**
+ * @brief Get the counters.
+ * @param handle Component handle.
+ * @param statistics Target of the counters.
+ */
+void relay_get_statistics(relay_handle_t handle, relay_statistics_t *statistics);
+
+#endif
@@ -5,6 +5,7 @@
 /**
  * @file
  * FreeRTOS Log statistics task.
+ * Also measures the buffer push and pull rates once a second.
  */
 
 #include "buffer.h"
@@ -13,6 +14,22 @@ typedef struct statistics_config_t {
 	buffer_handle_t buffer_handle;
 } statistics_config_t;
 
+/**
+ * Buffer rates over the last second.
+ */
+typedef struct statistics_rates_t {
+	uint32_t push_bytes;
+	uint32_t pull_bytes;
+	uint32_t push_count;
+	uint32_t pull_count;
+} statistics_rates_t;
+
+/**
+ * @brief Get the latest rates.
+ * @param rates Target of the rates.
+ */
+void statistics_get_rates(statistics_rates_t *rates);
+
 /**
  * @brief The task entry function.
  * This function never returns.
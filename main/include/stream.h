@@ -0,0 +1,165 @@
+// The author disclaims copyright to this source code.
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+/**
+ * @file
+ * Radio station stream connection, shared by the reader and the prefetcher.
+ * Split the URL, connect and send the request, collect and check the
+ * response header.
+ *
+ * Received data is read one piece at a time: the fragments of a netbuf
+ * (http), or what was decrypted into the staging buffer of the caller
+ * (https, see stream_tls.h), the buffer audio is pushed from.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lwip/api.h"
+#include "favorites.h"
+#include "dns_cache.h"
+#include "stream_tls.h"
+
+/** Maximum length of the stream URL, including terminating zero. */
+#define STREAM_URL_MAX_LENGTH (FAVORITES_URL_MAX_LENGTH)
+/** Response header is collected before the stream data starts. */
+#define STREAM_HEADER_MAX_LENGTH (1024)
+
+/**
+ * Parts of http[s]://host[:port][/path]
+ */
+typedef struct stream_url_t {
+	/** https */
+	bool tls;
+	char host[STREAM_URL_MAX_LENGTH];
+	uint16_t port;
+	char path[STREAM_URL_MAX_LENGTH];
+} stream_url_t;
+
+/**
+ * Where the time of a connect went.
+ */
+typedef struct stream_timing_t {
+	/** Start of the connect (esp_timer_get_time). */
+	int64_t start_us;
+	/** The address came from the cache. */
+	bool cached;
+	uint32_t resolve_us;
+	/** TCP handshake and request. */
+	uint32_t connect_us;
+	/** TLS handshake (https), resumed from a kept session. */
+	uint32_t handshake_us;
+	bool resumed;
+} stream_timing_t;
+
+/**
+ * Connection to a station.
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct stream_conn_t {
+	struct netconn *conn;
+	/** TLS session (https), NULL for http. */
+	stream_tls_handle_t tls;
+	/** Received (http), read one fragment at a time. */
+	struct netbuf *netbuf;
+	bool netbuf_read;
+	/** Decrypted into the staging buffer (https), not read yet. */
+	uint8_t *staging;
+	uint32_t staging_length;
+};
+
+typedef struct stream_conn_t *stream_conn_handle_t;
+
+/**
+ * Response header being collected.
+ */
+typedef struct stream_response_t {
+	char header[STREAM_HEADER_MAX_LENGTH + 1];
+	uint32_t header_length;
+	bool complete;
+} stream_response_t;
+
+/**
+ * @brief Split http[s]://host[:port][/path] in parts.
+ * @param url Stream URL.
+ * @param parsed Target of the parts.
+ * @return False when not supported.
+ */
+bool stream_parse_url(const char *url, stream_url_t *parsed);
+
+/**
+ * @brief Connect, handshake (https) and send the request.
+ * A cached address that does not connect is resolved again.
+ * @param dns_cache_handle Host name cache, may be NULL.
+ * @param url Stream URL parts.
+ * @param metadata Ask for in-stream metadata (Icy-MetaData).
+ * @param timeout_ms Receive timeout of the connection.
+ * @param timing Target of the timing.
+ * @return Connection, NULL on failure.
+ */
+stream_conn_handle_t stream_connect(dns_cache_handle_t dns_cache_handle, const stream_url_t *url, bool metadata,
+		uint32_t timeout_ms, stream_timing_t *timing);
+
+/**
+ * @brief Change the receive timeout.
+ * @param conn Connection.
+ * @param timeout_ms Receive timeout.
+ */
+void stream_set_timeout(stream_conn_handle_t conn, uint32_t timeout_ms);
+
+/**
+ * @brief Wait for data, drop what was not read of the previous data.
+ * @param conn Connection.
+ * @param staging Target of decrypted data (https), DMA capable to push from.
+ * @param size Room in the staging buffer.
+ * @return ERR_OK to read the data, ERR_TIMEOUT when nothing arrived, or another error.
+ */
+err_t stream_recv(stream_conn_handle_t conn, uint8_t *staging, uint32_t size);
+
+/**
+ * @brief Read the next piece of the data received.
+ * @param conn Connection.
+ * @param data Target of the location of the piece.
+ * @param length Target of the number of bytes.
+ * @return False when all was read.
+ */
+bool stream_data(stream_conn_handle_t conn, uint8_t **data, uint32_t *length);
+
+/**
+ * @brief Close and delete a connection.
+ * @param conn Connection.
+ */
+void stream_close(stream_conn_handle_t conn);
+
+/**
+ * @brief Prepare for a new response.
+ * @param response Response.
+ */
+void stream_response_reset(stream_response_t *response);
+
+/**
+ * @brief Collect response header.
+ * @param response Response, complete is set when the end of the header was found.
+ * @param data Received data.
+ * @param length Number of bytes.
+ * @return Number of bytes used, the rest is stream data.
+ */
+uint32_t stream_response_collect(stream_response_t *response, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief Find header value in the response header (case insensitive name).
+ * @param response Response.
+ * @param name Header name including the colon.
+ * @return Value up to the end of the header, NULL when not found.
+ */
+const char *stream_response_value(const stream_response_t *response, const char *name);
+
+/**
+ * @brief Check the status: ICY 200 OK or HTTP/1.x 200 OK.
+ * @param response Complete response.
+ * @return True when the stream follows.
+ */
+bool stream_response_ok(const stream_response_t *response);
+
+#endif
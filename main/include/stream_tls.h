@@ -0,0 +1,107 @@
+// The author disclaims copyright to this source code.
+#ifndef _STREAM_TLS_H_
+#define _STREAM_TLS_H_
+
+/**
+ * @file
+ * TLS for https streams (mbedTLS) over a netconn.
+ *
+ * A full handshake costs the ESP32 hundreds of milliseconds of CPU before
+ * the first audio byte. The session of every station (host and port) is
+ * kept: a reconnect or a switch back offers it (session ticket or session
+ * id) and the server may resume it with an abbreviated handshake, without
+ * the key exchange. Sessions are kept in RAM only.
+ *
+ * The server certificate is verified (chain and host name) with the root
+ * certificates of the configuration. Without them it is not verified, the
+ * connection is encrypted, not authenticated, and the startup log warns.
+ *
+ * Every connection holds the mbedTLS record buffers (in and out), about
+ * 35k bytes of heap. A prefetched https neighbour costs as much.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "lwip/api.h"
+#include "mbedtls/ssl.h"
+#include "favorites.h"
+
+/** Sessions kept, the least recently used one makes room. */
+#define STREAM_TLS_SESSIONS (FAVORITES_MAX_COUNT)
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct stream_tls_t {
+	mbedtls_ssl_context ssl;
+	struct netconn *conn;
+	/** Received records, being read by mbedTLS. */
+	struct netbuf *netbuf;
+	uint16_t offset;
+};
+
+typedef struct stream_tls_t *stream_tls_handle_t;
+
+typedef struct stream_tls_statistics_t {
+	/** Handshakes by kind: full, and resumed from a kept session. */
+	uint32_t full_count;
+	uint64_t full_us;
+	uint32_t full_max_us;
+	uint32_t resumed_count;
+	uint64_t resumed_us;
+	uint32_t resumed_max_us;
+	/** Handshakes that failed. */
+	uint32_t error_count;
+} stream_tls_statistics_t;
+
+/**
+ * @brief Begin using TLS, before the first connect.
+ */
+void stream_tls_begin();
+
+/**
+ * @brief Handshake over a connected netconn, offer the kept session of the station.
+ * @param conn Connected, the receive timeout limits every step.
+ * @param host Host name, also sent as server name (SNI).
+ * @param port Port, with the host the station of the session.
+ * @param handshake_us Target of the handshake time.
+ * @param resumed Set when the server resumed the session.
+ * @return Handle, NULL on failure (the netconn is left to the caller).
+ */
+stream_tls_handle_t stream_tls_connect(struct netconn *conn, const char *host, uint16_t port,
+		uint32_t *handshake_us, bool *resumed);
+
+/**
+ * @brief Encrypt and send.
+ * @param handle Component handle.
+ * @param data Data.
+ * @param length Number of bytes.
+ * @return ERR_OK when all was sent.
+ */
+err_t stream_tls_write(stream_tls_handle_t handle, const void *data, uint32_t length);
+
+/**
+ * @brief Receive and decrypt.
+ * @param handle Component handle.
+ * @param data Target of the decrypted data.
+ * @param size Room in the target.
+ * @param length Target of the number of bytes, at least one on ERR_OK.
+ * @return ERR_OK, ERR_TIMEOUT when nothing arrived, ERR_CLSD at the end, or another error.
+ */
+err_t stream_tls_read(stream_tls_handle_t handle, uint8_t *data, uint32_t size, uint32_t *length);
+
+/**
+ * @brief Close the session, the netconn is left to the caller.
+ * @param handle Component handle.
+ */
+void stream_tls_close(stream_tls_handle_t handle);
+
+/**
+ * @brief Get the statistics.
+ * @param statistics Target of the statistics.
+ */
+void stream_tls_get_statistics(stream_tls_statistics_t *statistics);
+
+#endif
@@ -0,0 +1,99 @@
+// The author disclaims copyright to this source code.
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+/**
+ * @file
+ * FreeRTOS Telemetry task, pushes live status to WebSocket subscribers.
+ *
+ * At a fixed interval the buffer fill, player state, stream bitrate and
+ * stream title are sampled. Only the fields that changed since the last
+ * update are published, nothing when nothing changed. Everything is
+ * published when a client subscribed or an update may have been missed
+ * (see websocket_server_resync).
+ *
+ * JSON (text frames), for example:
+ *     {"buffer":57,"state":"playing","bitrate":128000,"title":"Artist - Song"}
+ * The state is player_state_name: idle, prebuffering, playing or underrun.
+ *
+ * Binary (binary frames): one byte with the TELEMETRY_* bits of the fields
+ * present, then the fields present in this order:
+ * - buffer fill percentage, 1 byte
+ * - player state (player_state_t), 1 byte
+ * - bitrate in bits per second, 4 bytes, most significant first
+ * - title length, 1 byte, then the title (UTF-8, not terminated)
+ */
+
+#include <stdint.h>
+#include "buffer.h"
+#include "icy.h"
+#include "player.h"
+
+/** Field bits, for the changes. */
+#define TELEMETRY_BUFFER (0x01)
+#define TELEMETRY_STATE (0x02)
+#define TELEMETRY_BITRATE (0x04)
+#define TELEMETRY_TITLE (0x08)
+#define TELEMETRY_ALL (0x0F)
+
+/** Broadcast topic, a newer update replaces one still queued. */
+#define TELEMETRY_TOPIC (1)
+
+/** Longest update. */
+#define TELEMETRY_MAX_LENGTH (1024)
+
+typedef struct telemetry_config_t {
+	/** Source of the buffer fill and bitrate. */
+	buffer_handle_t buffer_handle;
+	/** Source of the stream title. */
+	icy_handle_t icy_handle;
+	/** Time between samples. */
+	uint32_t interval_ms;
+} telemetry_config_t;
+
+/**
+ * Sampled status.
+ */
+typedef struct telemetry_snapshot_t {
+	uint8_t buffer_percentage;
+	player_state_t state;
+	/** Bits per second, 0 when unknown. */
+	uint32_t bitrate;
+	char title[ICY_TITLE_MAX_LENGTH];
+} telemetry_snapshot_t;
+
+/**
+ * @brief Fields that differ.
+ * @param previous Last published.
+ * @param current Sampled now.
+ * @return TELEMETRY_* bits.
+ */
+uint8_t telemetry_changes(const telemetry_snapshot_t *previous, const telemetry_snapshot_t *current);
+
+/**
+ * @brief Encode an update as JSON.
+ * @param snapshot Status.
+ * @param changes TELEMETRY_* bits of the fields to include.
+ * @param out Target, not terminated.
+ * @param size Target size.
+ * @return Number of bytes, 0 when it does not fit.
+ */
+uint32_t telemetry_json(const telemetry_snapshot_t *snapshot, uint8_t changes, char *out, uint32_t size);
+
+/**
+ * @brief Encode an update in the binary format.
+ * @param snapshot Status.
+ * @param changes TELEMETRY_* bits of the fields to include.
+ * @param out Target.
+ * @param size Target size.
+ * @return Number of bytes, 0 when it does not fit.
+ */
+uint32_t telemetry_binary(const telemetry_snapshot_t *snapshot, uint8_t changes, uint8_t *out, uint32_t size);
+
+/**
+ * @brief The task entry function.
+ * This function never returns.
+ */
+void telemetry_task(void *pvParameters);
+
+#endif
@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_CONTROL_H_
+#define _TEST_CONTROL_H_
+
+/**
+ * @file
+ * Control command parser test, commands are not executed.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_control();
+
+#endif
@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_DNS_CACHE_H_
+#define _TEST_DNS_CACHE_H_
+
+/**
+ * @file
+ * Name server response parser test, address and time to live.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_dns_cache();
+
+#endif
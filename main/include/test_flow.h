@@ -0,0 +1,19 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_FLOW_H_
+#define _TEST_FLOW_H_
+
+/**
+ * @file
+ * Flow control test, receiving stops and resumes at the watermarks.
+ */
+
+#include "buffer.h"
+#include "esp_err.h"
+
+typedef struct test_flow_config_t {
+	buffer_handle_t buffer_handle;
+} test_flow_config_t;
+
+esp_err_t test_flow(test_flow_config_t config);
+
+#endif
@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_HTTP_REQUEST_H_
+#define _TEST_HTTP_REQUEST_H_
+
+/**
+ * @file
+ * Incremental HTTP request parser test.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_http_request();
+
+#endif
@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_ICY_H_
+#define _TEST_ICY_H_
+
+/**
+ * @file
+ * ICY metadata demultiplexer test and benchmark.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_icy();
+
+#endif
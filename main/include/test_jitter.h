@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_JITTER_H_
+#define _TEST_JITTER_H_
+
+/**
+ * @file
+ * Adaptive jitter buffer target test, driven by synthetic arrival traces.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_jitter();
+
+#endif
@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_JSON_READER_H_
+#define _TEST_JSON_READER_H_
+
+/**
+ * @file
+ * JSON tokenizer test, valid and malformed documents and the token limits.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_json_reader();
+
+#endif
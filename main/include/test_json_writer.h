@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_JSON_WRITER_H_
+#define _TEST_JSON_WRITER_H_
+
+/**
+ * @file
+ * Streaming JSON writer test.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_json_writer();
+
+#endif
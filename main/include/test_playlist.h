@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_PLAYLIST_H_
+#define _TEST_PLAYLIST_H_
+
+/**
+ * @file
+ * Playlist test, M3U and PLS parsing in pieces, mirror ranking.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_playlist();
+
+#endif
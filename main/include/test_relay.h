@@ -0,0 +1,19 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_RELAY_H_
+#define _TEST_RELAY_H_
+
+/**
+ * @file
+ * Audio relay test, several listeners read the buffer at their own pace.
+ */
+
+#include "buffer.h"
+#include "esp_err.h"
+
+typedef struct test_relay_config_t {
+	buffer_handle_t buffer_handle;
+} test_relay_config_t;
+
+esp_err_t test_relay(test_relay_config_t config);
+
+#endif
@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_TELEMETRY_H_
+#define _TEST_TELEMETRY_H_
+
+/**
+ * @file
+ * Telemetry encoding test, changed fields only, JSON and binary.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_telemetry();
+
+#endif
@@ -0,0 +1,15 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_WEBSOCKET_FRAME_H_
+#define _TEST_WEBSOCKET_FRAME_H_
+
+/**
+ * @file
+ * WebSocket frame parser test, including a fuzz test, a check that the
+ * steady receive path does not use the heap and a throughput benchmark.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_websocket_frame();
+
+#endif
@@ -0,0 +1,14 @@
+// The author disclaims copyright to this source code.
+#ifndef _TEST_WWW_ARCHIVE_H_
+#define _TEST_WWW_ARCHIVE_H_
+
+/**
+ * @file
+ * Web asset archive test, damaged archives are rejected.
+ */
+
+#include "esp_err.h"
+
+esp_err_t test_www_archive();
+
+#endif
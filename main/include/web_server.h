@@ -5,12 +5,59 @@
 /**
  * @file
  * Web server task.
+ * The task accepts connections and hands them over to a pool of worker tasks.
+ * Connections beyond the limit are refused (503 Service Unavailable).
+ * Connections persist (HTTP/1.1 keep-alive) until idle for a while, or until
+ * other connections wait for a worker.
+ *
+ * Status and control (JSON, streamed with chunked transfer encoding):
+ * - GET /api/status: buffer, rates, player, decoder and stream.
+ * - GET /api/volume, PUT or POST /api/volume?value=0-100
+ * - GET /api/favorites, PUT or POST /api/favorites?selected=index
+ * - PUT or POST /api/command with a control command in the body (see control.h)
+ * Responses are generated without malloc, in a buffer on the worker stack;
+ * netconn_write copies each chunk into lwIP pbufs, the buffer is reused.
+ *
+ * Monitoring: GET /metrics (Prometheus text format).
+ *
+ * Relay: GET /stream serves the buffered audio to other clients, each
+ * listener keeps a worker busy (see relay.h).
  */
 
 #include <stdint.h>
+#include "icy.h"
+#include "www_archive.h"
+#include "buffer.h"
+#include "jitter.h"
+#include "favorites.h"
+#include "metrics.h"
+#include "relay.h"
+#include "control.h"
 
 typedef struct web_server_config_t {
 	uint16_t port;
+	/** Source of the stream title. */
+	icy_handle_t icy_handle;
+	/** Source of the status. */
+	buffer_handle_t buffer_handle;
+	/** Adaptive player target, NULL when not used. */
+	jitter_handle_t jitter_handle;
+	/** Stations to select. */
+	favorites_handle_t favorites_handle;
+	/** Source of the metrics, NULL when not served. */
+	metrics_handle_t metrics_handle;
+	/** Source of the relayed audio, NULL when not served. */
+	relay_handle_t relay_handle;
+	/** Player control commands, NULL when not served. */
+	control_handle_t control_handle;
+	/** Source of the assets when not embedded, NULL when not available. */
+	www_archive_handle_t archive_handle;
+	/** Number of connections served at the same time. */
+	uint8_t workers;
+	/** Number of connections served or waiting for a worker. */
+	uint8_t max_connections;
+	/** Close a connection without requests for this long. */
+	uint32_t idle_timeout_ms;
 } web_server_config_t;
 
 /**
@@ -0,0 +1,156 @@
+// The author disclaims copyright to this source code.
+#ifndef _WEBSOCKET_FRAME_H_
+#define _WEBSOCKET_FRAME_H_
+
+/**
+ * @file
+ * Incremental WebSocket frame parser and frame header writer.
+ * https://tools.ietf.org/html/rfc6455#section-5
+ *
+ * Data is fed as it arrives, frames may be split anywhere and several may
+ * arrive at once. Parsing stops after each complete message or control
+ * frame, the remaining data belongs to the next one. Fragmented messages
+ * are reassembled into the message buffer, control frames may arrive in
+ * between. Frames from the client must be masked, the payload is copied and
+ * then unmasked in place a word at a time. Text is not checked to be valid
+ * UTF-8. Parsing does not use the heap.
+ *
+ *       0                   1                   2                   3
+ *       0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *      +-+-+-+-+-------+-+-------------+-------------------------------+
+ *      |F|R|R|R| opcode|M| Payload len |    Extended payload length    |
+ *      |I|S|S|S|  (4)  |A|     (7)     |             (16/64)           |
+ *      |N|V|V|V|       |S|             |   (if payload len==126/127)   |
+ *      | |1|2|3|       |K|             |                               |
+ *      +-+-+-+-+-------+-+-------------+ - - - - - - - - - - - - - - - +
+ *      |     Extended payload length continued, if payload len == 127  |
+ *      + - - - - - - - - - - - - - - - +-------------------------------+
+ *      |                               |Masking-key, if MASK set to 1  |
+ *      +-------------------------------+-------------------------------+
+ *      | Masking-key (continued)       |          Payload Data         |
+ *      +-------------------------------- - - - - - - - - - - - - - - - +
+ *      :                     Payload Data continued ...                :
+ *      + - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - +
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Longest frame header: 2 bytes, 64-bit length, mask. */
+#define WEBSOCKET_FRAME_HEADER_MAX_LENGTH (14)
+/** Longest frame header from the server (not masked). */
+#define WEBSOCKET_FRAME_SERVER_HEADER_MAX_LENGTH (10)
+/** Longest control frame payload. */
+#define WEBSOCKET_FRAME_CONTROL_MAX_LENGTH (125)
+
+/** Close status codes, https://tools.ietf.org/html/rfc6455#section-7.4.1 */
+#define WEBSOCKET_CLOSE_NORMAL (1000)
+#define WEBSOCKET_CLOSE_PROTOCOL_ERROR (1002)
+#define WEBSOCKET_CLOSE_NO_STATUS (1005)
+#define WEBSOCKET_CLOSE_TOO_BIG (1009)
+
+/**
+ * WebSocket frame opcode
+ * https://tools.ietf.org/html/rfc6455#section-11.8
+ */
+typedef enum websocket_opcode_t {
+	WEBSOCKET_OPCODE_CONTINUATION = 0,
+	WEBSOCKET_OPCODE_TEXT = 1,
+	WEBSOCKET_OPCODE_BINARY = 2,
+	WEBSOCKET_OPCODE_CLOSE = 8,
+	WEBSOCKET_OPCODE_PING = 9,
+	WEBSOCKET_OPCODE_PONG = 10,
+} websocket_opcode_t;
+
+typedef enum websocket_frame_result_t {
+	/** More data needed. */
+	WEBSOCKET_FRAME_INCOMPLETE = 0,
+	/**
+	 * Text or binary message complete, see message_opcode, message and message_length.
+	 * Valid until the next message starts.
+	 */
+	WEBSOCKET_FRAME_MESSAGE,
+	/** Ping, answer with a pong carrying the control payload. */
+	WEBSOCKET_FRAME_PING,
+	/** Pong, nothing to do. */
+	WEBSOCKET_FRAME_PONG,
+	/** Close, answer with a close carrying close_status, then close the connection. */
+	WEBSOCKET_FRAME_CLOSE,
+	/** Protocol violation or message too long, close with close_status. The connection can not be used anymore. */
+	WEBSOCKET_FRAME_ERROR,
+} websocket_frame_result_t;
+
+typedef enum websocket_frame_state_t {
+	WEBSOCKET_FRAME_STATE_HEADER = 0,
+	WEBSOCKET_FRAME_STATE_PAYLOAD,
+	WEBSOCKET_FRAME_STATE_ERROR,
+} websocket_frame_state_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+typedef struct websocket_frame_parser_t {
+	websocket_frame_state_t state;
+	/** Header being collected, and its length when complete. */
+	uint8_t header[WEBSOCKET_FRAME_HEADER_MAX_LENGTH];
+	uint32_t header_length;
+	uint32_t header_needed;
+	/** Current frame. */
+	bool fin;
+	websocket_opcode_t opcode;
+	uint8_t mask[4];
+	uint64_t payload_remaining;
+	/** Payload bytes of the current frame seen, selects the mask byte. */
+	uint32_t payload_offset;
+	/** Message being reassembled, provided by the user. */
+	uint8_t *message;
+	uint32_t message_size;
+	uint32_t message_length;
+	websocket_opcode_t message_opcode;
+	/** A fragmented message is in progress, continuation frames expected. */
+	bool fragmented;
+	/** Payload of the last control frame. */
+	uint8_t control[WEBSOCKET_FRAME_CONTROL_MAX_LENGTH];
+	uint32_t control_length;
+	/** Status to send in the close frame. */
+	uint16_t close_status;
+} websocket_frame_parser_t;
+
+/**
+ * @brief Prepare for a new connection.
+ * @param parser Parser.
+ * @param message Target of reassembled messages.
+ * @param message_size Longest message accepted.
+ */
+void websocket_frame_reset(websocket_frame_parser_t *parser, uint8_t *message, uint32_t message_size);
+
+/**
+ * @brief Continue in another message buffer, only between messages.
+ * Lets the user keep a complete message while the next one is received.
+ * @param parser Parser.
+ * @param message Target of reassembled messages, at least message_size bytes.
+ */
+void websocket_frame_set_message(websocket_frame_parser_t *parser, uint8_t *message);
+
+/**
+ * @brief Parse received data.
+ * @param parser Parser.
+ * @param data Received data.
+ * @param length Number of bytes.
+ * @param result Parse result.
+ * @return Number of bytes consumed, less than length when a result is available early.
+ */
+uint32_t websocket_frame_parse(websocket_frame_parser_t *parser, const uint8_t *data, uint32_t length,
+		websocket_frame_result_t *result);
+
+/**
+ * @brief Write an unfragmented, not masked frame header (server to client).
+ * @param header Target, at least WEBSOCKET_FRAME_SERVER_HEADER_MAX_LENGTH bytes.
+ * @param opcode Opcode.
+ * @param length Payload length.
+ * @return Header length.
+ */
+uint32_t websocket_frame_header(uint8_t *header, websocket_opcode_t opcode, uint64_t length);
+
+#endif
@@ -9,20 +9,160 @@
  * 1) https://tools.ietf.org/html/rfc6455
  * 2) https://developer.mozilla.org/en-US/docs/Web/API/WebSockets_API/Writing_WebSocket_servers
  *
+ * The task accepts connections and hands them over to a pool of worker tasks,
+ * one per client. Connections beyond the client limit are refused
+ * (503 Service Unavailable). Received frames are parsed incrementally
+ * (websocket_frame.h), pings are answered and fragmented text messages are
+ * reassembled before they are processed. Messages are received into a fixed
+ * pool of buffers (message_pool.h) with room for the frame header in front,
+ * the steady path does not use the heap.
+ *
+ * Each client has a bounded send queue, drained by its own sender task, so
+ * a slow client does not hold up the others. A newer message of the same
+ * topic replaces one still queued; when the queue is full older topic
+ * messages are dropped first. A client that does not catch up within the
+ * lag timeout is disconnected.
+ *
+ * Other text messages are control commands (control.h), each is answered
+ * with its result.
+ *
  * Some shortcuts have been taken:
- * - only one websocket client
- * - web traffic is handled on a separate server (also limited to one client)
- * - short frame payload to avoid masking (see explanation in 2)
+ * - web traffic is handled on a separate server
  * - the simplest thing that could possibly work with my web client
  */
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "metrics.h"
+#include "control.h"
+
+/** Broadcast topic of messages that are never superseded. */
+#define WEBSOCKET_TOPIC_NONE (0)
+
+/**
+ * Published messages a client receives. A client subscribes by sending the
+ * text "subscribe" (JSON) or "subscribe binary", and stops with "unsubscribe".
+ */
+typedef enum websocket_subscription_t {
+	WEBSOCKET_SUBSCRIPTION_NONE = 0,
+	/** Text frames. */
+	WEBSOCKET_SUBSCRIPTION_JSON,
+	/** Binary frames. */
+	WEBSOCKET_SUBSCRIPTION_BINARY,
+} websocket_subscription_t;
 
 typedef struct websocket_server_config_t {
 	uint16_t port;
+	/** Number of clients connected at the same time (one task each). */
+	uint8_t max_clients;
+	/** Longest message received, fragments are reassembled up to this length. */
+	uint32_t message_max_length;
+	/** Messages waiting to be processed or sent, besides the one each client is receiving. */
+	uint8_t message_buffers;
+	/** Frames waiting to be sent to a client. */
+	uint8_t send_queue_length;
+	/** Disconnect a client that does not empty its full send queue in this time. */
+	uint32_t lag_timeout_ms;
+	/** Watches the worker tasks, NULL when not watched. */
+	metrics_handle_t metrics_handle;
+	/** Executes the commands received. */
+	control_handle_t control_handle;
 } websocket_server_config_t;
 
+/**
+ * Consistent copy of the counters of a client, they survive reconnects.
+ */
+typedef struct websocket_client_statistics_t {
+	bool connected;
+	/** Frames waiting to be sent now. */
+	uint8_t queue_depth;
+	uint32_t sent_count;
+	/** Frames not sent, the send queue was full. */
+	uint32_t drop_count;
+	/** Messages replaced by a newer one of the same topic. */
+	uint32_t coalesce_count;
+	/** Disconnects because the client fell behind. */
+	uint32_t lag_count;
+} websocket_client_statistics_t;
+
+/**
+ * @brief Begin using the websocket server: message buffers and client state,
+ * publishing is possible from here, before the task accepts clients.
+ * @param config Configuration.
+ */
+void websocket_server_begin(websocket_server_config_t config);
+
+/**
+ * FreeRTOS websocket server task, after websocket_server_begin. The parameter is not used.
+ */
 void websocket_server_task(void *pvParameters);
-void websocket_process_task(void *pvUnused);
+
+/**
+ * @brief Queue a text message for every connected client.
+ * The frame is created once and shared by the send queues.
+ * @param topic Status topic, a newer message replaces a queued one of the
+ * same topic. WEBSOCKET_TOPIC_NONE for messages that are never superseded.
+ * @param text Text (UTF-8).
+ * @param length Number of bytes.
+ * @return Number of clients queued for.
+ */
+uint8_t websocket_server_broadcast(uint8_t topic, const char *text, uint16_t length);
+
+/**
+ * @brief Queue a message for the subscribers of a format.
+ * @param subscription Format, JSON is sent as text and binary as binary frames.
+ * @param topic Status topic, see websocket_server_broadcast.
+ * @param data Message.
+ * @param length Number of bytes.
+ * @return Number of clients queued for.
+ */
+uint8_t websocket_server_publish(websocket_subscription_t subscription, uint8_t topic, const void *data,
+		uint16_t length);
+
+/**
+ * @brief Whether published changes may have been missed.
+ * True once after a client subscribed, or a message with a topic was
+ * superseded or dropped. The publisher should send everything next.
+ * @return True when everything should be published.
+ */
+bool websocket_server_resync();
+
+/**
+ * @brief Number of clients connected.
+ * @return Clients.
+ */
+uint8_t websocket_server_clients_connected();
+
+/**
+ * @brief Get the counters of a client.
+ * @param index Client, from 0.
+ * @param statistics Target of the counters.
+ * @return False when there is no such client (or the server did not start yet).
+ */
+bool websocket_server_get_statistics(uint8_t index, websocket_client_statistics_t *statistics);
+
+/**
+ * @brief Self test: a server without network or tasks, with one client whose
+ * frames are kept instead of sent. Before websocket_server_begin.
+ * @param message_max_length Longest message received.
+ * @param out Target of the last frame sent to the client.
+ * @param size Room in the target, a longer frame is cut off.
+ */
+void websocket_server_loopback_begin(uint32_t message_max_length, uint8_t *out, uint32_t size);
+
+/**
+ * @brief Feed frames from the loopback client through the steady path of the
+ * server, as its worker, process and sender tasks would. Pings and closes are
+ * answered, text messages are echoed (in place of a command answer).
+ * @param data Frames from the client (masked).
+ * @param length Number of bytes.
+ * @return Length of the last frame sent to the client, see websocket_server_loopback_begin.
+ */
+uint32_t websocket_server_loopback(const uint8_t *data, uint32_t length);
+
+/**
+ * @brief End the self test, free what websocket_server_loopback_begin took.
+ */
+void websocket_server_loopback_end();
 
 #endif
@@ -0,0 +1,110 @@
+// The author disclaims copyright to this source code.
+#ifndef _WWW_ARCHIVE_H_
+#define _WWW_ARCHIVE_H_
+
+/**
+ * @file
+ * Web server asset archive in a flash data partition.
+ *
+ * The archive is built by tools/www_archive.py and flashed separately from
+ * the application (make www-flash). It is memory mapped, assets are served
+ * straight from flash without copies. Paths are found through a hash table
+ * (FNV-1a, linear probing).
+ *
+ * All offsets are relative to the start of the archive.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "www_assets.h"
+
+#define WWW_ARCHIVE_MAGIC (0x41575757)
+#define WWW_ARCHIVE_VERSION (1)
+/** Empty hash slot. */
+#define WWW_ARCHIVE_EMPTY (0xFFFF)
+
+typedef struct www_archive_header_t {
+	uint32_t magic;
+	uint32_t version;
+	/** Number of entries. */
+	uint32_t count;
+	/** Number of hash slots (power of two), 16-bit entry index each. */
+	uint32_t slots;
+	/** Archive size. */
+	uint32_t size;
+} www_archive_header_t;
+
+typedef struct www_archive_entry_t {
+	/** FNV-1a of the path. */
+	uint32_t hash;
+	/** Zero terminated strings. */
+	uint32_t path;
+	uint32_t etag;
+	uint32_t content;
+	uint32_t content_length;
+	uint32_t header_200;
+	uint32_t header_200_length;
+	uint32_t header_304;
+	uint32_t header_304_length;
+} www_archive_entry_t;
+
+typedef struct www_archive_config_t {
+	/** Data partition label. */
+	const char *label;
+} www_archive_config_t;
+
+/**
+ * Even though this data is 'public'.
+ * Do not shoot yourself in the foot by changing this data.
+ */
+struct www_archive_t {
+	spi_flash_mmap_handle_t mmap_handle;
+	const uint8_t *archive;
+	const www_archive_header_t *header;
+	const uint16_t *slots;
+	const www_archive_entry_t *entries;
+};
+
+typedef struct www_archive_t *www_archive_handle_t;
+
+/**
+ * @brief Begin using the archive.
+ * @param config Configuration.
+ * @param handle Created handle.
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without partition, ESP_ERR_INVALID_VERSION when not a valid archive.
+ */
+esp_err_t www_archive_begin(www_archive_config_t config, www_archive_handle_t *handle);
+
+/**
+ * @brief End using the archive.
+ * @param handle Component handle.
+ */
+void www_archive_end(www_archive_handle_t handle);
+
+/**
+ * @brief Find the asset of a request path.
+ * @param handle Component handle.
+ * @param path Request path.
+ * @param asset Asset found, pointing into flash.
+ * @return True when found.
+ */
+bool www_archive_find(www_archive_handle_t handle, const char *path, www_asset_t *asset);
+
+/**
+ * @brief Check the structure, a damaged archive must not make the web server read outside the partition.
+ * @param archive Start of the archive.
+ * @param size Size of the partition.
+ * @return True when every offset and length lies within the archive.
+ */
+bool www_archive_is_valid(const uint8_t *archive, uint32_t size);
+
+/**
+ * @brief FNV-1a hash.
+ * @param text Zero terminated text.
+ * @return Hash.
+ */
+uint32_t www_archive_hash(const char *text);
+
+#endif
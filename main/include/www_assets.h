@@ -0,0 +1,39 @@
+// The author disclaims copyright to this source code.
+#ifndef _WWW_ASSETS_H_
+#define _WWW_ASSETS_H_
+
+/**
+ * @file
+ * Web server assets.
+ * The assets are compressed (gzip) at build time, with a strong ETag and
+ * ready to send response headers, see tools/www_assets.py and component.mk.
+ * Only available when the assets are embedded in the application, see
+ * www_archive.h for assets in a flash partition.
+ */
+
+#include <stdint.h>
+
+typedef struct www_asset_t {
+	/** Request path. */
+	const char *path;
+	/** Strong entity tag, including quotes. */
+	const char *etag;
+	/** Compressed content. */
+	const uint8_t *content;
+	uint32_t content_length;
+	/** 200 OK header lines, without Connection and the empty line. */
+	const char *header_200;
+	uint32_t header_200_length;
+	/** 304 Not Modified header lines, without Connection and the empty line. */
+	const char *header_304;
+	uint32_t header_304_length;
+} www_asset_t;
+
+/**
+ * @brief Find the asset of a request path.
+ * @param path Request path.
+ * @return Asset, NULL when not found.
+ */
+const www_asset_t *www_assets_find(const char *path);
+
+#endif
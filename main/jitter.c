@@ -0,0 +1,146 @@
+// The author disclaims copyright to this source code.
+#include "jitter.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "jitter";
+
+/** Time constant of the peak decay. */
+#define JITTER_PEAK_DECAY_US (60000000)
+/** Keep the underrun boost this long after the last underrun. */
+#define JITTER_BOOST_HOLD_US (60000000)
+/** Time constant of the boost decay once the hold time passed. */
+#define JITTER_BOOST_DECAY_US (120000000)
+/** Only log target changes of at least this size. */
+#define JITTER_LOG_STEP_MS (250)
+
+/**
+ * Subtract value * elapsed / decay, approximates exponential decay for small steps.
+ */
+static uint32_t jitter_decay(uint32_t value, uint32_t elapsed_us, uint32_t decay_us) {
+	uint64_t step = (uint64_t) value * elapsed_us / decay_us;
+	return step >= value ? 0 : value - (uint32_t) step;
+}
+
+/**
+ * Recalculate the target, mutex must be taken.
+ */
+static void jitter_update_locked(jitter_handle_t handle, const char *cause) {
+	uint32_t spread_us = handle->gap_us + 4 * handle->deviation_us;
+	uint32_t base_us = handle->peak_us > spread_us ? handle->peak_us : spread_us;
+	uint32_t target_ms = (base_us + handle->boost_us) / 1000;
+	if (target_ms < handle->min_ms) {
+		target_ms = handle->min_ms;
+	} else if (target_ms > handle->max_ms) {
+		target_ms = handle->max_ms;
+	}
+	handle->target_ms = target_ms;
+	uint32_t change_ms = (target_ms > handle->logged_ms ? target_ms - handle->logged_ms : handle->logged_ms - target_ms);
+	if (change_ms >= JITTER_LOG_STEP_MS) {
+		ESP_LOGI(TAG, "target: %u -> %u ms (%s, gap %u, deviation %u, peak %u, boost %u ms)", handle->logged_ms,
+				target_ms, cause, handle->gap_us / 1000, handle->deviation_us / 1000, handle->peak_us / 1000,
+				handle->boost_us / 1000);
+		handle->logged_ms = target_ms;
+	}
+}
+
+void jitter_arrival(jitter_handle_t handle, int64_t now_us) {
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	if (handle->arrival_us != 0) {
+		int64_t elapsed_us = now_us - handle->arrival_us;
+		// longer gaps than the upper bound make no difference
+		uint32_t max_us = handle->max_ms * 1000;
+		uint32_t gap_us = elapsed_us < 0 ? 0 : elapsed_us > max_us ? max_us : (uint32_t) elapsed_us;
+
+		int32_t difference_us = (int32_t) gap_us - (int32_t) handle->gap_us;
+		uint32_t deviation_us = difference_us < 0 ? -difference_us : difference_us;
+		handle->deviation_us = (int32_t) handle->deviation_us + ((int32_t) deviation_us - (int32_t) handle->deviation_us) / 4;
+		handle->gap_us = (int32_t) handle->gap_us + difference_us / 8;
+
+		handle->peak_us = jitter_decay(handle->peak_us, gap_us, JITTER_PEAK_DECAY_US);
+		if (gap_us > handle->peak_us) {
+			handle->peak_us = gap_us;
+		}
+		if (now_us - handle->underrun_us > JITTER_BOOST_HOLD_US) {
+			handle->boost_us = jitter_decay(handle->boost_us, gap_us, JITTER_BOOST_DECAY_US);
+		}
+		jitter_update_locked(handle, gap_us == handle->peak_us ? "peak" : "arrival");
+	}
+	handle->arrival_us = now_us;
+	handle->arrival_count++;
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+}
+
+void jitter_pause(jitter_handle_t handle) {
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	handle->arrival_us = 0;
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+}
+
+void jitter_underrun(jitter_handle_t handle, int64_t now_us) {
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	uint32_t max_us = handle->max_ms * 1000;
+	handle->boost_us = (handle->boost_us + handle->underrun_ms * 1000 > max_us ? max_us
+			: handle->boost_us + handle->underrun_ms * 1000);
+	handle->underrun_us = now_us;
+	handle->underrun_count++;
+	jitter_update_locked(handle, "underrun");
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+}
+
+uint32_t jitter_target_ms(jitter_handle_t handle) {
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	uint32_t target_ms = handle->target_ms;
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	return target_ms;
+}
+
+void jitter_reset(jitter_handle_t handle) {
+	ESP_LOGD(TAG, ">jitter_reset");
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	handle->arrival_us = 0;
+	handle->gap_us = 0;
+	handle->deviation_us = 0;
+	handle->peak_us = 0;
+	handle->boost_us = 0;
+	handle->underrun_us = 0;
+	handle->arrival_count = 0;
+	handle->underrun_count = 0;
+	handle->target_ms = handle->min_ms;
+	handle->logged_ms = handle->min_ms;
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	ESP_LOGD(TAG, "<jitter_reset");
+}
+
+void jitter_begin(jitter_config_t config, jitter_handle_t *handle) {
+	ESP_LOGD(TAG, ">jitter_begin");
+	ESP_LOGD(TAG, "min_ms: %u", config.min_ms);
+	ESP_LOGD(TAG, "max_ms: %u", config.max_ms);
+	ESP_LOGD(TAG, "underrun_ms: %u", config.underrun_ms);
+	assert(config.min_ms <= config.max_ms);
+
+	jitter_handle_t jitter_handle = malloc(sizeof(struct jitter_t));
+	assert(jitter_handle != NULL);
+	memset(jitter_handle, 0, sizeof(struct jitter_t));
+	jitter_handle->min_ms = config.min_ms;
+	jitter_handle->max_ms = config.max_ms;
+	jitter_handle->underrun_ms = config.underrun_ms;
+	jitter_handle->mutex = xSemaphoreCreateMutex();
+	assert(jitter_handle->mutex != NULL);
+	jitter_reset(jitter_handle);
+
+	*handle = jitter_handle;
+
+	ESP_LOGD(TAG, "<jitter_begin");
+}
+
+void jitter_end(jitter_handle_t handle) {
+	ESP_LOGD(TAG, ">jitter_end");
+	vSemaphoreDelete(handle->mutex);
+	handle->mutex = NULL;
+	free(handle);
+	ESP_LOGD(TAG, "<jitter_end");
+}
@@ -0,0 +1,299 @@
+// The author disclaims copyright to this source code.
+#include "json_reader.h"
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "json_reader";
+
+/**
+ * Parser state, on the stack of json_reader_parse.
+ */
+typedef struct json_reader_t {
+	const char *json;
+	uint32_t length;
+	uint32_t position;
+	json_token_t *tokens;
+	uint32_t count;
+	uint32_t used;
+} json_reader_t;
+
+static bool json_reader_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static bool json_reader_hex(char c) {
+	return json_reader_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+/**
+ * Current character, 0 at the end (never valid where it matters).
+ */
+static char json_reader_peek(json_reader_t *reader) {
+	return reader->position < reader->length ? reader->json[reader->position] : 0;
+}
+
+static void json_reader_space(json_reader_t *reader) {
+	char c = json_reader_peek(reader);
+	while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+		reader->position++;
+		c = json_reader_peek(reader);
+	}
+}
+
+/**
+ * @return Index of the new token, or JSON_READER_TOO_MANY_TOKENS.
+ */
+static int32_t json_reader_token(json_reader_t *reader, json_token_type_t type, uint32_t start) {
+	if (reader->used == reader->count) {
+		return JSON_READER_TOO_MANY_TOKENS;
+	}
+	json_token_t *token = &reader->tokens[reader->used];
+	token->type = type;
+	token->start = start;
+	token->length = 0;
+	token->size = 0;
+	token->next = reader->used + 1;
+	return reader->used++;
+}
+
+/**
+ * "string", escapes are checked and kept.
+ */
+static int32_t json_reader_string(json_reader_t *reader) {
+	uint32_t start = ++reader->position;
+	while (reader->position < reader->length) {
+		uint8_t c = reader->json[reader->position];
+		if (c == '"') {
+			int32_t index = json_reader_token(reader, JSON_TOKEN_STRING, start);
+			if (index >= 0) {
+				reader->tokens[index].length = reader->position - start;
+				reader->position++;
+			}
+			return index;
+		} else if (c < 0x20) {
+			// control characters must be escaped
+			return JSON_READER_MALFORMED;
+		} else if (c == '\\') {
+			reader->position++;
+			c = json_reader_peek(reader);
+			if (c == 'u') {
+				for (int i = 0; i < 4; i++) {
+					reader->position++;
+					if (!json_reader_hex(json_reader_peek(reader))) {
+						return JSON_READER_MALFORMED;
+					}
+				}
+			} else if (c == 0 || strchr("\"\\/bfnrt", c) == NULL) {
+				return JSON_READER_MALFORMED;
+			}
+		}
+		reader->position++;
+	}
+	return JSON_READER_MALFORMED;
+}
+
+/**
+ * -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+ */
+static int32_t json_reader_number(json_reader_t *reader) {
+	uint32_t start = reader->position;
+	if (json_reader_peek(reader) == '-') {
+		reader->position++;
+	}
+	if (json_reader_peek(reader) == '0') {
+		reader->position++;
+	} else if (json_reader_digit(json_reader_peek(reader))) {
+		while (json_reader_digit(json_reader_peek(reader))) {
+			reader->position++;
+		}
+	} else {
+		return JSON_READER_MALFORMED;
+	}
+	if (json_reader_peek(reader) == '.') {
+		reader->position++;
+		if (!json_reader_digit(json_reader_peek(reader))) {
+			return JSON_READER_MALFORMED;
+		}
+		while (json_reader_digit(json_reader_peek(reader))) {
+			reader->position++;
+		}
+	}
+	if (json_reader_peek(reader) == 'e' || json_reader_peek(reader) == 'E') {
+		reader->position++;
+		if (json_reader_peek(reader) == '+' || json_reader_peek(reader) == '-') {
+			reader->position++;
+		}
+		if (!json_reader_digit(json_reader_peek(reader))) {
+			return JSON_READER_MALFORMED;
+		}
+		while (json_reader_digit(json_reader_peek(reader))) {
+			reader->position++;
+		}
+	}
+	int32_t index = json_reader_token(reader, JSON_TOKEN_NUMBER, start);
+	if (index >= 0) {
+		reader->tokens[index].length = reader->position - start;
+	}
+	return index;
+}
+
+/**
+ * true, false or null.
+ */
+static int32_t json_reader_literal(json_reader_t *reader, const char *text, json_token_type_t type) {
+	uint32_t length = strlen(text);
+	if (reader->length - reader->position < length || memcmp(&reader->json[reader->position], text, length) != 0) {
+		return JSON_READER_MALFORMED;
+	}
+	int32_t index = json_reader_token(reader, type, reader->position);
+	if (index >= 0) {
+		reader->tokens[index].length = length;
+		reader->position += length;
+	}
+	return index;
+}
+
+static int32_t json_reader_value(json_reader_t *reader, uint32_t depth);
+
+/**
+ * Object or array, the members follow the token.
+ */
+static int32_t json_reader_container(json_reader_t *reader, uint32_t depth) {
+	if (depth == JSON_READER_MAX_DEPTH) {
+		return JSON_READER_TOO_DEEP;
+	}
+	bool object = json_reader_peek(reader) == '{';
+	char close = object ? '}' : ']';
+	uint32_t start = reader->position++;
+	int32_t index = json_reader_token(reader, object ? JSON_TOKEN_OBJECT : JSON_TOKEN_ARRAY, start);
+	if (index < 0) {
+		return index;
+	}
+	json_reader_space(reader);
+	if (json_reader_peek(reader) == close) {
+		reader->position++;
+	} else {
+		while (1) {
+			int32_t result;
+			if (object) {
+				json_reader_space(reader);
+				if (json_reader_peek(reader) != '"') {
+					return JSON_READER_MALFORMED;
+				}
+				result = json_reader_string(reader);
+				if (result < 0) {
+					return result;
+				}
+				json_reader_space(reader);
+				if (json_reader_peek(reader) != ':') {
+					return JSON_READER_MALFORMED;
+				}
+				reader->position++;
+			}
+			result = json_reader_value(reader, depth + 1);
+			if (result < 0) {
+				return result;
+			}
+			reader->tokens[index].size++;
+			json_reader_space(reader);
+			char c = json_reader_peek(reader);
+			reader->position++;
+			if (c == close) {
+				break;
+			} else if (c != ',') {
+				return JSON_READER_MALFORMED;
+			}
+		}
+	}
+	reader->tokens[index].length = reader->position - start;
+	reader->tokens[index].next = reader->used;
+	return index;
+}
+
+static int32_t json_reader_value(json_reader_t *reader, uint32_t depth) {
+	json_reader_space(reader);
+	switch (json_reader_peek(reader)) {
+	case '{':
+	case '[':
+		return json_reader_container(reader, depth);
+	case '"':
+		return json_reader_string(reader);
+	case 't':
+		return json_reader_literal(reader, "true", JSON_TOKEN_TRUE);
+	case 'f':
+		return json_reader_literal(reader, "false", JSON_TOKEN_FALSE);
+	case 'n':
+		return json_reader_literal(reader, "null", JSON_TOKEN_NULL);
+	default:
+		return json_reader_number(reader);
+	}
+}
+
+int32_t json_reader_parse(const char *json, uint32_t length, json_token_t *tokens, uint32_t count) {
+	json_reader_t reader;
+	reader.json = json;
+	reader.length = length;
+	reader.position = 0;
+	reader.tokens = tokens;
+	reader.count = count;
+	reader.used = 0;
+	int32_t result = json_reader_value(&reader, 0);
+	if (result >= 0) {
+		// nothing but white space may follow
+		json_reader_space(&reader);
+		result = reader.position == length ? reader.used : JSON_READER_MALFORMED;
+	}
+	if (result < 0) {
+		ESP_LOGD(TAG, "error: %d at %u", result, reader.position);
+	}
+	return result;
+}
+
+bool json_reader_equals(const char *json, const json_token_t *token, const char *text) {
+	return strlen(text) == token->length && memcmp(&json[token->start], text, token->length) == 0;
+}
+
+int32_t json_reader_member(const char *json, const json_token_t *tokens, uint32_t object, const char *key) {
+	if (tokens[object].type != JSON_TOKEN_OBJECT) {
+		return -1;
+	}
+	uint32_t index = object + 1;
+	while (index < tokens[object].next) {
+		// a key, then its value
+		uint32_t value = index + 1;
+		if (json_reader_equals(json, &tokens[index], key)) {
+			return value;
+		}
+		index = tokens[value].next;
+	}
+	return -1;
+}
+
+bool json_reader_uint(const char *json, const json_token_t *token, uint32_t *value) {
+	if (token->type != JSON_TOKEN_NUMBER) {
+		return false;
+	}
+	uint64_t number = 0;
+	for (uint32_t i = 0; i < token->length; i++) {
+		char c = json[token->start + i];
+		if (!json_reader_digit(c)) {
+			// negative, fraction or exponent
+			return false;
+		}
+		number = 10 * number + (c - '0');
+		if (number > UINT32_MAX) {
+			return false;
+		}
+	}
+	*value = number;
+	return true;
+}
+
+bool json_reader_bool(const json_token_t *token, bool *value) {
+	if (token->type != JSON_TOKEN_TRUE && token->type != JSON_TOKEN_FALSE) {
+		return false;
+	}
+	*value = token->type == JSON_TOKEN_TRUE;
+	return true;
+}
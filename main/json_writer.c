@@ -0,0 +1,112 @@
+// The author disclaims copyright to this source code.
+#include "json_writer.h"
+#include <string.h>
+#include <assert.h>
+
+static const char JSON_WRITER_HEX[] = "0123456789abcdef";
+
+static void json_writer_escaped(json_writer_t *writer, const char *value) {
+	chunk_writer_t *chunk_writer = &writer->chunk_writer;
+	chunk_writer_put(chunk_writer, '"');
+	for (const char *p = value; *p != 0; p++) {
+		uint8_t c = (uint8_t) *p;
+		if (c == '"' || c == '\\') {
+			chunk_writer_put(chunk_writer, '\\');
+			chunk_writer_put(chunk_writer, c);
+		} else if (c == '\n') {
+			chunk_writer_write(chunk_writer, "\\n", 2);
+		} else if (c == '\r') {
+			chunk_writer_write(chunk_writer, "\\r", 2);
+		} else if (c == '\t') {
+			chunk_writer_write(chunk_writer, "\\t", 2);
+		} else if (c < 0x20) {
+			chunk_writer_write(chunk_writer, "\\u00", 4);
+			chunk_writer_put(chunk_writer, JSON_WRITER_HEX[c >> 4]);
+			chunk_writer_put(chunk_writer, JSON_WRITER_HEX[c & 0x0F]);
+		} else {
+			// UTF-8 passes unchanged
+			chunk_writer_put(chunk_writer, c);
+		}
+	}
+	chunk_writer_put(chunk_writer, '"');
+}
+
+/**
+ * Separator and member name in front of a value.
+ */
+static void json_writer_key(json_writer_t *writer, const char *key) {
+	uint32_t bit = 1 << writer->depth;
+	if (writer->values & bit) {
+		chunk_writer_put(&writer->chunk_writer, ',');
+	}
+	writer->values |= bit;
+	if (key != NULL) {
+		json_writer_escaped(writer, key);
+		chunk_writer_put(&writer->chunk_writer, ':');
+	}
+}
+
+static void json_writer_open(json_writer_t *writer, const char *key, char c) {
+	json_writer_key(writer, key);
+	chunk_writer_put(&writer->chunk_writer, c);
+	assert(writer->depth < JSON_WRITER_MAX_DEPTH - 1);
+	writer->depth++;
+	writer->values &= ~(1 << writer->depth);
+}
+
+static void json_writer_close(json_writer_t *writer, char c) {
+	assert(writer->depth > 0);
+	writer->depth--;
+	chunk_writer_put(&writer->chunk_writer, c);
+}
+
+void json_writer_start(json_writer_t *writer, bool chunked, chunk_writer_output_t output, void *context) {
+	chunk_writer_start(&writer->chunk_writer, chunked, output, context);
+	writer->depth = 0;
+	writer->values = 0;
+}
+
+bool json_writer_finish(json_writer_t *writer) {
+	assert(writer->depth == 0);
+	return chunk_writer_finish(&writer->chunk_writer);
+}
+
+void json_writer_object_start(json_writer_t *writer, const char *key) {
+	json_writer_open(writer, key, '{');
+}
+
+void json_writer_object_end(json_writer_t *writer) {
+	json_writer_close(writer, '}');
+}
+
+void json_writer_array_start(json_writer_t *writer, const char *key) {
+	json_writer_open(writer, key, '[');
+}
+
+void json_writer_array_end(json_writer_t *writer) {
+	json_writer_close(writer, ']');
+}
+
+void json_writer_string(json_writer_t *writer, const char *key, const char *value) {
+	json_writer_key(writer, key);
+	json_writer_escaped(writer, value);
+}
+
+void json_writer_uint(json_writer_t *writer, const char *key, uint64_t value) {
+	json_writer_key(writer, key);
+	chunk_writer_uint(&writer->chunk_writer, value);
+}
+
+void json_writer_int(json_writer_t *writer, const char *key, int64_t value) {
+	json_writer_key(writer, key);
+	chunk_writer_int(&writer->chunk_writer, value);
+}
+
+void json_writer_bool(json_writer_t *writer, const char *key, bool value) {
+	json_writer_key(writer, key);
+	if (value) {
+		chunk_writer_write(&writer->chunk_writer, "true", 4);
+	} else {
+		chunk_writer_write(&writer->chunk_writer, "false", 5);
+	}
+}
@@ -14,27 +14,83 @@
 #include "test_mem.h"
 #include "test_buffer.h"
 #include "test_dsp.h"
+#include "test_icy.h"
+#include "test_jitter.h"
+#include "test_http_request.h"
+#include "test_json_writer.h"
+#include "test_json_reader.h"
+#include "test_control.h"
+#include "test_websocket_frame.h"
+#include "test_telemetry.h"
+#include "test_relay.h"
+#include "test_flow.h"
+#include "test_dns_cache.h"
+#include "test_playlist.h"
+#include "test_www_archive.h"
 #include "blink.h"
 #include "hello.h"
+#include "reader.h"
+#include "prefetch.h"
+#include "flow.h"
+#include "dns_cache.h"
+#include "stream_tls.h"
+#include "icy.h"
+#include "jitter.h"
+#include "favorites.h"
+#include "www_archive.h"
+#include "metrics.h"
+#include "relay.h"
+#include "control.h"
 #include "player.h"
 #include "statistics.h"
 #include "network.h"
 #include "web_server.h"
 #include "websocket_server.h"
+#include "telemetry.h"
 
 static const char* TAG = "main";
 
+#if CONFIG_PREFETCH_BYTES > 0
+// the prefetched neighbours take the upper half of the memory
+#define MAIN_BUFFER_BYTES (CONFIG_MEM_TOTAL_BYTES / 2)
+#else
+#define MAIN_BUFFER_BYTES (CONFIG_MEM_TOTAL_BYTES)
+#endif
+
+#if CONFIG_STREAM_TLS_ENABLED
+// the TLS handshake runs on the stack of the connecting task
+#define MAIN_STREAM_STACK_BYTES (8192)
+#else
+#define MAIN_STREAM_STACK_BYTES (4096)
+#endif
+
 static spi_mem_handle_t main_spi_mem_handle;
 static buffer_handle_t main_buffer_handle;
 static vs1053_handle_t main_vs1053_handle;
+static icy_handle_t main_icy_handle;
+static jitter_handle_t main_jitter_handle;
+static favorites_handle_t main_favorites_handle;
+static prefetch_handle_t main_prefetch_handle;
+static flow_handle_t main_flow_handle;
+static dns_cache_handle_t main_dns_cache_handle;
+static www_archive_handle_t main_www_archive_handle;
+static metrics_handle_t main_metrics_handle;
+static relay_handle_t main_relay_handle;
+static control_handle_t main_control_handle;
+#if CONFIG_READER_ENABLED
+static reader_config_t main_reader_configuration;
+#else
 static hello_config_t main_reader_configuration;
+#endif
 static player_config_t main_player_configuration;
 static test_mem_config_t main_test_mem_configuration;
 static test_dsp_config_t main_test_dsp_configuration;
 static test_buffer_config_t main_test_buffer_configuration;
+static test_relay_config_t main_test_relay_configuration;
+static test_flow_config_t main_test_flow_configuration;
 static statistics_config_t main_statistics_configuration;
 static web_server_config_t main_web_server_configuration;
-static websocket_server_config_t main_websocket_server_configuration;
+static telemetry_config_t main_telemetry_configuration;
 
 static void main_log_configuration() {
 	ESP_LOGD(TAG, ">main_log_configuration");
@@ -90,11 +146,116 @@ static void main_hspi_initialize() {
 static void main_handles_create() {
 	ESP_LOGD(TAG, ">main_handles_create");
 	factory_mem_create(&main_spi_mem_handle);
-	factory_buffer_create(main_spi_mem_handle, CONFIG_MEM_TOTAL_BYTES, &main_buffer_handle);
+	factory_buffer_create(main_spi_mem_handle, MAIN_BUFFER_BYTES, &main_buffer_handle);
 	factory_dsp_create(&main_vs1053_handle);
+	icy_config_t icy_configuration;
+	icy_configuration.metaint = 0;
+	icy_begin(icy_configuration, &main_icy_handle);
+#if CONFIG_PLAYER_ADAPTIVE
+	jitter_config_t jitter_configuration;
+	jitter_configuration.min_ms = CONFIG_PLAYER_TARGET_MIN_MS;
+	jitter_configuration.max_ms = CONFIG_PLAYER_TARGET_MAX_MS;
+	jitter_configuration.underrun_ms = CONFIG_PLAYER_TARGET_UNDERRUN_MS;
+	jitter_begin(jitter_configuration, &main_jitter_handle);
+#else
+	main_jitter_handle = NULL;
+#endif
+	favorites_config_t favorites_configuration;
+#if CONFIG_READER_ENABLED
+	favorites_configuration.url = CONFIG_READER_URL;
+	favorites_configuration.list = CONFIG_READER_FAVORITES;
+#else
+	favorites_configuration.url = "";
+	favorites_configuration.list = "";
+#endif
+	favorites_begin(favorites_configuration, &main_favorites_handle);
+#if CONFIG_FLOW_HIGH_PERCENT > 0
+	flow_config_t flow_configuration;
+	flow_configuration.buffer_handle = main_buffer_handle;
+	flow_configuration.high_percent = CONFIG_FLOW_HIGH_PERCENT;
+	flow_configuration.low_percent = CONFIG_FLOW_LOW_PERCENT;
+	flow_begin(flow_configuration, &main_flow_handle);
+#else
+	main_flow_handle = NULL;
+#endif
+#if CONFIG_DNS_CACHE_ENABLED
+	dns_cache_config_t dns_cache_configuration;
+	dns_cache_configuration.favorites_handle = main_favorites_handle;
+	dns_cache_configuration.persist = true;
+	dns_cache_begin(dns_cache_configuration, &main_dns_cache_handle);
+#else
+	main_dns_cache_handle = NULL;
+#endif
+#if CONFIG_STREAM_TLS_ENABLED
+	stream_tls_begin();
+#endif
+#if CONFIG_PREFETCH_BYTES > 0
+	assert(CONFIG_PREFETCH_BYTES * PREFETCH_SLOTS <= CONFIG_MEM_TOTAL_BYTES - MAIN_BUFFER_BYTES);
+	prefetch_config_t prefetch_configuration;
+	prefetch_configuration.favorites_handle = main_favorites_handle;
+	prefetch_configuration.spi_mem_handle = main_spi_mem_handle;
+	prefetch_configuration.base = MAIN_BUFFER_BYTES;
+	prefetch_configuration.size = CONFIG_PREFETCH_BYTES;
+	// index the same audio per byte as the play buffer
+	prefetch_configuration.frame_index_entries = (uint32_t) (((uint64_t) CONFIG_BUFFER_FRAME_INDEX_ENTRIES
+			* CONFIG_PREFETCH_BYTES) / MAIN_BUFFER_BYTES);
+	prefetch_configuration.dns_cache_handle = main_dns_cache_handle;
+#if CONFIG_FLOW_HIGH_PERCENT > 0
+	// a prefetched region becomes the play buffer at its own size, leave room for a TCP window above the high watermark
+	assert((uint64_t) CONFIG_PREFETCH_BYTES * (100 - CONFIG_FLOW_HIGH_PERCENT) / 100 >= CONFIG_TCP_WND_DEFAULT);
+#endif
+	prefetch_begin(prefetch_configuration, &main_prefetch_handle);
+#else
+	main_prefetch_handle = NULL;
+#endif
+#if CONFIG_RELAY_MAX_LISTENERS > 0
+	// every listener keeps a web server worker, leave one for the UI, the API and the metrics
+	assert(CONFIG_RELAY_MAX_LISTENERS < CONFIG_WEB_SERVER_WORKERS);
+	relay_config_t relay_configuration;
+	relay_configuration.buffer_handle = main_buffer_handle;
+	relay_configuration.max_listeners = CONFIG_RELAY_MAX_LISTENERS;
+	relay_configuration.max_skips = CONFIG_RELAY_MAX_SKIPS;
+	relay_configuration.idle_timeout_ms = CONFIG_RELAY_IDLE_TIMEOUT_MS;
+	relay_begin(relay_configuration, &main_relay_handle);
+#else
+	main_relay_handle = NULL;
+#endif
+	control_config_t control_configuration;
+	control_configuration.favorites_handle = main_favorites_handle;
+	control_configuration.buffer_handle = main_buffer_handle;
+	control_begin(control_configuration, &main_control_handle);
+	metrics_config_t metrics_configuration;
+	metrics_configuration.buffer_handle = main_buffer_handle;
+	metrics_configuration.vs1053_handle = main_vs1053_handle;
+	metrics_configuration.jitter_handle = main_jitter_handle;
+	metrics_configuration.relay_handle = main_relay_handle;
+	metrics_configuration.control_handle = main_control_handle;
+	metrics_configuration.prefetch_handle = main_prefetch_handle;
+	metrics_configuration.flow_handle = main_flow_handle;
+	metrics_configuration.dns_cache_handle = main_dns_cache_handle;
+	metrics_begin(metrics_configuration, &main_metrics_handle);
+	main_www_archive_handle = NULL;
+#if CONFIG_WEB_SERVER_ASSETS_PARTITION
+	// the web server still works without, minus the user interface
+	www_archive_config_t www_archive_configuration;
+	www_archive_configuration.label = CONFIG_WEB_SERVER_ASSETS_PARTITION_LABEL;
+	if (www_archive_begin(www_archive_configuration, &main_www_archive_handle) != ESP_OK) {
+		main_www_archive_handle = NULL;
+	}
+#endif
 	ESP_LOGD(TAG, "main_spi_mem_handle: %p", main_spi_mem_handle);
 	ESP_LOGD(TAG, "main_buffer_handle: %p", main_buffer_handle);
 	ESP_LOGD(TAG, "main_vs1053_handle: %p", main_vs1053_handle);
+	ESP_LOGD(TAG, "main_icy_handle: %p", main_icy_handle);
+	ESP_LOGD(TAG, "main_jitter_handle: %p", main_jitter_handle);
+	ESP_LOGD(TAG, "main_favorites_handle: %p", main_favorites_handle);
+	ESP_LOGD(TAG, "main_prefetch_handle: %p", main_prefetch_handle);
+	ESP_LOGD(TAG, "main_flow_handle: %p", main_flow_handle);
+	ESP_LOGD(TAG, "main_dns_cache_handle: %p", main_dns_cache_handle);
+	ESP_LOGD(TAG, "main_metrics_handle: %p", main_metrics_handle);
+	ESP_LOGD(TAG, "main_relay_handle: %p", main_relay_handle);
+	ESP_LOGD(TAG, "main_control_handle: %p", main_control_handle);
+	ESP_LOGD(TAG, "main_www_archive_handle: %p", main_www_archive_handle);
 	ESP_LOGD(TAG, "<main_handles_create");
 }
 
@@ -127,40 +288,173 @@ void app_main() {
 		return;
 	}
 
+	// test relay listeners (uses buffer)
+	main_test_relay_configuration.buffer_handle = main_buffer_handle;
+	if (test_relay(main_test_relay_configuration) != ESP_OK) {
+		return;
+	}
+
+	// test flow control (uses buffer)
+	main_test_flow_configuration.buffer_handle = main_buffer_handle;
+	if (test_flow(main_test_flow_configuration) != ESP_OK) {
+		return;
+	}
+
 	// test dsp
 	main_test_dsp_configuration.vs1053_handle = main_vs1053_handle;
 	if (test_dsp(main_test_dsp_configuration) != ESP_OK) {
 		return;
 	}
 
+	// test metadata demultiplexer
+	if (test_icy() != ESP_OK) {
+		return;
+	}
+
+	// test jitter buffer target
+	if (test_jitter() != ESP_OK) {
+		return;
+	}
+
+	// test http request parser
+	if (test_http_request() != ESP_OK) {
+		return;
+	}
+
+	// test json writer
+	if (test_json_writer() != ESP_OK) {
+		return;
+	}
+
+	// test json reader
+	if (test_json_reader() != ESP_OK) {
+		return;
+	}
+
+	// test control command parser
+	if (test_control() != ESP_OK) {
+		return;
+	}
+
+	// test web asset archive validation
+	if (test_www_archive() != ESP_OK) {
+		return;
+	}
+
+	// test websocket frame parser
+	if (test_websocket_frame() != ESP_OK) {
+		return;
+	}
+
+	// test telemetry encoding
+	if (test_telemetry() != ESP_OK) {
+		return;
+	}
+
+	// test name server response parser
+	if (test_dns_cache() != ESP_OK) {
+		return;
+	}
+
+	// test playlist parser and mirror ranking
+	if (test_playlist() != ESP_OK) {
+		return;
+	}
+
 	network_begin();
 
+	// watched for stack usage
+	TaskHandle_t task;
+
 	// blink task
-	xTaskCreate(&blink_task, "blink_task", 2048, NULL, 5, NULL);
+	xTaskCreate(&blink_task, "blink_task", 2048, NULL, 5, &task);
+	metrics_add_task(main_metrics_handle, task);
 
+#if CONFIG_READER_ENABLED
+	// reader task
+	main_reader_configuration.buffer_handle = main_buffer_handle;
+	main_reader_configuration.icy_handle = main_icy_handle;
+	main_reader_configuration.jitter_handle = main_jitter_handle;
+	main_reader_configuration.favorites_handle = main_favorites_handle;
+	main_reader_configuration.prefetch_handle = main_prefetch_handle;
+	main_reader_configuration.flow_handle = main_flow_handle;
+	main_reader_configuration.dns_cache_handle = main_dns_cache_handle;
+	xTaskCreatePinnedToCore(&reader_task, "reader_task", MAIN_STREAM_STACK_BYTES, &main_reader_configuration, 5, &task, 1);
+	metrics_add_task(main_metrics_handle, task);
+#if CONFIG_DNS_CACHE_ENABLED
+	// dns cache task, refreshes in the background
+	xTaskCreate(&dns_cache_task, "dns_cache_task", 3072, main_dns_cache_handle, 1, &task);
+	metrics_add_task(main_metrics_handle, task);
+#endif
+#if CONFIG_PREFETCH_BYTES > 0
+	// prefetch task, below the reader
+	xTaskCreatePinnedToCore(&prefetch_task, "prefetch_task", MAIN_STREAM_STACK_BYTES, main_prefetch_handle, 4, &task, 1);
+	metrics_add_task(main_metrics_handle, task);
+#endif
+#else
 	// hello task
 	main_reader_configuration.buffer_handle = main_buffer_handle;
-	xTaskCreatePinnedToCore(&hello_task, "hello_task", 4096, &main_reader_configuration, 5, NULL, 1);
+	xTaskCreatePinnedToCore(&hello_task, "hello_task", 4096, &main_reader_configuration, 5, &task, 1);
+	metrics_add_task(main_metrics_handle, task);
+#endif
 
 	// player task
 	main_player_configuration.buffer_handle = main_buffer_handle;
 	main_player_configuration.vs1053_handle = main_vs1053_handle;
-	xTaskCreatePinnedToCore(&player_task, "player_task", 4096, &main_player_configuration, 5, NULL, 0);
+	main_player_configuration.start_threshold = CONFIG_PLAYER_START_THRESHOLD;
+	main_player_configuration.resume_threshold = CONFIG_PLAYER_RESUME_THRESHOLD;
+#if CONFIG_PLAYER_THRESHOLD_MS
+	main_player_configuration.threshold_ms = true;
+#else
+	main_player_configuration.threshold_ms = false;
+#endif
+	main_player_configuration.jitter_handle = main_jitter_handle;
+	main_player_configuration.volume = CONFIG_PLAYER_VOLUME;
+	xTaskCreatePinnedToCore(&player_task, "player_task", 4096, &main_player_configuration, 5, &task, 0);
+	metrics_add_task(main_metrics_handle, task);
 
 	// statistics task
 	main_statistics_configuration.buffer_handle = main_buffer_handle;
-	xTaskCreate(&statistics_task, "statistics_task", 4096, &main_statistics_configuration, 0, NULL);
-
-	// websocket process task
-	xTaskCreatePinnedToCore(&websocket_process_task, "websocket_process_task", 4096, NULL, 1, NULL, 1);
+	xTaskCreate(&statistics_task, "statistics_task", 4096, &main_statistics_configuration, 0, &task);
+	metrics_add_task(main_metrics_handle, task);
 
 	// web server task
 	main_web_server_configuration.port = CONFIG_WEB_SERVER_PORT;
-	xTaskCreatePinnedToCore(&web_server_task, "web_server_task", 4096, &main_web_server_configuration, 1, NULL, 1);
+	main_web_server_configuration.workers = CONFIG_WEB_SERVER_WORKERS;
+	main_web_server_configuration.max_connections = CONFIG_WEB_SERVER_MAX_CONNECTIONS;
+	main_web_server_configuration.idle_timeout_ms = CONFIG_WEB_SERVER_IDLE_TIMEOUT_MS;
+	main_web_server_configuration.archive_handle = main_www_archive_handle;
+	main_web_server_configuration.icy_handle = main_icy_handle;
+	main_web_server_configuration.buffer_handle = main_buffer_handle;
+	main_web_server_configuration.jitter_handle = main_jitter_handle;
+	main_web_server_configuration.favorites_handle = main_favorites_handle;
+	main_web_server_configuration.metrics_handle = main_metrics_handle;
+	main_web_server_configuration.relay_handle = main_relay_handle;
+	main_web_server_configuration.control_handle = main_control_handle;
+	xTaskCreatePinnedToCore(&web_server_task, "web_server_task", 4096, &main_web_server_configuration, 1, &task, 1);
+	metrics_add_task(main_metrics_handle, task);
 
 	// websocket server task
-	main_websocket_server_configuration.port = CONFIG_WEBSOCKET_SERVER_PORT;
-	xTaskCreatePinnedToCore(&websocket_server_task, "websocket_server_task", 8192, &main_websocket_server_configuration, 1, NULL, 1);
+	// the state before the task, telemetry publishes right away
+	websocket_server_config_t websocket_server_configuration;
+	websocket_server_configuration.port = CONFIG_WEBSOCKET_SERVER_PORT;
+	websocket_server_configuration.max_clients = CONFIG_WEBSOCKET_SERVER_MAX_CLIENTS;
+	websocket_server_configuration.message_max_length = CONFIG_WEBSOCKET_SERVER_MESSAGE_MAX_LENGTH;
+	websocket_server_configuration.message_buffers = CONFIG_WEBSOCKET_SERVER_MESSAGE_BUFFERS;
+	websocket_server_configuration.send_queue_length = CONFIG_WEBSOCKET_SERVER_SEND_QUEUE_LENGTH;
+	websocket_server_configuration.lag_timeout_ms = CONFIG_WEBSOCKET_SERVER_LAG_TIMEOUT_MS;
+	websocket_server_configuration.metrics_handle = main_metrics_handle;
+	websocket_server_configuration.control_handle = main_control_handle;
+	websocket_server_begin(websocket_server_configuration);
+	xTaskCreatePinnedToCore(&websocket_server_task, "websocket_server_task", 4096, NULL, 1, &task, 1);
+	metrics_add_task(main_metrics_handle, task);
+
+	// telemetry task
+	main_telemetry_configuration.buffer_handle = main_buffer_handle;
+	main_telemetry_configuration.icy_handle = main_icy_handle;
+	main_telemetry_configuration.interval_ms = CONFIG_TELEMETRY_INTERVAL_MS;
+	xTaskCreate(&telemetry_task, "telemetry_task", 3072, &main_telemetry_configuration, 1, &task);
+	metrics_add_task(main_metrics_handle, task);
 
 	// tasks are still running, never free resources
 	ESP_LOGD(TAG, "<app_main");
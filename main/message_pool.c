@@ -0,0 +1,61 @@
+// The author disclaims copyright to this source code.
+#include "message_pool.h"
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "message_pool";
+
+void message_pool_begin(message_pool_config_t config, message_pool_handle_t *handle) {
+	ESP_LOGD(TAG, ">message_pool_begin");
+	ESP_LOGD(TAG, "count: %u", config.count);
+	ESP_LOGD(TAG, "size: %u", config.size);
+	assert(config.count > 0);
+
+	message_pool_handle_t message_pool_handle = malloc(sizeof(struct message_pool_t));
+	assert(message_pool_handle != NULL);
+	memset(message_pool_handle, 0, sizeof(struct message_pool_t));
+	message_pool_handle->count = config.count;
+	message_pool_handle->size = config.size;
+	message_pool_handle->buffers = malloc(config.count * config.size);
+	assert(message_pool_handle->buffers != NULL);
+	message_pool_handle->free_queue = xQueueCreate(config.count, sizeof(uint8_t *));
+	assert(message_pool_handle->free_queue != NULL);
+	for (uint32_t i = 0; i < config.count; i++) {
+		uint8_t *buffer = &message_pool_handle->buffers[i * config.size];
+		assert(xQueueSendToBack(message_pool_handle->free_queue, &buffer, 0) == pdTRUE);
+	}
+
+	*handle = message_pool_handle;
+
+	ESP_LOGD(TAG, "<message_pool_begin");
+}
+
+void message_pool_end(message_pool_handle_t handle) {
+	ESP_LOGD(TAG, ">message_pool_end");
+	assert(uxQueueMessagesWaiting(handle->free_queue) == handle->count);
+	vQueueDelete(handle->free_queue);
+	free(handle->buffers);
+	free(handle);
+	ESP_LOGD(TAG, "<message_pool_end");
+}
+
+uint8_t *message_pool_take(message_pool_handle_t handle, uint32_t wait_ms) {
+	uint8_t *buffer;
+	if (xQueueReceive(handle->free_queue, &buffer, wait_ms / portTICK_PERIOD_MS) != pdTRUE) {
+		return NULL;
+	}
+	return buffer;
+}
+
+void message_pool_give(message_pool_handle_t handle, uint8_t *buffer) {
+	assert(buffer >= handle->buffers && buffer < &handle->buffers[handle->count * handle->size]);
+	// there is room for every buffer, this does not block
+	assert(xQueueSendToBack(handle->free_queue, &buffer, 0) == pdTRUE);
+}
+
+uint32_t message_pool_available(message_pool_handle_t handle) {
+	return uxQueueMessagesWaiting(handle->free_queue);
+}
@@ -0,0 +1,499 @@
+// The author disclaims copyright to this source code.
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "player.h"
+#include "reader.h"
+#include "stream_tls.h"
+#include "websocket_server.h"
+
+#include "lwip/stats.h"
+#include "lwip/memp.h"
+
+static const char* TAG = "metrics";
+
+static const char METRICS_PREFIX[] = "netradio_";
+static const char METRICS_COUNTER[] = "counter";
+static const char METRICS_GAUGE[] = "gauge";
+/** Most WebSocket clients configurable. */
+#define METRICS_MAX_WEBSOCKET_CLIENTS (8)
+
+/**
+ * # HELP name help
+ * # TYPE name type
+ */
+static void metrics_family(chunk_writer_t *writer, const char *name, const char *type, const char *help) {
+	chunk_writer_text(writer, "# HELP ");
+	chunk_writer_text(writer, METRICS_PREFIX);
+	chunk_writer_text(writer, name);
+	chunk_writer_put(writer, ' ');
+	chunk_writer_text(writer, help);
+	chunk_writer_text(writer, "\n# TYPE ");
+	chunk_writer_text(writer, METRICS_PREFIX);
+	chunk_writer_text(writer, name);
+	chunk_writer_put(writer, ' ');
+	chunk_writer_text(writer, type);
+	chunk_writer_put(writer, '\n');
+}
+
+/**
+ * name{label="value"} up to the value, label may be NULL.
+ * Label values are known names, not escaped.
+ */
+static void metrics_sample(chunk_writer_t *writer, const char *name, const char *label, const char *value) {
+	chunk_writer_text(writer, METRICS_PREFIX);
+	chunk_writer_text(writer, name);
+	if (label != NULL) {
+		chunk_writer_put(writer, '{');
+		chunk_writer_text(writer, label);
+		chunk_writer_text(writer, "=\"");
+		chunk_writer_text(writer, value);
+		chunk_writer_text(writer, "\"}");
+	}
+	chunk_writer_put(writer, ' ');
+}
+
+static void metrics_uint(chunk_writer_t *writer, const char *name, const char *label, const char *value,
+		uint64_t number) {
+	metrics_sample(writer, name, label, value);
+	chunk_writer_uint(writer, number);
+	chunk_writer_put(writer, '\n');
+}
+
+static void metrics_int(chunk_writer_t *writer, const char *name, const char *label, const char *value,
+		int64_t number) {
+	metrics_sample(writer, name, label, value);
+	chunk_writer_int(writer, number);
+	chunk_writer_put(writer, '\n');
+}
+
+/**
+ * Microseconds as seconds, without floating point.
+ */
+static void metrics_seconds(chunk_writer_t *writer, const char *name, const char *label, const char *value,
+		uint64_t us) {
+	metrics_sample(writer, name, label, value);
+	chunk_writer_uint(writer, us / 1000000);
+	chunk_writer_put(writer, '.');
+	uint32_t fraction = us % 1000000;
+	for (uint32_t digit = 100000; digit > 0; digit /= 10) {
+		chunk_writer_put(writer, '0' + (fraction / digit) % 10);
+	}
+	chunk_writer_put(writer, '\n');
+}
+
+/**
+ * Counter family with one sample.
+ */
+static void metrics_counter(chunk_writer_t *writer, const char *name, const char *help, uint64_t number) {
+	metrics_family(writer, name, METRICS_COUNTER, help);
+	metrics_uint(writer, name, NULL, NULL, number);
+}
+
+/**
+ * Gauge family with one sample.
+ */
+static void metrics_gauge(chunk_writer_t *writer, const char *name, const char *help, uint64_t number) {
+	metrics_family(writer, name, METRICS_GAUGE, help);
+	metrics_uint(writer, name, NULL, NULL, number);
+}
+
+static void metrics_write_buffer(metrics_handle_t handle, chunk_writer_t *writer) {
+	buffer_counters_t counters;
+	buffer_get_counters(handle->buffer_handle, &counters);
+	metrics_counter(writer, "buffer_push_bytes_total", "Bytes pushed into the buffer.", counters.push_bytes);
+	metrics_counter(writer, "buffer_pull_bytes_total", "Bytes pulled from the buffer.", counters.pull_bytes);
+	metrics_counter(writer, "buffer_pushes_total", "Pushes into the buffer.", counters.push_count);
+	metrics_counter(writer, "buffer_pulls_total", "Pulls from the buffer.", counters.pull_count);
+	metrics_counter(writer, "buffer_overflows_total", "Pushes that did not fit.", counters.overflow_count);
+	metrics_counter(writer, "buffer_overflow_bytes_total", "Bytes dropped because they did not fit.",
+			counters.overflow_bytes);
+	metrics_counter(writer, "buffer_underruns_total", "Pulls that found too little data.", counters.underrun_count);
+	metrics_counter(writer, "buffer_underrun_bytes_total", "Bytes missing in pulls.", counters.underrun_bytes);
+	metrics_counter(writer, "buffer_blocks_total", "Transfers that had to wait.", counters.block_count);
+	metrics_gauge(writer, "buffer_size_bytes", "Buffer size.", handle->buffer_handle->size);
+	metrics_gauge(writer, "buffer_available_bytes", "Bytes in the buffer.", buffer_available(handle->buffer_handle));
+	metrics_family(writer, "buffer_duration_seconds", METRICS_GAUGE, "Play time in the buffer.");
+	metrics_seconds(writer, "buffer_duration_seconds", NULL, NULL, buffer_duration_ms(handle->buffer_handle) * 1000ULL);
+}
+
+static void metrics_write_player(metrics_handle_t handle, chunk_writer_t *writer) {
+	player_statistics_t statistics;
+	player_get_statistics(&statistics);
+	metrics_family(writer, "player_state", METRICS_GAUGE, "Current player state, 1 for the active state.");
+	for (int state = 0; state < PLAYER_STATE_COUNT; state++) {
+		metrics_uint(writer, "player_state", "state", player_state_name(state), statistics.state == state);
+	}
+	metrics_family(writer, "player_state_entered_total", METRICS_COUNTER, "Times a player state was entered.");
+	for (int state = 0; state < PLAYER_STATE_COUNT; state++) {
+		metrics_uint(writer, "player_state_entered_total", "state", player_state_name(state), statistics.count[state]);
+	}
+	metrics_family(writer, "player_state_seconds_total", METRICS_COUNTER, "Time spent in a player state.");
+	for (int state = 0; state < PLAYER_STATE_COUNT; state++) {
+		metrics_seconds(writer, "player_state_seconds_total", "state", player_state_name(state),
+				statistics.time_us[state]);
+	}
+	if (handle->jitter_handle != NULL) {
+		metrics_family(writer, "player_target_seconds", METRICS_GAUGE, "Adaptive buffer level to start playing.");
+		metrics_seconds(writer, "player_target_seconds", NULL, NULL, jitter_target_ms(handle->jitter_handle) * 1000ULL);
+	}
+	metrics_gauge(writer, "player_volume", "Volume (0-100).", player_get_volume());
+	metrics_gauge(writer, "player_muted", "Output silenced, 1 when muted.", player_get_mute());
+	metrics_counter(writer, "player_volume_writes_total", "Volume and mute requests written to the decoder.",
+			statistics.volume_write_count);
+	metrics_family(writer, "player_volume_latency_seconds_total", METRICS_COUNTER,
+			"Time from volume or mute request to decoder register write.");
+	metrics_seconds(writer, "player_volume_latency_seconds_total", NULL, NULL, statistics.volume_latency_us);
+	metrics_family(writer, "player_volume_latency_max_seconds", METRICS_GAUGE,
+			"Longest time from volume or mute request to decoder register write.");
+	metrics_seconds(writer, "player_volume_latency_max_seconds", NULL, NULL, statistics.volume_latency_max_us);
+	metrics_counter(writer, "player_switches_total", "Station switches.", statistics.switch_count);
+	metrics_counter(writer, "player_switch_resets_total", "Station switches that needed a decoder reset.",
+			statistics.switch_reset_count);
+	metrics_family(writer, "player_switch_seconds_total", METRICS_COUNTER,
+			"Time from station switch until the decoder is ready.");
+	metrics_seconds(writer, "player_switch_seconds_total", NULL, NULL, statistics.switch_us);
+	metrics_family(writer, "player_switch_max_seconds", METRICS_GAUGE,
+			"Longest time from station switch until the decoder is ready.");
+	metrics_seconds(writer, "player_switch_max_seconds", NULL, NULL, statistics.switch_max_us);
+	metrics_counter(writer, "player_switch_audio_total", "Station switches that reached the decoder.",
+			statistics.switch_audio_count);
+	metrics_family(writer, "player_switch_audio_seconds_total", METRICS_COUNTER,
+			"Time from station switch until the first data of the next station reached the decoder.");
+	metrics_seconds(writer, "player_switch_audio_seconds_total", NULL, NULL, statistics.switch_audio_us);
+	metrics_family(writer, "player_switch_audio_max_seconds", METRICS_GAUGE,
+			"Longest time from station switch until the first data of the next station reached the decoder.");
+	metrics_seconds(writer, "player_switch_audio_max_seconds", NULL, NULL, statistics.switch_audio_max_us);
+	metrics_family(writer, "player_first_audio_seconds", METRICS_GAUGE,
+			"Time from startup until the first audio reached the decoder, 0 before.");
+	metrics_seconds(writer, "player_first_audio_seconds", NULL, NULL, statistics.first_audio_us);
+}
+
+static void metrics_write_spi(metrics_handle_t handle, chunk_writer_t *writer) {
+	spi_mem_statistics_t mem;
+	spi_mem_get_statistics(handle->buffer_handle->spi_mem_handle, &mem);
+	vs1053_spi_statistics_t control;
+	vs1053_spi_statistics_t data;
+	vs1053_get_statistics(handle->vs1053_handle, &control, &data);
+	// the samples of a family must be together
+	metrics_family(writer, "spi_transactions_total", METRICS_COUNTER, "SPI transactions.");
+	metrics_uint(writer, "spi_transactions_total", "device", "mem", mem.count);
+	metrics_uint(writer, "spi_transactions_total", "device", "dsp_control", control.count);
+	metrics_uint(writer, "spi_transactions_total", "device", "dsp_data", data.count);
+	metrics_family(writer, "spi_transaction_seconds_total", METRICS_COUNTER, "Time spent in SPI transactions.");
+	metrics_seconds(writer, "spi_transaction_seconds_total", "device", "mem", mem.time_us);
+	metrics_seconds(writer, "spi_transaction_seconds_total", "device", "dsp_control", control.time_us);
+	metrics_seconds(writer, "spi_transaction_seconds_total", "device", "dsp_data", data.time_us);
+	metrics_family(writer, "spi_transaction_max_seconds", METRICS_GAUGE, "Longest SPI transaction.");
+	metrics_seconds(writer, "spi_transaction_max_seconds", "device", "mem", mem.max_us);
+	metrics_seconds(writer, "spi_transaction_max_seconds", "device", "dsp_control", control.max_us);
+	metrics_seconds(writer, "spi_transaction_max_seconds", "device", "dsp_data", data.max_us);
+	vs1053_queue_statistics_t queue;
+	vs1053_get_queue_statistics(handle->vs1053_handle, &queue);
+	metrics_gauge(writer, "dsp_sci_queue_depth", "Decoder register writes waiting.", queue.depth);
+	metrics_counter(writer, "dsp_sci_queued_total", "Decoder register writes queued.", queue.queue_count);
+	metrics_counter(writer, "dsp_sci_coalesced_total", "Queued decoder register writes replaced by a newer one.",
+			queue.coalesce_count);
+	metrics_counter(writer, "dsp_sci_writes_total", "Queued decoder register writes applied.", queue.write_count);
+	metrics_family(writer, "dsp_sci_wait_seconds_total", METRICS_COUNTER,
+			"Time from queueing to writing a decoder register.");
+	metrics_seconds(writer, "dsp_sci_wait_seconds_total", NULL, NULL, queue.wait_us);
+	metrics_family(writer, "dsp_sci_wait_max_seconds", METRICS_GAUGE,
+			"Longest time from queueing to writing a decoder register.");
+	metrics_seconds(writer, "dsp_sci_wait_max_seconds", NULL, NULL, queue.wait_max_us);
+}
+
+static void metrics_write_relay(metrics_handle_t handle, chunk_writer_t *writer) {
+	relay_statistics_t statistics;
+	relay_get_statistics(handle->relay_handle, &statistics);
+	metrics_gauge(writer, "relay_listeners", "Listeners served now.", statistics.listeners);
+	metrics_counter(writer, "relay_listens_total", "Listeners served.", statistics.listen_count);
+	metrics_counter(writer, "relay_drops_total", "Listeners dropped, too slow or idle.", statistics.drop_count);
+	metrics_counter(writer, "relay_skips_total", "Times a listener fell behind and skipped.", statistics.skip_count);
+	metrics_counter(writer, "relay_skip_bytes_total", "Bytes skipped by listeners.", statistics.skip_bytes);
+	metrics_counter(writer, "relay_send_bytes_total", "Bytes sent to listeners.", statistics.send_bytes);
+}
+
+static void metrics_write_control(metrics_handle_t handle, chunk_writer_t *writer) {
+	control_statistics_t statistics;
+	control_get_statistics(handle->control_handle, &statistics);
+	metrics_family(writer, "control_commands_total", METRICS_COUNTER, "Control commands executed.");
+	for (int type = 0; type < CONTROL_COUNT; type++) {
+		metrics_uint(writer, "control_commands_total", "command", control_command_name(type), statistics.count[type]);
+	}
+	metrics_counter(writer, "control_errors_total", "Control commands refused.", statistics.error_count);
+	metrics_family(writer, "control_latency_seconds_total", METRICS_COUNTER,
+			"Time from receiving to executing a control command.");
+	for (int type = 0; type < CONTROL_COUNT; type++) {
+		metrics_seconds(writer, "control_latency_seconds_total", "command", control_command_name(type),
+				statistics.latency_us[type]);
+	}
+	metrics_family(writer, "control_latency_max_seconds", METRICS_GAUGE,
+			"Longest time from receiving to executing a control command.");
+	for (int type = 0; type < CONTROL_COUNT; type++) {
+		metrics_seconds(writer, "control_latency_max_seconds", "command", control_command_name(type),
+				statistics.latency_max_us[type]);
+	}
+}
+
+static void metrics_write_prefetch(metrics_handle_t handle, chunk_writer_t *writer) {
+	prefetch_statistics_t statistics;
+	prefetch_get_statistics(handle->prefetch_handle, &statistics);
+	metrics_counter(writer, "prefetch_hits_total", "Station switches served from a prefetched stream.",
+			statistics.hit_count);
+	metrics_counter(writer, "prefetch_misses_total", "Station switches that had to connect.", statistics.miss_count);
+	metrics_counter(writer, "prefetch_connects_total", "Prefetch connections made.", statistics.connect_count);
+	metrics_counter(writer, "prefetch_errors_total", "Prefetch connections lost or refused.", statistics.error_count);
+	metrics_family(writer, "prefetch_duration_seconds", METRICS_GAUGE, "Play time prefetched.");
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		char name[2] = { '0' + i, 0 };
+		metrics_seconds(writer, "prefetch_duration_seconds", "slot", name, statistics.duration_ms[i] * 1000ULL);
+	}
+}
+
+static void metrics_write_flow(metrics_handle_t handle, chunk_writer_t *writer) {
+	flow_statistics_t statistics;
+	flow_get_statistics(handle->flow_handle, &statistics);
+	metrics_gauge(writer, "reader_throttled", "Receiving stopped, the buffer is full, 1 when stopped.",
+			statistics.throttled);
+	metrics_counter(writer, "reader_throttles_total", "Times receiving stopped.", statistics.throttle_count);
+	metrics_family(writer, "reader_throttled_seconds_total", METRICS_COUNTER,
+			"Time receiving was stopped, the TCP receive window closed.");
+	metrics_seconds(writer, "reader_throttled_seconds_total", NULL, NULL, statistics.throttled_us);
+}
+
+#if CONFIG_READER_ENABLED
+static void metrics_write_reader(chunk_writer_t *writer) {
+	reader_statistics_t statistics;
+	reader_get_statistics(&statistics);
+	metrics_family(writer, "reader_first_bytes_total", METRICS_COUNTER,
+			"Connections that received data, by origin of the address.");
+	metrics_uint(writer, "reader_first_bytes_total", "dns", "cache", statistics.first_byte_cached_count);
+	metrics_uint(writer, "reader_first_bytes_total", "dns", "lookup", statistics.first_byte_lookup_count);
+	metrics_family(writer, "reader_first_byte_seconds_total", METRICS_COUNTER,
+			"Time from connect until the first data, by origin of the address.");
+	metrics_seconds(writer, "reader_first_byte_seconds_total", "dns", "cache", statistics.first_byte_cached_us);
+	metrics_seconds(writer, "reader_first_byte_seconds_total", "dns", "lookup", statistics.first_byte_lookup_us);
+	metrics_family(writer, "reader_first_byte_last_seconds", METRICS_GAUGE,
+			"Time from the last connect until the first data.");
+	metrics_seconds(writer, "reader_first_byte_last_seconds", NULL, NULL, statistics.first_byte_last_us);
+	metrics_counter(writer, "reader_spare_connects_total", "Spare connections made while a stream stalled.",
+			statistics.spare_count);
+	metrics_counter(writer, "reader_spare_used_total", "Spare connections that took over a stalled stream.",
+			statistics.spare_use_count);
+	metrics_counter(writer, "reader_failovers_total", "Switches to another mirror, the stream was too slow.",
+			statistics.failover_count);
+	metrics_family(writer, "reader_failover_buffer_seconds_total", METRICS_COUNTER,
+			"Play time in the buffer at the failovers, summed.");
+	metrics_seconds(writer, "reader_failover_buffer_seconds_total", NULL, NULL,
+			statistics.failover_level_ms_total * 1000ULL);
+	metrics_family(writer, "reader_failover_last_buffer_seconds", METRICS_GAUGE,
+			"Play time in the buffer at the last failover.");
+	metrics_seconds(writer, "reader_failover_last_buffer_seconds", NULL, NULL,
+			statistics.failover_level_last_ms * 1000ULL);
+	metrics_family(writer, "reader_failover_min_buffer_seconds", METRICS_GAUGE,
+			"Least play time in the buffer at a failover.");
+	metrics_seconds(writer, "reader_failover_min_buffer_seconds", NULL, NULL,
+			statistics.failover_level_min_ms * 1000ULL);
+	metrics_gauge(writer, "reader_mirrors", "Mirrors in the playlist of the selected favorite, 0 when not a playlist.",
+			statistics.mirror_count);
+	metrics_gauge(writer, "reader_mirror_active", "Mirror playing, its position in the playlist.",
+			statistics.mirror_active);
+}
+#endif
+
+#if CONFIG_STREAM_TLS_ENABLED
+static void metrics_write_tls(chunk_writer_t *writer) {
+	stream_tls_statistics_t statistics;
+	stream_tls_get_statistics(&statistics);
+	metrics_family(writer, "stream_tls_handshakes_total", METRICS_COUNTER,
+			"TLS handshakes, full or resumed from a kept session.");
+	metrics_uint(writer, "stream_tls_handshakes_total", "session", "full", statistics.full_count);
+	metrics_uint(writer, "stream_tls_handshakes_total", "session", "resumed", statistics.resumed_count);
+	metrics_family(writer, "stream_tls_handshake_seconds_total", METRICS_COUNTER, "Time spent in TLS handshakes.");
+	metrics_seconds(writer, "stream_tls_handshake_seconds_total", "session", "full", statistics.full_us);
+	metrics_seconds(writer, "stream_tls_handshake_seconds_total", "session", "resumed", statistics.resumed_us);
+	metrics_family(writer, "stream_tls_handshake_max_seconds", METRICS_GAUGE, "Longest TLS handshake.");
+	metrics_seconds(writer, "stream_tls_handshake_max_seconds", "session", "full", statistics.full_max_us);
+	metrics_seconds(writer, "stream_tls_handshake_max_seconds", "session", "resumed", statistics.resumed_max_us);
+	metrics_counter(writer, "stream_tls_errors_total", "TLS handshakes that failed.", statistics.error_count);
+}
+#endif
+
+static void metrics_write_dns_cache(metrics_handle_t handle, chunk_writer_t *writer) {
+	dns_cache_statistics_t statistics;
+	dns_cache_get_statistics(handle->dns_cache_handle, &statistics);
+	metrics_counter(writer, "dns_cache_hits_total", "Addresses resolved from the cache.", statistics.hit_count);
+	metrics_counter(writer, "dns_cache_stale_total", "Addresses resolved from the cache after they expired.",
+			statistics.stale_count);
+	metrics_counter(writer, "dns_cache_misses_total", "Addresses that had to wait for the name server.",
+			statistics.miss_count);
+	metrics_counter(writer, "dns_cache_queries_total", "Name server queries sent.", statistics.query_count);
+	metrics_counter(writer, "dns_cache_errors_total", "Hosts not resolved.", statistics.error_count);
+	metrics_counter(writer, "dns_cache_persists_total", "Addresses written to NVS.", statistics.persist_count);
+}
+
+#if LWIP_STATS && MEMP_STATS
+/**
+ * The pbuf pool, and the pbuf headers that refer to Wi-Fi receive buffers.
+ */
+static void metrics_write_lwip(chunk_writer_t *writer) {
+	struct stats_mem pool = *lwip_stats.memp[MEMP_PBUF_POOL];
+	struct stats_mem ref = *lwip_stats.memp[MEMP_PBUF];
+	metrics_family(writer, "lwip_pbufs_used", METRICS_GAUGE, "Pbufs in use.");
+	metrics_uint(writer, "lwip_pbufs_used", "pool", "pbuf_pool", pool.used);
+	metrics_uint(writer, "lwip_pbufs_used", "pool", "pbuf", ref.used);
+	metrics_family(writer, "lwip_pbufs_max_used", METRICS_GAUGE, "Most pbufs in use since startup.");
+	metrics_uint(writer, "lwip_pbufs_max_used", "pool", "pbuf_pool", pool.max);
+	metrics_uint(writer, "lwip_pbufs_max_used", "pool", "pbuf", ref.max);
+	metrics_family(writer, "lwip_pbuf_errors_total", METRICS_COUNTER, "Pbuf allocations that failed.");
+	metrics_uint(writer, "lwip_pbuf_errors_total", "pool", "pbuf_pool", pool.err);
+	metrics_uint(writer, "lwip_pbuf_errors_total", "pool", "pbuf", ref.err);
+	metrics_gauge(writer, "lwip_pbuf_pool_minimum_free", "Fewest free pbufs in the pool since startup.",
+			pool.max < PBUF_POOL_SIZE ? PBUF_POOL_SIZE - pool.max : 0);
+}
+#endif
+
+static void metrics_write_websocket(metrics_handle_t handle, chunk_writer_t *writer) {
+	websocket_client_statistics_t statistics[METRICS_MAX_WEBSOCKET_CLIENTS];
+	char names[METRICS_MAX_WEBSOCKET_CLIENTS][4];
+	uint8_t clients = 0;
+	while (clients < METRICS_MAX_WEBSOCKET_CLIENTS && websocket_server_get_statistics(clients, &statistics[clients])) {
+		snprintf(names[clients], sizeof(names[clients]), "%u", clients);
+		clients++;
+	}
+	metrics_family(writer, "websocket_connected", METRICS_GAUGE, "Client connected, 1 when connected.");
+	for (uint8_t i = 0; i < clients; i++) {
+		metrics_uint(writer, "websocket_connected", "client", names[i], statistics[i].connected);
+	}
+	metrics_family(writer, "websocket_send_queue_depth", METRICS_GAUGE, "Frames waiting to be sent.");
+	for (uint8_t i = 0; i < clients; i++) {
+		metrics_uint(writer, "websocket_send_queue_depth", "client", names[i], statistics[i].queue_depth);
+	}
+	metrics_family(writer, "websocket_sends_total", METRICS_COUNTER, "Frames sent.");
+	for (uint8_t i = 0; i < clients; i++) {
+		metrics_uint(writer, "websocket_sends_total", "client", names[i], statistics[i].sent_count);
+	}
+	metrics_family(writer, "websocket_drops_total", METRICS_COUNTER, "Frames dropped, the send queue was full.");
+	for (uint8_t i = 0; i < clients; i++) {
+		metrics_uint(writer, "websocket_drops_total", "client", names[i], statistics[i].drop_count);
+	}
+	metrics_family(writer, "websocket_coalesced_total", METRICS_COUNTER, "Messages replaced by a newer one.");
+	for (uint8_t i = 0; i < clients; i++) {
+		metrics_uint(writer, "websocket_coalesced_total", "client", names[i], statistics[i].coalesce_count);
+	}
+	metrics_family(writer, "websocket_lag_disconnects_total", METRICS_COUNTER, "Clients disconnected, fell behind.");
+	for (uint8_t i = 0; i < clients; i++) {
+		metrics_uint(writer, "websocket_lag_disconnects_total", "client", names[i], statistics[i].lag_count);
+	}
+}
+
+static void metrics_write_system(metrics_handle_t handle, chunk_writer_t *writer) {
+	metrics_family(writer, "uptime_seconds", METRICS_COUNTER, "Time since startup.");
+	metrics_seconds(writer, "uptime_seconds", NULL, NULL, esp_timer_get_time());
+	metrics_gauge(writer, "heap_free_bytes", "Free heap.", esp_get_free_heap_size());
+	metrics_gauge(writer, "heap_minimum_free_bytes", "Lowest free heap since startup.",
+			esp_get_minimum_free_heap_size());
+
+	metrics_family(writer, "task_stack_high_water_mark_bytes", METRICS_GAUGE, "Least free stack since the task started.");
+	portENTER_CRITICAL(&handle->mux);
+	uint32_t task_count = handle->task_count;
+	portEXIT_CRITICAL(&handle->mux);
+	for (uint32_t i = 0; i < task_count; i++) {
+		TaskHandle_t task = handle->tasks[i];
+		metrics_uint(writer, "task_stack_high_water_mark_bytes", "task", pcTaskGetTaskName(task),
+				uxTaskGetStackHighWaterMark(task));
+	}
+
+#if LWIP_STATS && MEMP_STATS
+	metrics_write_lwip(writer);
+#endif
+
+	wifi_ap_record_t ap;
+	if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+		metrics_family(writer, "wifi_rssi_dbm", METRICS_GAUGE, "Signal strength of the access point.");
+		metrics_int(writer, "wifi_rssi_dbm", NULL, NULL, ap.rssi);
+	}
+}
+
+void metrics_write(metrics_handle_t handle, chunk_writer_t *writer) {
+	metrics_write_buffer(handle, writer);
+	metrics_write_player(handle, writer);
+	metrics_write_spi(handle, writer);
+	if (handle->relay_handle != NULL) {
+		metrics_write_relay(handle, writer);
+	}
+	if (handle->control_handle != NULL) {
+		metrics_write_control(handle, writer);
+	}
+	if (handle->prefetch_handle != NULL) {
+		metrics_write_prefetch(handle, writer);
+	}
+	if (handle->flow_handle != NULL) {
+		metrics_write_flow(handle, writer);
+	}
+#if CONFIG_READER_ENABLED
+	metrics_write_reader(writer);
+#endif
+#if CONFIG_STREAM_TLS_ENABLED
+	metrics_write_tls(writer);
+#endif
+	if (handle->dns_cache_handle != NULL) {
+		metrics_write_dns_cache(handle, writer);
+	}
+	metrics_write_websocket(handle, writer);
+	metrics_write_system(handle, writer);
+}
+
+void metrics_add_task(metrics_handle_t handle, TaskHandle_t task) {
+	portENTER_CRITICAL(&handle->mux);
+	bool added = handle->task_count < METRICS_MAX_TASKS;
+	if (added) {
+		handle->tasks[handle->task_count++] = task;
+	}
+	portEXIT_CRITICAL(&handle->mux);
+	if (!added) {
+		ESP_LOGW(TAG, "too many tasks, ignored: %s", pcTaskGetTaskName(task));
+	}
+}
+
+void metrics_begin(metrics_config_t config, metrics_handle_t *handle) {
+	ESP_LOGD(TAG, ">metrics_begin");
+	ESP_LOGD(TAG, "buffer_handle: %p", config.buffer_handle);
+	ESP_LOGD(TAG, "vs1053_handle: %p", config.vs1053_handle);
+	ESP_LOGD(TAG, "jitter_handle: %p", config.jitter_handle);
+	ESP_LOGD(TAG, "relay_handle: %p", config.relay_handle);
+	ESP_LOGD(TAG, "control_handle: %p", config.control_handle);
+	ESP_LOGD(TAG, "prefetch_handle: %p", config.prefetch_handle);
+	ESP_LOGD(TAG, "flow_handle: %p", config.flow_handle);
+	ESP_LOGD(TAG, "dns_cache_handle: %p", config.dns_cache_handle);
+
+	metrics_handle_t metrics_handle = malloc(sizeof(struct metrics_t));
+	assert(metrics_handle != NULL);
+	memset(metrics_handle, 0, sizeof(struct metrics_t));
+	metrics_handle->buffer_handle = config.buffer_handle;
+	metrics_handle->vs1053_handle = config.vs1053_handle;
+	metrics_handle->jitter_handle = config.jitter_handle;
+	metrics_handle->relay_handle = config.relay_handle;
+	metrics_handle->control_handle = config.control_handle;
+	metrics_handle->prefetch_handle = config.prefetch_handle;
+	metrics_handle->flow_handle = config.flow_handle;
+	metrics_handle->dns_cache_handle = config.dns_cache_handle;
+	vPortCPUInitializeMutex(&metrics_handle->mux);
+
+	*handle = metrics_handle;
+
+	ESP_LOGD(TAG, "<metrics_begin");
+}
+
+void metrics_end(metrics_handle_t handle) {
+	ESP_LOGD(TAG, ">metrics_end");
+	free(handle);
+	ESP_LOGD(TAG, "<metrics_end");
+}
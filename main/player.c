@@ -4,13 +4,65 @@
 #include "freertos/task.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 
 static const char* TAG = "player";
 
+/** No data arrived for this long while (pre)buffering, the stream ended. */
+#define PLAYER_IDLE_US (10000000)
+/** Decoder status read interval while playing. */
+#define PLAYER_STATUS_US (1000000)
+
+static const char *PLAYER_STATE_NAMES[PLAYER_STATE_COUNT] = { "idle", "prebuffering", "playing", "underrun" };
+
 static vs1053_handle_t player_vs1053_handle;
 static buffer_handle_t player_buffer_handle;
 static uint8_t *player_data;
+static uint32_t player_start_threshold;
+static uint32_t player_resume_threshold;
+static bool player_threshold_ms;
+static jitter_handle_t player_jitter_handle;
+
+static portMUX_TYPE player_mux = portMUX_INITIALIZER_UNLOCKED;
+static player_state_t player_state = PLAYER_STATE_IDLE;
+static int64_t player_state_start_us;
+static uint32_t player_state_count[PLAYER_STATE_COUNT];
+static uint64_t player_state_time_us[PLAYER_STATE_COUNT];
+
+static uint8_t player_volume;
+static bool player_mute;
+/** Oldest volume or mute request not written to the decoder yet, 0 when none. */
+static int64_t player_volume_request_us;
+static uint32_t player_volume_write_count;
+static uint64_t player_volume_latency_us;
+static uint32_t player_volume_latency_max_us;
+/** Request time of the volume write queued in the decoder, 0 when none. */
+static int64_t player_volume_queued_us;
+/** Attenuation set in the decoder, out of range until the first write. */
+static uint16_t player_attenuation_applied;
+/** Station switch requested, and when. */
+static bool player_switch_requested;
+static int64_t player_switch_request_us;
+static uint32_t player_switch_count;
+static uint32_t player_switch_reset_count;
+static uint64_t player_switch_us;
+static uint32_t player_switch_max_us;
+/** Request time of the switch waiting for audio, 0 when none. */
+static int64_t player_switch_audio_request_us;
+static uint32_t player_switch_audio_count;
+static uint64_t player_switch_audio_us;
+static uint32_t player_switch_audio_max_us;
+/** Time from startup until the first audio reached the decoder, 0 before. */
+static uint32_t player_first_audio_us;
+/** Data sent to the decoder since the last cancel. */
+static bool player_decoding;
+static vs1053_status_t player_decoder_status;
+static int64_t player_decoder_status_us;
+
+/** Detect the end of the stream. */
+static uint32_t player_push_bytes;
+static int64_t player_push_us;
 
 static void player_data_malloc() {
 	ESP_LOGD(TAG, ">player_data_malloc");
@@ -24,6 +76,273 @@ static void player_data_malloc() {
 	ESP_LOGD(TAG, "<player_data_malloc");
 }
 
+const char *player_state_name(player_state_t state) {
+	return state < PLAYER_STATE_COUNT ? PLAYER_STATE_NAMES[state] : "?";
+}
+
+void player_get_statistics(player_statistics_t *statistics) {
+	int64_t now_us = esp_timer_get_time();
+	portENTER_CRITICAL(&player_mux);
+	statistics->state = player_state;
+	for (int state = 0; state < PLAYER_STATE_COUNT; state++) {
+		statistics->count[state] = player_state_count[state];
+		statistics->time_us[state] = player_state_time_us[state];
+	}
+	statistics->time_us[player_state] += now_us - player_state_start_us;
+	statistics->volume_write_count = player_volume_write_count;
+	statistics->volume_latency_us = player_volume_latency_us;
+	statistics->volume_latency_max_us = player_volume_latency_max_us;
+	statistics->switch_count = player_switch_count;
+	statistics->switch_reset_count = player_switch_reset_count;
+	statistics->switch_us = player_switch_us;
+	statistics->switch_max_us = player_switch_max_us;
+	statistics->switch_audio_count = player_switch_audio_count;
+	statistics->switch_audio_us = player_switch_audio_us;
+	statistics->switch_audio_max_us = player_switch_audio_max_us;
+	statistics->first_audio_us = player_first_audio_us;
+	portEXIT_CRITICAL(&player_mux);
+}
+
+void player_set_volume(uint8_t volume, int64_t request_us) {
+	portENTER_CRITICAL(&player_mux);
+	player_volume = (volume > PLAYER_VOLUME_MAX ? PLAYER_VOLUME_MAX : volume);
+	if (player_volume_request_us == 0) {
+		player_volume_request_us = request_us;
+	}
+	portEXIT_CRITICAL(&player_mux);
+}
+
+uint8_t player_get_volume() {
+	portENTER_CRITICAL(&player_mux);
+	uint8_t volume = player_volume;
+	portEXIT_CRITICAL(&player_mux);
+	return volume;
+}
+
+void player_set_mute(bool mute, int64_t request_us) {
+	portENTER_CRITICAL(&player_mux);
+	player_mute = mute;
+	if (player_volume_request_us == 0) {
+		player_volume_request_us = request_us;
+	}
+	portEXIT_CRITICAL(&player_mux);
+}
+
+bool player_get_mute() {
+	portENTER_CRITICAL(&player_mux);
+	bool mute = player_mute;
+	portEXIT_CRITICAL(&player_mux);
+	return mute;
+}
+
+void player_switch(int64_t request_us) {
+	portENTER_CRITICAL(&player_mux);
+	if (!player_switch_requested) {
+		player_switch_requested = true;
+		player_switch_request_us = request_us;
+	}
+	portEXIT_CRITICAL(&player_mux);
+}
+
+void player_get_decoder_status(vs1053_status_t *status) {
+	portENTER_CRITICAL(&player_mux);
+	*status = player_decoder_status;
+	portEXIT_CRITICAL(&player_mux);
+}
+
+/**
+ * Queue a volume or mute change, written by player_service between data transfers.
+ */
+static void player_apply_volume() {
+	portENTER_CRITICAL(&player_mux);
+	uint8_t volume = player_volume;
+	bool mute = player_mute;
+	int64_t request_us = player_volume_request_us;
+	player_volume_request_us = 0;
+	portEXIT_CRITICAL(&player_mux);
+	// attenuation in 0.5 dB steps, 0xFE is silent
+	uint16_t attenuation = (mute || volume == 0 ? 0xFE : 2 * (PLAYER_VOLUME_MAX - volume));
+	if (attenuation != player_attenuation_applied) {
+		ESP_LOGI(TAG, "volume: %u, mute: %d (attenuation %u)", volume, mute, attenuation);
+		vs1053_set_volume(player_vs1053_handle, attenuation, attenuation);
+		player_attenuation_applied = attenuation;
+		if (request_us != 0 && player_volume_queued_us == 0) {
+			// a write still queued is replaced, the oldest request waits longest
+			player_volume_queued_us = request_us;
+		}
+	}
+}
+
+/**
+ * Write the queued decoder registers, before the next data transfer.
+ */
+static void player_service() {
+	if (vs1053_service(player_vs1053_handle) > 0 && player_volume_queued_us != 0) {
+		uint32_t latency_us = esp_timer_get_time() - player_volume_queued_us;
+		player_volume_queued_us = 0;
+		portENTER_CRITICAL(&player_mux);
+		player_volume_write_count++;
+		player_volume_latency_us += latency_us;
+		if (latency_us > player_volume_latency_max_us) {
+			player_volume_latency_max_us = latency_us;
+		}
+		portEXIT_CRITICAL(&player_mux);
+	}
+}
+
+/**
+ * Read the decoder status now and then while playing.
+ */
+static void player_read_decoder_status() {
+	int64_t now_us = esp_timer_get_time();
+	if (now_us - player_decoder_status_us >= PLAYER_STATUS_US) {
+		player_decoder_status_us = now_us;
+		vs1053_status_t status;
+		vs1053_get_status(player_vs1053_handle, &status);
+		portENTER_CRITICAL(&player_mux);
+		player_decoder_status = status;
+		portEXIT_CRITICAL(&player_mux);
+	}
+}
+
+static void player_set_state(player_state_t state) {
+	int64_t now_us = esp_timer_get_time();
+	ESP_LOGI(TAG, "state: %s -> %s", player_state_name(player_state), player_state_name(state));
+	portENTER_CRITICAL(&player_mux);
+	player_state_time_us[player_state] += now_us - player_state_start_us;
+	player_state_start_us = now_us;
+	player_state = state;
+	player_state_count[state]++;
+	portEXIT_CRITICAL(&player_mux);
+}
+
+static bool player_threshold_reached(uint32_t threshold) {
+	if (buffer_free(player_buffer_handle) == 0) {
+		// nothing more will fit
+		return true;
+	}
+	if (player_jitter_handle != NULL) {
+		threshold = jitter_target_ms(player_jitter_handle);
+	}
+	uint32_t level = (player_threshold_ms ? buffer_duration_ms(player_buffer_handle)
+			: buffer_available(player_buffer_handle));
+	return level >= threshold;
+}
+
+/**
+ * @return True when nothing was pushed for a while.
+ */
+static bool player_is_idle() {
+	int64_t now_us = esp_timer_get_time();
+	buffer_counters_t counters;
+	buffer_get_counters(player_buffer_handle, &counters);
+	uint32_t push_bytes = counters.push_bytes;
+	if (push_bytes != player_push_bytes) {
+		player_push_bytes = push_bytes;
+		player_push_us = now_us;
+	}
+	return now_us - player_push_us > PLAYER_IDLE_US;
+}
+
+/**
+ * Stop the decoder on a station switch, the buffer was flushed by the reader.
+ * Prebuffer the next station, it is not an underrun.
+ */
+static void player_apply_switch() {
+	portENTER_CRITICAL(&player_mux);
+	bool requested = player_switch_requested;
+	int64_t request_us = player_switch_request_us;
+	player_switch_requested = false;
+	portEXIT_CRITICAL(&player_mux);
+	if (!requested) {
+		return;
+	}
+	bool reset = false;
+	if (player_decoding) {
+		reset = !vs1053_cancel(player_vs1053_handle);
+		player_decoding = false;
+	}
+	if (player_state != PLAYER_STATE_IDLE) {
+		player_set_state(PLAYER_STATE_IDLE);
+	}
+	uint32_t switch_us = esp_timer_get_time() - request_us;
+	ESP_LOGI(TAG, "switch: %u us, reset: %d", switch_us, reset);
+	player_switch_audio_request_us = request_us;
+	portENTER_CRITICAL(&player_mux);
+	player_switch_count++;
+	player_switch_reset_count += reset;
+	player_switch_us += switch_us;
+	if (switch_us > player_switch_max_us) {
+		player_switch_max_us = switch_us;
+	}
+	portEXIT_CRITICAL(&player_mux);
+}
+
+/**
+ * The first data of the next station reached the decoder.
+ */
+static void player_switch_audio() {
+	uint32_t audio_us = esp_timer_get_time() - player_switch_audio_request_us;
+	player_switch_audio_request_us = 0;
+	ESP_LOGI(TAG, "switch to audio: %u us", audio_us);
+	portENTER_CRITICAL(&player_mux);
+	player_switch_audio_count++;
+	player_switch_audio_us += audio_us;
+	if (audio_us > player_switch_audio_max_us) {
+		player_switch_audio_max_us = audio_us;
+	}
+	portEXIT_CRITICAL(&player_mux);
+}
+
+/**
+ * The first audio since startup reached the decoder.
+ */
+static void player_first_audio() {
+	uint32_t audio_us = esp_timer_get_time();
+	ESP_LOGI(TAG, "startup to audio: %u us", audio_us);
+	portENTER_CRITICAL(&player_mux);
+	player_first_audio_us = audio_us;
+	portEXIT_CRITICAL(&player_mux);
+}
+
+/**
+ * Evaluate state transitions.
+ */
+static void player_update_state(uint32_t available) {
+	switch (player_state) {
+	case PLAYER_STATE_IDLE:
+		if (available > 0) {
+			player_is_idle();
+			player_set_state(PLAYER_STATE_PREBUFFERING);
+		}
+		break;
+	case PLAYER_STATE_PREBUFFERING:
+		if (player_threshold_reached(player_start_threshold)) {
+			player_set_state(PLAYER_STATE_PLAYING);
+		} else if (player_is_idle()) {
+			player_set_state(PLAYER_STATE_IDLE);
+		}
+		break;
+	case PLAYER_STATE_PLAYING:
+		if (available == 0) {
+			player_set_state(PLAYER_STATE_UNDERRUN);
+			if (player_jitter_handle != NULL) {
+				jitter_underrun(player_jitter_handle, esp_timer_get_time());
+			}
+		}
+		break;
+	case PLAYER_STATE_UNDERRUN:
+		if (player_threshold_reached(player_resume_threshold)) {
+			player_set_state(PLAYER_STATE_PLAYING);
+		} else if (player_is_idle()) {
+			player_set_state(PLAYER_STATE_IDLE);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
 /**
  * FreeRTOS Player task.
  */
@@ -42,11 +361,32 @@ void player_task(void *pvParameters) {
 	player_vs1053_handle = config->vs1053_handle;
 	ESP_LOGD(TAG, "player_buffer_handle: %p", player_buffer_handle);
 	ESP_LOGD(TAG, "player_vs1053_handle: %p", player_vs1053_handle);
+	player_start_threshold = config->start_threshold;
+	player_resume_threshold = config->resume_threshold;
+	player_threshold_ms = config->threshold_ms;
+	player_jitter_handle = config->jitter_handle;
+	ESP_LOGD(TAG, "player_start_threshold: %u", player_start_threshold);
+	ESP_LOGD(TAG, "player_resume_threshold: %u", player_resume_threshold);
+	ESP_LOGD(TAG, "player_threshold_ms: %d", player_threshold_ms);
+	ESP_LOGD(TAG, "player_jitter_handle: %p", player_jitter_handle);
+	player_set_volume(config->volume, 0);
+	// force the initial volume into the decoder
+	player_attenuation_applied = UINT16_MAX;
+	ESP_LOGD(TAG, "player_volume: %u", player_volume);
+	player_state_start_us = esp_timer_get_time();
+	player_state_count[PLAYER_STATE_IDLE] = 1;
 
 	while (1) {
 		// check buffer (polling for now)
+		player_apply_switch();
 		uint32_t available = buffer_available(player_buffer_handle);
-		if (available > 0) {
+		player_update_state(available);
+		player_apply_volume();
+		player_service();
+		if (player_state == PLAYER_STATE_PLAYING) {
+			player_read_decoder_status();
+		}
+		if (player_state == PLAYER_STATE_PLAYING && available > 0) {
 			// read buffer
 			uint32_t length = available > VS1053_MAX_DATA_SIZE ? VS1053_MAX_DATA_SIZE : available;
 			ESP_LOGV(TAG, "buffer_pull %p %d %p", player_buffer_handle, length, player_data);
@@ -54,6 +394,13 @@ void player_task(void *pvParameters) {
 			// write decoder
 			ESP_LOGV(TAG, "vs1053_decode %p %p %d", player_vs1053_handle, player_data, length);
 			vs1053_decode(player_vs1053_handle, player_data, length);
+			player_decoding = true;
+			if (player_switch_audio_request_us != 0) {
+				player_switch_audio();
+			}
+			if (player_first_audio_us == 0) {
+				player_first_audio();
+			}
 		} else {
 			vTaskDelay(1 / portTICK_PERIOD_MS);
 		}
@@ -0,0 +1,229 @@
+// The author disclaims copyright to this source code.
+#include "playlist.h"
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "lwip/err.h"
+
+static const char* TAG = "playlist";
+
+/** Receive timeout while fetching. */
+#define PLAYLIST_RECEIVE_TIMEOUT_MS (5000)
+/** Decrypted playlist data (https), a playlist is small. */
+#define PLAYLIST_STAGING_LENGTH (512)
+/** Larger is a stream, not a playlist. */
+#define PLAYLIST_MAX_BYTES (16384)
+
+static const char *PLAYLIST_EXTENSIONS[] = { ".m3u", ".pls" };
+static const char *PLAYLIST_CONTENT_TYPES[] = { "audio/x-mpegurl", "audio/mpegurl", "application/x-mpegurl",
+		"audio/x-scpls", "application/pls+xml" };
+static const char PLAYLIST_UTF8_BOM[] = "\xEF\xBB\xBF";
+
+void playlist_reset(playlist_t *playlist) {
+	playlist->count = 0;
+	playlist->active = PLAYLIST_NONE;
+	playlist->line_length = 0;
+	playlist->line_overflow = false;
+}
+
+bool playlist_is_url(const char *url) {
+	size_t length = strcspn(url, "?#");
+	for (int i = 0; i < sizeof(PLAYLIST_EXTENSIONS) / sizeof(PLAYLIST_EXTENSIONS[0]); i++) {
+		size_t extension_length = strlen(PLAYLIST_EXTENSIONS[i]);
+		if (length > extension_length
+				&& strncasecmp(url + length - extension_length, PLAYLIST_EXTENSIONS[i], extension_length) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool playlist_is_content_type(const char *content_type) {
+	for (int i = 0; i < sizeof(PLAYLIST_CONTENT_TYPES) / sizeof(PLAYLIST_CONTENT_TYPES[0]); i++) {
+		size_t length = strlen(PLAYLIST_CONTENT_TYPES[i]);
+		if (strncasecmp(content_type, PLAYLIST_CONTENT_TYPES[i], length) == 0
+				&& strchr(";\r\n ", content_type[length]) != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Keep a stream URL as candidate, once.
+ */
+static void playlist_add(playlist_t *playlist, const char *url) {
+	if (strncasecmp(url, "http://", 7) != 0 && strncasecmp(url, "https://", 8) != 0) {
+		return;
+	}
+	if (strlen(url) >= STREAM_URL_MAX_LENGTH || playlist->count == PLAYLIST_MAX_CANDIDATES) {
+		ESP_LOGW(TAG, "skipped: %s", url);
+		return;
+	}
+	for (uint32_t i = 0; i < playlist->count; i++) {
+		if (strcmp(playlist->candidates[i].url, url) == 0) {
+			return;
+		}
+	}
+	playlist_candidate_t *candidate = &playlist->candidates[playlist->count++];
+	memset(candidate, 0, sizeof(playlist_candidate_t));
+	strcpy(candidate->url, url);
+	ESP_LOGD(TAG, "candidate: %s", url);
+}
+
+/**
+ * M3U: a URL per line, # starts a comment.
+ * PLS: File1=url, other keys are skipped.
+ */
+static void playlist_line(playlist_t *playlist) {
+	char *line = playlist->line;
+	line[playlist->line_length] = 0;
+	if (strncmp(line, PLAYLIST_UTF8_BOM, sizeof(PLAYLIST_UTF8_BOM) - 1) == 0) {
+		line += sizeof(PLAYLIST_UTF8_BOM) - 1;
+	}
+	while (isspace((unsigned char) *line)) {
+		line++;
+	}
+	char *end = line + strlen(line);
+	while (end > line && isspace((unsigned char) end[-1])) {
+		*--end = 0;
+	}
+	if (strncasecmp(line, "File", 4) == 0) {
+		char *value = line + 4;
+		while (isdigit((unsigned char) *value)) {
+			value++;
+		}
+		if (value > line + 4 && *value == '=') {
+			playlist_add(playlist, value + 1);
+		}
+	} else if (*line != '#') {
+		playlist_add(playlist, line);
+	}
+}
+
+void playlist_parse(playlist_t *playlist, const uint8_t *data, uint32_t length) {
+	for (uint32_t i = 0; i < length; i++) {
+		char c = data[i];
+		if (c == '\r' || c == '\n') {
+			if (!playlist->line_overflow && playlist->line_length > 0) {
+				playlist_line(playlist);
+			}
+			playlist->line_length = 0;
+			playlist->line_overflow = false;
+		} else if (playlist->line_length < PLAYLIST_LINE_MAX_LENGTH) {
+			playlist->line[playlist->line_length++] = c;
+		} else {
+			playlist->line_overflow = true;
+		}
+	}
+}
+
+void playlist_parse_end(playlist_t *playlist) {
+	const uint8_t end = '\n';
+	playlist_parse(playlist, &end, 1);
+}
+
+bool playlist_fetch(dns_cache_handle_t dns_cache_handle, const stream_url_t *url, stream_response_t *response,
+		playlist_t *playlist) {
+	ESP_LOGD(TAG, ">playlist_fetch %s %s", url->host, url->path);
+	playlist_reset(playlist);
+	stream_timing_t timing;
+	stream_conn_handle_t conn = stream_connect(dns_cache_handle, url, false, PLAYLIST_RECEIVE_TIMEOUT_MS, &timing);
+	if (conn == NULL) {
+		return false;
+	}
+	stream_response_reset(response);
+	uint8_t staging[PLAYLIST_STAGING_LENGTH];
+	uint32_t received = 0;
+	bool failed = false;
+	while (!failed && stream_recv(conn, staging, sizeof(staging)) == ERR_OK) {
+		uint8_t *data;
+		uint32_t length;
+		while (!failed && stream_data(conn, &data, &length)) {
+			if (!response->complete) {
+				uint32_t used = stream_response_collect(response, data, length);
+				if (response->complete) {
+					failed = !stream_response_ok(response);
+				} else if (response->header_length == STREAM_HEADER_MAX_LENGTH) {
+					ESP_LOGE(TAG, "response header too long");
+					failed = true;
+				}
+				data += used;
+				length -= used;
+			}
+			if (response->complete && !failed) {
+				playlist_parse(playlist, data, length);
+				received += length;
+				if (received > PLAYLIST_MAX_BYTES) {
+					ESP_LOGE(TAG, "not a playlist");
+					failed = true;
+				}
+			}
+		}
+	}
+	stream_close(conn);
+	if (failed) {
+		playlist_reset(playlist);
+	} else {
+		playlist_parse_end(playlist);
+	}
+	ESP_LOGI(TAG, "candidates: %u", playlist->count);
+	ESP_LOGD(TAG, "<playlist_fetch");
+	return playlist->count > 0;
+}
+
+/**
+ * @return True when a ranks before b.
+ */
+static bool playlist_before(const playlist_candidate_t *a, const playlist_candidate_t *b) {
+	if (a->failure_count != b->failure_count) {
+		return a->failure_count < b->failure_count;
+	}
+	// mirrors of a stream send the same bitrate, small differences are noise
+	if ((uint64_t) a->throughput * 10 < (uint64_t) b->throughput * 9) {
+		return false;
+	}
+	if ((uint64_t) b->throughput * 10 < (uint64_t) a->throughput * 9) {
+		return true;
+	}
+	if (a->connect_us != b->connect_us) {
+		return b->connect_us == 0 || (a->connect_us != 0 && a->connect_us < b->connect_us);
+	}
+	return false;
+}
+
+uint32_t playlist_select(playlist_t *playlist, bool failover) {
+	uint32_t best = PLAYLIST_NONE;
+	for (uint32_t i = 0; i < playlist->count; i++) {
+		if (failover && i == playlist->active && playlist->count > 1) {
+			continue;
+		}
+		if (best == PLAYLIST_NONE || playlist_before(&playlist->candidates[i], &playlist->candidates[best])) {
+			best = i;
+		}
+	}
+	playlist->active = best;
+	return best;
+}
+
+void playlist_connected(playlist_t *playlist, uint32_t connect_us) {
+	if (playlist->active != PLAYLIST_NONE) {
+		playlist->candidates[playlist->active].connect_us = connect_us;
+	}
+}
+
+void playlist_failed(playlist_t *playlist) {
+	if (playlist->active != PLAYLIST_NONE) {
+		playlist->candidates[playlist->active].failure_count++;
+	}
+}
+
+void playlist_throughput(playlist_t *playlist, uint32_t throughput) {
+	if (playlist->active != PLAYLIST_NONE) {
+		playlist_candidate_t *candidate = &playlist->candidates[playlist->active];
+		candidate->throughput = candidate->throughput == 0 ? throughput : (candidate->throughput * 3 + throughput) / 4;
+	}
+}
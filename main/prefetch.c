@@ -0,0 +1,343 @@
+// The author disclaims copyright to this source code.
+#include "prefetch.h"
+#include <string.h>
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "lwip/err.h"
+
+static const char* TAG = "prefetch";
+
+static const char PREFETCH_CONTENT_TYPE[] = "content-type:";
+
+// SPI DMA transfers are limited to SPI_MAX_DMA_LEN
+#define DMA_MAX_LENGTH 2048
+
+/** Receive timeout, a take waits at most this long for the slot. */
+#define PREFETCH_RECEIVE_MS (20)
+/** Give up on a connection without data. */
+#define PREFETCH_IDLE_US (5000000)
+/** Wait before reconnecting. */
+#define PREFETCH_RETRY_US (5000000)
+/** Wait when there is nothing to receive. */
+#define PREFETCH_IDLE_MS (100)
+
+/** Decrypted stream data (https), pushed from here. */
+static WORD_ALIGNED_ATTR uint8_t prefetch_staging[DMA_MAX_LENGTH];
+
+/**
+ * Close the connection, connect again later.
+ * Mutex must be taken when the slot could be taken.
+ */
+static void prefetch_close(prefetch_slot_t *slot, int64_t retry_us) {
+	if (slot->conn != NULL) {
+		stream_close(slot->conn);
+		slot->conn = NULL;
+	}
+	stream_response_reset(&slot->response);
+	slot->retry_us = retry_us;
+}
+
+static void prefetch_error(prefetch_handle_t handle, prefetch_slot_t *slot) {
+	// the next attempt ranks the other mirrors first
+	playlist_failed(&slot->playlist);
+	prefetch_close(slot, esp_timer_get_time() + PREFETCH_RETRY_US);
+	portENTER_CRITICAL(&handle->mux);
+	handle->error_count++;
+	portEXIT_CRITICAL(&handle->mux);
+}
+
+/**
+ * @return True when the favorite is next to the selected one.
+ */
+static bool prefetch_is_target(uint32_t favorite, uint32_t selected, uint32_t count) {
+	return favorite != selected && (favorite == (selected + 1) % count || favorite == (selected + count - 1) % count);
+}
+
+/**
+ * Follow the selection: release slots no longer next to it, start prefetching the new neighbours.
+ * The selected slot is kept until the reader had the chance to take it.
+ */
+static void prefetch_retarget(prefetch_handle_t handle) {
+	uint32_t select_count;
+	uint32_t selected = favorites_selected(handle->favorites_handle, &select_count);
+	uint32_t count = favorites_count(handle->favorites_handle);
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	bool waiting = handle->taken_select_count != select_count;
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		prefetch_slot_t *slot = &handle->slots[i];
+		if (slot->favorite != PREFETCH_NONE && !prefetch_is_target(slot->favorite, selected, count)
+				&& !(waiting && slot->favorite == selected)) {
+			ESP_LOGD(TAG, "release %d: %u", i, slot->favorite);
+			prefetch_close(slot, 0);
+			slot->favorite = PREFETCH_NONE;
+		}
+	}
+	uint32_t targets[PREFETCH_SLOTS] = { (selected + 1) % count, (selected + count - 1) % count };
+	for (int t = 0; t < PREFETCH_SLOTS; t++) {
+		bool found = !prefetch_is_target(targets[t], selected, count);
+		for (int i = 0; i < PREFETCH_SLOTS && !found; i++) {
+			found = handle->slots[i].favorite == targets[t];
+		}
+		for (int i = 0; i < PREFETCH_SLOTS && !found; i++) {
+			prefetch_slot_t *slot = &handle->slots[i];
+			if (slot->favorite == PREFETCH_NONE) {
+				ESP_LOGD(TAG, "prefetch %d: %u", i, targets[t]);
+				slot->favorite = targets[t];
+				playlist_reset(&slot->playlist);
+				slot->resolve_pending = false;
+				buffer_reset(slot->buffer_handle);
+				prefetch_close(slot, 0);
+				found = true;
+			}
+		}
+	}
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+}
+
+/**
+ * Connect a slot, without holding the mutex: a slot without a complete response is never taken.
+ */
+static void prefetch_connect(prefetch_handle_t handle, prefetch_slot_t *slot) {
+	const favorite_t *favorite = favorites_get(handle->favorites_handle, slot->favorite);
+	stream_url_t url;
+	if (favorite == NULL || !stream_parse_url(favorite->url, &url)) {
+		prefetch_error(handle, slot);
+		return;
+	}
+	ESP_LOGI(TAG, "connect: %s", favorite->name);
+	if (slot->playlist.count == 0 && (slot->resolve_pending || playlist_is_url(favorite->url))) {
+		slot->resolve_pending = false;
+		// fetched once per favorite, the reader takes it over with the connection
+		bool resolved = playlist_fetch(handle->dns_cache_handle, &url, &slot->response, &slot->playlist);
+		stream_response_reset(&slot->response);
+		if (!resolved) {
+			prefetch_error(handle, slot);
+			return;
+		}
+	}
+	if (slot->playlist.count > 0
+			&& !stream_parse_url(slot->playlist.candidates[playlist_select(&slot->playlist, false)].url, &url)) {
+		prefetch_error(handle, slot);
+		return;
+	}
+	stream_timing_t timing;
+	slot->conn = stream_connect(handle->dns_cache_handle, &url, false, PREFETCH_RECEIVE_MS, &timing);
+	if (slot->conn == NULL) {
+		prefetch_error(handle, slot);
+		return;
+	}
+	slot->receive_us = esp_timer_get_time();
+	portENTER_CRITICAL(&handle->mux);
+	handle->connect_count++;
+	portEXIT_CRITICAL(&handle->mux);
+}
+
+/**
+ * Push audio into the slot buffer, the oldest audio makes room.
+ */
+static void prefetch_push(prefetch_slot_t *slot, uint8_t *data, uint32_t length) {
+	while (length > 0) {
+		uint32_t transfer = (length > DMA_MAX_LENGTH ? DMA_MAX_LENGTH : length);
+		buffer_push(slot->buffer_handle, data, transfer);
+		data += transfer;
+		length -= transfer;
+	}
+}
+
+/**
+ * Check the status and the content type, a playlist is not audio.
+ * @return False when the slot can not be played.
+ */
+static bool prefetch_process_header(prefetch_slot_t *slot) {
+	if (!stream_response_ok(&slot->response)) {
+		return false;
+	}
+	const char *content_type = stream_response_value(&slot->response, PREFETCH_CONTENT_TYPE);
+	if (content_type != NULL && playlist_is_content_type(content_type)) {
+		// a playlist without the extension, a mirror that answers with a playlist fails
+		ESP_LOGW(TAG, "playlist, resolve: %u", slot->favorite);
+		slot->resolve_pending = slot->playlist.count == 0;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Receive what arrived for a slot. Mutex must be taken.
+ * @return True when data was received.
+ */
+static bool prefetch_receive(prefetch_handle_t handle, prefetch_slot_t *slot) {
+	if (slot->conn == NULL) {
+		return false;
+	}
+	err_t err = stream_recv(slot->conn, prefetch_staging, sizeof(prefetch_staging));
+	int64_t now_us = esp_timer_get_time();
+	if (err == ERR_TIMEOUT) {
+		if (now_us - slot->receive_us > PREFETCH_IDLE_US) {
+			ESP_LOGW(TAG, "no data: %u", slot->favorite);
+			prefetch_error(handle, slot);
+		}
+		return false;
+	}
+	if (err != ERR_OK) {
+		ESP_LOGW(TAG, "stream_recv error: %d", err);
+		prefetch_error(handle, slot);
+		return false;
+	}
+	slot->receive_us = now_us;
+	bool failed = false;
+	uint8_t *data;
+	uint32_t length;
+	while (!failed && stream_data(slot->conn, &data, &length)) {
+		if (!slot->response.complete) {
+			uint32_t used = stream_response_collect(&slot->response, data, length);
+			if (slot->response.complete) {
+				failed = !prefetch_process_header(slot);
+			} else if (slot->response.header_length == STREAM_HEADER_MAX_LENGTH) {
+				ESP_LOGE(TAG, "response header too long");
+				failed = true;
+			}
+			data += used;
+			length -= used;
+		}
+		if (slot->response.complete && !failed) {
+			prefetch_push(slot, data, length);
+		}
+	}
+	if (failed && slot->resolve_pending) {
+		// connect again right away, to the mirror of the playlist
+		prefetch_close(slot, 0);
+	} else if (failed) {
+		prefetch_error(handle, slot);
+	}
+	return true;
+}
+
+bool prefetch_take(prefetch_handle_t handle, uint32_t favorite, uint32_t select_count, buffer_handle_t buffer_handle,
+		stream_conn_handle_t *conn, playlist_t *playlist) {
+	ESP_LOGD(TAG, ">prefetch_take %u", favorite);
+	bool taken = false;
+	assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+	for (int i = 0; i < PREFETCH_SLOTS && !taken; i++) {
+		prefetch_slot_t *slot = &handle->slots[i];
+		if (slot->favorite == favorite && slot->conn != NULL && slot->response.complete
+				&& buffer_available(slot->buffer_handle) > 0) {
+			// the slot keeps the previous audio until it is reused
+			buffer_swap(buffer_handle, slot->buffer_handle);
+			*conn = slot->conn;
+			slot->conn = NULL;
+			*playlist = slot->playlist;
+			playlist_reset(&slot->playlist);
+			stream_response_reset(&slot->response);
+			slot->favorite = PREFETCH_NONE;
+			taken = true;
+		}
+	}
+	handle->taken_select_count = select_count;
+	assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+	portENTER_CRITICAL(&handle->mux);
+	if (taken) {
+		handle->hit_count++;
+	} else {
+		handle->miss_count++;
+	}
+	portEXIT_CRITICAL(&handle->mux);
+	ESP_LOGD(TAG, "<prefetch_take %d", taken);
+	return taken;
+}
+
+void prefetch_get_statistics(prefetch_handle_t handle, prefetch_statistics_t *statistics) {
+	portENTER_CRITICAL(&handle->mux);
+	statistics->hit_count = handle->hit_count;
+	statistics->miss_count = handle->miss_count;
+	statistics->connect_count = handle->connect_count;
+	statistics->error_count = handle->error_count;
+	portEXIT_CRITICAL(&handle->mux);
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		statistics->duration_ms[i] = buffer_duration_ms(handle->slots[i].buffer_handle);
+	}
+}
+
+void prefetch_task(void *pvParameters) {
+	ESP_LOGI(TAG, ">prefetch_task");
+
+	prefetch_handle_t handle = (prefetch_handle_t) pvParameters;
+	ESP_LOGD(TAG, "handle: %p", handle);
+
+	while (1) {
+		prefetch_retarget(handle);
+		bool received = false;
+		for (int i = 0; i < PREFETCH_SLOTS; i++) {
+			prefetch_slot_t *slot = &handle->slots[i];
+			if (slot->favorite != PREFETCH_NONE && slot->conn == NULL && esp_timer_get_time() >= slot->retry_us) {
+				prefetch_connect(handle, slot);
+			}
+			// between slots a take gets the mutex
+			assert(xSemaphoreTake(handle->mutex, portMAX_DELAY) == pdTRUE);
+			received |= prefetch_receive(handle, slot);
+			assert(xSemaphoreGive(handle->mutex) == pdTRUE);
+		}
+		if (!received) {
+			vTaskDelay(PREFETCH_IDLE_MS / portTICK_PERIOD_MS);
+		}
+	}
+	// should never be reached
+}
+
+void prefetch_begin(prefetch_config_t config, prefetch_handle_t *handle) {
+	ESP_LOGD(TAG, ">prefetch_begin");
+	ESP_LOGD(TAG, "favorites_handle: %p", config.favorites_handle);
+	ESP_LOGD(TAG, "spi_mem_handle: %p", config.spi_mem_handle);
+	ESP_LOGD(TAG, "base: %u", config.base);
+	ESP_LOGD(TAG, "size: %u", config.size);
+	ESP_LOGD(TAG, "frame_index_entries: %u", config.frame_index_entries);
+	ESP_LOGD(TAG, "dns_cache_handle: %p", config.dns_cache_handle);
+
+	prefetch_handle_t prefetch_handle = malloc(sizeof(struct prefetch_t));
+	assert(prefetch_handle != NULL);
+	memset(prefetch_handle, 0, sizeof(struct prefetch_t));
+	prefetch_handle->favorites_handle = config.favorites_handle;
+	prefetch_handle->dns_cache_handle = config.dns_cache_handle;
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		prefetch_slot_t *slot = &prefetch_handle->slots[i];
+		buffer_config_t buffer_config;
+		buffer_config.spi_mem_handle = config.spi_mem_handle;
+		buffer_config.base = config.base + i * config.size;
+		buffer_config.size = config.size;
+		buffer_config.frame_index_entries = config.frame_index_entries;
+		// keep the latest audio
+		buffer_config.overflow_policy = BUFFER_POLICY_DROP_OLDEST;
+		buffer_config.underrun_policy = BUFFER_POLICY_PARTIAL;
+		buffer_config.block_ms = 0;
+		buffer_begin(buffer_config, &slot->buffer_handle);
+		slot->favorite = PREFETCH_NONE;
+		slot->conn = NULL;
+		stream_response_reset(&slot->response);
+		playlist_reset(&slot->playlist);
+		slot->resolve_pending = false;
+	}
+	// the first selection is played without prefetching
+	favorites_selected(config.favorites_handle, &prefetch_handle->taken_select_count);
+	prefetch_handle->mutex = xSemaphoreCreateMutex();
+	assert(prefetch_handle->mutex != NULL);
+	vPortCPUInitializeMutex(&prefetch_handle->mux);
+
+	*handle = prefetch_handle;
+
+	ESP_LOGD(TAG, "<prefetch_begin");
+}
+
+void prefetch_end(prefetch_handle_t handle) {
+	ESP_LOGD(TAG, ">prefetch_end");
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		prefetch_close(&handle->slots[i], 0);
+		buffer_end(handle->slots[i].buffer_handle);
+	}
+	vSemaphoreDelete(handle->mutex);
+	free(handle);
+	ESP_LOGD(TAG, "<prefetch_end");
+}
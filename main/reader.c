@@ -0,0 +1,491 @@
+// The author disclaims copyright to this source code.
+#include "reader.h"
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include "player.h"
+#include "stream.h"
+#include "playlist.h"
+
+#include "lwip/api.h"
+#include "lwip/err.h"
+
+static const char* TAG = "reader";
+
+// SPI DMA transfers are limited to SPI_MAX_DMA_LEN
+#define DMA_MAX_LENGTH 2048
+
+/** Give up on a connection without data. */
+#define READER_RECEIVE_TIMEOUT_MS (5000)
+/** Wake up without data, to check for a stall. */
+#define READER_STALL_MS (1000)
+/** Connect a spare after this time without data, while the buffer still plays. */
+#define READER_SPARE_MS (2000)
+/** Wait before reconnecting. */
+#define READER_RETRY_MS (1000)
+/** Check for another selection while receiving is stopped. */
+#define READER_FLOW_CHECK_MS (100)
+/** Compare what arrived with what was played, every window. */
+#define READER_RATE_WINDOW_MS (5000)
+/** Fail over to another mirror when the buffer would run empty within this time. */
+#define READER_FAILOVER_MS (8000)
+
+static const char READER_ICY_METAINT[] = "icy-metaint:";
+static const char READER_CONTENT_TYPE[] = "content-type:";
+
+static buffer_handle_t reader_buffer_handle;
+static icy_handle_t reader_icy_handle;
+static jitter_handle_t reader_jitter_handle;
+static favorites_handle_t reader_favorites_handle;
+static prefetch_handle_t reader_prefetch_handle;
+static flow_handle_t reader_flow_handle;
+static dns_cache_handle_t reader_dns_cache_handle;
+/** Selection being played. */
+static uint32_t reader_select_count;
+
+static stream_url_t reader_url;
+static stream_response_t reader_response;
+/** Timing of the last connect, the first byte is pending until it arrives. */
+static stream_timing_t reader_timing;
+static bool reader_first_byte_pending;
+/** Time of the last data, or of the end of holding back. */
+static int64_t reader_receive_us;
+/** Connection to the same stream, made while the current one stalls. */
+static stream_conn_handle_t reader_spare;
+/** Decrypted stream data (https), pushed from here. */
+static WORD_ALIGNED_ATTR uint8_t reader_staging[DMA_MAX_LENGTH];
+/** Mirrors of the selected favorite, when it is a playlist. */
+static playlist_t reader_playlist;
+/** The favorite answered with a playlist, fetch it before connecting again. */
+static bool reader_resolve_pending;
+/** The stream was too slow, connect another mirror. */
+static bool reader_failover;
+/** Rate window: start, bytes received, buffered audio at the start, flow control stops at the start. */
+static int64_t reader_window_us;
+static uint32_t reader_window_bytes;
+static uint32_t reader_window_level_ms;
+static uint32_t reader_window_throttle_count;
+
+static reader_statistics_t reader_statistics;
+static portMUX_TYPE reader_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void reader_get_statistics(reader_statistics_t *statistics) {
+	portENTER_CRITICAL(&reader_mux);
+	*statistics = reader_statistics;
+	portEXIT_CRITICAL(&reader_mux);
+}
+
+/**
+ * Push audio into the buffer, wait for space when needed.
+ */
+static void reader_push_audio(uint8_t *data, uint32_t length) {
+	while (length > 0) {
+		// limit to transfer size, the overflow policy of the buffer decides when it does not fit
+		uint32_t transfer = (length > DMA_MAX_LENGTH ? DMA_MAX_LENGTH : length);
+		ESP_LOGV(TAG, "buffer_push %p %p %d", reader_buffer_handle, data, transfer);
+		buffer_push(reader_buffer_handle, data, transfer);
+		data += transfer;
+		length -= transfer;
+	}
+}
+
+/**
+ * Strip the metadata from stream data and push the audio.
+ */
+static void reader_push_stream(uint8_t *data, uint32_t length) {
+	while (length > 0) {
+		uint8_t *audio;
+		uint32_t audio_length;
+		uint32_t consumed = icy_demux(reader_icy_handle, data, length, &audio, &audio_length);
+		if (audio_length > 0) {
+			reader_push_audio(audio, audio_length);
+		}
+		data += consumed;
+		length -= consumed;
+	}
+}
+
+/**
+ * Check status and prepare demultiplexer.
+ */
+static bool reader_process_header() {
+	if (!stream_response_ok(&reader_response)) {
+		return false;
+	}
+	const char *content_type = stream_response_value(&reader_response, READER_CONTENT_TYPE);
+	if (content_type != NULL && playlist_is_content_type(content_type)) {
+		// a playlist without the extension
+		ESP_LOGW(TAG, "playlist, resolve");
+		reader_resolve_pending = reader_playlist.count == 0;
+		return false;
+	}
+	const char *metaint = stream_response_value(&reader_response, READER_ICY_METAINT);
+	icy_reset(reader_icy_handle, metaint == NULL ? 0 : atoi(metaint));
+	return true;
+}
+
+/**
+ * @return True when another favorite was selected.
+ */
+static bool reader_selection_changed() {
+	uint32_t select_count;
+	favorites_selected(reader_favorites_handle, &select_count);
+	return select_count != reader_select_count;
+}
+
+/**
+ * Hold back while the buffer is full, the TCP receive window closes meanwhile.
+ * @return False when another favorite was selected while holding back.
+ */
+static bool reader_flow() {
+	if (reader_flow_handle == NULL) {
+		return true;
+	}
+	uint32_t throttle_count = reader_flow_handle->throttle_count;
+	while (!flow_wait(reader_flow_handle, READER_FLOW_CHECK_MS)) {
+		if (reader_selection_changed()) {
+			return false;
+		}
+	}
+	if (throttle_count != reader_flow_handle->throttle_count && reader_jitter_handle != NULL) {
+		// the gap was ours, not the network's
+		jitter_pause(reader_jitter_handle);
+	}
+	if (throttle_count != reader_flow_handle->throttle_count) {
+		reader_receive_us = esp_timer_get_time();
+	}
+	return true;
+}
+
+static void reader_spare_close() {
+	if (reader_spare != NULL) {
+		stream_close(reader_spare);
+		reader_spare = NULL;
+	}
+}
+
+/**
+ * No data for a while. Connect a spare to the same stream while the buffered
+ * audio still plays, it takes over when this connection is given up.
+ * @param header_complete Receiving audio, a stall before is not worth a spare.
+ * @return False to give up on the connection.
+ */
+static bool reader_stalled(bool header_complete) {
+	if (reader_selection_changed()) {
+		return false;
+	}
+	int64_t stall_us = esp_timer_get_time() - reader_receive_us;
+	if (stall_us >= READER_RECEIVE_TIMEOUT_MS * 1000LL) {
+		ESP_LOGE(TAG, "no data for %lld us", stall_us);
+		return false;
+	}
+	if (header_complete && reader_spare == NULL && stall_us >= READER_SPARE_MS * 1000LL) {
+		ESP_LOGW(TAG, "stalled, connect spare");
+		stream_timing_t timing;
+		reader_spare = stream_connect(reader_dns_cache_handle, &reader_url, true, READER_STALL_MS, &timing);
+		if (reader_spare != NULL) {
+			portENTER_CRITICAL(&reader_mux);
+			reader_statistics.spare_count++;
+			portEXIT_CRITICAL(&reader_mux);
+		}
+	}
+	return true;
+}
+
+/**
+ * The first data of a new connection arrived.
+ */
+static void reader_first_byte() {
+	reader_first_byte_pending = false;
+	uint32_t first_byte_us = esp_timer_get_time() - reader_timing.start_us;
+	ESP_LOGI(TAG, "first byte: %u us (%s, resolve %u us, connect %u us, handshake %u us%s)", first_byte_us,
+			reader_timing.cached ? "cached" : "lookup", reader_timing.resolve_us, reader_timing.connect_us,
+			reader_timing.handshake_us, reader_timing.resumed ? " resumed" : "");
+	portENTER_CRITICAL(&reader_mux);
+	if (reader_timing.cached) {
+		reader_statistics.first_byte_cached_count++;
+		reader_statistics.first_byte_cached_us += first_byte_us;
+	} else {
+		reader_statistics.first_byte_lookup_count++;
+		reader_statistics.first_byte_lookup_us += first_byte_us;
+	}
+	reader_statistics.first_byte_last_us = first_byte_us;
+	portEXIT_CRITICAL(&reader_mux);
+	playlist_connected(&reader_playlist, first_byte_us);
+}
+
+/**
+ * Start a rate window.
+ */
+static void reader_rate_start(int64_t now_us) {
+	reader_window_us = now_us;
+	reader_window_bytes = 0;
+	reader_window_level_ms = buffer_duration_ms(reader_buffer_handle);
+	reader_window_throttle_count = reader_flow_handle == NULL ? 0 : reader_flow_handle->throttle_count;
+}
+
+/**
+ * Compare what arrived with what the decoder played, once per window.
+ * While the buffer drains the stream is slower than the decoder, when it
+ * would run empty soon another mirror is connected before it does.
+ * A window with flow control stops says nothing, the reader held back.
+ * @return False to fail over.
+ */
+static bool reader_rate_check() {
+	int64_t now_us = esp_timer_get_time();
+	uint32_t elapsed_ms = (now_us - reader_window_us) / 1000;
+	if (elapsed_ms < READER_RATE_WINDOW_MS) {
+		return true;
+	}
+	bool throttled = reader_flow_handle != NULL && reader_flow_handle->throttle_count != reader_window_throttle_count;
+	uint32_t level_ms = buffer_duration_ms(reader_buffer_handle);
+	bool failover = false;
+	if (!throttled) {
+		playlist_throughput(&reader_playlist, (uint64_t) reader_window_bytes * 1000 / elapsed_ms);
+		if (reader_playlist.count > 1 && level_ms < reader_window_level_ms) {
+			uint32_t drained_ms = reader_window_level_ms - level_ms;
+			uint64_t empty_ms = (uint64_t) level_ms * elapsed_ms / drained_ms;
+			if (empty_ms < READER_FAILOVER_MS) {
+				ESP_LOGW(TAG, "too slow, fail over: %u bytes in %u ms, buffer %u ms, empty in %llu ms",
+						reader_window_bytes, elapsed_ms, level_ms, empty_ms);
+				portENTER_CRITICAL(&reader_mux);
+				reader_statistics.failover_count++;
+				reader_statistics.failover_level_last_ms = level_ms;
+				reader_statistics.failover_level_ms_total += level_ms;
+				if (reader_statistics.failover_count == 1 || level_ms < reader_statistics.failover_level_min_ms) {
+					reader_statistics.failover_level_min_ms = level_ms;
+				}
+				portEXIT_CRITICAL(&reader_mux);
+				failover = true;
+			}
+		}
+	}
+	reader_rate_start(now_us);
+	return !failover;
+}
+
+static void reader_mirror_statistics() {
+	portENTER_CRITICAL(&reader_mux);
+	reader_statistics.mirror_count = reader_playlist.count;
+	reader_statistics.mirror_active = reader_playlist.active == PLAYLIST_NONE ? 0 : reader_playlist.active;
+	portEXIT_CRITICAL(&reader_mux);
+}
+
+/**
+ * Stream URL of the favorite into reader_url: the favorite itself, or the best
+ * ranked mirror of its playlist. The playlist is fetched once per selection.
+ * @return False when there is nothing to connect to.
+ */
+static bool reader_stream_url(const favorite_t *favorite) {
+	if (reader_playlist.count == 0 && (reader_resolve_pending || playlist_is_url(favorite->url))) {
+		reader_resolve_pending = false;
+		// the response is collected again when the stream connects
+		if (!stream_parse_url(favorite->url, &reader_url)
+				|| !playlist_fetch(reader_dns_cache_handle, &reader_url, &reader_response, &reader_playlist)) {
+			return false;
+		}
+	}
+	if (reader_playlist.count == 0) {
+		return stream_parse_url(favorite->url, &reader_url);
+	}
+	uint32_t active = playlist_select(&reader_playlist, reader_failover);
+	reader_failover = false;
+	reader_mirror_statistics();
+	const char *url = reader_playlist.candidates[active].url;
+	ESP_LOGI(TAG, "mirror %u of %u: %s", active, reader_playlist.count, url);
+	if (!stream_parse_url(url, &reader_url)) {
+		playlist_failed(&reader_playlist);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Stop playing the previous stream. Take over the next stream when it was
+ * prefetched, with its mirrors into reader_playlist, otherwise end the previous
+ * one on a frame boundary and drop what is buffered. The player stops the decoder.
+ * @return Prefetched connection, NULL when not prefetched.
+ */
+static stream_conn_handle_t reader_switch(uint32_t selected) {
+	ESP_LOGI(TAG, "switch stream");
+	int64_t request_us = esp_timer_get_time();
+	reader_spare_close();
+	stream_conn_handle_t conn = NULL;
+	if (reader_prefetch_handle == NULL
+			|| !prefetch_take(reader_prefetch_handle, selected, reader_select_count, reader_buffer_handle, &conn,
+					&reader_playlist)) {
+		buffer_cut(reader_buffer_handle);
+		buffer_discard(reader_buffer_handle, buffer_available(reader_buffer_handle));
+		conn = NULL;
+	}
+	player_switch(request_us);
+	return conn;
+}
+
+/**
+ * Receive the stream until it ends or another favorite is selected.
+ * @param header_complete The response header was read already, the stream has no metadata.
+ */
+static void reader_receive(stream_conn_handle_t conn, bool header_complete) {
+	ESP_LOGD(TAG, ">reader_receive");
+
+	stream_response_reset(&reader_response);
+	if (header_complete) {
+		icy_reset(reader_icy_handle, 0);
+	}
+
+	// ERR_OK when another favorite was selected, or the stream stalled
+	err_t err = ERR_OK;
+	reader_receive_us = esp_timer_get_time();
+	reader_rate_start(reader_receive_us);
+	while (reader_flow()) {
+		err = stream_recv(conn, reader_staging, sizeof(reader_staging));
+		if (err == ERR_TIMEOUT) {
+			err = ERR_OK;
+			if (!reader_stalled(header_complete)) {
+				break;
+			}
+			continue;
+		}
+		if (err != ERR_OK) {
+			break;
+		}
+		if (reader_selection_changed()) {
+			ESP_LOGD(TAG, "<reader_receive");
+			return;
+		}
+		reader_receive_us = esp_timer_get_time();
+		if (reader_first_byte_pending) {
+			reader_first_byte();
+		}
+		if (reader_spare != NULL) {
+			ESP_LOGI(TAG, "recovered, close spare");
+			reader_spare_close();
+		}
+		if (header_complete && reader_jitter_handle != NULL) {
+			jitter_arrival(reader_jitter_handle, esp_timer_get_time());
+		}
+		// walk all pieces, the demultiplexer handles arbitrary boundaries
+		uint8_t *data;
+		uint32_t length;
+		while (stream_data(conn, &data, &length)) {
+			if (!header_complete) {
+				uint32_t used = stream_response_collect(&reader_response, data, length);
+				header_complete = reader_response.complete;
+				if (header_complete) {
+					if (!reader_process_header()) {
+						return;
+					}
+				} else if (reader_response.header_length == STREAM_HEADER_MAX_LENGTH) {
+					ESP_LOGE(TAG, "response header too long");
+					return;
+				}
+				data += used;
+				length -= used;
+			}
+			if (header_complete) {
+				reader_push_stream(data, length);
+				reader_window_bytes += length;
+			}
+		}
+		if (header_complete && !reader_rate_check()) {
+			reader_failover = true;
+			reader_spare_close();
+			ESP_LOGD(TAG, "<reader_receive");
+			return;
+		}
+	}
+	if (err != ERR_OK) {
+		ESP_LOGE(TAG, "stream_recv error: %d", err);
+	}
+
+	ESP_LOGD(TAG, "<reader_receive");
+}
+
+static void reader_stream() {
+	ESP_LOGD(TAG, ">reader_stream");
+	stream_conn_handle_t conn = stream_connect(reader_dns_cache_handle, &reader_url, true, READER_STALL_MS,
+			&reader_timing);
+	if (conn != NULL) {
+		reader_first_byte_pending = true;
+		reader_receive(conn, false);
+		reader_first_byte_pending = false;
+		stream_close(conn);
+	}
+	ESP_LOGD(TAG, "<reader_stream");
+}
+
+/**
+ * FreeRTOS Reader task.
+ */
+void reader_task(void *pvParameters) {
+	ESP_LOGI(TAG, ">reader_task");
+
+	reader_config_t *config = (reader_config_t *) pvParameters;
+	reader_buffer_handle = config->buffer_handle;
+	reader_icy_handle = config->icy_handle;
+	reader_jitter_handle = config->jitter_handle;
+	reader_favorites_handle = config->favorites_handle;
+	reader_prefetch_handle = config->prefetch_handle;
+	reader_flow_handle = config->flow_handle;
+	reader_dns_cache_handle = config->dns_cache_handle;
+	ESP_LOGD(TAG, "reader_buffer_handle: %p", reader_buffer_handle);
+	ESP_LOGD(TAG, "reader_icy_handle: %p", reader_icy_handle);
+	ESP_LOGD(TAG, "reader_jitter_handle: %p", reader_jitter_handle);
+	ESP_LOGD(TAG, "reader_favorites_handle: %p", reader_favorites_handle);
+	ESP_LOGD(TAG, "reader_prefetch_handle: %p", reader_prefetch_handle);
+	ESP_LOGD(TAG, "reader_flow_handle: %p", reader_flow_handle);
+	ESP_LOGD(TAG, "reader_dns_cache_handle: %p", reader_dns_cache_handle);
+
+	favorites_selected(reader_favorites_handle, &reader_select_count);
+	while (1) {
+		uint32_t select_count;
+		uint32_t selected = favorites_selected(reader_favorites_handle, &select_count);
+		stream_conn_handle_t conn = NULL;
+		if (select_count != reader_select_count) {
+			reader_select_count = select_count;
+			playlist_reset(&reader_playlist);
+			reader_resolve_pending = false;
+			reader_failover = false;
+			conn = reader_switch(selected);
+			reader_mirror_statistics();
+		}
+		const favorite_t *favorite = favorites_get(reader_favorites_handle, selected);
+		ESP_LOGI(TAG, "favorite: %u %s %s", selected, favorite->name, favorite->url);
+		if (conn != NULL) {
+			// prefetched, continue the stream
+			// the URL of a spare: the mirror the prefetcher connected, no playlist fetch before playing
+			const char *url = reader_playlist.count == 0 ?
+					favorite->url : reader_playlist.candidates[reader_playlist.active].url;
+			stream_parse_url(url, &reader_url);
+			stream_set_timeout(conn, READER_STALL_MS);
+			reader_receive(conn, true);
+			stream_close(conn);
+		} else if (reader_spare != NULL) {
+			// connected while the previous connection stalled
+			ESP_LOGI(TAG, "take over spare");
+			conn = reader_spare;
+			reader_spare = NULL;
+			portENTER_CRITICAL(&reader_mux);
+			reader_statistics.spare_use_count++;
+			portEXIT_CRITICAL(&reader_mux);
+			reader_receive(conn, false);
+			stream_close(conn);
+		} else if (reader_stream_url(favorite)) {
+			reader_stream();
+		}
+		if (reader_spare == NULL && !reader_selection_changed()) {
+			// the mirror ended, stalled or was too slow
+			playlist_failed(&reader_playlist);
+			if (!reader_failover) {
+				// reconnect, not too fast
+				vTaskDelay(READER_RETRY_MS / portTICK_PERIOD_MS);
+			}
+		}
+	}
+	// should never be reached
+}
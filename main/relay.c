@@ -0,0 +1,112 @@
+// The author disclaims copyright to this source code.
+#include "relay.h"
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "relay";
+
+/** Longest single wait for audio, between checks of the idle timeout. */
+#define RELAY_WAIT_MS (100)
+
+bool relay_join(relay_handle_t handle) {
+	bool joined = false;
+	portENTER_CRITICAL(&handle->mux);
+	if (handle->listeners < handle->max_listeners) {
+		handle->listeners++;
+		handle->listen_count++;
+		joined = true;
+	}
+	portEXIT_CRITICAL(&handle->mux);
+	return joined;
+}
+
+void relay_serve(relay_handle_t handle, relay_output_t output, void *context) {
+	ESP_LOGD(TAG, ">relay_serve");
+	uint8_t data[RELAY_CHUNK_LENGTH];
+	buffer_cursor_t cursor;
+	buffer_cursor_begin(handle->buffer_handle, &cursor);
+	TickType_t idle_timeout = handle->idle_timeout_ms / portTICK_PERIOD_MS;
+	TickType_t received = xTaskGetTickCount();
+	uint32_t skip_count = 0;
+	uint64_t skip_bytes = 0;
+	bool dropped = false;
+	while (1) {
+		uint32_t length = buffer_cursor_read(handle->buffer_handle, &cursor, sizeof(data), data, RELAY_WAIT_MS);
+		if (cursor.skip_count != skip_count) {
+			// fell behind, the audio jumps to a frame start
+			portENTER_CRITICAL(&handle->mux);
+			handle->skip_count += cursor.skip_count - skip_count;
+			handle->skip_bytes += cursor.skip_bytes - skip_bytes;
+			portEXIT_CRITICAL(&handle->mux);
+			ESP_LOGW(TAG, "listener skipped, total: %u", cursor.skip_count);
+			skip_count = cursor.skip_count;
+			skip_bytes = cursor.skip_bytes;
+			if (handle->max_skips > 0 && skip_count >= handle->max_skips) {
+				dropped = true;
+				break;
+			}
+		}
+		if (length > 0) {
+			received = xTaskGetTickCount();
+			if (!output(context, data, length)) {
+				// listener gone
+				break;
+			}
+			portENTER_CRITICAL(&handle->mux);
+			handle->send_bytes += length;
+			portEXIT_CRITICAL(&handle->mux);
+		} else if (xTaskGetTickCount() - received >= idle_timeout) {
+			dropped = true;
+			break;
+		}
+	}
+	portENTER_CRITICAL(&handle->mux);
+	handle->listeners--;
+	if (dropped) {
+		handle->drop_count++;
+	}
+	portEXIT_CRITICAL(&handle->mux);
+	ESP_LOGD(TAG, "<relay_serve %llu bytes, %s", cursor.read_bytes, dropped ? "dropped" : "gone");
+}
+
+void relay_get_statistics(relay_handle_t handle, relay_statistics_t *statistics) {
+	portENTER_CRITICAL(&handle->mux);
+	statistics->listeners = handle->listeners;
+	statistics->listen_count = handle->listen_count;
+	statistics->drop_count = handle->drop_count;
+	statistics->skip_count = handle->skip_count;
+	statistics->skip_bytes = handle->skip_bytes;
+	statistics->send_bytes = handle->send_bytes;
+	portEXIT_CRITICAL(&handle->mux);
+}
+
+void relay_begin(relay_config_t config, relay_handle_t *handle) {
+	ESP_LOGD(TAG, ">relay_begin");
+	ESP_LOGD(TAG, "buffer_handle: %p", config.buffer_handle);
+	ESP_LOGD(TAG, "max_listeners: %u", config.max_listeners);
+	ESP_LOGD(TAG, "max_skips: %u", config.max_skips);
+	ESP_LOGD(TAG, "idle_timeout_ms: %u", config.idle_timeout_ms);
+
+	relay_handle_t relay_handle = malloc(sizeof(struct relay_t));
+	assert(relay_handle != NULL);
+	memset(relay_handle, 0, sizeof(struct relay_t));
+	relay_handle->buffer_handle = config.buffer_handle;
+	relay_handle->max_listeners = config.max_listeners;
+	relay_handle->max_skips = config.max_skips;
+	relay_handle->idle_timeout_ms = config.idle_timeout_ms;
+	vPortCPUInitializeMutex(&relay_handle->mux);
+
+	*handle = relay_handle;
+
+	ESP_LOGD(TAG, "<relay_begin");
+}
+
+void relay_end(relay_handle_t handle) {
+	ESP_LOGD(TAG, ">relay_end");
+	assert(handle->listeners == 0);
+	free(handle);
+	ESP_LOGD(TAG, "<relay_end");
+}
@@ -1,5 +1,6 @@
 // The author disclaims copyright to this source code.
 #include "statistics.h"
+#include "player.h"
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "sdkconfig.h"
@@ -11,6 +12,14 @@ static uint32_t statistics_previous_pull_bytes;
 static uint32_t statistics_previous_push_bytes;
 static uint32_t statistics_previous_pull_count;
 static uint32_t statistics_previous_push_count;
+static statistics_rates_t statistics_rates;
+static portMUX_TYPE statistics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void statistics_get_rates(statistics_rates_t *rates) {
+	portENTER_CRITICAL(&statistics_mux);
+	*rates = statistics_rates;
+	portEXIT_CRITICAL(&statistics_mux);
+}
 
 void statistics_task(void *pvParameters) {
 	ESP_LOGD(TAG, ">statistics_task");
@@ -21,10 +30,13 @@ void statistics_task(void *pvParameters) {
 
 	while (1) {
 
-		uint32_t pull_bytes = statistics_buffer_handle->pull_bytes;
-		uint32_t push_bytes = statistics_buffer_handle->push_bytes;
-		uint32_t pull_count = statistics_buffer_handle->pull_count;
-		uint32_t push_count = statistics_buffer_handle->push_count;
+		buffer_counters_t counters;
+		buffer_get_counters(statistics_buffer_handle, &counters);
+		// the rates fit, the difference of the low words is exact
+		uint32_t pull_bytes = counters.pull_bytes;
+		uint32_t push_bytes = counters.push_bytes;
+		uint32_t pull_count = counters.pull_count;
+		uint32_t push_count = counters.push_count;
 
 		uint32_t pull_bytes_per_second = (pull_bytes - statistics_previous_pull_bytes);
 		uint32_t push_bytes_per_second = (push_bytes - statistics_previous_push_bytes);
@@ -39,6 +51,13 @@ void statistics_task(void *pvParameters) {
 		statistics_previous_pull_count = pull_count;
 		statistics_previous_push_count = push_count;
 
+		portENTER_CRITICAL(&statistics_mux);
+		statistics_rates.push_bytes = push_bytes_per_second;
+		statistics_rates.pull_bytes = pull_bytes_per_second;
+		statistics_rates.push_count = push_count_per_second;
+		statistics_rates.pull_count = pull_count_per_second;
+		portEXIT_CRITICAL(&statistics_mux);
+
 		ESP_LOGD(TAG, "push_count: %10u %10u", push_count, push_count_per_second);
 		ESP_LOGD(TAG, "push_bytes: %10u %10u", push_bytes, push_bytes_per_second);
 
@@ -47,6 +66,17 @@ void statistics_task(void *pvParameters) {
 
 		ESP_LOGD(TAG, "usage: %10u %10u", available, percentage);
 
+		ESP_LOGD(TAG, "overflow: %10llu %10llu", counters.overflow_count, counters.overflow_bytes);
+		ESP_LOGD(TAG, "underrun: %10llu %10llu", counters.underrun_count, counters.underrun_bytes);
+
+		player_statistics_t player_statistics;
+		player_get_statistics(&player_statistics);
+		ESP_LOGD(TAG, "player: %s", player_state_name(player_statistics.state));
+		for (int state = 0; state < PLAYER_STATE_COUNT; state++) {
+			ESP_LOGD(TAG, "%-12s %10u %10u ms", player_state_name(state), player_statistics.count[state],
+					(uint32_t) (player_statistics.time_us[state] / 1000));
+		}
+
 		vTaskDelay(1000 / portTICK_PERIOD_MS);
 	}
 	// should never be reached
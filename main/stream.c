@@ -0,0 +1,270 @@
+// The author disclaims copyright to this source code.
+#include "stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "lwip/err.h"
+
+static const char* TAG = "stream";
+
+/**
+ * Request metadata, use HTTP/1.0 to avoid chunked transfer encoding.
+ */
+static const char STREAM_REQUEST[] = "GET %s HTTP/1.0\r\n"
+		"Host: %s\r\n"
+		"User-Agent: net-radio\r\n"
+		"%s"
+		"Accept: */*\r\n"
+		"\r\n";
+static const char STREAM_METADATA[] = "Icy-MetaData: 1\r\n";
+static const char STREAM_END_OF_HEADER[] = "\r\n\r\n";
+
+/** Receive timeout during the TLS handshake, the server computes as well. */
+#define STREAM_HANDSHAKE_TIMEOUT_MS (5000)
+
+bool stream_parse_url(const char *url, stream_url_t *parsed) {
+	ESP_LOGD(TAG, ">stream_parse_url %s", url);
+	static const char scheme[] = "http://";
+#if CONFIG_STREAM_TLS_ENABLED
+	static const char scheme_tls[] = "https://";
+#endif
+	const char *host;
+	if (strncasecmp(url, scheme, sizeof(scheme) - 1) == 0) {
+		host = url + sizeof(scheme) - 1;
+		parsed->tls = false;
+#if CONFIG_STREAM_TLS_ENABLED
+	} else if (strncasecmp(url, scheme_tls, sizeof(scheme_tls) - 1) == 0) {
+		host = url + sizeof(scheme_tls) - 1;
+		parsed->tls = true;
+#endif
+	} else {
+		ESP_LOGE(TAG, "unsupported scheme: %s", url);
+		return false;
+	}
+	const char *path = strchr(host, '/');
+	if (path == NULL) {
+		path = host + strlen(host);
+	}
+	const char *port = memchr(host, ':', path - host);
+	const char *host_end = (port == NULL ? path : port);
+	if ((host_end == host) || (host_end - host >= STREAM_URL_MAX_LENGTH)) {
+		ESP_LOGE(TAG, "invalid host: %s", url);
+		return false;
+	}
+	memcpy(parsed->host, host, host_end - host);
+	parsed->host[host_end - host] = 0;
+	parsed->port = (port == NULL ? (parsed->tls ? 443 : 80) : atoi(port + 1));
+	snprintf(parsed->path, STREAM_URL_MAX_LENGTH, "%s", (*path == 0 ? "/" : path));
+	ESP_LOGD(TAG, "<stream_parse_url %s %u %s", parsed->host, parsed->port, parsed->path);
+	return true;
+}
+
+/**
+ * TCP handshake with the address of the host.
+ */
+static struct netconn *stream_connect_addr(const ip_addr_t *addr, uint16_t port, uint32_t timeout_ms) {
+	struct netconn *conn = netconn_new(NETCONN_TCP);
+	if (conn == NULL) {
+		ESP_LOGE(TAG, "netconn_new failed");
+		return NULL;
+	}
+	netconn_set_recvtimeout(conn, timeout_ms);
+	err_t err = netconn_connect(conn, addr, port);
+	if (err != ERR_OK) {
+		ESP_LOGE(TAG, "netconn_connect %s error: %d", ipaddr_ntoa(addr), err);
+		netconn_delete(conn);
+		return NULL;
+	}
+	return conn;
+}
+
+/**
+ * Send the request, encrypted for https.
+ */
+static err_t stream_write(stream_conn_handle_t conn, const char *request, uint32_t length) {
+#if CONFIG_STREAM_TLS_ENABLED
+	if (conn->tls != NULL) {
+		return stream_tls_write(conn->tls, request, length);
+	}
+#endif
+	return netconn_write(conn->conn, request, length, NETCONN_COPY);
+}
+
+stream_conn_handle_t stream_connect(dns_cache_handle_t dns_cache_handle, const stream_url_t *url, bool metadata,
+		uint32_t timeout_ms, stream_timing_t *timing) {
+	ESP_LOGD(TAG, ">stream_connect");
+
+	timing->start_us = esp_timer_get_time();
+	timing->handshake_us = 0;
+	timing->resumed = false;
+	ip_addr_t addr;
+	if (!dns_cache_resolve(dns_cache_handle, url->host, &addr, &timing->cached)) {
+		return NULL;
+	}
+	int64_t resolved_us = esp_timer_get_time();
+	uint32_t connect_timeout_ms = url->tls ? STREAM_HANDSHAKE_TIMEOUT_MS : timeout_ms;
+	struct netconn *netconn = stream_connect_addr(&addr, url->port, connect_timeout_ms);
+	if (netconn == NULL && timing->cached) {
+		// the host may have moved
+		dns_cache_invalidate(dns_cache_handle, url->host);
+		if (dns_cache_resolve(dns_cache_handle, url->host, &addr, &timing->cached)) {
+			resolved_us = esp_timer_get_time();
+			netconn = stream_connect_addr(&addr, url->port, connect_timeout_ms);
+		}
+	}
+	timing->resolve_us = resolved_us - timing->start_us;
+	if (netconn == NULL) {
+		return NULL;
+	}
+	stream_conn_handle_t conn = malloc(sizeof(struct stream_conn_t));
+	if (conn == NULL) {
+		ESP_LOGE(TAG, "malloc failed");
+		netconn_close(netconn);
+		netconn_delete(netconn);
+		return NULL;
+	}
+	memset(conn, 0, sizeof(struct stream_conn_t));
+	conn->conn = netconn;
+#if CONFIG_STREAM_TLS_ENABLED
+	if (url->tls) {
+		conn->tls = stream_tls_connect(netconn, url->host, url->port, &timing->handshake_us, &timing->resumed);
+		if (conn->tls == NULL) {
+			stream_close(conn);
+			return NULL;
+		}
+		netconn_set_recvtimeout(netconn, timeout_ms);
+	}
+#endif
+	char request[sizeof(STREAM_REQUEST) + sizeof(STREAM_METADATA) + 2 * STREAM_URL_MAX_LENGTH];
+	int length = snprintf(request, sizeof(request), STREAM_REQUEST, url->path, url->host,
+			metadata ? STREAM_METADATA : "");
+	err_t err = stream_write(conn, request, length);
+	if (err != ERR_OK) {
+		ESP_LOGE(TAG, "stream_write error: %d", err);
+		stream_close(conn);
+		return NULL;
+	}
+	timing->connect_us = esp_timer_get_time() - resolved_us - timing->handshake_us;
+
+	ESP_LOGD(TAG, "<stream_connect");
+	return conn;
+}
+
+void stream_set_timeout(stream_conn_handle_t conn, uint32_t timeout_ms) {
+	netconn_set_recvtimeout(conn->conn, timeout_ms);
+}
+
+/**
+ * Drop what was not read.
+ */
+static void stream_release(stream_conn_handle_t conn) {
+	if (conn->netbuf != NULL) {
+		netbuf_delete(conn->netbuf);
+		conn->netbuf = NULL;
+	}
+	conn->staging_length = 0;
+}
+
+err_t stream_recv(stream_conn_handle_t conn, uint8_t *staging, uint32_t size) {
+	stream_release(conn);
+#if CONFIG_STREAM_TLS_ENABLED
+	if (conn->tls != NULL) {
+		conn->staging = staging;
+		return stream_tls_read(conn->tls, staging, size, &conn->staging_length);
+	}
+#endif
+	conn->netbuf_read = false;
+	return netconn_recv(conn->conn, &conn->netbuf);
+}
+
+bool stream_data(stream_conn_handle_t conn, uint8_t **data, uint32_t *length) {
+	if (conn->staging_length > 0) {
+		*data = conn->staging;
+		*length = conn->staging_length;
+		conn->staging_length = 0;
+		return true;
+	}
+	if (conn->netbuf == NULL) {
+		return false;
+	}
+	if (conn->netbuf_read && netbuf_next(conn->netbuf) < 0) {
+		stream_release(conn);
+		return false;
+	}
+	conn->netbuf_read = true;
+	u16_t fragment_length;
+	netbuf_data(conn->netbuf, (void**) data, &fragment_length);
+	*length = fragment_length;
+	return true;
+}
+
+void stream_close(stream_conn_handle_t conn) {
+	stream_release(conn);
+#if CONFIG_STREAM_TLS_ENABLED
+	if (conn->tls != NULL) {
+		stream_tls_close(conn->tls);
+	}
+#endif
+	netconn_close(conn->conn);
+	netconn_delete(conn->conn);
+	free(conn);
+}
+
+void stream_response_reset(stream_response_t *response) {
+	response->header_length = 0;
+	response->header[0] = 0;
+	response->complete = false;
+}
+
+uint32_t stream_response_collect(stream_response_t *response, const uint8_t *data, uint32_t length) {
+	uint32_t room = STREAM_HEADER_MAX_LENGTH - response->header_length;
+	uint32_t copy = length > room ? room : length;
+	memcpy(&response->header[response->header_length], data, copy);
+	uint32_t previous_length = response->header_length;
+	response->header_length += copy;
+	response->header[response->header_length] = 0;
+
+	char *end = strstr(response->header, STREAM_END_OF_HEADER);
+	if (end == NULL) {
+		return copy;
+	}
+	response->complete = true;
+	end += sizeof(STREAM_END_OF_HEADER) - 1;
+	*end = 0;
+	response->header_length = end - response->header;
+	return response->header_length - previous_length;
+}
+
+const char *stream_response_value(const stream_response_t *response, const char *name) {
+	size_t length = strlen(name);
+	const char *line = response->header;
+	while (line != NULL && *line != 0) {
+		if (strncasecmp(line, name, length) == 0) {
+			const char *value = line + length;
+			while (*value == ' ') {
+				value++;
+			}
+			return value;
+		}
+		line = strchr(line, '\n');
+		if (line != NULL) {
+			line++;
+		}
+	}
+	return NULL;
+}
+
+bool stream_response_ok(const stream_response_t *response) {
+	ESP_LOGD(TAG, "header: %s", response->header);
+	const char *status = strchr(response->header, ' ');
+	if (status == NULL || atoi(status + 1) != 200) {
+		ESP_LOGE(TAG, "unexpected response: %.*s", strcspn(response->header, "\r\n"), response->header);
+		return false;
+	}
+	return true;
+}
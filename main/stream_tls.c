@@ -0,0 +1,348 @@
+// The author disclaims copyright to this source code.
+#include "stream_tls.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "lwip/err.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+
+static const char* TAG = "stream_tls";
+
+#if CONFIG_STREAM_TLS_ENABLED
+#define STREAM_TLS_CA_PEM CONFIG_STREAM_TLS_CA_PEM
+#else
+// compiled but not used
+#define STREAM_TLS_CA_PEM ""
+#endif
+
+/**
+ * Session of a station.
+ */
+typedef struct stream_tls_session_t {
+	char host[FAVORITES_URL_MAX_LENGTH];
+	uint16_t port;
+	bool valid;
+	/** Last offered or kept, the least recent makes room. */
+	int64_t used_us;
+	mbedtls_ssl_session session;
+} stream_tls_session_t;
+
+static mbedtls_entropy_context stream_tls_entropy;
+static mbedtls_ctr_drbg_context stream_tls_ctr_drbg;
+static mbedtls_ssl_config stream_tls_config;
+/** Root certificates to verify the servers with, empty when not verified. */
+static mbedtls_x509_crt stream_tls_ca;
+/** Protects the sessions. */
+static SemaphoreHandle_t stream_tls_mutex;
+static stream_tls_session_t stream_tls_sessions[STREAM_TLS_SESSIONS];
+
+/** Master secret of a session. */
+#define STREAM_TLS_MASTER_LENGTH (sizeof(stream_tls_sessions[0].session.master))
+
+static stream_tls_statistics_t stream_tls_statistics;
+static portMUX_TYPE stream_tls_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * mbedTLS sends.
+ */
+static int stream_tls_send(void *context, const unsigned char *data, size_t length) {
+	stream_tls_handle_t handle = (stream_tls_handle_t) context;
+	err_t err = netconn_write(handle->conn, data, length, NETCONN_COPY);
+	if (err != ERR_OK) {
+		ESP_LOGE(TAG, "netconn_write error: %d", err);
+		return MBEDTLS_ERR_NET_SEND_FAILED;
+	}
+	return length;
+}
+
+/**
+ * mbedTLS receives, from what the netconn received.
+ * A receive timeout asks mbedTLS to read again later.
+ */
+static int stream_tls_recv(void *context, unsigned char *data, size_t size) {
+	stream_tls_handle_t handle = (stream_tls_handle_t) context;
+	if (handle->netbuf == NULL) {
+		err_t err = netconn_recv(handle->conn, &handle->netbuf);
+		if (err == ERR_TIMEOUT) {
+			return MBEDTLS_ERR_SSL_WANT_READ;
+		}
+		if (err == ERR_CLSD) {
+			return 0;
+		}
+		if (err != ERR_OK) {
+			ESP_LOGE(TAG, "netconn_recv error: %d", err);
+			return MBEDTLS_ERR_NET_RECV_FAILED;
+		}
+		handle->offset = 0;
+	}
+	uint16_t copied = netbuf_copy_partial(handle->netbuf, data, size > UINT16_MAX ? UINT16_MAX : size,
+			handle->offset);
+	handle->offset += copied;
+	if (handle->offset >= netbuf_len(handle->netbuf)) {
+		netbuf_delete(handle->netbuf);
+		handle->netbuf = NULL;
+	}
+	return copied;
+}
+
+/**
+ * @return Session of the station, NULL when not kept. Mutex must be taken.
+ */
+static stream_tls_session_t *stream_tls_find(const char *host, uint16_t port) {
+	for (int i = 0; i < STREAM_TLS_SESSIONS; i++) {
+		stream_tls_session_t *session = &stream_tls_sessions[i];
+		if (session->valid && session->port == port && strcasecmp(session->host, host) == 0) {
+			return session;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Parse the configured root certificates.
+ * The configuration keeps a PEM on a single line, line ends written as \n.
+ * @return Number of certificates, 0 when none are configured.
+ */
+static int stream_tls_ca_parse() {
+	const char *pem = STREAM_TLS_CA_PEM;
+	if (*pem == 0) {
+		return 0;
+	}
+	char *text = malloc(strlen(pem) + 1);
+	assert(text != NULL);
+	char *end = text;
+	while (*pem != 0) {
+		if (pem[0] == '\\' && pem[1] == 'n') {
+			*end++ = '\n';
+			pem += 2;
+		} else {
+			*end++ = *pem++;
+		}
+	}
+	*end = 0;
+	// the terminator counts, it tells PEM from DER
+	int ret = mbedtls_x509_crt_parse(&stream_tls_ca, (const unsigned char *) text, end - text + 1);
+	free(text);
+	if (ret != 0) {
+		ESP_LOGE(TAG, "root certificates error: -0x%04x", -ret);
+	}
+	// configured but unusable does not fall back to not verifying
+	assert(ret == 0);
+	int count = 0;
+	for (mbedtls_x509_crt *crt = &stream_tls_ca; crt != NULL && crt->version != 0; crt = crt->next) {
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Offer the kept session of the station.
+ * @param master Target of the master secret of the offered session.
+ * @return True when offered.
+ */
+static bool stream_tls_offer(mbedtls_ssl_context *ssl, const char *host, uint16_t port, unsigned char *master) {
+	bool offered = false;
+	assert(xSemaphoreTake(stream_tls_mutex, portMAX_DELAY) == pdTRUE);
+	stream_tls_session_t *session = stream_tls_find(host, port);
+	if (session != NULL) {
+		if (mbedtls_ssl_set_session(ssl, &session->session) == 0) {
+			memcpy(master, session->session.master, STREAM_TLS_MASTER_LENGTH);
+			session->used_us = esp_timer_get_time();
+			offered = true;
+		} else {
+			ESP_LOGW(TAG, "session not offered: %s", host);
+		}
+	}
+	assert(xSemaphoreGive(stream_tls_mutex) == pdTRUE);
+	return offered;
+}
+
+/**
+ * Keep the session of the station, it may have a new ticket.
+ * A resumed handshake continues with the master secret of the offered session,
+ * a full handshake derives a new one: tells resumed from full for a session id
+ * and a ticket alike, from the public session only.
+ * @param offered_master Master secret of the offered session, NULL when none was offered.
+ * @return True when the server resumed the offered session.
+ */
+static bool stream_tls_keep(mbedtls_ssl_context *ssl, const char *host, uint16_t port,
+		const unsigned char *offered_master) {
+	mbedtls_ssl_session kept;
+	mbedtls_ssl_session_init(&kept);
+	if (mbedtls_ssl_get_session(ssl, &kept) != 0) {
+		mbedtls_ssl_session_free(&kept);
+		return false;
+	}
+	bool resumed = offered_master != NULL && memcmp(kept.master, offered_master, STREAM_TLS_MASTER_LENGTH) == 0;
+	if (strlen(host) >= FAVORITES_URL_MAX_LENGTH) {
+		mbedtls_ssl_session_free(&kept);
+		return resumed;
+	}
+	assert(xSemaphoreTake(stream_tls_mutex, portMAX_DELAY) == pdTRUE);
+	stream_tls_session_t *session = stream_tls_find(host, port);
+	if (session == NULL) {
+		// never used first
+		session = &stream_tls_sessions[0];
+		for (int i = 1; i < STREAM_TLS_SESSIONS; i++) {
+			if (stream_tls_sessions[i].used_us < session->used_us) {
+				session = &stream_tls_sessions[i];
+			}
+		}
+	}
+	mbedtls_ssl_session_free(&session->session);
+	session->session = kept;
+	strcpy(session->host, host);
+	session->port = port;
+	session->valid = true;
+	session->used_us = esp_timer_get_time();
+	assert(xSemaphoreGive(stream_tls_mutex) == pdTRUE);
+	return resumed;
+}
+
+static void stream_tls_free(stream_tls_handle_t handle) {
+	mbedtls_ssl_free(&handle->ssl);
+	if (handle->netbuf != NULL) {
+		netbuf_delete(handle->netbuf);
+	}
+	free(handle);
+}
+
+stream_tls_handle_t stream_tls_connect(struct netconn *conn, const char *host, uint16_t port,
+		uint32_t *handshake_us, bool *resumed) {
+	ESP_LOGD(TAG, ">stream_tls_connect %s", host);
+	int64_t start_us = esp_timer_get_time();
+	*handshake_us = 0;
+	*resumed = false;
+	stream_tls_handle_t handle = malloc(sizeof(struct stream_tls_t));
+	if (handle == NULL) {
+		ESP_LOGE(TAG, "malloc failed");
+		return NULL;
+	}
+	memset(handle, 0, sizeof(struct stream_tls_t));
+	handle->conn = conn;
+	mbedtls_ssl_init(&handle->ssl);
+	unsigned char offered_master[STREAM_TLS_MASTER_LENGTH];
+	bool offered = false;
+	int ret = mbedtls_ssl_setup(&handle->ssl, &stream_tls_config);
+	if (ret == 0) {
+		ret = mbedtls_ssl_set_hostname(&handle->ssl, host);
+	}
+	if (ret == 0) {
+		mbedtls_ssl_set_bio(&handle->ssl, handle, stream_tls_send, stream_tls_recv, NULL);
+		offered = stream_tls_offer(&handle->ssl, host, port, offered_master);
+		ret = mbedtls_ssl_handshake(&handle->ssl);
+	}
+	uint32_t duration_us = esp_timer_get_time() - start_us;
+	*handshake_us = duration_us;
+	if (ret != 0) {
+		// want read: no answer within the receive timeout
+		ESP_LOGE(TAG, "handshake %s error: -0x%04x", host, -ret);
+		portENTER_CRITICAL(&stream_tls_mux);
+		stream_tls_statistics.error_count++;
+		portEXIT_CRITICAL(&stream_tls_mux);
+		stream_tls_free(handle);
+		return NULL;
+	}
+	*resumed = stream_tls_keep(&handle->ssl, host, port, offered ? offered_master : NULL);
+	ESP_LOGI(TAG, "handshake %s: %u us (%s)", host, duration_us, *resumed ? "resumed" : "full");
+	portENTER_CRITICAL(&stream_tls_mux);
+	if (*resumed) {
+		stream_tls_statistics.resumed_count++;
+		stream_tls_statistics.resumed_us += duration_us;
+		if (duration_us > stream_tls_statistics.resumed_max_us) {
+			stream_tls_statistics.resumed_max_us = duration_us;
+		}
+	} else {
+		stream_tls_statistics.full_count++;
+		stream_tls_statistics.full_us += duration_us;
+		if (duration_us > stream_tls_statistics.full_max_us) {
+			stream_tls_statistics.full_max_us = duration_us;
+		}
+	}
+	portEXIT_CRITICAL(&stream_tls_mux);
+	ESP_LOGD(TAG, "<stream_tls_connect");
+	return handle;
+}
+
+err_t stream_tls_write(stream_tls_handle_t handle, const void *data, uint32_t length) {
+	const unsigned char *bytes = data;
+	while (length > 0) {
+		int ret = mbedtls_ssl_write(&handle->ssl, bytes, length);
+		if (ret <= 0) {
+			ESP_LOGE(TAG, "mbedtls_ssl_write error: -0x%04x", -ret);
+			return ERR_VAL;
+		}
+		bytes += ret;
+		length -= ret;
+	}
+	return ERR_OK;
+}
+
+err_t stream_tls_read(stream_tls_handle_t handle, uint8_t *data, uint32_t size, uint32_t *length) {
+	*length = 0;
+	int ret = mbedtls_ssl_read(&handle->ssl, data, size);
+	if (ret > 0) {
+		*length = ret;
+		return ERR_OK;
+	}
+	if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
+		return ERR_TIMEOUT;
+	}
+	if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY || ret == MBEDTLS_ERR_SSL_CONN_EOF) {
+		return ERR_CLSD;
+	}
+	ESP_LOGE(TAG, "mbedtls_ssl_read error: -0x%04x", -ret);
+	return ERR_VAL;
+}
+
+void stream_tls_close(stream_tls_handle_t handle) {
+	// best effort, the connection closes anyway
+	mbedtls_ssl_close_notify(&handle->ssl);
+	stream_tls_free(handle);
+}
+
+void stream_tls_get_statistics(stream_tls_statistics_t *statistics) {
+	portENTER_CRITICAL(&stream_tls_mux);
+	*statistics = stream_tls_statistics;
+	portEXIT_CRITICAL(&stream_tls_mux);
+}
+
+void stream_tls_begin() {
+	ESP_LOGD(TAG, ">stream_tls_begin");
+	mbedtls_entropy_init(&stream_tls_entropy);
+	mbedtls_ctr_drbg_init(&stream_tls_ctr_drbg);
+	assert(mbedtls_ctr_drbg_seed(&stream_tls_ctr_drbg, mbedtls_entropy_func, &stream_tls_entropy,
+			(const unsigned char *) TAG, strlen(TAG)) == 0);
+	mbedtls_ssl_config_init(&stream_tls_config);
+	assert(mbedtls_ssl_config_defaults(&stream_tls_config, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+			MBEDTLS_SSL_PRESET_DEFAULT) == 0);
+	mbedtls_x509_crt_init(&stream_tls_ca);
+	int ca_count = stream_tls_ca_parse();
+	if (ca_count > 0) {
+		mbedtls_ssl_conf_ca_chain(&stream_tls_config, &stream_tls_ca, NULL);
+		mbedtls_ssl_conf_authmode(&stream_tls_config, MBEDTLS_SSL_VERIFY_REQUIRED);
+		ESP_LOGI(TAG, "server certificates verified, root certificates: %d", ca_count);
+	} else {
+		// no root certificates to verify with
+		mbedtls_ssl_conf_authmode(&stream_tls_config, MBEDTLS_SSL_VERIFY_NONE);
+		ESP_LOGW(TAG, "server certificates NOT verified, https is encrypted but not authenticated");
+	}
+	mbedtls_ssl_conf_rng(&stream_tls_config, mbedtls_ctr_drbg_random, &stream_tls_ctr_drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	mbedtls_ssl_conf_session_tickets(&stream_tls_config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+	for (int i = 0; i < STREAM_TLS_SESSIONS; i++) {
+		mbedtls_ssl_session_init(&stream_tls_sessions[i].session);
+	}
+	stream_tls_mutex = xSemaphoreCreateMutex();
+	assert(stream_tls_mutex != NULL);
+	ESP_LOGD(TAG, "<stream_tls_begin");
+}
@@ -0,0 +1,158 @@
+// The author disclaims copyright to this source code.
+#include "telemetry.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "json_writer.h"
+#include "websocket_server.h"
+
+static const char* TAG = "telemetry";
+
+static buffer_handle_t telemetry_buffer_handle;
+static icy_handle_t telemetry_icy_handle;
+static uint32_t telemetry_interval_ms;
+/** Encoded update, only used by the task. */
+static uint8_t telemetry_message[TELEMETRY_MAX_LENGTH];
+
+/**
+ * Target of the JSON writer.
+ */
+typedef struct telemetry_output_t {
+	char *out;
+	uint32_t size;
+	uint32_t length;
+} telemetry_output_t;
+
+static bool telemetry_collect(void *context, const char *data, uint32_t length, bool more) {
+	telemetry_output_t *output = (telemetry_output_t *) context;
+	if (output->length + length > output->size) {
+		return false;
+	}
+	memcpy(&output->out[output->length], data, length);
+	output->length += length;
+	return true;
+}
+
+uint8_t telemetry_changes(const telemetry_snapshot_t *previous, const telemetry_snapshot_t *current) {
+	uint8_t changes = 0;
+	if (current->buffer_percentage != previous->buffer_percentage) {
+		changes |= TELEMETRY_BUFFER;
+	}
+	if (current->state != previous->state) {
+		changes |= TELEMETRY_STATE;
+	}
+	if (current->bitrate != previous->bitrate) {
+		changes |= TELEMETRY_BITRATE;
+	}
+	if (strcmp(current->title, previous->title) != 0) {
+		changes |= TELEMETRY_TITLE;
+	}
+	return changes;
+}
+
+uint32_t telemetry_json(const telemetry_snapshot_t *snapshot, uint8_t changes, char *out, uint32_t size) {
+	telemetry_output_t output;
+	output.out = out;
+	output.size = size;
+	output.length = 0;
+	json_writer_t writer;
+	json_writer_start(&writer, false, telemetry_collect, &output);
+	json_writer_object_start(&writer, NULL);
+	if (changes & TELEMETRY_BUFFER) {
+		json_writer_uint(&writer, "buffer", snapshot->buffer_percentage);
+	}
+	if (changes & TELEMETRY_STATE) {
+		json_writer_string(&writer, "state", player_state_name(snapshot->state));
+	}
+	if (changes & TELEMETRY_BITRATE) {
+		json_writer_uint(&writer, "bitrate", snapshot->bitrate);
+	}
+	if (changes & TELEMETRY_TITLE) {
+		json_writer_string(&writer, "title", snapshot->title);
+	}
+	json_writer_object_end(&writer);
+	return json_writer_finish(&writer) ? output.length : 0;
+}
+
+uint32_t telemetry_binary(const telemetry_snapshot_t *snapshot, uint8_t changes, uint8_t *out, uint32_t size) {
+	uint32_t title_length = strlen(snapshot->title);
+	// the title length must fit its byte
+	if (title_length > 0xFF) {
+		title_length = 0xFF;
+	}
+	uint32_t length = 1;
+	length += (changes & TELEMETRY_BUFFER) ? 1 : 0;
+	length += (changes & TELEMETRY_STATE) ? 1 : 0;
+	length += (changes & TELEMETRY_BITRATE) ? 4 : 0;
+	length += (changes & TELEMETRY_TITLE) ? 1 + title_length : 0;
+	if (length > size) {
+		return 0;
+	}
+	uint8_t *next = out;
+	*next++ = changes & TELEMETRY_ALL;
+	if (changes & TELEMETRY_BUFFER) {
+		*next++ = snapshot->buffer_percentage;
+	}
+	if (changes & TELEMETRY_STATE) {
+		*next++ = snapshot->state;
+	}
+	if (changes & TELEMETRY_BITRATE) {
+		*next++ = snapshot->bitrate >> 24;
+		*next++ = snapshot->bitrate >> 16;
+		*next++ = snapshot->bitrate >> 8;
+		*next++ = snapshot->bitrate;
+	}
+	if (changes & TELEMETRY_TITLE) {
+		*next++ = title_length;
+		memcpy(next, snapshot->title, title_length);
+	}
+	return length;
+}
+
+static void telemetry_sample(telemetry_snapshot_t *snapshot) {
+	buffer_handle_t buffer = telemetry_buffer_handle;
+	snapshot->buffer_percentage = 100ULL * buffer_available(buffer) / buffer->size;
+	player_statistics_t statistics;
+	player_get_statistics(&statistics);
+	snapshot->state = statistics.state;
+	snapshot->bitrate = buffer->frame_index != NULL ? buffer->frame_index->bitrate : 0;
+	icy_title(telemetry_icy_handle, snapshot->title, sizeof(snapshot->title));
+}
+
+void telemetry_task(void *pvParameters) {
+	ESP_LOGD(TAG, ">telemetry_task");
+
+	telemetry_config_t *config = (telemetry_config_t *) pvParameters;
+	telemetry_buffer_handle = config->buffer_handle;
+	telemetry_icy_handle = config->icy_handle;
+	telemetry_interval_ms = config->interval_ms;
+	ESP_LOGD(TAG, "telemetry_buffer_handle: %p", telemetry_buffer_handle);
+	ESP_LOGD(TAG, "telemetry_icy_handle: %p", telemetry_icy_handle);
+	ESP_LOGD(TAG, "telemetry_interval_ms: %u", telemetry_interval_ms);
+
+	telemetry_snapshot_t previous;
+	telemetry_snapshot_t current;
+	memset(&previous, 0, sizeof(previous));
+	TickType_t wake = xTaskGetTickCount();
+	while (1) {
+		// a steady rate, whatever the time spent publishing
+		vTaskDelayUntil(&wake, telemetry_interval_ms / portTICK_PERIOD_MS);
+
+		telemetry_sample(&current);
+		uint8_t changes = websocket_server_resync() ? TELEMETRY_ALL : telemetry_changes(&previous, &current);
+		if (changes != 0) {
+			uint32_t length = telemetry_json(&current, changes, (char *) telemetry_message, TELEMETRY_MAX_LENGTH);
+			if (length > 0) {
+				websocket_server_publish(WEBSOCKET_SUBSCRIPTION_JSON, TELEMETRY_TOPIC, telemetry_message, length);
+			}
+			length = telemetry_binary(&current, changes, telemetry_message, TELEMETRY_MAX_LENGTH);
+			if (length > 0) {
+				websocket_server_publish(WEBSOCKET_SUBSCRIPTION_BINARY, TELEMETRY_TOPIC, telemetry_message, length);
+			}
+			previous = current;
+		}
+	}
+	// should never be reached
+}
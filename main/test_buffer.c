@@ -181,6 +181,298 @@ static esp_err_t test_buffer_push_pull() {
 	return ESP_OK;
 }
 
+/** MPEG 1 layer III, 128kbps, 44100Hz, no padding: 417 bytes, 26122us */
+static const uint8_t TEST_BUFFER_MPEG_HEADER[] = { 0xFF, 0xFB, 0x90, 0x00 };
+#define TEST_BUFFER_MPEG_LENGTH (417)
+#define TEST_BUFFER_MPEG_DURATION_US (26122)
+/** ADTS AAC LC, 44100Hz, stereo, 300 bytes, one raw data block: 23219us */
+static const uint8_t TEST_BUFFER_ADTS_HEADER[] = { 0xFF, 0xF1, 0x50, 0x80, 0x25, 0x9F, 0xFC };
+#define TEST_BUFFER_ADTS_LENGTH (300)
+#define TEST_BUFFER_ADTS_DURATION_US (23219)
+
+static uint32_t test_buffer_frames_length;
+
+/**
+ * Push bytes collected so far.
+ */
+static void test_buffer_frames_flush() {
+	if (test_buffer_frames_length > 0) {
+		buffer_push(test_buffer_handle, test_buffer_data, test_buffer_frames_length);
+		test_buffer_frames_length = 0;
+	}
+}
+
+/**
+ * Collect bytes, push in DMA sized chunks so frames are cut at random places.
+ */
+static void test_buffer_frames_add(const uint8_t *data, uint32_t length, uint8_t fill) {
+	for (uint32_t i = 0; i < length; i++) {
+		test_buffer_data[test_buffer_frames_length++] = (data == NULL ? fill : data[i]);
+		if (test_buffer_frames_length == DMA_MAX_LENGTH) {
+			test_buffer_frames_flush();
+		}
+	}
+}
+
+static void test_buffer_frames_push(const uint8_t *header, uint32_t header_length, uint32_t length, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		test_buffer_frames_add(header, header_length, 0);
+		test_buffer_frames_add(NULL, length - header_length, 0);
+	}
+}
+
+static esp_err_t test_buffer_check_frames(uint32_t count_expected, uint32_t duration_ms_expected) {
+	uint32_t count_actual = frame_index_count(test_buffer_handle->frame_index);
+	uint32_t duration_ms_actual = buffer_duration_ms(test_buffer_handle);
+	if (count_actual != count_expected || duration_ms_actual != duration_ms_expected) {
+		buffer_log(test_buffer_handle);
+		ESP_LOGE(TAG, "frames expected: %d %dms, actual: %d %dms", count_expected, duration_ms_expected, count_actual,
+				duration_ms_actual);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_buffer_frames() {
+	ESP_LOGD(TAG, ">test_buffer_frames");
+	if (test_buffer_handle->frame_index == NULL) {
+		ESP_LOGD(TAG, "<test_buffer_frames no frame index");
+		return ESP_OK;
+	}
+	buffer_reset(test_buffer_handle);
+	test_buffer_frames_length = 0;
+
+	// 20 frames
+	test_buffer_frames_push(TEST_BUFFER_MPEG_HEADER, sizeof(TEST_BUFFER_MPEG_HEADER), TEST_BUFFER_MPEG_LENGTH, 20);
+	test_buffer_frames_flush();
+	if (test_buffer_check_frames(20, 20 * TEST_BUFFER_MPEG_DURATION_US / 1000) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	// corruption, expect the frame before to be dropped and sync on the next 5
+	uint32_t sync_lost_count = test_buffer_handle->frame_index->sync_lost_count;
+	test_buffer_frames_add(NULL, 100, 0x55);
+	test_buffer_frames_push(TEST_BUFFER_MPEG_HEADER, sizeof(TEST_BUFFER_MPEG_HEADER), TEST_BUFFER_MPEG_LENGTH, 5);
+	test_buffer_frames_flush();
+	if (test_buffer_check_frames(24, 24 * TEST_BUFFER_MPEG_DURATION_US / 1000) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	sync_lost_count = test_buffer_handle->frame_index->sync_lost_count - sync_lost_count;
+	if (sync_lost_count != 1) {
+		ESP_LOGE(TAG, "sync_lost_count expected: 1, actual: %d", sync_lost_count);
+		return ESP_FAIL;
+	}
+
+	// frame aligned discard
+	uint32_t discarded = buffer_discard(test_buffer_handle, 1000);
+	if (discarded != 3 * TEST_BUFFER_MPEG_LENGTH) {
+		ESP_LOGE(TAG, "discarded expected: %d, actual: %d", 3 * TEST_BUFFER_MPEG_LENGTH, discarded);
+		return ESP_FAIL;
+	}
+	if (test_buffer_check_frames(21, 21 * TEST_BUFFER_MPEG_DURATION_US / 1000) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	// cut an incomplete frame
+	uint32_t available = buffer_available(test_buffer_handle);
+	test_buffer_frames_add(TEST_BUFFER_MPEG_HEADER, sizeof(TEST_BUFFER_MPEG_HEADER), 0);
+	test_buffer_frames_add(NULL, 100, 0);
+	test_buffer_frames_flush();
+	uint32_t removed = buffer_cut(test_buffer_handle);
+	if (removed != 104 || test_buffer_check_size(available) != ESP_OK) {
+		ESP_LOGE(TAG, "removed expected: 104, actual: %d", removed);
+		return ESP_FAIL;
+	}
+	if (test_buffer_check_frames(21, 21 * TEST_BUFFER_MPEG_DURATION_US / 1000) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	// ADTS
+	buffer_reset(test_buffer_handle);
+	test_buffer_frames_push(TEST_BUFFER_ADTS_HEADER, sizeof(TEST_BUFFER_ADTS_HEADER), TEST_BUFFER_ADTS_LENGTH, 10);
+	test_buffer_frames_flush();
+	if (test_buffer_check_frames(10, 10 * TEST_BUFFER_ADTS_DURATION_US / 1000) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	buffer_reset(test_buffer_handle);
+	ESP_LOGD(TAG, "<test_buffer_frames");
+	return ESP_OK;
+}
+
+static esp_err_t test_buffer_check_transfer(const char *name, uint32_t expected, uint32_t actual) {
+	if (actual != expected) {
+		buffer_log(test_buffer_handle);
+		ESP_LOGE(TAG, "%s expected: %d, actual: %d", name, expected, actual);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_buffer_overflow() {
+	ESP_LOGD(TAG, ">test_buffer_overflow");
+	// zeros are never mistaken for a frame header
+	memset(test_buffer_data, 0, DMA_MAX_LENGTH);
+	uint32_t size = test_buffer_handle->size;
+	for (uint32_t remaining = size - 100; remaining > 0;) {
+		remaining -= buffer_push(test_buffer_handle, test_buffer_data,
+				remaining > DMA_MAX_LENGTH ? DMA_MAX_LENGTH : remaining);
+	}
+
+	test_buffer_handle->overflow_policy = BUFFER_POLICY_PARTIAL;
+	if (test_buffer_check_transfer("partial", 100, buffer_push(test_buffer_handle, test_buffer_data, 200)) != ESP_OK
+			|| test_buffer_check_transfer("overflow_bytes", 100, test_buffer_handle->overflow_bytes) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	test_buffer_handle->overflow_policy = BUFFER_POLICY_DROP_NEWEST;
+	if (test_buffer_check_transfer("drop newest", 0, buffer_push(test_buffer_handle, test_buffer_data, 50)) != ESP_OK
+			|| test_buffer_check_transfer("overflow_bytes", 150, test_buffer_handle->overflow_bytes) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	test_buffer_handle->overflow_policy = BUFFER_POLICY_BLOCK;
+	if (test_buffer_check_transfer("block", 0, buffer_push(test_buffer_handle, test_buffer_data, 50)) != ESP_OK
+			|| test_buffer_check_transfer("block_count", 1, test_buffer_handle->block_count) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	test_buffer_handle->overflow_policy = BUFFER_POLICY_DROP_OLDEST;
+	if (test_buffer_check_transfer("drop oldest", 50, buffer_push(test_buffer_handle, test_buffer_data, 50)) != ESP_OK
+			|| test_buffer_check_transfer("read_addr", 50, test_buffer_handle->read_addr) != ESP_OK
+			|| test_buffer_check_size(size) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	if (test_buffer_check_transfer("overflow_count", 4, test_buffer_handle->overflow_count) != ESP_OK
+			|| test_buffer_check_transfer("overflow_bytes", 250, test_buffer_handle->overflow_bytes) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	if (test_buffer_handle->frame_index != NULL) {
+		// drop whole frames
+		buffer_reset(test_buffer_handle);
+		test_buffer_frames_length = 0;
+		test_buffer_frames_push(TEST_BUFFER_MPEG_HEADER, sizeof(TEST_BUFFER_MPEG_HEADER), TEST_BUFFER_MPEG_LENGTH,
+				size / TEST_BUFFER_MPEG_LENGTH);
+		test_buffer_frames_flush();
+		test_buffer_frames_push(TEST_BUFFER_MPEG_HEADER, sizeof(TEST_BUFFER_MPEG_HEADER), TEST_BUFFER_MPEG_LENGTH, 1);
+		test_buffer_frames_flush();
+		if (test_buffer_check_transfer("read_addr", TEST_BUFFER_MPEG_LENGTH, test_buffer_handle->read_addr) != ESP_OK
+				|| test_buffer_check_transfer("overflow_bytes", TEST_BUFFER_MPEG_LENGTH,
+						test_buffer_handle->overflow_bytes) != ESP_OK) {
+			return ESP_FAIL;
+		}
+	}
+	ESP_LOGD(TAG, "<test_buffer_overflow");
+	return ESP_OK;
+}
+
+static esp_err_t test_buffer_underrun() {
+	ESP_LOGD(TAG, ">test_buffer_underrun");
+	buffer_push(test_buffer_handle, test_buffer_data, 10);
+
+	test_buffer_handle->underrun_policy = BUFFER_POLICY_PARTIAL;
+	if (test_buffer_check_transfer("partial", 10, buffer_pull(test_buffer_handle, 20, test_buffer_data)) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	test_buffer_handle->underrun_policy = BUFFER_POLICY_BLOCK;
+	if (test_buffer_check_transfer("block", 0, buffer_pull(test_buffer_handle, 20, test_buffer_data)) != ESP_OK
+			|| test_buffer_check_transfer("block_count", 1, test_buffer_handle->block_count) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	if (test_buffer_check_transfer("underrun_count", 2, test_buffer_handle->underrun_count) != ESP_OK
+			|| test_buffer_check_transfer("underrun_bytes", 30, test_buffer_handle->underrun_bytes) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_buffer_underrun");
+	return ESP_OK;
+}
+
+/**
+ * Exercise every policy, the configured policies are restored afterwards.
+ */
+static esp_err_t test_buffer_policies() {
+	ESP_LOGD(TAG, ">test_buffer_policies");
+	buffer_policy_t overflow_policy = test_buffer_handle->overflow_policy;
+	buffer_policy_t underrun_policy = test_buffer_handle->underrun_policy;
+	uint32_t block_ms = test_buffer_handle->block_ms;
+	test_buffer_handle->block_ms = 10;
+
+	buffer_reset(test_buffer_handle);
+	esp_err_t result = test_buffer_overflow();
+	if (result == ESP_OK) {
+		buffer_reset(test_buffer_handle);
+		result = test_buffer_underrun();
+	}
+
+	test_buffer_handle->overflow_policy = overflow_policy;
+	test_buffer_handle->underrun_policy = underrun_policy;
+	test_buffer_handle->block_ms = block_ms;
+	buffer_reset(test_buffer_handle);
+	ESP_LOGD(TAG, "<test_buffer_policies");
+	return result;
+}
+
+static void test_buffer_region(uint32_t base, uint32_t size, buffer_handle_t *handle) {
+	buffer_config_t config;
+	config.spi_mem_handle = test_buffer_handle->spi_mem_handle;
+	config.base = base;
+	config.size = size;
+	config.frame_index_entries = 0;
+	config.overflow_policy = BUFFER_POLICY_PARTIAL;
+	config.underrun_policy = BUFFER_POLICY_PARTIAL;
+	config.block_ms = 0;
+	buffer_begin(config, handle);
+}
+
+/**
+ * Two small buffers in the region of the buffer under test.
+ * Transfers wrap at the end of their own region, a swap exchanges the content.
+ */
+static esp_err_t test_buffer_swap() {
+	ESP_LOGD(TAG, ">test_buffer_swap");
+	buffer_handle_t buffer_handle = test_buffer_handle;
+	buffer_handle_t first;
+	buffer_handle_t second;
+	test_buffer_region(buffer_handle->base + 4096, 4096, &first);
+	test_buffer_region(buffer_handle->base, 2048, &second);
+
+	esp_err_t result = ESP_OK;
+	test_buffer_tinymt_init();
+	// move to the end of the region, the next push wraps
+	test_buffer_handle = first;
+	test_buffer_push(3000);
+	test_buffer_tinymt_init();
+	result = test_buffer_pull(3000);
+	if (result == ESP_OK) {
+		test_buffer_tinymt_init();
+		test_buffer_handle = second;
+		test_buffer_push(1500);
+		test_buffer_handle = first;
+		test_buffer_push(2000);
+		buffer_swap(first, second);
+		result = test_buffer_check_size(1500);
+	}
+	if (result == ESP_OK) {
+		result = test_buffer_check_transfer("size", 2048, first->size);
+	}
+	if (result == ESP_OK) {
+		test_buffer_tinymt_init();
+		result = test_buffer_pull(1500);
+	}
+	if (result == ESP_OK) {
+		test_buffer_handle = second;
+		result = test_buffer_check_size(2000);
+	}
+	if (result == ESP_OK) {
+		result = test_buffer_pull(2000);
+	}
+
+	test_buffer_handle = buffer_handle;
+	buffer_end(first);
+	buffer_end(second);
+	buffer_reset(test_buffer_handle);
+	ESP_LOGD(TAG, "<test_buffer_swap");
+	return result;
+}
+
 /**
  * Buffer test.
  */
@@ -200,6 +492,18 @@ esp_err_t test_buffer(test_buffer_config_t config) {
 		return ESP_FAIL;
 	}
 
+	if (test_buffer_frames() != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	if (test_buffer_policies() != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	if (test_buffer_swap() != ESP_OK) {
+		return ESP_FAIL;
+	}
+
 	test_buffer_data_free();
 
 	ESP_LOGD(TAG, "<test_buffer");
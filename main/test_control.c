@@ -0,0 +1,94 @@
+// The author disclaims copyright to this source code.
+#include "test_control.h"
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "control.h"
+
+static const char* TAG = "test_control";
+
+#define TEST_CONTROL_RECEIVED_US (1234)
+
+typedef struct test_control_expected_t {
+	const char *json;
+	control_result_t result;
+	control_command_type_t type;
+	uint32_t value;
+} test_control_expected_t;
+
+static const test_control_expected_t TEST_CONTROL_EXPECTED[] = {
+		{ "{\"command\":\"volume\",\"value\":40}", CONTROL_OK, CONTROL_VOLUME, 40 },
+		{ " { \"value\" : 100 , \"command\" : \"volume\" } ", CONTROL_OK, CONTROL_VOLUME, 100 },
+		{ "{\"command\":\"mute\",\"value\":true}", CONTROL_OK, CONTROL_MUTE, 1 },
+		{ "{\"command\":\"mute\",\"value\":false}", CONTROL_OK, CONTROL_MUTE, 0 },
+		{ "{\"command\":\"select\",\"value\":2,\"id\":[1,{\"value\":3}]}", CONTROL_OK, CONTROL_SELECT, 2 },
+		{ "{\"command\":\"next\"}", CONTROL_OK, CONTROL_NEXT, 0 },
+		{ "{\"command\":\"previous\"}", CONTROL_OK, CONTROL_PREVIOUS, 0 },
+		{ "{\"command\":\"reset\"}", CONTROL_OK, CONTROL_RESET, 0 },
+		{ "{\"command\":\"volume\"}", CONTROL_INVALID, CONTROL_VOLUME, 0 },
+		{ "{\"command\":\"volume\",\"value\":-1}", CONTROL_INVALID, CONTROL_VOLUME, 0 },
+		{ "{\"command\":\"volume\",\"value\":\"40\"}", CONTROL_INVALID, CONTROL_VOLUME, 0 },
+		{ "{\"command\":\"mute\",\"value\":1}", CONTROL_INVALID, CONTROL_MUTE, 0 },
+		{ "{\"command\":\"echo\"}", CONTROL_UNKNOWN, 0, 0 },
+		{ "{\"command\":\"volumes\"}", CONTROL_UNKNOWN, 0, 0 },
+		{ "{\"command\":1}", CONTROL_MALFORMED, 0, 0 },
+		{ "[\"command\",\"next\"]", CONTROL_MALFORMED, 0, 0 },
+		{ "{\"command\":\"next\"", CONTROL_MALFORMED, 0, 0 },
+		{ "subscribe", CONTROL_MALFORMED, 0, 0 } };
+
+#define TEST_CONTROL_COUNT (sizeof(TEST_CONTROL_EXPECTED) / sizeof(TEST_CONTROL_EXPECTED[0]))
+
+static char test_control_output[64];
+static uint32_t test_control_output_length;
+
+static bool test_control_collect(void *context, const char *data, uint32_t length, bool more) {
+	if (test_control_output_length + length > sizeof(test_control_output)) {
+		return false;
+	}
+	memcpy(&test_control_output[test_control_output_length], data, length);
+	test_control_output_length += length;
+	return true;
+}
+
+static esp_err_t test_control_result(const control_command_t *command, control_result_t result,
+		const char *expected) {
+	test_control_output_length = 0;
+	json_writer_t writer;
+	json_writer_start(&writer, false, test_control_collect, NULL);
+	control_write_result(&writer, command, result);
+	if (!json_writer_finish(&writer) || test_control_output_length != strlen(expected)
+			|| memcmp(test_control_output, expected, test_control_output_length) != 0) {
+		ESP_LOGE(TAG, "result expected: %s, actual: %.*s", expected, test_control_output_length, test_control_output);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/**
+ * Control command parser test.
+ */
+esp_err_t test_control() {
+	ESP_LOGD(TAG, ">test_control");
+	control_command_t command;
+	for (int i = 0; i < TEST_CONTROL_COUNT; i++) {
+		const test_control_expected_t *expected = &TEST_CONTROL_EXPECTED[i];
+		control_result_t result = control_parse(expected->json, strlen(expected->json), TEST_CONTROL_RECEIVED_US,
+				&command);
+		if (result != expected->result
+				|| (result == CONTROL_OK && (command.type != expected->type || command.value != expected->value
+						|| command.received_us != TEST_CONTROL_RECEIVED_US))
+				|| (result == CONTROL_INVALID && command.type != expected->type)) {
+			ESP_LOGE(TAG, "%s expected: %d %d %u, actual: %d %d %u", expected->json, expected->result, expected->type,
+					expected->value, result, command.type, command.value);
+			return ESP_FAIL;
+		}
+	}
+
+	command.type = CONTROL_VOLUME;
+	if (test_control_result(&command, CONTROL_OK, "{\"command\":\"volume\",\"result\":\"ok\"}") != ESP_OK
+			|| test_control_result(NULL, CONTROL_MALFORMED, "{\"result\":\"malformed\"}") != ESP_OK) {
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_control");
+	return ESP_OK;
+}
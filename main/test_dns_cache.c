@@ -0,0 +1,89 @@
+// The author disclaims copyright to this source code.
+#include "test_dns_cache.h"
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "dns_cache.h"
+
+static const char* TAG = "test_dns_cache";
+
+#define TEST_DNS_CACHE_ID (0x1234)
+#define TEST_DNS_CACHE_HOST "radio.example"
+
+/** Header: id, response with recursion, 1 question, 2 answers. Question: radio.example IN A. */
+#define TEST_DNS_CACHE_HEADER(rcode, answers) \
+	0x12, 0x34, 0x81, 0x80 | (rcode), 0x00, 0x01, 0x00, (answers), 0x00, 0x00, 0x00, 0x00, \
+	0x05, 'r', 'a', 'd', 'i', 'o', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x00, 0x00, 0x01, 0x00, 0x01
+
+/** Address, the name is a pointer to the question. */
+static const uint8_t TEST_DNS_CACHE_A[] = {
+	TEST_DNS_CACHE_HEADER(0, 1),
+	0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0E, 0x10, 0x00, 0x04, 192, 0, 2, 1
+};
+
+/** Alias with a short time to live, then the address of the alias. */
+static const uint8_t TEST_DNS_CACHE_CNAME_A[] = {
+	TEST_DNS_CACHE_HEADER(0, 2),
+	0xC0, 0x0C, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3C, 0x00, 0x06, 0x03, 'c', 'd', 'n', 0xC0, 0x12,
+	0xC0, 0x2B, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0E, 0x10, 0x00, 0x04, 198, 51, 100, 7
+};
+
+/** No such name. */
+static const uint8_t TEST_DNS_CACHE_NXDOMAIN[] = {
+	TEST_DNS_CACHE_HEADER(3, 0)
+};
+
+static esp_err_t test_dns_cache_check(const char *name, const uint8_t *data, uint32_t length, const char *host,
+		uint16_t id, bool found_expected, const uint8_t address_expected[4], uint32_t ttl_expected) {
+	uint8_t address[4] = { 0 };
+	uint32_t ttl_s = 0;
+	bool found = dns_cache_parse(data, length, host, id, address, &ttl_s);
+	if (found != found_expected
+			|| (found && (memcmp(address, address_expected, 4) != 0 || ttl_s != ttl_expected))) {
+		ESP_LOGE(TAG, "%s expected: %d %u.%u.%u.%u ttl %u, actual: %d %u.%u.%u.%u ttl %u", name, found_expected,
+				address_expected[0], address_expected[1], address_expected[2], address_expected[3], ttl_expected,
+				found, address[0], address[1], address[2], address[3], ttl_s);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+esp_err_t test_dns_cache() {
+	ESP_LOGD(TAG, ">test_dns_cache");
+	const uint8_t a[4] = { 192, 0, 2, 1 };
+	const uint8_t cname_a[4] = { 198, 51, 100, 7 };
+	const uint8_t none[4] = { 0 };
+	esp_err_t result = test_dns_cache_check("A", TEST_DNS_CACHE_A, sizeof(TEST_DNS_CACHE_A),
+			TEST_DNS_CACHE_HOST, TEST_DNS_CACHE_ID, true, a, 3600);
+	if (result == ESP_OK) {
+		// the alias expires first
+		result = test_dns_cache_check("CNAME A", TEST_DNS_CACHE_CNAME_A, sizeof(TEST_DNS_CACHE_CNAME_A),
+				TEST_DNS_CACHE_HOST, TEST_DNS_CACHE_ID, true, cname_a, 60);
+	}
+	if (result == ESP_OK) {
+		result = test_dns_cache_check("NXDOMAIN", TEST_DNS_CACHE_NXDOMAIN, sizeof(TEST_DNS_CACHE_NXDOMAIN),
+				TEST_DNS_CACHE_HOST, TEST_DNS_CACHE_ID, false, none, 0);
+	}
+	if (result == ESP_OK) {
+		// not the answer to our query
+		result = test_dns_cache_check("id", TEST_DNS_CACHE_A, sizeof(TEST_DNS_CACHE_A),
+				TEST_DNS_CACHE_HOST, TEST_DNS_CACHE_ID + 1, false, none, 0);
+	}
+	if (result == ESP_OK) {
+		// the address is cut off
+		result = test_dns_cache_check("truncated", TEST_DNS_CACHE_A, sizeof(TEST_DNS_CACHE_A) - 2,
+				TEST_DNS_CACHE_HOST, TEST_DNS_CACHE_ID, false, none, 0);
+	}
+	if (result == ESP_OK) {
+		// the answer to another question
+		result = test_dns_cache_check("question", TEST_DNS_CACHE_A, sizeof(TEST_DNS_CACHE_A), "radio.example.org",
+				TEST_DNS_CACHE_ID, false, none, 0);
+	}
+	if (result == ESP_OK) {
+		// names compare case insensitive
+		result = test_dns_cache_check("case", TEST_DNS_CACHE_A, sizeof(TEST_DNS_CACHE_A), "Radio.Example",
+				TEST_DNS_CACHE_ID, true, a, 3600);
+	}
+	ESP_LOGD(TAG, "<test_dns_cache");
+	return result;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 #include "esp_err.h"
 
@@ -12,6 +13,64 @@ static const char* TAG = "test_dsp";
 
 vs1053_handle_t test_dsp_handle;
 
+/**
+ * Repeated volume writes wait as one, until serviced.
+ */
+static esp_err_t test_dsp_queue() {
+	ESP_LOGD(TAG, ">test_dsp_queue");
+	vs1053_queue_statistics_t before;
+	vs1053_get_queue_statistics(test_dsp_handle, &before);
+	for (uint8_t attenuation = 40; attenuation < 45; attenuation++) {
+		vs1053_set_volume(test_dsp_handle, attenuation, attenuation);
+	}
+	vs1053_queue_statistics_t queued;
+	vs1053_get_queue_statistics(test_dsp_handle, &queued);
+	uint32_t written = vs1053_service(test_dsp_handle);
+	vs1053_queue_statistics_t after;
+	vs1053_get_queue_statistics(test_dsp_handle, &after);
+	if (queued.depth != 1 || queued.queue_count - before.queue_count != 5
+			|| queued.coalesce_count - before.coalesce_count != 4) {
+		ESP_LOGE(TAG, "queued depth: %u, count: %u, coalesced: %u", queued.depth,
+				queued.queue_count - before.queue_count, queued.coalesce_count - before.coalesce_count);
+		return ESP_FAIL;
+	}
+	if (written != 1 || after.depth != 0 || after.write_count - before.write_count != 1) {
+		ESP_LOGE(TAG, "written: %u, depth: %u", written, after.depth);
+		return ESP_FAIL;
+	}
+	if (vs1053_service(test_dsp_handle) != 0) {
+		ESP_LOGE(TAG, "written twice");
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_dsp_queue");
+	return ESP_OK;
+}
+
+/**
+ * Cancel halfway a stream, the decoder must stop without a reset and be ready for the next one.
+ */
+static esp_err_t test_dsp_cancel() {
+	ESP_LOGD(TAG, ">test_dsp_cancel");
+	vs1053_decode_long(test_dsp_handle, (uint8_t*) &HELLO_MP3[0], sizeof(HELLO_MP3) / 2);
+	int64_t start_us = esp_timer_get_time();
+	bool cancelled = vs1053_cancel(test_dsp_handle);
+	uint32_t cancel_us = esp_timer_get_time() - start_us;
+	ESP_LOGI(TAG, "cancel: %u us", cancel_us);
+	if (!cancelled) {
+		// a normal cancel does not need the reset
+		ESP_LOGE(TAG, "cancel failed, reset");
+		return ESP_FAIL;
+	}
+	vs1053_status_t status;
+	vs1053_get_status(test_dsp_handle, &status);
+	if (status.hdat0 != 0 || status.hdat1 != 0) {
+		ESP_LOGE(TAG, "still decoding, hdat0: 0x%04x, hdat1: 0x%04x", status.hdat0, status.hdat1);
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_dsp_cancel");
+	return ESP_OK;
+}
+
 /**
  * DSP test task.
  */
@@ -26,8 +85,12 @@ esp_err_t test_dsp(test_dsp_config_t config) {
 	vTaskDelay(1000 / portTICK_PERIOD_MS);
 	vs1053_soft_reset(test_dsp_handle);
 	// todo verify dsp functioning correctly (status?)
+	esp_err_t result = test_dsp_queue();
+	if (result == ESP_OK) {
+		result = test_dsp_cancel();
+	}
 
 	ESP_LOGD(TAG, "<test_dsp");
-	return ESP_OK;
+	return result;
 }
 
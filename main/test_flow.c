@@ -0,0 +1,109 @@
+// The author disclaims copyright to this source code.
+#include "test_flow.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "flow.h"
+
+static const char* TAG = "test_flow";
+
+// SPI DMA transfers are limited to SPI_MAX_DMA_LEN
+#define DMA_MAX_LENGTH 2048
+
+static buffer_handle_t test_flow_buffer_handle;
+static uint8_t *test_flow_data;
+
+/**
+ * Fill the buffer up to a level (percentage of the size), zeros are never mistaken for a frame header.
+ */
+static void test_flow_fill(uint32_t percent) {
+	uint32_t level = (uint32_t) (((uint64_t) test_flow_buffer_handle->size * percent) / 100);
+	uint32_t available = buffer_available(test_flow_buffer_handle);
+	if (available > level) {
+		buffer_discard(test_flow_buffer_handle, available - level);
+	}
+	for (uint32_t remaining = level - buffer_available(test_flow_buffer_handle); remaining > 0;) {
+		remaining -= buffer_push(test_flow_buffer_handle, test_flow_data,
+				remaining > DMA_MAX_LENGTH ? DMA_MAX_LENGTH : remaining);
+	}
+}
+
+/**
+ * Fill up to a level, then check whether receiving is allowed.
+ */
+static esp_err_t test_flow_check(flow_handle_t handle, uint32_t percent, bool receive_expected,
+		uint32_t throttle_count_expected) {
+	test_flow_fill(percent);
+	bool receive_actual = flow_wait(handle, 0);
+	flow_statistics_t statistics;
+	flow_get_statistics(handle, &statistics);
+	if (receive_actual != receive_expected || statistics.throttled == receive_expected
+			|| statistics.throttle_count != throttle_count_expected) {
+		buffer_log(test_flow_buffer_handle);
+		ESP_LOGE(TAG, "level %u%% expected: %d %u, actual: %d %u", percent, receive_expected, throttle_count_expected,
+				receive_actual, statistics.throttle_count);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/**
+ * Fill the buffer past the high watermark and drain it again.
+ * Between the watermarks the state does not change.
+ */
+static esp_err_t test_flow_watermarks() {
+	ESP_LOGD(TAG, ">test_flow_watermarks");
+	flow_config_t config;
+	config.buffer_handle = test_flow_buffer_handle;
+	config.high_percent = 50;
+	config.low_percent = 25;
+	flow_handle_t handle;
+	flow_begin(config, &handle);
+
+	esp_err_t result = test_flow_check(handle, 40, true, 0);
+	if (result == ESP_OK) {
+		result = test_flow_check(handle, 60, false, 1);
+	}
+	if (result == ESP_OK) {
+		// hysteresis
+		result = test_flow_check(handle, 40, false, 1);
+	}
+	if (result == ESP_OK) {
+		result = test_flow_check(handle, 20, true, 1);
+	}
+	if (result == ESP_OK) {
+		result = test_flow_check(handle, 40, true, 1);
+	}
+	if (result == ESP_OK) {
+		result = test_flow_check(handle, 50, false, 2);
+	}
+
+	flow_end(handle);
+	ESP_LOGD(TAG, "<test_flow_watermarks");
+	return result;
+}
+
+/**
+ * Flow control test.
+ */
+esp_err_t test_flow(test_flow_config_t config) {
+	ESP_LOGD(TAG, ">test_flow");
+
+	test_flow_buffer_handle = config.buffer_handle;
+	ESP_LOGD(TAG, "test_flow_buffer_handle: %p", test_flow_buffer_handle);
+
+	test_flow_data = heap_caps_malloc(DMA_MAX_LENGTH, MALLOC_CAP_DMA);
+	assert(test_flow_data != NULL);
+	memset(test_flow_data, 0, DMA_MAX_LENGTH);
+	buffer_reset(test_flow_buffer_handle);
+
+	esp_err_t result = test_flow_watermarks();
+
+	buffer_reset(test_flow_buffer_handle);
+	heap_caps_free(test_flow_data);
+	test_flow_data = NULL;
+
+	ESP_LOGD(TAG, "<test_flow");
+	return result;
+}
@@ -0,0 +1,161 @@
+// The author disclaims copyright to this source code.
+#include "test_http_request.h"
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "http_request.h"
+
+static const char* TAG = "test_http_request";
+
+/** Pipelined requests, with a body, an ignored long header and HTTP/1.0. */
+static const char TEST_HTTP_REQUEST_PIPELINE[] = "GET / HTTP/1.1\r\n"
+		"Host: net-radio.local\r\n"
+		"Accept: text/html\r\n"
+		"Accept-Encoding: gzip, deflate\r\n"
+		"If-None-Match: \"65ea66d21b479752\"\r\n"
+		"\r\n"
+		"POST /api/volume?x=1&value=50 HTTP/1.1\r\n"
+		"content-length: 4\r\n"
+		"X-Long: ................................................................................................"
+		"................................................................................................"
+		"................................................................................................\r\n"
+		"\r\n"
+		"50\r\n"
+		"GET /title HTTP/1.1\r\n"
+		"Connection: close\r\n"
+		"\r\n"
+		"GET /jquery-3.2.1.slim.min.js HTTP/1.0\n"
+		"\n";
+
+typedef struct test_http_request_expected_t {
+	const char *method;
+	const char *path;
+	const char *query;
+	bool keep_alive;
+	bool accept_gzip;
+	const char *if_none_match;
+	const char *body;
+} test_http_request_expected_t;
+
+static const test_http_request_expected_t TEST_HTTP_REQUEST_EXPECTED[] = {
+		{ "GET", "/", "", true, true, "\"65ea66d21b479752\"", "" },
+		{ "POST", "/api/volume", "x=1&value=50", true, false, "", "50\r\n" },
+		{ "GET", "/title", "", false, false, "", "" },
+		{ "GET", "/jquery-3.2.1.slim.min.js", "", false, false, "", "" } };
+
+#define TEST_HTTP_REQUEST_COUNT (sizeof(TEST_HTTP_REQUEST_EXPECTED) / sizeof(TEST_HTTP_REQUEST_EXPECTED[0]))
+
+/**
+ * Parse the pipeline fed in pieces of a fixed size.
+ */
+static esp_err_t test_http_request_pipeline(uint32_t piece) {
+	http_request_t request;
+	http_request_reset(&request);
+	uint32_t count = 0;
+	const uint8_t *data = (const uint8_t *) TEST_HTTP_REQUEST_PIPELINE;
+	uint32_t remaining = sizeof(TEST_HTTP_REQUEST_PIPELINE) - 1;
+	while (remaining > 0) {
+		uint32_t length = remaining > piece ? piece : remaining;
+		remaining -= length;
+		while (length > 0) {
+			http_request_result_t result;
+			uint32_t consumed = http_request_parse(&request, data, length, &result);
+			data += consumed;
+			length -= consumed;
+			if (result == HTTP_REQUEST_ERROR) {
+				ESP_LOGE(TAG, "piece %u: unexpected error", piece);
+				return ESP_FAIL;
+			}
+			if (result == HTTP_REQUEST_COMPLETE) {
+				const test_http_request_expected_t *expected = &TEST_HTTP_REQUEST_EXPECTED[count++];
+				if (strcmp(request.method, expected->method) != 0 || strcmp(request.path, expected->path) != 0
+						|| strcmp(request.query, expected->query) != 0 || request.keep_alive != expected->keep_alive || request.accept_gzip != expected->accept_gzip
+						|| strcmp(request.if_none_match, expected->if_none_match) != 0
+						|| strcmp(request.body, expected->body) != 0 || request.body_length != strlen(expected->body)) {
+					ESP_LOGE(TAG, "piece %u: expected: %s %s %d, actual: %s %s %d", piece, expected->method,
+							expected->path, expected->keep_alive, request.method, request.path, request.keep_alive);
+					return ESP_FAIL;
+				}
+				http_request_reset(&request);
+			}
+		}
+	}
+	if (count != TEST_HTTP_REQUEST_COUNT) {
+		ESP_LOGE(TAG, "piece %u: requests expected: %u, actual: %u", piece, TEST_HTTP_REQUEST_COUNT, count);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_http_request_malformed() {
+	static const char malformed[] = "GET /\r\n\r\n";
+	http_request_t request;
+	http_request_reset(&request);
+	http_request_result_t result;
+	http_request_parse(&request, (const uint8_t *) malformed, sizeof(malformed) - 1, &result);
+	if (result != HTTP_REQUEST_ERROR) {
+		ESP_LOGE(TAG, "malformed: error expected, actual: %d", result);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_http_request_query() {
+	static const char query[] = "GET /api/favorites?selected=1&value=12&x HTTP/1.1\r\n\r\n";
+	http_request_t request;
+	http_request_reset(&request);
+	http_request_result_t result;
+	http_request_parse(&request, (const uint8_t *) query, sizeof(query) - 1, &result);
+	char value[3];
+	if (result != HTTP_REQUEST_COMPLETE || !http_request_query_value(&request, "value", value, sizeof(value))
+			|| strcmp(value, "12") != 0) {
+		ESP_LOGE(TAG, "query: value 12 expected");
+		return ESP_FAIL;
+	}
+	if (http_request_query_value(&request, "select", value, sizeof(value))
+			|| http_request_query_value(&request, "x", value, sizeof(value))
+			|| http_request_query_value(&request, "selected", value, 1)) {
+		ESP_LOGE(TAG, "query: absent or too long expected");
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/**
+ * Only the start of a long body is kept, the next request is not affected.
+ */
+static esp_err_t test_http_request_body() {
+	static const char body[] = "POST /api/command HTTP/1.1\r\nContent-Length: 200\r\n\r\n";
+	http_request_t request;
+	http_request_reset(&request);
+	http_request_result_t result;
+	http_request_parse(&request, (const uint8_t *) body, sizeof(body) - 1, &result);
+	uint8_t content[200];
+	memset(content, '{', sizeof(content));
+	uint32_t consumed = http_request_parse(&request, content, sizeof(content), &result);
+	if (result != HTTP_REQUEST_COMPLETE || consumed != sizeof(content) || !request.body_overflow
+			|| request.body_length != HTTP_REQUEST_BODY_MAX_LENGTH - 1
+			|| strlen(request.body) != HTTP_REQUEST_BODY_MAX_LENGTH - 1) {
+		ESP_LOGE(TAG, "body: overflow expected, length: %u", request.body_length);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/**
+ * HTTP request parser test.
+ */
+esp_err_t test_http_request() {
+	ESP_LOGD(TAG, ">test_http_request");
+	for (uint32_t piece = 1; piece <= sizeof(TEST_HTTP_REQUEST_PIPELINE); piece++) {
+		if (test_http_request_pipeline(piece) != ESP_OK) {
+			return ESP_FAIL;
+		}
+	}
+	if (test_http_request_malformed() != ESP_OK || test_http_request_query() != ESP_OK
+			|| test_http_request_body() != ESP_OK) {
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_http_request");
+	return ESP_OK;
+}
@@ -0,0 +1,191 @@
+// The author disclaims copyright to this source code.
+#include "test_icy.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "xtensa/hal.h"
+#include "tinymt32.h"
+#include "icy.h"
+
+static const char* TAG = "test_icy";
+
+/** Audio bytes in the test stream. */
+#define TEST_ICY_AUDIO_LENGTH (16384)
+/** Small interval to get many metadata blocks. */
+#define TEST_ICY_METAINT (1000)
+/** Interval as commonly used by stations. */
+#define TEST_ICY_METAINT_BENCHMARK (8192)
+/** Audio plus metadata, worst case one metadata block per TEST_ICY_METAINT audio bytes. */
+#define TEST_ICY_STREAM_LENGTH (TEST_ICY_AUDIO_LENGTH + (TEST_ICY_AUDIO_LENGTH / TEST_ICY_METAINT + 1) * 64)
+/** Largest netbuf fragment expected (TCP MSS). */
+#define TEST_ICY_FRAGMENT_LENGTH (1460)
+
+static const char TEST_ICY_META[] = "StreamTitle='It's a test';StreamUrl='';";
+static const char TEST_ICY_TITLE[] = "It's a test";
+
+static tinymt32_t test_icy_tinymt;
+static uint8_t *test_icy_audio;
+static uint8_t *test_icy_stream;
+static uint8_t *test_icy_output;
+
+static void test_icy_tinymt_init() {
+	test_icy_tinymt.mat1 = 0x8f7011ee;
+	test_icy_tinymt.mat2 = 0xfc78ff1f;
+	test_icy_tinymt.tmat = 0x3793fdff;
+	tinymt32_init(&test_icy_tinymt, 1);
+}
+
+static void *test_icy_malloc(size_t size) {
+	void *buffer = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+	if (buffer == NULL) {
+		ESP_LOGE(TAG, "heap_caps_malloc: out of memory");
+		size_t available = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+		ESP_LOGD(TAG, "heap_caps_get_minimum_free_size: %d", available);
+	}
+	return buffer;
+}
+
+/**
+ * Interleave audio with metadata blocks, every other block is empty.
+ * @return Stream length.
+ */
+static uint32_t test_icy_create_stream(uint32_t metaint) {
+	uint32_t meta_length = ((sizeof(TEST_ICY_META) - 1) + 15) / 16;
+	uint32_t stream_length = 0;
+	uint32_t block = 0;
+	for (uint32_t audio = 0; audio < TEST_ICY_AUDIO_LENGTH; audio += metaint) {
+		uint32_t span = TEST_ICY_AUDIO_LENGTH - audio > metaint ? metaint : TEST_ICY_AUDIO_LENGTH - audio;
+		memcpy(&test_icy_stream[stream_length], &test_icy_audio[audio], span);
+		stream_length += span;
+		if (span == metaint) {
+			if (block++ % 2 == 0) {
+				test_icy_stream[stream_length++] = meta_length;
+				memset(&test_icy_stream[stream_length], 0, meta_length * 16);
+				memcpy(&test_icy_stream[stream_length], TEST_ICY_META, sizeof(TEST_ICY_META) - 1);
+				stream_length += meta_length * 16;
+			} else {
+				test_icy_stream[stream_length++] = 0;
+			}
+		}
+	}
+	return stream_length;
+}
+
+/**
+ * Demultiplex the stream in fragments, copy audio to output.
+ * @return Number of audio bytes.
+ */
+static uint32_t test_icy_demux(icy_handle_t handle, uint32_t stream_length, bool random) {
+	uint32_t output_length = 0;
+	uint32_t offset = 0;
+	while (offset < stream_length) {
+		uint32_t fragment = (random ? 1 + tinymt32_generate_uint32(&test_icy_tinymt) % TEST_ICY_FRAGMENT_LENGTH : TEST_ICY_FRAGMENT_LENGTH);
+		fragment = fragment > stream_length - offset ? stream_length - offset : fragment;
+		uint8_t *data = &test_icy_stream[offset];
+		uint32_t length = fragment;
+		while (length > 0) {
+			uint8_t *audio;
+			uint32_t audio_length;
+			uint32_t consumed = icy_demux(handle, data, length, &audio, &audio_length);
+			memcpy(&test_icy_output[output_length], audio, audio_length);
+			output_length += audio_length;
+			data += consumed;
+			length -= consumed;
+		}
+		offset += fragment;
+	}
+	return output_length;
+}
+
+static esp_err_t test_icy_correctness(icy_handle_t handle) {
+	ESP_LOGD(TAG, ">test_icy_correctness");
+	uint32_t stream_length = test_icy_create_stream(TEST_ICY_METAINT);
+	icy_reset(handle, TEST_ICY_METAINT);
+	uint32_t output_length = test_icy_demux(handle, stream_length, true);
+
+	if (output_length != TEST_ICY_AUDIO_LENGTH) {
+		ESP_LOGE(TAG, "audio length expected: %d, actual: %d", TEST_ICY_AUDIO_LENGTH, output_length);
+		return ESP_FAIL;
+	}
+	if (memcmp(test_icy_output, test_icy_audio, TEST_ICY_AUDIO_LENGTH) != 0) {
+		ESP_LOGE(TAG, "audio differs");
+		return ESP_FAIL;
+	}
+	uint32_t meta_count_expected = TEST_ICY_AUDIO_LENGTH / TEST_ICY_METAINT;
+	if (handle->meta_count != meta_count_expected) {
+		ESP_LOGE(TAG, "meta_count expected: %d, actual: %d", meta_count_expected, handle->meta_count);
+		return ESP_FAIL;
+	}
+	char title[ICY_TITLE_MAX_LENGTH];
+	uint32_t title_count = icy_title(handle, title, sizeof(title));
+	if (strcmp(title, TEST_ICY_TITLE) != 0 || title_count != 1) {
+		ESP_LOGE(TAG, "title expected: %s (1), actual: %s (%d)", TEST_ICY_TITLE, title, title_count);
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_icy_correctness");
+	return ESP_OK;
+}
+
+/**
+ * Compare demultiplexing (including the copy the consumer does) to a plain memcpy.
+ */
+static esp_err_t test_icy_benchmark(icy_handle_t handle) {
+	ESP_LOGD(TAG, ">test_icy_benchmark");
+	uint32_t stream_length = test_icy_create_stream(TEST_ICY_METAINT_BENCHMARK);
+
+	uint32_t start = xthal_get_ccount();
+	memcpy(test_icy_output, test_icy_stream, stream_length);
+	uint32_t memcpy_cycles = xthal_get_ccount() - start;
+
+	icy_reset(handle, TEST_ICY_METAINT_BENCHMARK);
+	start = xthal_get_ccount();
+	uint32_t output_length = test_icy_demux(handle, stream_length, false);
+	uint32_t demux_cycles = xthal_get_ccount() - start;
+
+	if (output_length != TEST_ICY_AUDIO_LENGTH) {
+		ESP_LOGE(TAG, "audio length expected: %d, actual: %d", TEST_ICY_AUDIO_LENGTH, output_length);
+		return ESP_FAIL;
+	}
+	ESP_LOGI(TAG, "memcpy: %u bytes, %u cycles, %u.%03u bytes/cycle", stream_length, memcpy_cycles,
+			stream_length / memcpy_cycles, (1000 * stream_length / memcpy_cycles) % 1000);
+	ESP_LOGI(TAG, "demux: %u bytes, %u cycles, %u.%03u bytes/cycle (%u%% of memcpy)", stream_length, demux_cycles,
+			stream_length / demux_cycles, (1000 * stream_length / demux_cycles) % 1000,
+			100 * memcpy_cycles / demux_cycles);
+	ESP_LOGD(TAG, "<test_icy_benchmark");
+	return ESP_OK;
+}
+
+/**
+ * ICY metadata demultiplexer test.
+ */
+esp_err_t test_icy() {
+	ESP_LOGD(TAG, ">test_icy");
+
+	esp_err_t result = ESP_FAIL;
+	test_icy_audio = test_icy_malloc(TEST_ICY_AUDIO_LENGTH);
+	// also the target of the plain memcpy
+	test_icy_output = test_icy_malloc(TEST_ICY_STREAM_LENGTH);
+	test_icy_stream = test_icy_malloc(TEST_ICY_STREAM_LENGTH);
+	if (test_icy_audio != NULL && test_icy_output != NULL && test_icy_stream != NULL) {
+		test_icy_tinymt_init();
+		for (int i = 0; i < TEST_ICY_AUDIO_LENGTH; i++) {
+			test_icy_audio[i] = (uint8_t) tinymt32_generate_uint32(&test_icy_tinymt);
+		}
+
+		icy_handle_t handle;
+		icy_config_t config;
+		config.metaint = 0;
+		icy_begin(config, &handle);
+		if (test_icy_correctness(handle) == ESP_OK && test_icy_benchmark(handle) == ESP_OK) {
+			result = ESP_OK;
+		}
+		icy_end(handle);
+	}
+	heap_caps_free(test_icy_audio);
+	heap_caps_free(test_icy_output);
+	heap_caps_free(test_icy_stream);
+
+	ESP_LOGD(TAG, "<test_icy");
+	return result;
+}
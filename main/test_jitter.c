@@ -0,0 +1,117 @@
+// The author disclaims copyright to this source code.
+#include "test_jitter.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "tinymt32.h"
+#include "jitter.h"
+
+static const char* TAG = "test_jitter";
+
+#define TEST_JITTER_MIN_MS (1000)
+#define TEST_JITTER_MAX_MS (8000)
+#define TEST_JITTER_UNDERRUN_MS (1000)
+/** One TCP segment of a 128kbps stream. */
+#define TEST_JITTER_GAP_US (90000)
+/** Arrival time varies +/- this much. */
+#define TEST_JITTER_VARIATION_US (20000)
+
+static tinymt32_t test_jitter_tinymt;
+/** Trace time. */
+static int64_t test_jitter_now_us;
+
+static void test_jitter_tinymt_init() {
+	test_jitter_tinymt.mat1 = 0x8f7011ee;
+	test_jitter_tinymt.mat2 = 0xfc78ff1f;
+	test_jitter_tinymt.tmat = 0x3793fdff;
+	tinymt32_init(&test_jitter_tinymt, 1);
+}
+
+/**
+ * Arrivals at the stream rate for a while, with a stall every stall_interval_s (0 for none).
+ */
+static void test_jitter_trace(jitter_handle_t handle, uint32_t duration_s, uint32_t stall_interval_s,
+		uint32_t stall_ms) {
+	int64_t end_us = test_jitter_now_us + (int64_t) duration_s * 1000000;
+	int64_t stall_us = test_jitter_now_us + (int64_t) stall_interval_s * 1000000;
+	while (test_jitter_now_us < end_us) {
+		uint32_t variation_us = tinymt32_generate_uint32(&test_jitter_tinymt) % (2 * TEST_JITTER_VARIATION_US);
+		test_jitter_now_us += TEST_JITTER_GAP_US - TEST_JITTER_VARIATION_US + variation_us;
+		if (stall_interval_s > 0 && test_jitter_now_us >= stall_us) {
+			test_jitter_now_us += stall_ms * 1000;
+			stall_us += (int64_t) stall_interval_s * 1000000;
+		}
+		jitter_arrival(handle, test_jitter_now_us);
+	}
+}
+
+static esp_err_t test_jitter_check(jitter_handle_t handle, const char *trace, uint32_t min_ms, uint32_t max_ms) {
+	uint32_t target_ms = jitter_target_ms(handle);
+	ESP_LOGI(TAG, "%s: target %u ms", trace, target_ms);
+	if (target_ms < min_ms || target_ms > max_ms) {
+		ESP_LOGE(TAG, "%s: target expected: %u-%u ms, actual: %u ms", trace, min_ms, max_ms, target_ms);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_jitter_traces(jitter_handle_t handle) {
+	// a good network stays at the lower bound
+	test_jitter_trace(handle, 120, 0, 0);
+	if (test_jitter_check(handle, "steady", TEST_JITTER_MIN_MS, TEST_JITTER_MIN_MS) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	// regular 3 second stalls must be covered
+	test_jitter_trace(handle, 120, 20, 3000);
+	if (test_jitter_check(handle, "stalls", 3000, 4000) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	// back to normal, the peak decays
+	test_jitter_trace(handle, 600, 0, 0);
+	if (test_jitter_check(handle, "recovered", TEST_JITTER_MIN_MS, TEST_JITTER_MIN_MS) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	// underruns raise the target
+	jitter_underrun(handle, test_jitter_now_us);
+	test_jitter_trace(handle, 10, 0, 0);
+	jitter_underrun(handle, test_jitter_now_us);
+	test_jitter_trace(handle, 10, 0, 0);
+	if (test_jitter_check(handle, "underruns", 2000, 2500) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	// and decay when no underruns happen
+	test_jitter_trace(handle, 900, 0, 0);
+	if (test_jitter_check(handle, "no underruns", TEST_JITTER_MIN_MS, TEST_JITTER_MIN_MS) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	// never above the upper bound
+	for (int i = 0; i < 10; i++) {
+		jitter_underrun(handle, test_jitter_now_us);
+	}
+	test_jitter_trace(handle, 60, 10, 10000);
+	if (test_jitter_check(handle, "bounded", TEST_JITTER_MAX_MS, TEST_JITTER_MAX_MS) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/**
+ * Jitter buffer target test.
+ */
+esp_err_t test_jitter() {
+	ESP_LOGD(TAG, ">test_jitter");
+
+	jitter_handle_t handle;
+	jitter_config_t config;
+	config.min_ms = TEST_JITTER_MIN_MS;
+	config.max_ms = TEST_JITTER_MAX_MS;
+	config.underrun_ms = TEST_JITTER_UNDERRUN_MS;
+	jitter_begin(config, &handle);
+	test_jitter_tinymt_init();
+	test_jitter_now_us = 1;
+
+	esp_err_t result = test_jitter_traces(handle);
+
+	jitter_end(handle);
+	ESP_LOGD(TAG, "<test_jitter");
+	return result;
+}
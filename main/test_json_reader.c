@@ -0,0 +1,134 @@
+// The author disclaims copyright to this source code.
+#include "test_json_reader.h"
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "json_reader.h"
+
+static const char* TAG = "test_json_reader";
+
+#define TEST_JSON_READER_TOKENS (32)
+
+static const char TEST_JSON_READER_DOCUMENT[] =
+		" {\"text\" : \"a\\\"b\\\\c\\n\\u00e9\", \"numbers\":[0,-1.5e+3,42],\"empty\":{},\"nested\":{\"x\":[[]]},"
+		"\"flags\":[true,false,null],\"value\":40}\r\n";
+
+/** Documents that must be refused. */
+static const char *TEST_JSON_READER_MALFORMED[] = { "", " ", "{", "}", "{\"a\"}", "{\"a\":}", "{\"a\":1,}", "[1,]",
+		"[1 2]", "{a:1}", "{\"a\":1}x", "\"\\x\"", "\"\\u12\"", "\"a", "\"a\nb\"", "01", "-", "1.", "1e", ".5", "tru",
+		"nul", "[+1]", "{\"a\" 1}" };
+
+#define TEST_JSON_READER_MALFORMED_COUNT (sizeof(TEST_JSON_READER_MALFORMED) / sizeof(TEST_JSON_READER_MALFORMED[0]))
+
+static esp_err_t test_json_reader_check(const char *name, int64_t expected, int64_t actual) {
+	if (actual != expected) {
+		ESP_LOGE(TAG, "%s expected: %lld, actual: %lld", name, expected, actual);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_json_reader_document() {
+	const char *json = TEST_JSON_READER_DOCUMENT;
+	json_token_t tokens[TEST_JSON_READER_TOKENS];
+	int32_t count = json_reader_parse(json, strlen(json), tokens, TEST_JSON_READER_TOKENS);
+	if (test_json_reader_check("count", 22, count) != ESP_OK
+			|| test_json_reader_check("type", JSON_TOKEN_OBJECT, tokens[0].type) != ESP_OK
+			|| test_json_reader_check("members", 6, tokens[0].size) != ESP_OK
+			|| test_json_reader_check("next", count, tokens[0].next) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	// strings point into the document, escapes kept
+	int32_t text = json_reader_member(json, tokens, 0, "text");
+	if (text < 0 || !json_reader_equals(json, &tokens[text], "a\\\"b\\\\c\\n\\u00e9")) {
+		ESP_LOGE(TAG, "text not found");
+		return ESP_FAIL;
+	}
+
+	// values after nested containers are found
+	int32_t numbers = json_reader_member(json, tokens, 0, "numbers");
+	int32_t value = json_reader_member(json, tokens, 0, "value");
+	uint32_t number;
+	if (numbers < 0 || test_json_reader_check("numbers", 3, tokens[numbers].size) != ESP_OK
+			|| test_json_reader_check("numbers next", numbers + 4, tokens[numbers].next) != ESP_OK
+			|| value < 0 || !json_reader_uint(json, &tokens[value], &number)
+			|| test_json_reader_check("value", 40, number) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	if (json_reader_member(json, tokens, 0, "x") >= 0 || json_reader_member(json, tokens, numbers, "x") >= 0) {
+		ESP_LOGE(TAG, "nested member found at the top level");
+		return ESP_FAIL;
+	}
+
+	// only whole, non-negative 32 bit numbers
+	if (json_reader_uint(json, &tokens[numbers + 2], &number) || !json_reader_uint(json, &tokens[numbers + 1], &number)
+			|| json_reader_uint(json, &tokens[text], &number)) {
+		ESP_LOGE(TAG, "uint conversion");
+		return ESP_FAIL;
+	}
+	json_token_t big;
+	big.type = JSON_TOKEN_NUMBER;
+	big.start = 0;
+	big.length = 10;
+	if (json_reader_uint("4294967296", &big, &number) || !json_reader_uint("4294967295", &big, &number)) {
+		ESP_LOGE(TAG, "uint range");
+		return ESP_FAIL;
+	}
+
+	int32_t flags = json_reader_member(json, tokens, 0, "flags");
+	bool flag = false;
+	if (flags < 0 || !json_reader_bool(&tokens[flags + 1], &flag) || !flag
+			|| !json_reader_bool(&tokens[flags + 2], &flag) || flag || json_reader_bool(&tokens[flags + 3], &flag)) {
+		ESP_LOGE(TAG, "bool conversion");
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_json_reader_malformed() {
+	json_token_t tokens[TEST_JSON_READER_TOKENS];
+	for (int i = 0; i < TEST_JSON_READER_MALFORMED_COUNT; i++) {
+		const char *json = TEST_JSON_READER_MALFORMED[i];
+		if (json_reader_parse(json, strlen(json), tokens, TEST_JSON_READER_TOKENS) != JSON_READER_MALFORMED) {
+			ESP_LOGE(TAG, "not refused: %s", json);
+			return ESP_FAIL;
+		}
+	}
+	// a document must not be read beyond its length
+	if (json_reader_parse("{}", 1, tokens, TEST_JSON_READER_TOKENS) != JSON_READER_MALFORMED
+			|| json_reader_parse("true", 3, tokens, TEST_JSON_READER_TOKENS) != JSON_READER_MALFORMED) {
+		ESP_LOGE(TAG, "read beyond the length");
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_json_reader_limits() {
+	json_token_t tokens[TEST_JSON_READER_TOKENS];
+	static const char deep[] = "[[[[[[[[[]]]]]]]]]";
+	static const char deepest[] = "[[[[[[[[]]]]]]]]";
+	const char *json = TEST_JSON_READER_DOCUMENT;
+	if (test_json_reader_check("too deep", JSON_READER_TOO_DEEP,
+			json_reader_parse(deep, strlen(deep), tokens, TEST_JSON_READER_TOKENS)) != ESP_OK
+			|| test_json_reader_check("deepest", JSON_READER_MAX_DEPTH,
+					json_reader_parse(deepest, strlen(deepest), tokens, TEST_JSON_READER_TOKENS)) != ESP_OK
+			|| test_json_reader_check("too many", JSON_READER_TOO_MANY_TOKENS,
+					json_reader_parse(json, strlen(json), tokens, 21)) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/**
+ * JSON tokenizer test.
+ */
+esp_err_t test_json_reader() {
+	ESP_LOGD(TAG, ">test_json_reader");
+	if (test_json_reader_document() != ESP_OK || test_json_reader_malformed() != ESP_OK
+			|| test_json_reader_limits() != ESP_OK) {
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_json_reader");
+	return ESP_OK;
+}
@@ -0,0 +1,122 @@
+// The author disclaims copyright to this source code.
+#include "test_json_writer.h"
+#include <string.h>
+#include <stdlib.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "json_writer.h"
+
+static const char* TAG = "test_json_writer";
+
+/** Several outputs worth of document. */
+#define TEST_JSON_WRITER_OUTPUT_LENGTH (4096)
+#define TEST_JSON_WRITER_ITEMS (100)
+
+static const char TEST_JSON_WRITER_START[] =
+		"{\"text\":\"a\\\"b\\\\c\\n\\u0001\",\"negative\":-42,\"max\":18446744073709551615,\"items\":[";
+
+static char test_json_writer_output[TEST_JSON_WRITER_OUTPUT_LENGTH];
+static uint32_t test_json_writer_output_length;
+static uint32_t test_json_writer_output_count;
+
+static bool test_json_writer_collect(void *context, const char *data, uint32_t length, bool more) {
+	if (test_json_writer_output_length + length > TEST_JSON_WRITER_OUTPUT_LENGTH) {
+		return false;
+	}
+	memcpy(&test_json_writer_output[test_json_writer_output_length], data, length);
+	test_json_writer_output_length += length;
+	test_json_writer_output_count++;
+	return true;
+}
+
+static bool test_json_writer_document(bool chunked) {
+	test_json_writer_output_length = 0;
+	test_json_writer_output_count = 0;
+	json_writer_t writer;
+	json_writer_start(&writer, chunked, test_json_writer_collect, NULL);
+	json_writer_object_start(&writer, NULL);
+	json_writer_string(&writer, "text", "a\"b\\c\n\x01");
+	json_writer_int(&writer, "negative", -42);
+	json_writer_uint(&writer, "max", UINT64_MAX);
+	json_writer_array_start(&writer, "items");
+	for (int i = 0; i < TEST_JSON_WRITER_ITEMS; i++) {
+		json_writer_object_start(&writer, NULL);
+		json_writer_uint(&writer, "index", i);
+		json_writer_bool(&writer, "odd", i & 1);
+		json_writer_object_end(&writer);
+	}
+	json_writer_array_end(&writer);
+	json_writer_object_end(&writer);
+	return json_writer_finish(&writer);
+}
+
+/**
+ * Remove the chunk framing in place.
+ * @return False when the framing is wrong.
+ */
+static bool test_json_writer_dechunk(uint32_t *length) {
+	char *input = test_json_writer_output;
+	char *end = &test_json_writer_output[test_json_writer_output_length];
+	*length = 0;
+	while (input < end) {
+		char *size_end;
+		uint32_t size = strtoul(input, &size_end, 16);
+		if (size_end == input || size_end + 2 > end || strncmp(size_end, "\r\n", 2) != 0) {
+			return false;
+		}
+		input = size_end + 2;
+		if (size == 0) {
+			// last chunk
+			return input + 2 == end && strncmp(input, "\r\n", 2) == 0;
+		}
+		if (input + size + 2 > end || strncmp(input + size, "\r\n", 2) != 0) {
+			return false;
+		}
+		memmove(&test_json_writer_output[*length], input, size);
+		*length += size;
+		input += size + 2;
+	}
+	return false;
+}
+
+/**
+ * JSON writer test, the chunked document must equal the plain document.
+ */
+esp_err_t test_json_writer() {
+	ESP_LOGD(TAG, ">test_json_writer");
+
+	size_t free_size = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	if (!test_json_writer_document(false)) {
+		ESP_LOGE(TAG, "plain: output failed");
+		return ESP_FAIL;
+	}
+	if (heap_caps_get_free_size(MALLOC_CAP_8BIT) != free_size) {
+		ESP_LOGE(TAG, "plain: heap used");
+		return ESP_FAIL;
+	}
+	if (strncmp(test_json_writer_output, TEST_JSON_WRITER_START, sizeof(TEST_JSON_WRITER_START) - 1) != 0
+			|| test_json_writer_output_count < 2) {
+		ESP_LOGE(TAG, "plain: unexpected: %.*s", sizeof(TEST_JSON_WRITER_START) - 1, test_json_writer_output);
+		return ESP_FAIL;
+	}
+	char *plain = heap_caps_malloc(test_json_writer_output_length, MALLOC_CAP_8BIT);
+	if (plain == NULL) {
+		ESP_LOGE(TAG, "heap_caps_malloc: out of memory");
+		return ESP_FAIL;
+	}
+	uint32_t plain_length = test_json_writer_output_length;
+	memcpy(plain, test_json_writer_output, plain_length);
+
+	esp_err_t result = ESP_OK;
+	uint32_t length;
+	if (!test_json_writer_document(true) || !test_json_writer_dechunk(&length) || length != plain_length
+			|| memcmp(test_json_writer_output, plain, plain_length) != 0) {
+		ESP_LOGE(TAG, "chunked: differs from plain");
+		result = ESP_FAIL;
+	}
+	heap_caps_free(plain);
+
+	ESP_LOGD(TAG, "<test_json_writer");
+	return result;
+}
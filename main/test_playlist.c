@@ -0,0 +1,185 @@
+// The author disclaims copyright to this source code.
+#include "test_playlist.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "playlist.h"
+
+static const char* TAG = "test_playlist";
+
+/** Byte order mark, comments, a duplicate, no end of line at the end. */
+static const char TEST_PLAYLIST_M3U[] = "\xEF\xBB\xBF#EXTM3U\r\n"
+		"#EXTINF:-1,Radio\r\n"
+		"http://one.example:8000/stream\r\n"
+		"\r\n"
+		"  https://two.example/stream.mp3  \r\n"
+		"http://one.example:8000/stream\r\n"
+		"not a url\n"
+		"http://three.example/stream";
+
+static const char TEST_PLAYLIST_PLS[] = "[playlist]\n"
+		"NumberOfEntries=2\n"
+		"File1=http://one.example/stream\n"
+		"Title1=One\n"
+		"file2=http://two.example/stream\n"
+		"Length1=-1\n"
+		"Version=2\n";
+
+static playlist_t test_playlist_playlist;
+
+/**
+ * Parse in pieces of the given size, the line boundaries fall anywhere.
+ */
+static void test_playlist_parse(const char *text, uint32_t piece) {
+	playlist_t *playlist = &test_playlist_playlist;
+	playlist_reset(playlist);
+	uint32_t length = strlen(text);
+	for (uint32_t offset = 0; offset < length; offset += piece) {
+		playlist_parse(playlist, (const uint8_t *) text + offset, length - offset < piece ? length - offset : piece);
+	}
+	playlist_parse_end(playlist);
+}
+
+static esp_err_t test_playlist_check(const char *name, uint32_t count_expected, const char **urls_expected) {
+	playlist_t *playlist = &test_playlist_playlist;
+	if (playlist->count != count_expected) {
+		ESP_LOGE(TAG, "%s count expected: %u, actual: %u", name, count_expected, playlist->count);
+		return ESP_FAIL;
+	}
+	for (uint32_t i = 0; i < count_expected; i++) {
+		if (strcmp(playlist->candidates[i].url, urls_expected[i]) != 0) {
+			ESP_LOGE(TAG, "%s %u expected: %s, actual: %s", name, i, urls_expected[i], playlist->candidates[i].url);
+			return ESP_FAIL;
+		}
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_playlist_formats() {
+	const char *m3u[] = { "http://one.example:8000/stream", "https://two.example/stream.mp3",
+			"http://three.example/stream" };
+	const char *pls[] = { "http://one.example/stream", "http://two.example/stream" };
+	esp_err_t result = ESP_OK;
+	uint32_t pieces[] = { 1, 3, 7, 1024 };
+	for (int i = 0; i < sizeof(pieces) / sizeof(pieces[0]) && result == ESP_OK; i++) {
+		test_playlist_parse(TEST_PLAYLIST_M3U, pieces[i]);
+		result = test_playlist_check("M3U", 3, m3u);
+		if (result == ESP_OK) {
+			test_playlist_parse(TEST_PLAYLIST_PLS, pieces[i]);
+			result = test_playlist_check("PLS", 2, pls);
+		}
+	}
+	if (result == ESP_OK) {
+		// a line too long is skipped, the next one is not
+		char text[PLAYLIST_LINE_MAX_LENGTH + 64];
+		memset(text, 'x', PLAYLIST_LINE_MAX_LENGTH + 16);
+		strcpy(text, "http://");
+		text[7] = 'x';
+		strcpy(text + PLAYLIST_LINE_MAX_LENGTH + 16, "\nhttp://one.example/stream\n");
+		test_playlist_parse(text, 5);
+		result = test_playlist_check("overflow", 1, &pls[0]);
+	}
+	if (result == ESP_OK) {
+		// the rest is skipped
+		test_playlist_parse("", 1);
+		for (int i = 0; i < PLAYLIST_MAX_CANDIDATES + 2; i++) {
+			char line[32];
+			sprintf(line, "http://mirror%d.example/\n", i);
+			playlist_parse(&test_playlist_playlist, (const uint8_t *) line, strlen(line));
+		}
+		if (test_playlist_playlist.count != PLAYLIST_MAX_CANDIDATES) {
+			ESP_LOGE(TAG, "max count expected: %u, actual: %u", PLAYLIST_MAX_CANDIDATES, test_playlist_playlist.count);
+			result = ESP_FAIL;
+		}
+	}
+	return result;
+}
+
+static esp_err_t test_playlist_select(const char *name, bool failover, uint32_t expected) {
+	uint32_t actual = playlist_select(&test_playlist_playlist, failover);
+	if (actual != expected) {
+		ESP_LOGE(TAG, "%s expected: %u, actual: %u", name, expected, actual);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_playlist_ranking() {
+	playlist_t *playlist = &test_playlist_playlist;
+	test_playlist_parse(TEST_PLAYLIST_M3U, 1024);
+	// playlist order while nothing is known
+	esp_err_t result = test_playlist_select("first", false, 0);
+	if (result == ESP_OK) {
+		// too slow, the next one is tried
+		playlist_connected(playlist, 300000);
+		playlist_throughput(playlist, 8000);
+		playlist_failed(playlist);
+		result = test_playlist_select("failover", true, 1);
+	}
+	if (result == ESP_OK) {
+		// fast enough and quicker to connect than the last
+		playlist_connected(playlist, 200000);
+		playlist_throughput(playlist, 16000);
+		result = test_playlist_select("stay", false, 1);
+	}
+	if (result == ESP_OK) {
+		// always another one on failover
+		playlist_failed(playlist);
+		result = test_playlist_select("failover again", true, 2);
+	}
+	if (result == ESP_OK) {
+		// equal throughput within a tenth, the quickest to connect wins
+		playlist_connected(playlist, 100000);
+		playlist_throughput(playlist, 15000);
+		playlist_failed(playlist);
+		result = test_playlist_select("connect time", false, 2);
+	}
+	if (result == ESP_OK) {
+		playlist->candidates[2].connect_us = 250000;
+		result = test_playlist_select("connect time", false, 1);
+	}
+	if (result == ESP_OK) {
+		// the higher throughput wins, even though slower to connect
+		playlist->candidates[0].throughput = 16000;
+		playlist->candidates[1].throughput = 10000;
+		playlist->candidates[2].throughput = 10000;
+		result = test_playlist_select("throughput", false, 0);
+	}
+	return result;
+}
+
+static esp_err_t test_playlist_recognize() {
+	const char *urls[] = { "http://radio.example/listen.m3u", "http://radio.example/listen.PLS?sid=1",
+			"http://radio.example/listen.m3u8", "http://radio.example/stream", "http://radio.example/m3u" };
+	const bool urls_expected[] = { true, true, false, false, false };
+	for (int i = 0; i < sizeof(urls) / sizeof(urls[0]); i++) {
+		if (playlist_is_url(urls[i]) != urls_expected[i]) {
+			ESP_LOGE(TAG, "url %s expected: %d", urls[i], urls_expected[i]);
+			return ESP_FAIL;
+		}
+	}
+	const char *types[] = { "audio/x-scpls\r\n", "Audio/X-MpegURL; charset=utf-8\r\n", "audio/mpeg\r\n",
+			"audio/mpegurl2\r\n" };
+	const bool types_expected[] = { true, true, false, false };
+	for (int i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (playlist_is_content_type(types[i]) != types_expected[i]) {
+			ESP_LOGE(TAG, "content type %s expected: %d", types[i], types_expected[i]);
+			return ESP_FAIL;
+		}
+	}
+	return ESP_OK;
+}
+
+esp_err_t test_playlist() {
+	ESP_LOGD(TAG, ">test_playlist");
+	esp_err_t result = test_playlist_formats();
+	if (result == ESP_OK) {
+		result = test_playlist_ranking();
+	}
+	if (result == ESP_OK) {
+		result = test_playlist_recognize();
+	}
+	ESP_LOGD(TAG, "<test_playlist");
+	return result;
+}
@@ -0,0 +1,220 @@
+// The author disclaims copyright to this source code.
+#include "test_relay.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "relay.h"
+
+static const char* TAG = "test_relay";
+
+/** MPEG 1 layer III, 128kbps, 44100Hz, no padding: 417 bytes */
+static const uint8_t TEST_RELAY_MPEG_HEADER[] = { 0xFF, 0xFB, 0x90, 0x00 };
+#define TEST_RELAY_MPEG_LENGTH (417)
+
+#define TEST_RELAY_LISTENERS (3)
+#define TEST_RELAY_FAST (0)
+#define TEST_RELAY_SLOW (1)
+#define TEST_RELAY_LATE (2)
+
+static buffer_handle_t test_relay_buffer_handle;
+static uint8_t *test_relay_data;
+/** Frames pushed since the reset. */
+static uint32_t test_relay_frames;
+
+/**
+ * Expected byte at a buffer address: frame headers, the payload holds the
+ * frame number (below 0x80, never mistaken for a frame header).
+ */
+static uint8_t test_relay_expected(uint32_t addr) {
+	uint32_t offset = addr % TEST_RELAY_MPEG_LENGTH;
+	if (offset < sizeof(TEST_RELAY_MPEG_HEADER)) {
+		return TEST_RELAY_MPEG_HEADER[offset];
+	}
+	return (addr / TEST_RELAY_MPEG_LENGTH) & 0x7F;
+}
+
+/**
+ * Push complete frames, like the reader does.
+ * @return False when a push was held back.
+ */
+static bool test_relay_push(uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t addr = test_relay_frames * TEST_RELAY_MPEG_LENGTH;
+		for (uint32_t j = 0; j < TEST_RELAY_MPEG_LENGTH; j++) {
+			test_relay_data[j] = test_relay_expected(addr + j);
+		}
+		if (buffer_push(test_relay_buffer_handle, test_relay_data, TEST_RELAY_MPEG_LENGTH) != TEST_RELAY_MPEG_LENGTH) {
+			ESP_LOGE(TAG, "push held back, frame: %u", test_relay_frames);
+			return false;
+		}
+		test_relay_frames++;
+	}
+	return true;
+}
+
+/**
+ * Read at a cursor and check every byte against the address it came from.
+ * @return Bytes read, or -1 when the data is not what was pushed there.
+ */
+static int32_t test_relay_read(buffer_cursor_t *cursor, uint32_t length) {
+	uint32_t skip_count = cursor->skip_count;
+	uint32_t read = buffer_cursor_read(test_relay_buffer_handle, cursor, length, test_relay_data, 0);
+	uint32_t addr = cursor->addr - read;
+	if (read > 0 && (cursor->skip_count != skip_count || cursor->read_bytes == read)
+			&& addr % TEST_RELAY_MPEG_LENGTH != 0) {
+		ESP_LOGE(TAG, "not frame aligned: %u", addr);
+		return -1;
+	}
+	for (uint32_t i = 0; i < read; i++) {
+		if (test_relay_data[i] != test_relay_expected(addr + i)) {
+			ESP_LOGE(TAG, "data at %u expected: 0x%02x, actual: 0x%02x", addr + i, test_relay_expected(addr + i),
+					test_relay_data[i]);
+			return -1;
+		}
+	}
+	return read;
+}
+
+static esp_err_t test_relay_check(const char *name, uint64_t expected, uint64_t actual) {
+	if (actual != expected) {
+		buffer_log(test_relay_buffer_handle);
+		ESP_LOGE(TAG, "%s expected: %llu, actual: %llu", name, expected, actual);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/**
+ * A fast, a slow and a late listener next to the player.
+ * The slow listener must skip forward frame aligned, the player and the
+ * other listeners must not notice.
+ */
+static esp_err_t test_relay_listeners() {
+	ESP_LOGD(TAG, ">test_relay_listeners");
+	buffer_cursor_t cursors[TEST_RELAY_LISTENERS];
+	uint64_t received[TEST_RELAY_LISTENERS];
+	memset(received, 0, sizeof(received));
+
+	// the player is 10 frames behind the reader, like during normal play
+	test_relay_push(10);
+	buffer_cursor_begin(test_relay_buffer_handle, &cursors[TEST_RELAY_FAST]);
+	buffer_cursor_begin(test_relay_buffer_handle, &cursors[TEST_RELAY_SLOW]);
+
+	// several buffers worth of audio
+	uint32_t rounds = 3 * test_relay_buffer_handle->size / TEST_RELAY_MPEG_LENGTH;
+	uint32_t pulled = 0;
+	for (uint32_t round = 0; round < rounds; round++) {
+		if (!test_relay_push(1)) {
+			return ESP_FAIL;
+		}
+		pulled += buffer_pull(test_relay_buffer_handle, TEST_RELAY_MPEG_LENGTH, test_relay_data);
+		if (round == rounds / 2) {
+			buffer_cursor_begin(test_relay_buffer_handle, &cursors[TEST_RELAY_LATE]);
+		}
+		for (int i = 0; i < TEST_RELAY_LISTENERS; i++) {
+			if (i == TEST_RELAY_LATE && round < rounds / 2) {
+				continue;
+			}
+			// the slow listener takes a third of the audio rate
+			uint32_t length = (i == TEST_RELAY_SLOW ? TEST_RELAY_MPEG_LENGTH / 3 : RELAY_CHUNK_LENGTH);
+			int32_t read;
+			do {
+				read = test_relay_read(&cursors[i], length);
+				if (read < 0) {
+					ESP_LOGE(TAG, "listener: %d, round: %u", i, round);
+					return ESP_FAIL;
+				}
+				received[i] += read;
+			} while (read > 0 && i != TEST_RELAY_SLOW);
+		}
+	}
+
+	// the fast listener got everything from where it started, the player was not held back
+	uint64_t pushed = (uint64_t) test_relay_frames * TEST_RELAY_MPEG_LENGTH;
+	if (test_relay_check("fast received", pushed, received[TEST_RELAY_FAST]) != ESP_OK
+			|| test_relay_check("fast skips", 0, cursors[TEST_RELAY_FAST].skip_count) != ESP_OK
+			|| test_relay_check("late skips", 0, cursors[TEST_RELAY_LATE].skip_count) != ESP_OK
+			|| test_relay_check("late end", cursors[TEST_RELAY_FAST].addr, cursors[TEST_RELAY_LATE].addr) != ESP_OK
+			|| test_relay_check("pulled", rounds * TEST_RELAY_MPEG_LENGTH, pulled) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	// the slow listener skipped, every byte it did not receive was skipped
+	buffer_cursor_t *slow = &cursors[TEST_RELAY_SLOW];
+	if (slow->skip_count == 0
+			|| test_relay_check("slow received", slow->read_bytes, received[TEST_RELAY_SLOW]) != ESP_OK
+			|| test_relay_check("slow position", slow->addr, slow->read_bytes + slow->skip_bytes) != ESP_OK) {
+		ESP_LOGE(TAG, "slow skip_count: %u", slow->skip_count);
+		return ESP_FAIL;
+	}
+
+	// data removed by a reset is not read
+	buffer_reset(test_relay_buffer_handle);
+	test_relay_frames = 0;
+	if (test_relay_check("after reset", 0, test_relay_read(&cursors[TEST_RELAY_FAST], RELAY_CHUNK_LENGTH)) != ESP_OK
+			|| test_relay_check("cursor", 0, cursors[TEST_RELAY_FAST].addr) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_relay_listeners");
+	return ESP_OK;
+}
+
+/**
+ * Listener limit.
+ */
+static esp_err_t test_relay_join() {
+	ESP_LOGD(TAG, ">test_relay_join");
+	relay_config_t config;
+	config.buffer_handle = test_relay_buffer_handle;
+	config.max_listeners = 2;
+	config.max_skips = 0;
+	config.idle_timeout_ms = 1000;
+	relay_handle_t handle;
+	relay_begin(config, &handle);
+	bool joined = relay_join(handle) && relay_join(handle) && !relay_join(handle);
+	relay_statistics_t statistics;
+	relay_get_statistics(handle, &statistics);
+	// nobody is served, release the places
+	handle->listeners = 0;
+	relay_end(handle);
+	if (!joined || test_relay_check("listeners", 2, statistics.listeners) != ESP_OK) {
+		ESP_LOGE(TAG, "listener limit not respected");
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_relay_join");
+	return ESP_OK;
+}
+
+/**
+ * Audio relay test, the buffer is reset and its policies restored afterwards.
+ */
+esp_err_t test_relay(test_relay_config_t config) {
+	ESP_LOGD(TAG, ">test_relay");
+
+	test_relay_buffer_handle = config.buffer_handle;
+	ESP_LOGD(TAG, "test_relay_buffer_handle: %p", test_relay_buffer_handle);
+
+	test_relay_data = heap_caps_malloc(RELAY_CHUNK_LENGTH, MALLOC_CAP_DMA);
+	assert(test_relay_data != NULL);
+	buffer_policy_t overflow_policy = test_relay_buffer_handle->overflow_policy;
+	uint32_t block_ms = test_relay_buffer_handle->block_ms;
+	// a push that has to wait fails the test
+	test_relay_buffer_handle->overflow_policy = BUFFER_POLICY_BLOCK;
+	test_relay_buffer_handle->block_ms = 0;
+	buffer_reset(test_relay_buffer_handle);
+	test_relay_frames = 0;
+
+	esp_err_t result = test_relay_listeners();
+	if (result == ESP_OK) {
+		result = test_relay_join();
+	}
+
+	test_relay_buffer_handle->overflow_policy = overflow_policy;
+	test_relay_buffer_handle->block_ms = block_ms;
+	buffer_reset(test_relay_buffer_handle);
+	heap_caps_free(test_relay_data);
+	test_relay_data = NULL;
+
+	ESP_LOGD(TAG, "<test_relay");
+	return result;
+}
@@ -0,0 +1,90 @@
+// The author disclaims copyright to this source code.
+#include "test_telemetry.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "telemetry.h"
+
+static const char* TAG = "test_telemetry";
+
+static esp_err_t test_telemetry_json(const telemetry_snapshot_t *snapshot, uint8_t changes, const char *expected) {
+	char out[TELEMETRY_MAX_LENGTH];
+	uint32_t length = telemetry_json(snapshot, changes, out, sizeof(out));
+	if (length != strlen(expected) || memcmp(out, expected, length) != 0) {
+		ESP_LOGE(TAG, "json expected: %s, actual: %.*s", expected, length, out);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_telemetry_binary(const telemetry_snapshot_t *snapshot, uint8_t changes, const uint8_t *expected,
+		uint32_t expected_length) {
+	uint8_t out[TELEMETRY_MAX_LENGTH];
+	uint32_t length = telemetry_binary(snapshot, changes, out, sizeof(out));
+	if (length != expected_length || memcmp(out, expected, length) != 0) {
+		ESP_LOGE(TAG, "binary changes: 0x%02x, expected length: %u, actual: %u", changes, expected_length, length);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+esp_err_t test_telemetry() {
+	ESP_LOGD(TAG, ">test_telemetry");
+
+	telemetry_snapshot_t previous;
+	memset(&previous, 0, sizeof(previous));
+	previous.buffer_percentage = 57;
+	previous.state = PLAYER_STATE_PLAYING;
+	previous.bitrate = 128000;
+	strcpy(previous.title, "Artist - Song");
+	telemetry_snapshot_t current = previous;
+
+	// nothing changed, nothing to send
+	if (telemetry_changes(&previous, &current) != 0) {
+		ESP_LOGE(TAG, "changes without a change");
+		return ESP_FAIL;
+	}
+	current.buffer_percentage = 58;
+	strcpy(current.title, "Artist - \"Next\"");
+	uint8_t changes = telemetry_changes(&previous, &current);
+	if (changes != (TELEMETRY_BUFFER | TELEMETRY_TITLE)) {
+		ESP_LOGE(TAG, "changes expected: 0x%02x, actual: 0x%02x", TELEMETRY_BUFFER | TELEMETRY_TITLE, changes);
+		return ESP_FAIL;
+	}
+
+	// only the changed fields
+	if (test_telemetry_json(&current, changes, "{\"buffer\":58,\"title\":\"Artist - \\\"Next\\\"\"}") != ESP_OK) {
+		return ESP_FAIL;
+	}
+	const uint8_t delta[] = { TELEMETRY_BUFFER | TELEMETRY_TITLE, 58, 15, 'A', 'r', 't', 'i', 's', 't', ' ', '-', ' ',
+			'"', 'N', 'e', 'x', 't', '"' };
+	if (test_telemetry_binary(&current, changes, delta, sizeof(delta)) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	// everything, after a resync
+	current.title[0] = '\0';
+	char expected[128];
+	snprintf(expected, sizeof(expected), "{\"buffer\":58,\"state\":\"%s\",\"bitrate\":128000,\"title\":\"\"}",
+			player_state_name(PLAYER_STATE_PLAYING));
+	if (test_telemetry_json(&current, TELEMETRY_ALL, expected) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	const uint8_t full[] = { TELEMETRY_ALL, 58, PLAYER_STATE_PLAYING, 0x00, 0x01, 0xF4, 0x00, 0 };
+	if (test_telemetry_binary(&current, TELEMETRY_ALL, full, sizeof(full)) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	// an update that does not fit is not sent
+	char small[8];
+	uint8_t small_binary[4];
+	if (telemetry_json(&current, TELEMETRY_ALL, small, sizeof(small)) != 0
+			|| telemetry_binary(&current, TELEMETRY_ALL, small_binary, sizeof(small_binary)) != 0) {
+		ESP_LOGE(TAG, "update does not fit");
+		return ESP_FAIL;
+	}
+
+	ESP_LOGD(TAG, "<test_telemetry");
+	return ESP_OK;
+}
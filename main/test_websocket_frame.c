@@ -0,0 +1,387 @@
+// The author disclaims copyright to this source code.
+#include "test_websocket_frame.h"
+#include <assert.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#if CONFIG_HEAP_TRACING
+#include "esp_heap_trace.h"
+#endif
+#include "tinymt32.h"
+#include "websocket_frame.h"
+#include "message_pool.h"
+#include "websocket_server.h"
+
+static const char* TAG = "test_websocket_frame";
+
+#define TEST_WEBSOCKET_FRAME_MESSAGE_SIZE (1024)
+#define TEST_WEBSOCKET_FRAME_STREAM_SIZE (2048)
+#define TEST_WEBSOCKET_FRAME_BINARY_LENGTH (300)
+#define TEST_WEBSOCKET_FRAME_FUZZ_ROUNDS (2000)
+#define TEST_WEBSOCKET_FRAME_BENCHMARK_LENGTH (1000)
+#define TEST_WEBSOCKET_FRAME_BENCHMARK_ROUNDS (1000)
+#define TEST_WEBSOCKET_FRAME_POOL_COUNT (2)
+#define TEST_WEBSOCKET_FRAME_HEAP_ROUNDS (100)
+#if CONFIG_HEAP_TRACING
+#define TEST_WEBSOCKET_FRAME_HEAP_RECORDS (8)
+#endif
+
+static const uint8_t TEST_WEBSOCKET_FRAME_MASK[] = { 0x37, 0xFA, 0x21, 0x3D };
+
+typedef struct test_websocket_frame_expected_t {
+	websocket_frame_result_t result;
+	websocket_opcode_t opcode;
+	const uint8_t *payload;
+	uint32_t length;
+} test_websocket_frame_expected_t;
+
+static uint8_t test_websocket_frame_message[TEST_WEBSOCKET_FRAME_MESSAGE_SIZE];
+static uint8_t test_websocket_frame_stream[TEST_WEBSOCKET_FRAME_STREAM_SIZE];
+static uint32_t test_websocket_frame_stream_length;
+static uint8_t test_websocket_frame_binary[TEST_WEBSOCKET_FRAME_BINARY_LENGTH];
+static websocket_frame_parser_t test_websocket_frame_parser;
+static tinymt32_t test_websocket_frame_tinymt;
+#if CONFIG_HEAP_TRACING
+static heap_trace_record_t test_websocket_frame_heap_records[TEST_WEBSOCKET_FRAME_HEAP_RECORDS];
+#endif
+
+/**
+ * Append a masked frame (client to server) to the stream.
+ * @param long_length Use a 64-bit length even when shorter would do.
+ */
+static void test_websocket_frame_append(bool fin, websocket_opcode_t opcode, const void *payload, uint32_t length,
+		bool long_length) {
+	uint8_t *frame = &test_websocket_frame_stream[test_websocket_frame_stream_length];
+	uint32_t header_length;
+	if (long_length) {
+		frame[0] = opcode;
+		frame[1] = 127;
+		for (int i = 0; i < 8; i++) {
+			frame[2 + i] = ((uint64_t) length >> (56 - 8 * i)) & 0xFF;
+		}
+		header_length = 10;
+	} else {
+		header_length = websocket_frame_header(frame, opcode, length);
+	}
+	frame[0] = (fin ? 0x80 : 0x00) | opcode;
+	frame[1] |= 0x80;
+	memcpy(&frame[header_length], TEST_WEBSOCKET_FRAME_MASK, 4);
+	header_length += 4;
+	const uint8_t *bytes = payload;
+	for (uint32_t i = 0; i < length; i++) {
+		frame[header_length + i] = bytes[i] ^ TEST_WEBSOCKET_FRAME_MASK[i & 3];
+	}
+	test_websocket_frame_stream_length += header_length + length;
+	assert(test_websocket_frame_stream_length <= TEST_WEBSOCKET_FRAME_STREAM_SIZE);
+}
+
+/**
+ * Fragmented text with a ping in between, binary with a 16-bit length, text
+ * with a 64-bit length, a pong and a close.
+ * @param binary Include the binary message.
+ */
+static void test_websocket_frame_conversation(bool binary) {
+	for (int i = 0; i < TEST_WEBSOCKET_FRAME_BINARY_LENGTH; i++) {
+		test_websocket_frame_binary[i] = i;
+	}
+	test_websocket_frame_stream_length = 0;
+	test_websocket_frame_append(false, WEBSOCKET_OPCODE_TEXT, "Hello, ", 7, false);
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_PING, "ping!", 5, false);
+	test_websocket_frame_append(false, WEBSOCKET_OPCODE_CONTINUATION, "frag", 4, false);
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_CONTINUATION, "mented", 6, false);
+	if (binary) {
+		test_websocket_frame_append(true, WEBSOCKET_OPCODE_BINARY, test_websocket_frame_binary,
+				TEST_WEBSOCKET_FRAME_BINARY_LENGTH, false);
+	}
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_TEXT, "sixty four", 10, true);
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_PONG, NULL, 0, false);
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_CLOSE, "\x03\xE8", 2, false);
+}
+
+static esp_err_t test_websocket_frame_check(const test_websocket_frame_expected_t *expected,
+		websocket_frame_result_t result) {
+	websocket_frame_parser_t *parser = &test_websocket_frame_parser;
+	if (result != expected->result) {
+		ESP_LOGE(TAG, "result expected: %d, actual: %d", expected->result, result);
+		return ESP_FAIL;
+	}
+	const uint8_t *payload = parser->control;
+	uint32_t length = parser->control_length;
+	if (result == WEBSOCKET_FRAME_MESSAGE) {
+		if (parser->message_opcode != expected->opcode) {
+			ESP_LOGE(TAG, "opcode expected: %d, actual: %d", expected->opcode, parser->message_opcode);
+			return ESP_FAIL;
+		}
+		payload = parser->message;
+		length = parser->message_length;
+	}
+	if (result == WEBSOCKET_FRAME_CLOSE || result == WEBSOCKET_FRAME_ERROR) {
+		if (parser->close_status != expected->length) {
+			ESP_LOGE(TAG, "close status expected: %u, actual: %u", expected->length, parser->close_status);
+			return ESP_FAIL;
+		}
+	} else if (length != expected->length || memcmp(payload, expected->payload, length) != 0) {
+		ESP_LOGE(TAG, "payload expected: %u, actual: %u", expected->length, length);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/**
+ * Feed the stream in pieces of the given length.
+ * @return Results checked against the expected results.
+ */
+static esp_err_t test_websocket_frame_feed(uint32_t piece, const test_websocket_frame_expected_t *expected,
+		uint32_t expected_count) {
+	websocket_frame_reset(&test_websocket_frame_parser, test_websocket_frame_message,
+			TEST_WEBSOCKET_FRAME_MESSAGE_SIZE);
+	uint32_t count = 0;
+	uint32_t offset = 0;
+	while (offset < test_websocket_frame_stream_length) {
+		uint32_t length = test_websocket_frame_stream_length - offset;
+		if (length > piece) {
+			length = piece;
+		}
+		const uint8_t *data = &test_websocket_frame_stream[offset];
+		offset += length;
+		while (length > 0) {
+			websocket_frame_result_t result;
+			uint32_t consumed = websocket_frame_parse(&test_websocket_frame_parser, data, length, &result);
+			data += consumed;
+			length -= consumed;
+			if (result == WEBSOCKET_FRAME_INCOMPLETE) {
+				continue;
+			}
+			if (count == expected_count || test_websocket_frame_check(&expected[count], result) != ESP_OK) {
+				ESP_LOGE(TAG, "piece: %u, result: %u", piece, count);
+				return ESP_FAIL;
+			}
+			count++;
+			if (result == WEBSOCKET_FRAME_ERROR) {
+				// nothing more is understood
+				length = 0;
+				offset = test_websocket_frame_stream_length;
+			}
+		}
+	}
+	if (count != expected_count) {
+		ESP_LOGE(TAG, "piece: %u, results expected: %u, actual: %u", piece, expected_count, count);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t test_websocket_frame_pieces() {
+	ESP_LOGD(TAG, ">test_websocket_frame_pieces");
+	const test_websocket_frame_expected_t expected[] = {
+		{ WEBSOCKET_FRAME_PING, 0, (const uint8_t *) "ping!", 5 },
+		{ WEBSOCKET_FRAME_MESSAGE, WEBSOCKET_OPCODE_TEXT, (const uint8_t *) "Hello, fragmented", 17 },
+		{ WEBSOCKET_FRAME_MESSAGE, WEBSOCKET_OPCODE_BINARY, test_websocket_frame_binary,
+				TEST_WEBSOCKET_FRAME_BINARY_LENGTH },
+		{ WEBSOCKET_FRAME_MESSAGE, WEBSOCKET_OPCODE_TEXT, (const uint8_t *) "sixty four", 10 },
+		{ WEBSOCKET_FRAME_PONG, 0, (const uint8_t *) "", 0 },
+		{ WEBSOCKET_FRAME_CLOSE, 0, NULL, WEBSOCKET_CLOSE_NORMAL },
+	};
+	const uint32_t pieces[] = { 1, 2, 3, 7, 64, TEST_WEBSOCKET_FRAME_STREAM_SIZE };
+	test_websocket_frame_conversation(true);
+	for (int i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+		if (test_websocket_frame_feed(pieces[i], expected, sizeof(expected) / sizeof(expected[0])) != ESP_OK) {
+			return ESP_FAIL;
+		}
+	}
+	ESP_LOGD(TAG, "<test_websocket_frame_pieces");
+	return ESP_OK;
+}
+
+static esp_err_t test_websocket_frame_errors() {
+	ESP_LOGD(TAG, ">test_websocket_frame_errors");
+	test_websocket_frame_expected_t expected = { WEBSOCKET_FRAME_ERROR, 0, NULL, WEBSOCKET_CLOSE_TOO_BIG };
+
+	// fragments adding up to more than the message buffer
+	test_websocket_frame_stream_length = 0;
+	test_websocket_frame_append(false, WEBSOCKET_OPCODE_TEXT, test_websocket_frame_stream, 600, false);
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_CONTINUATION, test_websocket_frame_stream, 600, false);
+	if (test_websocket_frame_feed(TEST_WEBSOCKET_FRAME_STREAM_SIZE, &expected, 1) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	// not masked
+	expected.length = WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+	test_websocket_frame_stream_length = 0;
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_TEXT, "text", 4, false);
+	test_websocket_frame_stream[1] &= 0x7F;
+	if (test_websocket_frame_feed(TEST_WEBSOCKET_FRAME_STREAM_SIZE, &expected, 1) != ESP_OK) {
+		return ESP_FAIL;
+	}
+
+	// continuation without a start, fragmented ping, close status of 1 byte
+	test_websocket_frame_stream_length = 0;
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_CONTINUATION, "text", 4, false);
+	if (test_websocket_frame_feed(TEST_WEBSOCKET_FRAME_STREAM_SIZE, &expected, 1) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	test_websocket_frame_stream_length = 0;
+	test_websocket_frame_append(false, WEBSOCKET_OPCODE_PING, "ping", 4, false);
+	if (test_websocket_frame_feed(TEST_WEBSOCKET_FRAME_STREAM_SIZE, &expected, 1) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	test_websocket_frame_stream_length = 0;
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_CLOSE, "\x03", 1, false);
+	if (test_websocket_frame_feed(TEST_WEBSOCKET_FRAME_STREAM_SIZE, &expected, 1) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_websocket_frame_errors");
+	return ESP_OK;
+}
+
+/**
+ * Random changes to a valid conversation, fed in random pieces.
+ * The parser must stay within its buffers and always make progress.
+ */
+static esp_err_t test_websocket_frame_fuzz() {
+	ESP_LOGD(TAG, ">test_websocket_frame_fuzz");
+	websocket_frame_parser_t *parser = &test_websocket_frame_parser;
+	uint32_t errors = 0;
+	tinymt32_init(&test_websocket_frame_tinymt, 1);
+	for (int round = 0; round < TEST_WEBSOCKET_FRAME_FUZZ_ROUNDS; round++) {
+		test_websocket_frame_conversation(true);
+		uint32_t changes = 1 + tinymt32_generate_uint32(&test_websocket_frame_tinymt) % 4;
+		for (uint32_t i = 0; i < changes; i++) {
+			uint32_t offset = tinymt32_generate_uint32(&test_websocket_frame_tinymt) % test_websocket_frame_stream_length;
+			test_websocket_frame_stream[offset] = tinymt32_generate_uint32(&test_websocket_frame_tinymt);
+		}
+		websocket_frame_reset(parser, test_websocket_frame_message, TEST_WEBSOCKET_FRAME_MESSAGE_SIZE);
+		uint32_t offset = 0;
+		websocket_frame_result_t result = WEBSOCKET_FRAME_INCOMPLETE;
+		while (offset < test_websocket_frame_stream_length && result != WEBSOCKET_FRAME_ERROR) {
+			uint32_t length = 1 + tinymt32_generate_uint32(&test_websocket_frame_tinymt) % 100;
+			if (length > test_websocket_frame_stream_length - offset) {
+				length = test_websocket_frame_stream_length - offset;
+			}
+			uint32_t consumed = websocket_frame_parse(parser, &test_websocket_frame_stream[offset], length, &result);
+			if (consumed == 0 || consumed > length || (consumed < length && result == WEBSOCKET_FRAME_INCOMPLETE)
+					|| parser->message_length > parser->message_size
+					|| parser->control_length > WEBSOCKET_FRAME_CONTROL_MAX_LENGTH
+					|| parser->header_length > WEBSOCKET_FRAME_HEADER_MAX_LENGTH) {
+				ESP_LOGE(TAG, "round: %d, offset: %u, length: %u, consumed: %u", round, offset, length, consumed);
+				return ESP_FAIL;
+			}
+			offset += consumed;
+		}
+		if (result == WEBSOCKET_FRAME_ERROR) {
+			errors++;
+		}
+	}
+	ESP_LOGD(TAG, "errors: %u", errors);
+	ESP_LOGD(TAG, "<test_websocket_frame_fuzz");
+	return ESP_OK;
+}
+
+/**
+ * The steady path of the server, its own functions over a loopback client:
+ * receive into a pool buffer, answer the ping, hand over and echo the text
+ * messages, send and give the buffers back. Must not use the heap at all.
+ * Counted with heap tracing (CONFIG_HEAP_TRACING), otherwise only a change
+ * of the free heap is seen.
+ */
+static esp_err_t test_websocket_frame_heap() {
+	ESP_LOGD(TAG, ">test_websocket_frame_heap");
+	message_pool_config_t config;
+	config.count = TEST_WEBSOCKET_FRAME_POOL_COUNT;
+	config.size = WEBSOCKET_FRAME_SERVER_HEADER_MAX_LENGTH + TEST_WEBSOCKET_FRAME_MESSAGE_SIZE;
+	message_pool_handle_t pool;
+	message_pool_begin(config, &pool);
+
+	// a pool runs empty instead of allocating
+	uint8_t *first = message_pool_take(pool, 0);
+	uint8_t *second = message_pool_take(pool, 0);
+	bool empty = message_pool_take(pool, 0) == NULL;
+	message_pool_give(pool, first);
+	message_pool_give(pool, second);
+	message_pool_end(pool);
+	if (first == NULL || second == NULL || first == second || !empty) {
+		ESP_LOGE(TAG, "pool not as expected");
+		return ESP_FAIL;
+	}
+
+	// no binary message, the server would log every one it ignores
+	test_websocket_frame_conversation(false);
+	websocket_server_loopback_begin(TEST_WEBSOCKET_FRAME_MESSAGE_SIZE, test_websocket_frame_message,
+			sizeof(test_websocket_frame_message));
+	size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#if CONFIG_HEAP_TRACING
+	heap_trace_init_standalone(test_websocket_frame_heap_records, TEST_WEBSOCKET_FRAME_HEAP_RECORDS);
+	heap_trace_start(HEAP_TRACE_ALL);
+#endif
+	uint32_t last_length = 0;
+	for (int round = 0; round < TEST_WEBSOCKET_FRAME_HEAP_ROUNDS; round++) {
+		last_length = websocket_server_loopback(test_websocket_frame_stream, test_websocket_frame_stream_length);
+	}
+	uint32_t heap_calls = 0;
+#if CONFIG_HEAP_TRACING
+	heap_trace_stop();
+	heap_calls = heap_trace_get_count();
+#endif
+	size_t free_after = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	websocket_client_statistics_t statistics;
+	websocket_server_get_statistics(0, &statistics);
+	websocket_server_loopback_end();
+
+	// two text messages echoed every round, the close answered last
+	static const uint8_t close[] = { 0x88, 0x02, 0x03, 0xE8 };
+	uint32_t messages = statistics.sent_count;
+	ESP_LOGD(TAG, "messages: %u, heap calls: %u", messages, heap_calls);
+	if (messages != 2 * TEST_WEBSOCKET_FRAME_HEAP_ROUNDS || statistics.drop_count != 0 || heap_calls != 0
+			|| free_after != free_before || last_length != sizeof(close)
+			|| memcmp(test_websocket_frame_message, close, sizeof(close)) != 0) {
+		ESP_LOGE(TAG, "messages: %u, drops: %u, heap calls: %u, free before: %u, after: %u, last frame: %u",
+				messages, statistics.drop_count, heap_calls, free_before, free_after, last_length);
+		return ESP_FAIL;
+	}
+	ESP_LOGD(TAG, "<test_websocket_frame_heap");
+	return ESP_OK;
+}
+
+/**
+ * Throughput of the parser, for comparison only.
+ */
+static void test_websocket_frame_benchmark() {
+	ESP_LOGD(TAG, ">test_websocket_frame_benchmark");
+	test_websocket_frame_stream_length = 0;
+	test_websocket_frame_append(true, WEBSOCKET_OPCODE_TEXT, test_websocket_frame_stream,
+			TEST_WEBSOCKET_FRAME_BENCHMARK_LENGTH, false);
+	websocket_frame_reset(&test_websocket_frame_parser, test_websocket_frame_message,
+			TEST_WEBSOCKET_FRAME_MESSAGE_SIZE);
+	int64_t start_us = esp_timer_get_time();
+	for (int round = 0; round < TEST_WEBSOCKET_FRAME_BENCHMARK_ROUNDS; round++) {
+		websocket_frame_result_t result;
+		websocket_frame_parse(&test_websocket_frame_parser, test_websocket_frame_stream,
+				test_websocket_frame_stream_length, &result);
+	}
+	int64_t duration_us = esp_timer_get_time() - start_us;
+	uint64_t bytes = (uint64_t) TEST_WEBSOCKET_FRAME_BENCHMARK_ROUNDS * test_websocket_frame_stream_length;
+	ESP_LOGI(TAG, "parsed %llu bytes in %lld us, %llu kB/s", bytes, duration_us,
+			duration_us > 0 ? bytes * 1000 / duration_us : 0);
+	ESP_LOGD(TAG, "<test_websocket_frame_benchmark");
+}
+
+esp_err_t test_websocket_frame() {
+	ESP_LOGD(TAG, ">test_websocket_frame");
+	esp_err_t result = test_websocket_frame_pieces();
+	if (result == ESP_OK) {
+		result = test_websocket_frame_errors();
+	}
+	if (result == ESP_OK) {
+		result = test_websocket_frame_fuzz();
+	}
+	if (result == ESP_OK) {
+		result = test_websocket_frame_heap();
+	}
+	if (result == ESP_OK) {
+		test_websocket_frame_benchmark();
+	}
+	ESP_LOGD(TAG, "<test_websocket_frame");
+	return result;
+}
@@ -0,0 +1,102 @@
+// The author disclaims copyright to this source code.
+#include "test_www_archive.h"
+#include <stddef.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "www_archive.h"
+
+static const char* TAG = "test_www_archive";
+
+/**
+ * One asset: header, two hash slots, one entry, then the strings and the data.
+ */
+typedef struct test_www_archive_t {
+	www_archive_header_t header;
+	uint16_t slots[2];
+	www_archive_entry_t entry;
+	char data[12];
+} test_www_archive_t;
+
+static test_www_archive_t test_www_archive_archive;
+
+static void test_www_archive_build() {
+	test_www_archive_t *archive = &test_www_archive_archive;
+	memset(archive, 0, sizeof(test_www_archive_t));
+	archive->header.magic = WWW_ARCHIVE_MAGIC;
+	archive->header.version = WWW_ARCHIVE_VERSION;
+	archive->header.count = 1;
+	archive->header.slots = 2;
+	archive->header.size = sizeof(test_www_archive_t);
+	archive->slots[0] = 0;
+	archive->slots[1] = WWW_ARCHIVE_EMPTY;
+	// path, etag, content, 200 and 304 header
+	memcpy(archive->data, "/\0\"1\"\0xabcd", 11);
+	uint32_t data = offsetof(test_www_archive_t, data);
+	archive->entry.hash = www_archive_hash("/");
+	archive->entry.path = data;
+	archive->entry.etag = data + 2;
+	archive->entry.content = data + 6;
+	archive->entry.content_length = 1;
+	archive->entry.header_200 = data + 7;
+	archive->entry.header_200_length = 2;
+	archive->entry.header_304 = data + 9;
+	archive->entry.header_304_length = 2;
+}
+
+static esp_err_t test_www_archive_check(const char *name, uint32_t size, bool expected) {
+	bool actual = www_archive_is_valid((const uint8_t *) &test_www_archive_archive, size);
+	test_www_archive_build();
+	if (actual != expected) {
+		ESP_LOGE(TAG, "%s expected: %d, actual: %d", name, expected, actual);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+esp_err_t test_www_archive() {
+	ESP_LOGD(TAG, ">test_www_archive");
+	test_www_archive_t *archive = &test_www_archive_archive;
+	uint32_t size = sizeof(test_www_archive_t);
+	test_www_archive_build();
+	esp_err_t result = test_www_archive_check("valid", size, true);
+	if (result == ESP_OK) {
+		result = test_www_archive_check("partition too small", sizeof(www_archive_header_t) - 1, false);
+	}
+	if (result == ESP_OK) {
+		archive->header.size = size + 4;
+		result = test_www_archive_check("larger than the partition", size, false);
+	}
+	if (result == ESP_OK) {
+		// twice the slots wraps to zero
+		archive->header.slots = 0x80000000;
+		result = test_www_archive_check("slots", size, false);
+	}
+	if (result == ESP_OK) {
+		// rejected before the slots are read, the partition size is not real
+		archive->header.size = 0x100000;
+		archive->header.slots = 0x20000;
+		archive->header.count = WWW_ARCHIVE_EMPTY;
+		result = test_www_archive_check("count", 0x100000, false);
+	}
+	if (result == ESP_OK) {
+		archive->slots[1] = 1;
+		result = test_www_archive_check("slot index", size, false);
+	}
+	if (result == ESP_OK) {
+		// the end wraps around into the archive
+		archive->entry.content = 0xFFFFFFFF;
+		archive->entry.content_length = 2;
+		result = test_www_archive_check("content", size, false);
+	}
+	if (result == ESP_OK) {
+		archive->entry.header_304_length = 0xFFFFFFFF;
+		result = test_www_archive_check("304 header", size, false);
+	}
+	if (result == ESP_OK) {
+		archive->entry.etag = size;
+		result = test_www_archive_check("etag", size, false);
+	}
+	ESP_LOGD(TAG, "<test_www_archive");
+	return result;
+}
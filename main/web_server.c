@@ -1,15 +1,27 @@
 // The author disclaims copyright to this source code.
 #include "web_server.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "http_request.h"
+#include "www_assets.h"
+#include "www_archive.h"
+#include "json_writer.h"
+#include "player.h"
+#include "statistics.h"
+#include "metrics.h"
+#include "relay.h"
+#include "control.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 
 #include "driver/gpio.h"
@@ -21,6 +33,7 @@
 
 static const char* TAG = "web_server";
 
+
 /**
  * The structure of a HTTP response:
  * Status-Line = HTTP-Version SP Status-Code SP Reason-Phrase CRLF
@@ -28,76 +41,569 @@ static const char* TAG = "web_server";
  * (An empty line) CRLF
  * Followed by the content (with a length as specified by the Content-Length header).
  */
-static const char http_bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: Closed\r\n\r\n";
-static const char http_server_error[] = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: Closed\r\n\r\n";
+static const char http_bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char http_service_unavailable[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
+static const char http_not_acceptable[] = "HTTP/1.1 406 Not Acceptable\r\nContent-Length: 0\r\n";
 // the response contains one variable, the content length, and is cut in half
-static const char http_ok_1[] = "HTTP/1.1 200 OKr\nContent-Type: text/html; charset=utf-8\r\nContent length: ";
-static const char http_ok_2[] = "\r\nConnection: Closed\r\n\r\n";
-
-// embed text file, see component.mk
-extern const uint8_t index_html_start[] asm("_binary_index_html_start");
-extern const uint8_t index_html_end[] asm("_binary_index_html_end");
-extern const uint8_t jquery_js_start[] asm("_binary_jquery_3_2_1_slim_min_js_start");
-extern const uint8_t jquery_js_end[] asm("_binary_jquery_3_2_1_slim_min_js_end");
+static const char http_ok_text_1[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\nCache-Control: no-cache\r\nContent-Length: ";
+// JSON is streamed, the length is not known up front
+static const char http_ok_json_chunked[] = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nCache-Control: no-cache\r\nTransfer-Encoding: chunked\r\n";
+// HTTP/1.0 has no chunked transfer encoding, closing the connection ends the content
+static const char http_ok_json[] = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nCache-Control: no-cache\r\n";
+static const char http_ok_metrics_chunked[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nCache-Control: no-cache\r\nTransfer-Encoding: chunked\r\n";
+static const char http_ok_metrics[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nCache-Control: no-cache\r\n";
+// the audio continues until the client or the server closes the connection
+static const char http_ok_stream[] = "HTTP/1.1 200 OK\r\nContent-Type: audio/mpeg\r\nCache-Control: no-cache, no-store\r\nConnection: close\r\n\r\n";
+static const char http_not_found_keep_alive[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: keep-alive\r\n\r\n";
+static const char http_not_found_close[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char http_2_keep_alive[] = "\r\nConnection: keep-alive\r\n\r\n";
+static const char http_2_close[] = "\r\nConnection: close\r\n\r\n";
+// completes a precomputed header
+static const char http_connection_keep_alive[] = "Connection: keep-alive\r\n\r\n";
+static const char http_connection_close[] = "Connection: close\r\n\r\n";
 
 static uint16_t web_server_port;
+static icy_handle_t web_server_icy_handle;
+static www_archive_handle_t web_server_archive_handle;
+static buffer_handle_t web_server_buffer_handle;
+static jitter_handle_t web_server_jitter_handle;
+static favorites_handle_t web_server_favorites_handle;
+static metrics_handle_t web_server_metrics_handle;
+static relay_handle_t web_server_relay_handle;
+static control_handle_t web_server_control_handle;
+static uint8_t web_server_workers;
+static uint8_t web_server_max_connections;
+static uint32_t web_server_idle_timeout_ms;
+/** Accepted connections waiting for a worker. */
+static QueueHandle_t web_server_queue;
+/** Connections queued or being served. */
+static uint8_t web_server_connections;
+static portMUX_TYPE web_server_mux = portMUX_INITIALIZER_UNLOCKED;
 
-static void web_server_write(struct netconn *conn, const void *begin, size_t length) {
+static void web_server_write_header(struct netconn *conn, const char *header_1, size_t header_1_length, size_t length,
+		bool keep_alive) {
 	assert(length < 1000000);
-	char content_length[6];
-	int content_length_length = snprintf(content_length, 6, "%d", length);
-	netconn_write(conn, http_ok_1, sizeof(http_ok_1) - 1, NETCONN_NOCOPY | NETCONN_MORE);
+	char content_length[7];
+	int content_length_length = snprintf(content_length, sizeof(content_length), "%d", length);
+	netconn_write(conn, header_1, header_1_length, NETCONN_NOCOPY | NETCONN_MORE);
 	netconn_write(conn, content_length, content_length_length, NETCONN_COPY | NETCONN_MORE);
-	netconn_write(conn, http_ok_2, sizeof(http_ok_2) - 1, NETCONN_NOCOPY | NETCONN_MORE);
-	netconn_write(conn, begin, length, NETCONN_NOCOPY);
+	if (keep_alive) {
+		netconn_write(conn, http_2_keep_alive, sizeof(http_2_keep_alive) - 1, NETCONN_NOCOPY | NETCONN_MORE);
+	} else {
+		netconn_write(conn, http_2_close, sizeof(http_2_close) - 1, NETCONN_NOCOPY | NETCONN_MORE);
+	}
+}
+
+/**
+ * Write a precomputed header followed by the Connection header.
+ */
+static void web_server_write_precomputed(struct netconn *conn, const char *header, size_t header_length, bool keep_alive,
+		uint8_t flags) {
+	netconn_write(conn, header, header_length, NETCONN_NOCOPY | NETCONN_MORE);
+	if (keep_alive) {
+		netconn_write(conn, http_connection_keep_alive, sizeof(http_connection_keep_alive) - 1, NETCONN_NOCOPY | flags);
+	} else {
+		netconn_write(conn, http_connection_close, sizeof(http_connection_close) - 1, NETCONN_NOCOPY | flags);
+	}
+}
+
+/**
+ * Compressed asset, or 304 Not Modified when the client has it cached already.
+ * All data is constant, nothing is copied.
+ */
+static void web_server_write_asset(struct netconn *conn, const www_asset_t *asset, http_request_t *request,
+		bool keep_alive) {
+	if (request->if_none_match[0] != 0
+			&& (strstr(request->if_none_match, asset->etag) != NULL || strcmp(request->if_none_match, "*") == 0)) {
+		web_server_write_precomputed(conn, asset->header_304, asset->header_304_length, keep_alive, 0);
+	} else if (!request->accept_gzip) {
+		// only the compressed content is available
+		web_server_write_precomputed(conn, http_not_acceptable, sizeof(http_not_acceptable) - 1, keep_alive, 0);
+	} else {
+		web_server_write_precomputed(conn, asset->header_200, asset->header_200_length, keep_alive, NETCONN_MORE);
+		netconn_write(conn, asset->content, asset->content_length, NETCONN_NOCOPY);
+	}
+}
+
+/**
+ * Current stream title (from in-stream metadata) as plain text.
+ */
+static void web_server_write_title(struct netconn *conn, bool keep_alive) {
+	char title[ICY_TITLE_MAX_LENGTH];
+	icy_title(web_server_icy_handle, title, sizeof(title));
+	size_t length = strlen(title);
+	web_server_write_header(conn, http_ok_text_1, sizeof(http_ok_text_1) - 1, length, keep_alive);
+	netconn_write(conn, title, length, NETCONN_COPY);
+}
+
+/**
+ * Write a JSON document.
+ */
+typedef void (*web_server_json_t)(json_writer_t *writer);
+
+static bool web_server_chunk_output(void *context, const char *data, uint32_t length, bool more) {
+	if (length == 0) {
+		return true;
+	}
+	// the writer reuses its buffer, lwIP copies into pbufs (the only allocation of a response)
+	return netconn_write((struct netconn *) context, data, length, NETCONN_COPY | (more ? NETCONN_MORE : 0)) == ERR_OK;
+}
+
+/**
+ * Header of content written while it is generated, the length is not known up front.
+ * HTTP/1.0 has no chunked transfer encoding, closing the connection ends the content.
+ * @return True when chunked.
+ */
+static bool web_server_write_streamed_header(struct netconn *conn, http_request_t *request, bool *keep_alive,
+		const char *header_chunked, size_t header_chunked_length, const char *header, size_t header_length) {
+	bool chunked = request->version_minor >= 1;
+	if (chunked) {
+		web_server_write_precomputed(conn, header_chunked, header_chunked_length, *keep_alive, NETCONN_MORE);
+	} else {
+		*keep_alive = false;
+		web_server_write_precomputed(conn, header, header_length, *keep_alive, NETCONN_MORE);
+	}
+	return chunked;
+}
+
+/**
+ * JSON response, written while it is generated.
+ * @return True when the connection persists.
+ */
+static bool web_server_write_json(struct netconn *conn, http_request_t *request, bool keep_alive,
+		web_server_json_t json) {
+	bool chunked = web_server_write_streamed_header(conn, request, &keep_alive, http_ok_json_chunked,
+			sizeof(http_ok_json_chunked) - 1, http_ok_json, sizeof(http_ok_json) - 1);
+	json_writer_t writer;
+	json_writer_start(&writer, chunked, web_server_chunk_output, conn);
+	json(&writer);
+	if (!json_writer_finish(&writer)) {
+		ESP_LOGW(TAG, "json output failed: %s", request->path);
+		keep_alive = false;
+	}
+	return keep_alive;
+}
+
+/**
+ * Metrics (Prometheus text format), written while they are collected.
+ * @return True when the connection persists.
+ */
+static bool web_server_write_metrics(struct netconn *conn, http_request_t *request, bool keep_alive) {
+	bool chunked = web_server_write_streamed_header(conn, request, &keep_alive, http_ok_metrics_chunked,
+			sizeof(http_ok_metrics_chunked) - 1, http_ok_metrics, sizeof(http_ok_metrics) - 1);
+	chunk_writer_t writer;
+	chunk_writer_start(&writer, chunked, web_server_chunk_output, conn);
+	metrics_write(web_server_metrics_handle, &writer);
+	if (!chunk_writer_finish(&writer)) {
+		ESP_LOGW(TAG, "metrics output failed");
+		keep_alive = false;
+	}
+	return keep_alive;
+}
+
+static bool web_server_relay_output(void *context, const uint8_t *data, uint32_t length) {
+	// the relay reuses its buffer, copy
+	return netconn_write((struct netconn *) context, data, length, NETCONN_COPY) == ERR_OK;
+}
+
+/**
+ * Buffered audio, relayed until the listener is gone or dropped.
+ * @return False, the connection never persists.
+ */
+static bool web_server_write_stream(struct netconn *conn) {
+	if (!relay_join(web_server_relay_handle)) {
+		ESP_LOGW(TAG, "relay listener limit reached");
+		netconn_write(conn, http_service_unavailable, sizeof(http_service_unavailable) - 1, NETCONN_NOCOPY);
+		return false;
+	}
+	// a listener that stops reading must not keep a worker forever
+	netconn_set_sendtimeout(conn, web_server_relay_handle->idle_timeout_ms);
+	netconn_write(conn, http_ok_stream, sizeof(http_ok_stream) - 1, NETCONN_NOCOPY | NETCONN_MORE);
+	relay_serve(web_server_relay_handle, web_server_relay_output, conn);
+	return false;
+}
+
+static void web_server_json_status(json_writer_t *writer) {
+	buffer_handle_t buffer = web_server_buffer_handle;
+	json_writer_object_start(writer, NULL);
+
+	uint32_t available = buffer_available(buffer);
+	buffer_counters_t counters;
+	buffer_get_counters(buffer, &counters);
+	json_writer_object_start(writer, "buffer");
+	json_writer_uint(writer, "size", buffer->size);
+	json_writer_uint(writer, "available", available);
+	json_writer_uint(writer, "percentage", 100ULL * available / buffer->size);
+	json_writer_uint(writer, "duration_ms", buffer_duration_ms(buffer));
+	json_writer_uint(writer, "push_bytes", counters.push_bytes);
+	json_writer_uint(writer, "pull_bytes", counters.pull_bytes);
+	json_writer_uint(writer, "push_count", counters.push_count);
+	json_writer_uint(writer, "pull_count", counters.pull_count);
+	json_writer_uint(writer, "overflow_count", counters.overflow_count);
+	json_writer_uint(writer, "overflow_bytes", counters.overflow_bytes);
+	json_writer_uint(writer, "underrun_count", counters.underrun_count);
+	json_writer_uint(writer, "underrun_bytes", counters.underrun_bytes);
+	json_writer_object_end(writer);
+
+	statistics_rates_t rates;
+	statistics_get_rates(&rates);
+	json_writer_object_start(writer, "rates");
+	json_writer_uint(writer, "push_bytes", rates.push_bytes);
+	json_writer_uint(writer, "pull_bytes", rates.pull_bytes);
+	json_writer_uint(writer, "push_count", rates.push_count);
+	json_writer_uint(writer, "pull_count", rates.pull_count);
+	json_writer_object_end(writer);
+
+	player_statistics_t statistics;
+	player_get_statistics(&statistics);
+	json_writer_object_start(writer, "player");
+	json_writer_string(writer, "state", player_state_name(statistics.state));
+	json_writer_uint(writer, "volume", player_get_volume());
+	json_writer_bool(writer, "mute", player_get_mute());
+	if (web_server_jitter_handle != NULL) {
+		json_writer_uint(writer, "target_ms", jitter_target_ms(web_server_jitter_handle));
+	}
+	json_writer_array_start(writer, "states");
+	for (int state = 0; state < PLAYER_STATE_COUNT; state++) {
+		json_writer_object_start(writer, NULL);
+		json_writer_string(writer, "name", player_state_name(state));
+		json_writer_uint(writer, "count", statistics.count[state]);
+		json_writer_uint(writer, "time_ms", statistics.time_us[state] / 1000);
+		json_writer_object_end(writer);
+	}
+	json_writer_array_end(writer);
+	json_writer_object_end(writer);
+
+	vs1053_status_t decoder;
+	player_get_decoder_status(&decoder);
+	json_writer_object_start(writer, "decoder");
+	json_writer_string(writer, "format", vs1053_format_name(decoder.hdat1));
+	json_writer_uint(writer, "hdat0", decoder.hdat0);
+	json_writer_uint(writer, "hdat1", decoder.hdat1);
+	json_writer_uint(writer, "sample_rate", decoder.audata & 0xFFFE);
+	json_writer_uint(writer, "channels", (decoder.audata & 0x0001) ? 2 : 1);
+	json_writer_uint(writer, "decode_time_s", decoder.decode_time);
+	json_writer_object_end(writer);
+
+	char title[ICY_TITLE_MAX_LENGTH];
+	icy_title(web_server_icy_handle, title, sizeof(title));
+	json_writer_object_start(writer, "stream");
+	json_writer_uint(writer, "favorite", favorites_selected(web_server_favorites_handle, NULL));
+	json_writer_string(writer, "title", title);
+	if (buffer->frame_index != NULL) {
+		json_writer_uint(writer, "bitrate", buffer->frame_index->bitrate);
+		json_writer_uint(writer, "sample_rate", buffer->frame_index->sample_rate);
+	}
+	json_writer_object_end(writer);
+
+	json_writer_object_end(writer);
 }
 
+static void web_server_json_volume(json_writer_t *writer) {
+	json_writer_object_start(writer, NULL);
+	json_writer_uint(writer, "volume", player_get_volume());
+	json_writer_uint(writer, "max", PLAYER_VOLUME_MAX);
+	json_writer_bool(writer, "mute", player_get_mute());
+	json_writer_object_end(writer);
+}
+
+static void web_server_json_favorites(json_writer_t *writer) {
+	json_writer_object_start(writer, NULL);
+	json_writer_uint(writer, "selected", favorites_selected(web_server_favorites_handle, NULL));
+	json_writer_array_start(writer, "favorites");
+	uint32_t count = favorites_count(web_server_favorites_handle);
+	for (uint32_t index = 0; index < count; index++) {
+		const favorite_t *favorite = favorites_get(web_server_favorites_handle, index);
+		json_writer_object_start(writer, NULL);
+		json_writer_string(writer, "name", favorite->name);
+		json_writer_string(writer, "url", favorite->url);
+		json_writer_object_end(writer);
+	}
+	json_writer_array_end(writer);
+	json_writer_object_end(writer);
+}
+
+/**
+ * Decimal query parameter.
+ * @return False when absent, not a number or above the maximum.
+ */
+static bool web_server_query_uint(http_request_t *request, const char *name, uint32_t max, uint32_t *value) {
+	char text[11];
+	if (!http_request_query_value(request, name, text, sizeof(text)) || text[0] == 0
+			|| strspn(text, "0123456789") != strlen(text)) {
+		return false;
+	}
+	*value = strtoul(text, NULL, 10);
+	return *value <= max;
+}
+
+/**
+ * Volume, changed when asked for.
+ * @return True when the connection persists.
+ */
+static bool web_server_api_volume(struct netconn *conn, http_request_t *request, bool change, bool keep_alive,
+		int64_t received_us) {
+	if (change) {
+		uint32_t volume;
+		if (!web_server_query_uint(request, "value", PLAYER_VOLUME_MAX, &volume)) {
+			netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+			return false;
+		}
+		player_set_volume(volume, received_us);
+	}
+	return web_server_write_json(conn, request, keep_alive, web_server_json_volume);
+}
+
+/**
+ * Favorites, selected when asked for.
+ * @return True when the connection persists.
+ */
+static bool web_server_api_favorites(struct netconn *conn, http_request_t *request, bool change, bool keep_alive) {
+	if (change) {
+		uint32_t index;
+		if (!web_server_query_uint(request, "selected", UINT32_MAX, &index)
+				|| !favorites_select(web_server_favorites_handle, index)) {
+			netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+			return false;
+		}
+	}
+	return web_server_write_json(conn, request, keep_alive, web_server_json_favorites);
+}
+
+/**
+ * Control command in the body, answered with the result.
+ * @return True when the connection persists.
+ */
+static bool web_server_api_command(struct netconn *conn, http_request_t *request, bool keep_alive,
+		int64_t received_us) {
+	control_command_t command;
+	control_result_t result = CONTROL_MALFORMED;
+	if (!request->body_overflow) {
+		result = control_parse(request->body, request->body_length, received_us, &command);
+	}
+	if (result == CONTROL_OK) {
+		result = control_execute(web_server_control_handle, &command);
+	} else {
+		control_refused(web_server_control_handle);
+	}
+	if (result != CONTROL_OK) {
+		ESP_LOGW(TAG, "command refused: %d", result);
+		netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+		return false;
+	}
+	bool chunked = web_server_write_streamed_header(conn, request, &keep_alive, http_ok_json_chunked,
+			sizeof(http_ok_json_chunked) - 1, http_ok_json, sizeof(http_ok_json) - 1);
+	json_writer_t writer;
+	json_writer_start(&writer, chunked, web_server_chunk_output, conn);
+	control_write_result(&writer, &command, result);
+	if (!json_writer_finish(&writer)) {
+		ESP_LOGW(TAG, "json output failed: %s", request->path);
+		keep_alive = false;
+	}
+	return keep_alive;
+}
+
+static bool web_server_find_asset(const char *path, www_asset_t *asset) {
+#if CONFIG_WEB_SERVER_ASSETS_EMBEDDED
+	const www_asset_t *embedded = www_assets_find(path);
+	if (embedded != NULL) {
+		*asset = *embedded;
+	}
+	return embedded != NULL;
+#else
+	return web_server_archive_handle != NULL && www_archive_find(web_server_archive_handle, path, asset);
+#endif
+}
+
+/**
+ * Respond to a complete request.
+ * @return True when the connection persists.
+ */
+static bool web_server_respond(struct netconn *conn, http_request_t *request) {
+	ESP_LOGD(TAG, "request: %s %s", request->method, request->path);
+	int64_t received_us = esp_timer_get_time();
+	// when other connections wait for a worker, do not keep this one
+	bool keep_alive = request->keep_alive && uxQueueMessagesWaiting(web_server_queue) == 0;
+	www_asset_t asset;
+	bool get = (strcmp(request->method, "GET") == 0);
+	bool change = (strcmp(request->method, "PUT") == 0 || strcmp(request->method, "POST") == 0);
+	if (strcmp(request->path, "/api/volume") == 0 && (get || change)) {
+		keep_alive = web_server_api_volume(conn, request, change, keep_alive, received_us);
+	} else if (strcmp(request->path, "/api/favorites") == 0 && (get || change)) {
+		keep_alive = web_server_api_favorites(conn, request, change, keep_alive);
+	} else if (strcmp(request->path, "/api/command") == 0 && change && web_server_control_handle != NULL) {
+		keep_alive = web_server_api_command(conn, request, keep_alive, received_us);
+	} else if (!get) {
+		ESP_LOGE(TAG, "Bad request: %s %s", request->method, request->path);
+		netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+		keep_alive = false;
+	} else if (strcmp(request->path, "/stream") == 0 && web_server_relay_handle != NULL) {
+		keep_alive = web_server_write_stream(conn);
+	} else if (strcmp(request->path, "/metrics") == 0 && web_server_metrics_handle != NULL) {
+		keep_alive = web_server_write_metrics(conn, request, keep_alive);
+	} else if (strcmp(request->path, "/api/status") == 0) {
+		keep_alive = web_server_write_json(conn, request, keep_alive, web_server_json_status);
+	} else if (strcmp(request->path, "/title") == 0) {
+		// stream title
+		web_server_write_title(conn, keep_alive);
+	} else if (web_server_find_asset(request->path, &asset)) {
+		// index.html, jquery.js
+		web_server_write_asset(conn, &asset, request, keep_alive);
+	} else {
+		ESP_LOGE(TAG, "Not found: %s", request->path);
+		if (keep_alive) {
+			netconn_write(conn, http_not_found_keep_alive, sizeof(http_not_found_keep_alive) - 1, NETCONN_NOCOPY);
+		} else {
+			netconn_write(conn, http_not_found_close, sizeof(http_not_found_close) - 1, NETCONN_NOCOPY);
+		}
+	}
+	return keep_alive;
+}
+
+/**
+ * Serve requests until the client or the server closes the connection, or the connection is idle too long.
+ * Requests may arrive in pieces, or several at once (pipelined).
+ */
 static void web_server_process(struct netconn *conn) {
 	ESP_LOGD(TAG, ">web_server_process")
 
+	http_request_t request;
+	http_request_reset(&request);
+	bool open = true;
 	struct netbuf *netbuf;
-	err_t err = netconn_recv(conn, &netbuf);
-	if (err == ERR_OK) {
-
-		char *buf;
-		u16_t len;
-		netbuf_data(netbuf, (void**) &buf, &len);
-
-		// Request-Line = Method SP Request-URI SP HTTP-Version CRLF
-		char *request_line = strtok(buf, "\n");
-		if (request_line) {
-
-			if (strstr(request_line, "GET / ")) {
-				// index.html
-				web_server_write(conn, index_html_start, index_html_end - index_html_start);
-			} else if (strstr(request_line, "GET /jquery")) {
-				// jquery.js
-				web_server_write(conn, jquery_js_start, jquery_js_end - jquery_js_start);
-			} else {
-				ESP_LOGE(TAG, "Bad request: %s", request_line);
-				netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+	err_t err = ERR_OK;
+	while (open && (err = netconn_recv(conn, &netbuf)) == ERR_OK) {
+		do {
+			uint8_t *data;
+			u16_t length;
+			netbuf_data(netbuf, (void**) &data, &length);
+			while (open && length > 0) {
+				http_request_result_t result;
+				uint32_t consumed = http_request_parse(&request, data, length, &result);
+				data += consumed;
+				length -= consumed;
+				if (result == HTTP_REQUEST_COMPLETE) {
+					open = web_server_respond(conn, &request);
+					http_request_reset(&request);
+				} else if (result == HTTP_REQUEST_ERROR) {
+					netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
+					open = false;
+				}
 			}
-		} else {
-			ESP_LOGE(TAG, "Bad request: expected newline")
-			netconn_write(conn, http_bad_request, sizeof(http_bad_request) - 1, NETCONN_NOCOPY);
-		}
-	} else {
-		ESP_LOGE(TAG, "netconn_recv error: %d", err)
-		netconn_write(conn, http_server_error, sizeof(http_server_error) - 1, NETCONN_NOCOPY);
+		} while (open && netbuf_next(netbuf) >= 0);
+		netbuf_delete(netbuf);
+	}
+	if (err != ERR_OK) {
+		// timeout or closed by the client
+		ESP_LOGD(TAG, "netconn_recv: %d", err)
 	}
 
 	netconn_close(conn);
-	netbuf_delete(netbuf);
 
 	ESP_LOGD(TAG, "<web_server_process")
 }
 
+/**
+ * Count a new connection.
+ * @return False when the connection limit is reached.
+ */
+static bool web_server_connection_open() {
+	bool accepted = false;
+	portENTER_CRITICAL(&web_server_mux);
+	if (web_server_connections < web_server_max_connections) {
+		web_server_connections++;
+		accepted = true;
+	}
+	portEXIT_CRITICAL(&web_server_mux);
+	return accepted;
+}
+
+static void web_server_connection_close(struct netconn *conn) {
+	netconn_delete(conn);
+	portENTER_CRITICAL(&web_server_mux);
+	web_server_connections--;
+	portEXIT_CRITICAL(&web_server_mux);
+}
+
+/**
+ * FreeRTOS Web server worker task, serves accepted connections one at a time.
+ */
+static void web_server_worker_task(void *pvUnused) {
+	ESP_LOGD(TAG, ">web_server_worker_task");
+	struct netconn *conn;
+	while (1) {
+		if (xQueueReceive(web_server_queue, &conn, portMAX_DELAY) == pdTRUE) {
+			web_server_process(conn);
+			web_server_connection_close(conn);
+		}
+	}
+	// should never be reached
+}
+
+/**
+ * Hand over an accepted connection to the workers, refuse it when too busy.
+ */
+static void web_server_dispatch(struct netconn *conn) {
+	if (!web_server_connection_open()) {
+		ESP_LOGW(TAG, "connection limit reached: %u", web_server_max_connections);
+		netconn_write(conn, http_service_unavailable, sizeof(http_service_unavailable) - 1, NETCONN_NOCOPY);
+		netconn_close(conn);
+		netconn_delete(conn);
+		return;
+	}
+	// a slow or idle client must not block a worker forever
+	netconn_set_recvtimeout(conn, web_server_idle_timeout_ms);
+	// the queue holds every connection allowed, this does not block
+	assert(xQueueSendToBack(web_server_queue, &conn, 0) == pdTRUE);
+}
+
+static void web_server_workers_create() {
+	ESP_LOGD(TAG, ">web_server_workers_create");
+	web_server_queue = xQueueCreate(web_server_max_connections, sizeof(struct netconn *));
+	assert(web_server_queue != NULL);
+	for (int i = 0; i < web_server_workers; i++) {
+		char name[configMAX_TASK_NAME_LEN];
+		snprintf(name, sizeof(name), "web_server_%d", i);
+		TaskHandle_t task;
+		xTaskCreate(&web_server_worker_task, name, 4096, NULL, 1, &task);
+		if (web_server_metrics_handle != NULL) {
+			metrics_add_task(web_server_metrics_handle, task);
+		}
+	}
+	ESP_LOGD(TAG, "<web_server_workers_create");
+}
+
 void web_server_task(void *pvParameters) {
 	ESP_LOGI(TAG, ">web_server_task");
 
 	web_server_config_t *config = (web_server_config_t *) pvParameters;
 	web_server_port = config->port;
+	web_server_icy_handle = config->icy_handle;
+	web_server_archive_handle = config->archive_handle;
+	web_server_buffer_handle = config->buffer_handle;
+	web_server_jitter_handle = config->jitter_handle;
+	web_server_favorites_handle = config->favorites_handle;
+	web_server_metrics_handle = config->metrics_handle;
+	web_server_relay_handle = config->relay_handle;
+	web_server_control_handle = config->control_handle;
+	web_server_workers = config->workers;
+	web_server_max_connections = config->max_connections;
+	web_server_idle_timeout_ms = config->idle_timeout_ms;
 	ESP_LOGD(TAG, "web_server_port: %u", web_server_port);
+	ESP_LOGD(TAG, "web_server_icy_handle: %p", web_server_icy_handle);
+	ESP_LOGD(TAG, "web_server_archive_handle: %p", web_server_archive_handle);
+	ESP_LOGD(TAG, "web_server_buffer_handle: %p", web_server_buffer_handle);
+	ESP_LOGD(TAG, "web_server_jitter_handle: %p", web_server_jitter_handle);
+	ESP_LOGD(TAG, "web_server_favorites_handle: %p", web_server_favorites_handle);
+	ESP_LOGD(TAG, "web_server_metrics_handle: %p", web_server_metrics_handle);
+	ESP_LOGD(TAG, "web_server_relay_handle: %p", web_server_relay_handle);
+	ESP_LOGD(TAG, "web_server_control_handle: %p", web_server_control_handle);
+	ESP_LOGD(TAG, "web_server_workers: %u", web_server_workers);
+	ESP_LOGD(TAG, "web_server_max_connections: %u", web_server_max_connections);
+	ESP_LOGD(TAG, "web_server_idle_timeout_ms: %u", web_server_idle_timeout_ms);
+	assert(web_server_workers > 0 && web_server_max_connections >= web_server_workers);
+
+	web_server_workers_create();
 
 	err_t err;
 	struct netconn *listening_conn = netconn_new(NETCONN_TCP);
@@ -120,8 +626,7 @@ void web_server_task(void *pvParameters) {
 					if (err != ERR_OK) {
 						ESP_LOGE(TAG, "netconn_accept error: %d", err)
 					} else {
-						web_server_process(accepted_conn);
-						netconn_delete(accepted_conn);
+						web_server_dispatch(accepted_conn);
 					}
 				} while (err == ERR_OK);
 				netconn_close(listening_conn);
@@ -0,0 +1,254 @@
+// The author disclaims copyright to this source code.
+#include "websocket_frame.h"
+#include <assert.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "websocket_frame";
+
+/** Bits of the first header byte. */
+#define WEBSOCKET_FRAME_FIN (0x80)
+#define WEBSOCKET_FRAME_RSV (0x70)
+#define WEBSOCKET_FRAME_OPCODE (0x0F)
+/** Control frames have the high bit of the opcode set. */
+#define WEBSOCKET_FRAME_CONTROL (0x08)
+/** Bits of the second header byte. */
+#define WEBSOCKET_FRAME_MASK (0x80)
+#define WEBSOCKET_FRAME_LENGTH (0x7F)
+#define WEBSOCKET_FRAME_LENGTH_16 (126)
+#define WEBSOCKET_FRAME_LENGTH_64 (127)
+#define WEBSOCKET_FRAME_MASK_LENGTH (4)
+
+void websocket_frame_reset(websocket_frame_parser_t *parser, uint8_t *message, uint32_t message_size) {
+	parser->state = WEBSOCKET_FRAME_STATE_HEADER;
+	parser->header_length = 0;
+	parser->header_needed = 2;
+	parser->fin = false;
+	parser->opcode = WEBSOCKET_OPCODE_CONTINUATION;
+	parser->payload_remaining = 0;
+	parser->payload_offset = 0;
+	parser->message = message;
+	parser->message_size = message_size;
+	parser->message_length = 0;
+	parser->message_opcode = WEBSOCKET_OPCODE_TEXT;
+	parser->fragmented = false;
+	parser->control_length = 0;
+	parser->close_status = WEBSOCKET_CLOSE_NORMAL;
+}
+
+void websocket_frame_set_message(websocket_frame_parser_t *parser, uint8_t *message) {
+	assert(!parser->fragmented);
+	parser->message = message;
+}
+
+/**
+ * Unmask in place, a word at a time where the target is aligned.
+ * @param offset Payload bytes of the frame before the target, selects the mask byte.
+ */
+static void websocket_frame_unmask(uint8_t *target, uint32_t length, const uint8_t *mask, uint32_t offset) {
+	uint32_t i = 0;
+	while (i < length && ((uintptr_t) &target[i] & 3) != 0) {
+		target[i] ^= mask[(offset + i) & 3];
+		i++;
+	}
+	uint32_t words = (length - i) / 4;
+	if (words > 0) {
+		// the mask as it lines up with the aligned words
+		uint8_t rotated[4];
+		for (int j = 0; j < 4; j++) {
+			rotated[j] = mask[(offset + i + j) & 3];
+		}
+		uint32_t mask_word;
+		memcpy(&mask_word, rotated, 4);
+		uint32_t *target_words = (uint32_t *) &target[i];
+		for (uint32_t j = 0; j < words; j++) {
+			target_words[j] ^= mask_word;
+		}
+		i += words * 4;
+	}
+	while (i < length) {
+		target[i] ^= mask[(offset + i) & 3];
+		i++;
+	}
+}
+
+static websocket_frame_result_t websocket_frame_error(websocket_frame_parser_t *parser, uint16_t close_status) {
+	ESP_LOGD(TAG, "error: %u", close_status);
+	parser->state = WEBSOCKET_FRAME_STATE_ERROR;
+	parser->close_status = close_status;
+	return WEBSOCKET_FRAME_ERROR;
+}
+
+/**
+ * The first two header bytes tell how long the header is.
+ */
+static websocket_frame_result_t websocket_frame_header_start(websocket_frame_parser_t *parser) {
+	if ((parser->header[1] & WEBSOCKET_FRAME_MASK) == 0) {
+		// frames from the client must be masked
+		return websocket_frame_error(parser, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+	}
+	uint8_t length = parser->header[1] & WEBSOCKET_FRAME_LENGTH;
+	parser->header_needed = 2 + WEBSOCKET_FRAME_MASK_LENGTH;
+	if (length == WEBSOCKET_FRAME_LENGTH_16) {
+		parser->header_needed += 2;
+	} else if (length == WEBSOCKET_FRAME_LENGTH_64) {
+		parser->header_needed += 8;
+	}
+	return WEBSOCKET_FRAME_INCOMPLETE;
+}
+
+/**
+ * Check a complete header and prepare for the payload.
+ */
+static websocket_frame_result_t websocket_frame_header_end(websocket_frame_parser_t *parser) {
+	uint8_t *header = parser->header;
+	if (header[0] & WEBSOCKET_FRAME_RSV) {
+		// no extensions negotiated
+		return websocket_frame_error(parser, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+	}
+	parser->fin = (header[0] & WEBSOCKET_FRAME_FIN) != 0;
+	parser->opcode = header[0] & WEBSOCKET_FRAME_OPCODE;
+
+	uint64_t length = header[1] & WEBSOCKET_FRAME_LENGTH;
+	uint32_t offset = 2;
+	if (length == WEBSOCKET_FRAME_LENGTH_16) {
+		length = (header[2] << 8) | header[3];
+		offset = 4;
+	} else if (length == WEBSOCKET_FRAME_LENGTH_64) {
+		length = 0;
+		for (offset = 2; offset < 10; offset++) {
+			length = (length << 8) | header[offset];
+		}
+		if (length >> 63) {
+			// the most significant bit must be 0
+			return websocket_frame_error(parser, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+		}
+	}
+	memcpy(parser->mask, &header[offset], WEBSOCKET_FRAME_MASK_LENGTH);
+
+	if (parser->opcode & WEBSOCKET_FRAME_CONTROL) {
+		if ((parser->opcode != WEBSOCKET_OPCODE_CLOSE && parser->opcode != WEBSOCKET_OPCODE_PING
+				&& parser->opcode != WEBSOCKET_OPCODE_PONG) || !parser->fin
+				|| length > WEBSOCKET_FRAME_CONTROL_MAX_LENGTH) {
+			// control frames are short and never fragmented
+			return websocket_frame_error(parser, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+		}
+		parser->control_length = 0;
+	} else {
+		if (parser->opcode == WEBSOCKET_OPCODE_CONTINUATION) {
+			if (!parser->fragmented) {
+				return websocket_frame_error(parser, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+			}
+		} else if (parser->opcode == WEBSOCKET_OPCODE_TEXT || parser->opcode == WEBSOCKET_OPCODE_BINARY) {
+			if (parser->fragmented) {
+				// the previous message did not end
+				return websocket_frame_error(parser, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+			}
+			parser->message_opcode = parser->opcode;
+			parser->message_length = 0;
+		} else {
+			return websocket_frame_error(parser, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+		}
+		if (length > parser->message_size - parser->message_length) {
+			return websocket_frame_error(parser, WEBSOCKET_CLOSE_TOO_BIG);
+		}
+	}
+	parser->payload_remaining = length;
+	parser->payload_offset = 0;
+	parser->state = WEBSOCKET_FRAME_STATE_PAYLOAD;
+	return WEBSOCKET_FRAME_INCOMPLETE;
+}
+
+/**
+ * Frame complete, prepare for the next header.
+ */
+static websocket_frame_result_t websocket_frame_end(websocket_frame_parser_t *parser) {
+	parser->state = WEBSOCKET_FRAME_STATE_HEADER;
+	parser->header_length = 0;
+	parser->header_needed = 2;
+	switch (parser->opcode) {
+	case WEBSOCKET_OPCODE_PING:
+		return WEBSOCKET_FRAME_PING;
+	case WEBSOCKET_OPCODE_PONG:
+		return WEBSOCKET_FRAME_PONG;
+	case WEBSOCKET_OPCODE_CLOSE:
+		if (parser->control_length == 1) {
+			// a status code has 2 bytes
+			return websocket_frame_error(parser, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+		}
+		// echo the status code
+		parser->close_status = parser->control_length == 0 ?
+				WEBSOCKET_CLOSE_NO_STATUS : (parser->control[0] << 8) | parser->control[1];
+		return WEBSOCKET_FRAME_CLOSE;
+	default:
+		parser->fragmented = !parser->fin;
+		return parser->fin ? WEBSOCKET_FRAME_MESSAGE : WEBSOCKET_FRAME_INCOMPLETE;
+	}
+}
+
+uint32_t websocket_frame_parse(websocket_frame_parser_t *parser, const uint8_t *data, uint32_t length,
+		websocket_frame_result_t *result) {
+	*result = WEBSOCKET_FRAME_INCOMPLETE;
+	if (parser->state == WEBSOCKET_FRAME_STATE_ERROR) {
+		// nothing more is understood
+		*result = WEBSOCKET_FRAME_ERROR;
+		return length;
+	}
+	uint32_t consumed = 0;
+	while (consumed < length && *result == WEBSOCKET_FRAME_INCOMPLETE) {
+		if (parser->state == WEBSOCKET_FRAME_STATE_HEADER) {
+			parser->header[parser->header_length++] = data[consumed++];
+			if (parser->header_length == 2) {
+				*result = websocket_frame_header_start(parser);
+			} else if (parser->header_length == parser->header_needed) {
+				*result = websocket_frame_header_end(parser);
+				if (*result == WEBSOCKET_FRAME_INCOMPLETE && parser->payload_remaining == 0) {
+					// no payload
+					*result = websocket_frame_end(parser);
+				}
+			}
+		} else {
+			uint32_t span = length - consumed;
+			if (span > parser->payload_remaining) {
+				span = parser->payload_remaining;
+			}
+			uint8_t *target;
+			if (parser->opcode & WEBSOCKET_FRAME_CONTROL) {
+				target = &parser->control[parser->control_length];
+				parser->control_length += span;
+			} else {
+				target = &parser->message[parser->message_length];
+				parser->message_length += span;
+			}
+			memcpy(target, &data[consumed], span);
+			websocket_frame_unmask(target, span, parser->mask, parser->payload_offset);
+			parser->payload_offset += span;
+			parser->payload_remaining -= span;
+			consumed += span;
+			if (parser->payload_remaining == 0) {
+				*result = websocket_frame_end(parser);
+			}
+		}
+	}
+	return consumed;
+}
+
+uint32_t websocket_frame_header(uint8_t *header, websocket_opcode_t opcode, uint64_t length) {
+	header[0] = WEBSOCKET_FRAME_FIN | opcode;
+	if (length < WEBSOCKET_FRAME_LENGTH_16) {
+		header[1] = length;
+		return 2;
+	}
+	if (length <= 0xFFFF) {
+		header[1] = WEBSOCKET_FRAME_LENGTH_16;
+		header[2] = (length >> 8) & 0xFF;
+		header[3] = length & 0xFF;
+		return 4;
+	}
+	header[1] = WEBSOCKET_FRAME_LENGTH_64;
+	for (int i = 0; i < 8; i++) {
+		header[2 + i] = (length >> (56 - 8 * i)) & 0xFF;
+	}
+	return 10;
+}
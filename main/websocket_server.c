@@ -1,19 +1,32 @@
 // The author disclaims copyright to this source code.
 #include "websocket_server.h"
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "lwip/api.h"
 #include "lwip/err.h"
 #include "hwcrypto/sha.h"
-#include "wpa2/utils/base64.h"
 #include "sdkconfig.h"
+#include "websocket_frame.h"
+#include "message_pool.h"
+#include "json_writer.h"
 
 static const char* TAG = "websocket_server";
 
+/** HTTP response when the client limit is reached */
+static const char HTTP_SERVICE_UNAVAILABLE[] = "HTTP/1.1 503 Service Unavailable\r\n"
+		"Content-Length: 0\r\n"
+		"Retry-After: 1\r\n"
+		"Connection: close\r\n"
+		"\r\n";
 /** HTTP response indicating switch to websocket protocol */
 static const char HTTP_SWITCHING[] = "HTTP/1.1 101 Switching Protocols\r\n"
 		"Upgrade: websocket\r\n"
@@ -21,75 +34,139 @@ static const char HTTP_SWITCHING[] = "HTTP/1.1 101 Switching Protocols\r\n"
 		"Sec-WebSocket-Accept: %.*s\r\n"
 		"\r\n";
 /** The length of the format string '%.*s' itself */
-static const int HTTP_SWITCHING_FORMAT_LENGTH = 4;
+#define HTTP_SWITCHING_FORMAT_LENGTH (4)
 /** HTTP header specifying client key */
 static const char SEC_WEBSOCKET_KEY[] = "Sec-WebSocket-Key:";
 /** WebSocket client key length. Can not find size in spec, example shown has length 24 */
-static const int SEC_WEBSOCKET_KEY_LENGTH = 24;
+#define SEC_WEBSOCKET_KEY_LENGTH (24)
 /** WebSocket protocol GUID */
 static const char SEC_WEBSOCKET_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 /** Number of bytes in SHA1 hash of client key plus GUID */
-static const int SEC_WEBSOCKET_ACCEPT_SHA1_LENGTH = 20;
-/** Number of mask bytes in frame (from client to server */
-static const int FRAME_MASK_BYTES = 4;
-
-/**
- * WebSocket frame opcode
- * https://tools.ietf.org/html/rfc6455#section-11.8
- *  |Opcode  | Meaning                             | Reference |
- */
-typedef enum websocket_server_opcode_t {
-	/**  | 0      | Continuation Frame                  | RFC 6455  | */
-	CONTINUATION = 0,
-	/**  | 1      | Text Frame                          | RFC 6455  | */
-	TEXT = 1,
-	/**  | 2      | Binary Frame                        | RFC 6455  | */
-	BINARY = 2,
-	/**  | 8      | Connection Close Frame              | RFC 6455  | */
-	CONNECTION_CLOSE = 8,
-	/**  | 9      | Ping Frame                          | RFC 6455  | */
-	PING = 9,
-	/**  | 10     | Pong Frame                          | RFC 6455  | */
-	PONG = 10
-} websocket_server_opcode_t;
-
-/**
- * WebSocket frame format
- * https://developer.mozilla.org/en-US/docs/Web/API/WebSockets_API/Writing_WebSocket_servers#Format
- * ​​
- *       0                   1                   2                   3
- *       0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
- *      +-+-+-+-+-------+-+-------------+-------------------------------+
- *      |F|R|R|R| opcode|M| Payload len |    Extended payload length    |
- *      |I|S|S|S|  (4)  |A|     (7)     |             (16/64)           |
- *      |N|V|V|V|       |S|             |   (if payload len==126/127)   |
- *      | |1|2|3|       |K|             |                               |
- *      +-+-+-+-+-------+-+-------------+ - - - - - - - - - - - - - - - +
- *      |     Extended payload length continued, if payload len == 127  |
- *      + - - - - - - - - - - - - - - - +-------------------------------+
- *      |                               |Masking-key, if MASK set to 1  |
- *      +-------------------------------+-------------------------------+
- *      | Masking-key (continued)       |          Payload Data         |
- *      +-------------------------------- - - - - - - - - - - - - - - - +
- *      :                     Payload Data continued ...                :
- *      + - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - +
- *      |                     Payload Data continued ...                |
- *      +---------------------------------------------------------------+
+#define SEC_WEBSOCKET_ACCEPT_SHA1_LENGTH (20)
+/** Number of characters in the base64 encoded hash */
+#define SEC_WEBSOCKET_ACCEPT_KEY_LENGTH (28)
+static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+/**
+ * A message buffer holds its reference count, room for the frame header and
+ * the payload (word aligned).
+ */
+#define WEBSOCKET_MESSAGE_HEADER_ROOM (12)
+#define WEBSOCKET_MESSAGE_OFFSET (sizeof(uint32_t) + WEBSOCKET_MESSAGE_HEADER_ROOM)
+/** Time to wait for a message buffer when a client connects. */
+#define WEBSOCKET_MESSAGE_WAIT_MS (1000)
+/** Time between checks whether the client fell behind, while waiting for data. */
+#define WEBSOCKET_RECEIVE_POLL_MS (500)
+/** Subscription requests, exact text messages. */
+static const char WEBSOCKET_SUBSCRIBE[] = "subscribe";
+static const char WEBSOCKET_SUBSCRIBE_BINARY[] = "subscribe binary";
+static const char WEBSOCKET_UNSUBSCRIBE[] = "unsubscribe";
+
+/**
+ * Text message received, queued for processing.
+ */
+typedef struct {
+	/** Client that sent the message, see websocket_client_t. */
+	uint8_t client;
+	uint32_t client_id;
+	uint32_t payload_length;
+	/** Message buffer from the pool, the payload starts at WEBSOCKET_MESSAGE_OFFSET. */
+	uint8_t *buffer;
+	/** Time the message was complete (esp_timer_get_time). */
+	int64_t received_us;
+} websocket_message_t;
+
+/**
+ * Answer written in place of the message it answers.
+ */
+typedef struct {
+	char *out;
+	uint32_t size;
+	uint32_t length;
+} websocket_answer_t;
+
+/**
+ * Frame queued for sending to a client.
+ */
+typedef struct {
+	/** Message buffer holding the frame, the queue holds a reference. */
+	uint8_t *buffer;
+	const uint8_t *frame;
+	uint32_t frame_length;
+	/** Connection the frame is for. */
+	uint32_t client_id;
+	/** A newer message of the same topic supersedes this one, 0 when never superseded. */
+	uint8_t topic;
+} websocket_send_t;
+
+/**
+ * Frames written to the loopback client of the self test, instead of sent.
  */
 typedef struct {
-	struct netconn* connection;
-	// frame header
-	bool fin;
-	websocket_server_opcode_t opcode;
-	bool mask;
-	// 64-bit extended payload length unsupported
-	uint16_t payload_length;
-	// frame payload
-	char* payload;
-} websocket_frame_t;
+	/** Last frame, cut off at the size. */
+	uint8_t *out;
+	uint32_t size;
+	uint32_t length;
+} websocket_loopback_t;
+
+/**
+ * Per connection state, one for each worker task.
+ * The send queue and counters are guarded by websocket_server_mux.
+ */
+typedef struct websocket_client_t {
+	/** NULL when not connected. */
+	struct netconn *conn;
+	/** Changes with every connection, a frame queued for an earlier connection is not sent. */
+	uint32_t id;
+	/** Writes come from several tasks (replies, broadcasts). */
+	SemaphoreHandle_t mutex;
+	/** Frames received, only used by the worker. */
+	websocket_frame_parser_t parser;
+	/** Message buffer being received into, from the pool. */
+	uint8_t *buffer;
+	/** Frames waiting to be sent, a ring of websocket_server_send_queue_length. */
+	websocket_send_t *sends;
+	uint8_t send_head;
+	uint8_t send_count;
+	/** Drains the send queue. */
+	TaskHandle_t sender;
+	/** Since the send queue overflowed and was not emptied after, 0 when not behind. */
+	int64_t behind_since_us;
+	/** Behind too long or a write failed, the worker disconnects. */
+	bool lagging;
+	/** Published messages received, set by the process task. */
+	websocket_subscription_t subscription;
+	/** Self test only, frames are kept here instead of written to the connection. */
+	websocket_loopback_t *loopback;
+	/** Counters, only grow. */
+	uint32_t sent_count;
+	uint32_t drop_count;
+	uint32_t coalesce_count;
+	uint32_t lag_count;
+} websocket_client_t;
 
 static uint16_t websocket_server_port;
+static uint8_t websocket_server_max_clients;
+static uint32_t websocket_server_message_max_length;
+static metrics_handle_t websocket_server_metrics_handle;
+static control_handle_t websocket_server_control_handle;
+static uint8_t websocket_server_message_buffers;
+static uint8_t websocket_server_send_queue_length;
+static uint32_t websocket_server_lag_timeout_ms;
+/** Message buffers, one for each client plus the ones waiting to be processed or sent. */
+static message_pool_handle_t websocket_server_message_pool;
 static QueueHandle_t websocket_server_receive_queue;
+/** Accepted connections waiting for a worker. */
+static QueueHandle_t websocket_server_accept_queue;
+static websocket_client_t *websocket_server_clients;
+/** Connections queued or connected. */
+static uint8_t websocket_server_connections;
+static uint32_t websocket_server_next_id;
+static portMUX_TYPE websocket_server_mux = portMUX_INITIALIZER_UNLOCKED;
+/** A client subscribed, or a message with a topic was superseded or dropped. */
+static bool websocket_server_resync_needed;
+/** Connection of the loopback client, never handed to lwIP. */
+static struct netconn websocket_server_loopback_conn;
+static websocket_loopback_t websocket_server_loopback_out;
 
 /**
  * Create string representation of data bytes.
@@ -107,45 +184,379 @@ static char* createHex(char *data, int length) {
 	return out;
 }
 
-static char* createAcceptKey(char* request, unsigned int request_length) {
-	// char *client_key = memmem(buf, i, SEC_WEBSOCKET_KEY, sizeof(SEC_WEBSOCKET_KEY));
-	char *client_key = strstr(request, SEC_WEBSOCKET_KEY);
+/**
+ * Encode 3 bytes at a time, the last group is padded.
+ */
+static void websocket_base64(const uint8_t *data, uint32_t length, char *out) {
+	for (uint32_t i = 0; i < length; i += 3) {
+		uint32_t group = data[i] << 16;
+		if (i + 1 < length) {
+			group |= data[i + 1] << 8;
+		}
+		if (i + 2 < length) {
+			group |= data[i + 2];
+		}
+		*out++ = BASE64[(group >> 18) & 0x3F];
+		*out++ = BASE64[(group >> 12) & 0x3F];
+		*out++ = i + 1 < length ? BASE64[(group >> 6) & 0x3F] : '=';
+		*out++ = i + 2 < length ? BASE64[group & 0x3F] : '=';
+	}
+	*out = 0;
+}
+
+/**
+ * Calculate the accept key, on the stack.
+ * @param accept_key Target, SEC_WEBSOCKET_ACCEPT_KEY_LENGTH + 1 characters.
+ * @return False when the client key is not found.
+ */
+static bool createAcceptKey(const char* request, unsigned int request_length, char *accept_key) {
+	// the request is not terminated, search within its length
+	const char *client_key = NULL;
+	uint32_t needed = sizeof(SEC_WEBSOCKET_KEY) + SEC_WEBSOCKET_KEY_LENGTH;
+	for (uint32_t i = 0; client_key == NULL && i + needed <= request_length; i++) {
+		if (memcmp(&request[i], SEC_WEBSOCKET_KEY, sizeof(SEC_WEBSOCKET_KEY) - 1) == 0) {
+			client_key = &request[i + sizeof(SEC_WEBSOCKET_KEY)];
+		}
+	}
 	if (client_key == NULL) {
 		// not found
-		return NULL;
+		return false;
 	}
-	unsigned char* sha_input = malloc(SEC_WEBSOCKET_KEY_LENGTH + sizeof(SEC_WEBSOCKET_GUID));
-	assert(sha_input != NULL);
-	unsigned char* sha_output = malloc(SEC_WEBSOCKET_ACCEPT_SHA1_LENGTH);
-	assert(sha_output != NULL);
 	// concatenate request key and websocket guid
-	memcpy(sha_input, client_key + sizeof(SEC_WEBSOCKET_KEY), SEC_WEBSOCKET_KEY_LENGTH);
-	memcpy(sha_input + SEC_WEBSOCKET_KEY_LENGTH, SEC_WEBSOCKET_GUID, sizeof(SEC_WEBSOCKET_GUID));
-	unsigned int sha_input_length = SEC_WEBSOCKET_KEY_LENGTH + sizeof(SEC_WEBSOCKET_GUID);
-	ESP_LOGD(TAG, "sha_input:%u %.*s", sha_input_length, sha_input_length, sha_input);
+	uint8_t sha_input[SEC_WEBSOCKET_KEY_LENGTH + sizeof(SEC_WEBSOCKET_GUID) - 1];
+	memcpy(sha_input, client_key, SEC_WEBSOCKET_KEY_LENGTH);
+	memcpy(sha_input + SEC_WEBSOCKET_KEY_LENGTH, SEC_WEBSOCKET_GUID, sizeof(SEC_WEBSOCKET_GUID) - 1);
+	ESP_LOGD(TAG, "sha_input:%u %.*s", sizeof(sha_input), sizeof(sha_input), sha_input);
 	// calculate sha1 hash
-	esp_sha(SHA1, sha_input, strlen((char*) sha_input), sha_output);
-	char* accept_key = (char*) _base64_encode(sha_output, SEC_WEBSOCKET_ACCEPT_SHA1_LENGTH, &request_length);
-	free(sha_input);
-	free(sha_output);
-	return accept_key;
+	uint8_t sha_output[SEC_WEBSOCKET_ACCEPT_SHA1_LENGTH];
+	esp_sha(SHA1, sha_input, sizeof(sha_input), sha_output);
+	websocket_base64(sha_output, SEC_WEBSOCKET_ACCEPT_SHA1_LENGTH, accept_key);
+	ESP_LOGD(TAG, "accept_key:%s", accept_key);
+	return true;
 }
 
-char* createSwitchingResponse(char* accept_key) {
-	unsigned int accept_key_length = strlen(accept_key);
-	// strip line ends (I see an extra LF on the wire)
-	while (accept_key[accept_key_length - 1] <= 0x20) {
-		accept_key_length--;
+/**
+ * Frame header in front of the payload in a message buffer.
+ * @param frame Start of the frame.
+ * @return Frame length.
+ */
+static uint32_t websocket_message_frame(uint8_t *buffer, websocket_opcode_t opcode, uint32_t payload_length,
+		uint8_t **frame) {
+	uint8_t header[WEBSOCKET_FRAME_SERVER_HEADER_MAX_LENGTH];
+	uint32_t header_length = websocket_frame_header(header, opcode, payload_length);
+	*frame = &buffer[WEBSOCKET_MESSAGE_OFFSET - header_length];
+	memcpy(*frame, header, header_length);
+	return header_length + payload_length;
+}
+
+/**
+ * Take a message buffer, holding the only reference.
+ */
+static uint8_t *websocket_buffer_take(uint32_t wait_ms) {
+	uint8_t *buffer = message_pool_take(websocket_server_message_pool, wait_ms);
+	if (buffer != NULL) {
+		*(uint32_t *) buffer = 1;
+	}
+	return buffer;
+}
+
+/**
+ * Drop a reference, call locked.
+ * @return True when it was the last, give the buffer back after unlocking.
+ */
+static bool websocket_buffer_unref_locked(uint8_t *buffer) {
+	return --*(uint32_t *) buffer == 0;
+}
+
+static void websocket_buffer_release(uint8_t *buffer) {
+	portENTER_CRITICAL(&websocket_server_mux);
+	bool last = websocket_buffer_unref_locked(buffer);
+	portEXIT_CRITICAL(&websocket_server_mux);
+	if (last) {
+		message_pool_give(websocket_server_message_pool, buffer);
 	}
-	ESP_LOGD(TAG, "accept_key:%u %.*s", accept_key_length, accept_key_length, accept_key);
+}
 
-	char* response = malloc(sizeof(HTTP_SWITCHING) - HTTP_SWITCHING_FORMAT_LENGTH + accept_key_length);
-	assert(response != NULL);
-	sprintf(response, HTTP_SWITCHING, accept_key_length, accept_key);
-	return response;
+/**
+ * Frame at a position in the send queue, call locked.
+ */
+static websocket_send_t *websocket_client_queued(websocket_client_t *client, uint8_t position) {
+	return &client->sends[(client->send_head + position) % websocket_server_send_queue_length];
+}
+
+/**
+ * Remove a frame from the send queue, later frames move up. Call locked.
+ * @return Buffer to give back after unlocking, NULL when still referenced.
+ */
+static uint8_t *websocket_client_unqueue_locked(websocket_client_t *client, uint8_t position) {
+	uint8_t *buffer = websocket_client_queued(client, position)->buffer;
+	for (uint8_t i = position; i + 1 < client->send_count; i++) {
+		*websocket_client_queued(client, i) = *websocket_client_queued(client, i + 1);
+	}
+	client->send_count--;
+	return websocket_buffer_unref_locked(buffer) ? buffer : NULL;
+}
+
+/**
+ * The client can not keep up, the worker disconnects it. Call locked.
+ */
+static void websocket_client_lag_locked(websocket_client_t *client) {
+	if (!client->lagging) {
+		client->lagging = true;
+		client->lag_count++;
+	}
+}
+
+/**
+ * The send queue is full, call locked.
+ * A client that does not empty its queue in time is disconnected.
+ */
+static void websocket_client_behind_locked(websocket_client_t *client, int64_t now_us) {
+	if (client->behind_since_us == 0) {
+		client->behind_since_us = now_us;
+	} else if (now_us - client->behind_since_us > websocket_server_lag_timeout_ms * 1000LL) {
+		websocket_client_lag_locked(client);
+	}
+}
+
+/**
+ * Queue a frame for a client, its sender writes it.
+ * A message of the same topic still queued is replaced in place. When the
+ * queue is full the oldest message with a topic is dropped to make room,
+ * otherwise the new frame is dropped.
+ * @param send Frame, the queue takes its own reference to the buffer.
+ * @return False when not queued.
+ */
+static bool websocket_client_queue(uint8_t index, const websocket_send_t *send) {
+	websocket_client_t *client = &websocket_server_clients[index];
+	uint8_t *released = NULL;
+	bool queued = false;
+	int64_t now_us = esp_timer_get_time();
+	portENTER_CRITICAL(&websocket_server_mux);
+	if (client->conn != NULL && (send->client_id == 0 || send->client_id == client->id) && !client->lagging) {
+		websocket_send_t *target = NULL;
+		for (uint8_t i = 0; i < client->send_count && target == NULL && send->topic != 0; i++) {
+			if (websocket_client_queued(client, i)->topic == send->topic) {
+				target = websocket_client_queued(client, i);
+			}
+		}
+		if (target != NULL) {
+			// superseded, the newer message takes its place
+			if (websocket_buffer_unref_locked(target->buffer)) {
+				released = target->buffer;
+			}
+			client->coalesce_count++;
+			websocket_server_resync_needed = true;
+		} else {
+			if (client->send_count == websocket_server_send_queue_length) {
+				websocket_client_behind_locked(client, now_us);
+				bool dropped = false;
+				for (uint8_t i = 0; i < client->send_count && !dropped; i++) {
+					if (websocket_client_queued(client, i)->topic != 0) {
+						released = websocket_client_unqueue_locked(client, i);
+						dropped = true;
+					}
+				}
+				websocket_server_resync_needed |= dropped || send->topic != 0;
+				// either the oldest message with a topic or the new frame
+				client->drop_count++;
+			}
+			if (client->send_count < websocket_server_send_queue_length) {
+				target = websocket_client_queued(client, client->send_count);
+				client->send_count++;
+			}
+		}
+		if (target != NULL) {
+			*target = *send;
+			target->client_id = client->id;
+			(*(uint32_t *) send->buffer)++;
+			queued = true;
+		}
+	}
+	portEXIT_CRITICAL(&websocket_server_mux);
+	if (released != NULL) {
+		message_pool_give(websocket_server_message_pool, released);
+	}
+	if (queued) {
+		xTaskNotifyGive(client->sender);
+	}
+	return queued;
+}
+
+/**
+ * Take the next frame to send, the reference to the buffer comes along.
+ * @return False when the queue is empty.
+ */
+static bool websocket_client_next(uint8_t index, websocket_send_t *send) {
+	websocket_client_t *client = &websocket_server_clients[index];
+	bool next = false;
+	portENTER_CRITICAL(&websocket_server_mux);
+	if (client->send_count > 0) {
+		*send = *websocket_client_queued(client, 0);
+		client->send_head = (client->send_head + 1) % websocket_server_send_queue_length;
+		client->send_count--;
+		next = true;
+	}
+	if (client->send_count == 0) {
+		// caught up
+		client->behind_since_us = 0;
+	}
+	portEXIT_CRITICAL(&websocket_server_mux);
+	return next;
+}
+
+/**
+ * Make a connection available for writing.
+ */
+static void websocket_client_connect(uint8_t index, struct netconn *conn) {
+	websocket_client_t *client = &websocket_server_clients[index];
+	portENTER_CRITICAL(&websocket_server_mux);
+	uint32_t id = ++websocket_server_next_id;
+	portEXIT_CRITICAL(&websocket_server_mux);
+	// a write taking this long means the client fell behind
+	netconn_set_sendtimeout(conn, websocket_server_lag_timeout_ms);
+	assert(xSemaphoreTake(client->mutex, portMAX_DELAY) == pdTRUE);
+	portENTER_CRITICAL(&websocket_server_mux);
+	client->conn = conn;
+	client->id = id;
+	client->behind_since_us = 0;
+	client->lagging = false;
+	client->subscription = WEBSOCKET_SUBSCRIPTION_NONE;
+	portEXIT_CRITICAL(&websocket_server_mux);
+	assert(xSemaphoreGive(client->mutex) == pdTRUE);
+	ESP_LOGI(TAG, "client %u connected, id: %u", index, id);
+}
+
+/**
+ * Stop writing to a connection, any write in progress completes first.
+ * Frames still queued are dropped.
+ */
+static void websocket_client_disconnect(uint8_t index) {
+	websocket_client_t *client = &websocket_server_clients[index];
+	assert(xSemaphoreTake(client->mutex, portMAX_DELAY) == pdTRUE);
+	portENTER_CRITICAL(&websocket_server_mux);
+	client->conn = NULL;
+	portEXIT_CRITICAL(&websocket_server_mux);
+	assert(xSemaphoreGive(client->mutex) == pdTRUE);
+	bool queued = true;
+	while (queued) {
+		uint8_t *released = NULL;
+		portENTER_CRITICAL(&websocket_server_mux);
+		queued = client->send_count > 0;
+		if (queued) {
+			released = websocket_client_unqueue_locked(client, 0);
+		}
+		portEXIT_CRITICAL(&websocket_server_mux);
+		if (released != NULL) {
+			message_pool_give(websocket_server_message_pool, released);
+		}
+	}
+	ESP_LOGI(TAG, "client %u disconnected", index);
+}
+
+/**
+ * @return True when the client fell behind and must be disconnected.
+ */
+static bool websocket_client_lagging(uint8_t index) {
+	portENTER_CRITICAL(&websocket_server_mux);
+	bool lagging = websocket_server_clients[index].lagging;
+	portEXIT_CRITICAL(&websocket_server_mux);
+	return lagging;
+}
+
+/**
+ * Write a frame to a client, when it is (still) the same connection.
+ * Header and payload are contiguous, one write.
+ * @param id Connection id, 0 for any.
+ */
+static err_t websocket_client_write(uint8_t index, uint32_t id, const uint8_t *frame, uint32_t frame_length) {
+	websocket_client_t *client = &websocket_server_clients[index];
+	err_t err = ERR_CONN;
+	assert(xSemaphoreTake(client->mutex, portMAX_DELAY) == pdTRUE);
+	if (client->conn != NULL && (id == 0 || client->id == id)) {
+		if (client->loopback != NULL) {
+			websocket_loopback_t *loopback = client->loopback;
+			loopback->length = frame_length < loopback->size ? frame_length : loopback->size;
+			memcpy(loopback->out, frame, loopback->length);
+			err = ERR_OK;
+		} else {
+			err = netconn_write(client->conn, frame, frame_length, NETCONN_COPY);
+		}
+	}
+	assert(xSemaphoreGive(client->mutex) == pdTRUE);
+	return err;
+}
+
+/**
+ * Answer a control frame, from the worker of the client.
+ */
+static void websocket_client_control(uint8_t index, websocket_opcode_t opcode, const uint8_t *payload,
+		uint32_t payload_length) {
+	uint8_t frame[WEBSOCKET_FRAME_SERVER_HEADER_MAX_LENGTH + WEBSOCKET_FRAME_CONTROL_MAX_LENGTH];
+	uint32_t header_length = websocket_frame_header(frame, opcode, payload_length);
+	memcpy(&frame[header_length], payload, payload_length);
+	websocket_client_write(index, 0, frame, header_length + payload_length);
+}
+
+/**
+ * Close with a status code, the connection is closed after.
+ */
+static void websocket_client_close(uint8_t index, uint16_t status) {
+	uint8_t payload[2];
+	payload[0] = status >> 8;
+	payload[1] = status & 0xFF;
+	// no status received, none is echoed
+	websocket_client_control(index, WEBSOCKET_OPCODE_CLOSE, payload, status == WEBSOCKET_CLOSE_NO_STATUS ? 0 : 2);
+}
+
+/**
+ * Act on a parse result.
+ * @return False when the connection must be closed.
+ */
+static bool websocket_client_receive(uint8_t index, websocket_frame_result_t result) {
+	websocket_client_t *client = &websocket_server_clients[index];
+	websocket_frame_parser_t *parser = &client->parser;
+	switch (result) {
+	case WEBSOCKET_FRAME_MESSAGE:
+		if (parser->message_opcode != WEBSOCKET_OPCODE_TEXT) {
+			// ignore unsupported payload type
+			ESP_LOGE(TAG, "unsupported payload");
+		} else {
+			// continue receiving in another buffer, hand over this one
+			uint8_t *buffer = websocket_buffer_take(0);
+			if (buffer == NULL) {
+				ESP_LOGW(TAG, "too busy, message dropped");
+			} else {
+				websocket_message_t message;
+				message.client = index;
+				message.client_id = client->id;
+				message.payload_length = parser->message_length;
+				message.buffer = client->buffer;
+				message.received_us = esp_timer_get_time();
+				client->buffer = buffer;
+				websocket_frame_set_message(parser, &buffer[WEBSOCKET_MESSAGE_OFFSET]);
+				// the queue has room for every buffer, the receiving end gives it back to the pool
+				assert(xQueueSendToBack(websocket_server_receive_queue, &message, 0) == pdTRUE);
+			}
+		}
+		return true;
+	case WEBSOCKET_FRAME_PING:
+		websocket_client_control(index, WEBSOCKET_OPCODE_PONG, parser->control, parser->control_length);
+		return true;
+	case WEBSOCKET_FRAME_CLOSE:
+		ESP_LOGD(TAG, "CONNECTION_CLOSE %u", parser->close_status);
+		websocket_client_close(index, parser->close_status);
+		return false;
+	case WEBSOCKET_FRAME_ERROR:
+		ESP_LOGE(TAG, "protocol error, close %u", parser->close_status);
+		websocket_client_close(index, parser->close_status);
+		return false;
+	default:
+		return true;
+	}
 }
 
-static void websocket_lifecycle(struct netconn *conn) {
+static void websocket_lifecycle(uint8_t index, struct netconn *conn) {
 	ESP_LOGD(TAG, ">websocket_lifecycle");
 
 	struct netbuf *upgrade_netbuf;
@@ -157,97 +568,56 @@ static void websocket_lifecycle(struct netconn *conn) {
 		u16_t request_length;
 		netbuf_data(upgrade_netbuf, (void**) &request, &request_length);
 
-		char* accept_key = createAcceptKey(request, request_length);
-		if (accept_key == NULL) {
+		char accept_key[SEC_WEBSOCKET_ACCEPT_KEY_LENGTH + 1];
+		websocket_client_t *client = &websocket_server_clients[index];
+		if (!createAcceptKey(request, request_length, accept_key)) {
 			ESP_LOGE(TAG, "HTTP header '%s' not found", SEC_WEBSOCKET_KEY);
+		} else if ((client->buffer = websocket_buffer_take(WEBSOCKET_MESSAGE_WAIT_MS)) == NULL) {
+			ESP_LOGE(TAG, "no message buffer");
+			netconn_write(conn, HTTP_SERVICE_UNAVAILABLE, sizeof(HTTP_SERVICE_UNAVAILABLE) - 1, NETCONN_NOCOPY);
 		} else {
-			char* response = createSwitchingResponse(accept_key);
-			ESP_LOGD(TAG, "response: %.*s", strlen(response), response);
-			netconn_write(conn, response, strlen(response), NETCONN_COPY);
+			char response[sizeof(HTTP_SWITCHING) - HTTP_SWITCHING_FORMAT_LENGTH + SEC_WEBSOCKET_ACCEPT_KEY_LENGTH];
+			int response_length = snprintf(response, sizeof(response), HTTP_SWITCHING, SEC_WEBSOCKET_ACCEPT_KEY_LENGTH,
+					accept_key);
+			ESP_LOGD(TAG, "response: %.*s", response_length, response);
+			netconn_write(conn, response, response_length, NETCONN_COPY);
 
-			free(accept_key);
-			free(response);
+			websocket_frame_reset(&client->parser, &client->buffer[WEBSOCKET_MESSAGE_OFFSET],
+					websocket_server_message_max_length);
+			websocket_client_connect(index, conn);
 
+			// frames may be split over, or share, buffers
+			bool open = true;
 			struct netbuf *frame_netbuf;
-			err_t err;
-			while ((err = netconn_recv(conn, &frame_netbuf)) == ERR_OK) {
-
-				// keep an eye on memory usage
-				size_t available = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
-				ESP_LOGD(TAG, "heap_caps_get_minimum_free_size: %d", available);
-
-				// read request
-				netbuf_data(frame_netbuf, (void**) &request, &request_length);
-
-				// build frame from request bytes
-				ESP_LOGD(TAG, "request: %02X %02X %02X %02X ..", request[0], request[1], request[2], request[3]);
-				websocket_frame_t frame;
-				frame.fin = (request[0] & 0x80) > 0;
-				ESP_LOGD(TAG, "fin: %s", (frame.fin ? "true" : "false"));
-				frame.opcode = (request[0] & 0x0F);
-				ESP_LOGD(TAG, "opcode: %u", frame.opcode);
-				frame.mask = (request[1] & 0x80) > 0;
-				ESP_LOGD(TAG, "mask: %s", (frame.mask ? "true" : "false"));
-				// start of mask varies with payload length
-				char* start_of_mask = NULL;
-				frame.payload_length = (request[1] & 0x7F);
-				if (frame.payload_length < 126) {
-					ESP_LOGD(TAG, "payload_length(7): %u", frame.payload_length);
-					start_of_mask = &request[2];
-				} else if (frame.payload_length == 126) {
-					frame.payload_length = ((request[2] & 0xFF) << 8) + (request[3] & 0xFF);
-					ESP_LOGD(TAG, "payload_length(16): %u", frame.payload_length);
-					start_of_mask = &request[4];
-				} else if (frame.payload_length == 127) {
-					ESP_LOGE(TAG, "Unsupported payload length(64)");
-					break;
-				}
-
-				if (frame.opcode == CONNECTION_CLOSE) {
-					// break from while loop receiving frames
-					ESP_LOGD(TAG, "CONNECTION_CLOSE");
-					break;
-				}
-
-				// allocate memory for unmasked payload
-				char * payload = malloc(frame.payload_length);
-				if (payload == NULL) {
-					// should abort
-					ESP_LOGE(TAG, "malloc failed");
-				} else {
-					// payload from client should be masked
-					if (frame.mask) {
-						for (request_length = 0; request_length < frame.payload_length; request_length++) {
-							payload[request_length] = (start_of_mask + FRAME_MASK_BYTES)[request_length]
-									^ start_of_mask[request_length % FRAME_MASK_BYTES];
-						}
-					} else {
-						ESP_LOGE(TAG, "payload should be masked");
-						memcpy(payload, start_of_mask, frame.payload_length);
-					}
-
-					// ignore unsupported payload type
-					if ((payload == NULL) || (frame.opcode != TEXT)) {
-						ESP_LOGE(TAG, "unsupported payload");
-					} else {
-						frame.connection = conn;
-						frame.payload = payload;
-
-						// copies the frame, but this contains a reference to the payload that was just allocated
-						// and must be free-ed by the receiving end
-						xQueueSendFromISR(websocket_server_receive_queue, &frame, 0);
+			netconn_set_recvtimeout(conn, WEBSOCKET_RECEIVE_POLL_MS);
+			while (open && ((err = netconn_recv(conn, &frame_netbuf)) == ERR_OK || err == ERR_TIMEOUT)) {
+				if (err == ERR_TIMEOUT) {
+					if (websocket_client_lagging(index)) {
+						ESP_LOGW(TAG, "client %u fell behind", index);
+						open = false;
 					}
+					continue;
 				}
+				do {
+					uint8_t *data;
+					u16_t length;
+					netbuf_data(frame_netbuf, (void**) &data, &length);
+					while (open && length > 0) {
+						websocket_frame_result_t result;
+						uint32_t consumed = websocket_frame_parse(&client->parser, data, length, &result);
+						data += consumed;
+						length -= consumed;
+						open = websocket_client_receive(index, result);
+					}
+				} while (open && netbuf_next(frame_netbuf) >= 0);
 				netbuf_delete(frame_netbuf);
-				frame_netbuf = NULL;
 			}
 			if (err != ERR_OK) {
 				ESP_LOGE(TAG, "netconn_recv error:%d", err);
 			}
-			// if broken out of the loop, still delete the buffer
-			if (frame_netbuf != NULL) {
-				netbuf_delete(frame_netbuf);
-			}
+			websocket_client_disconnect(index);
+			websocket_buffer_release(client->buffer);
+			client->buffer = NULL;
 		}
 		netbuf_delete(upgrade_netbuf);
 	}
@@ -255,52 +625,431 @@ static void websocket_lifecycle(struct netconn *conn) {
 	ESP_LOGD(TAG, "<websocket_lifecycle");
 }
 
-static err_t write_text(websocket_frame_t frame) {
-	ESP_LOGD(TAG, ">write_text");
+/**
+ * Queue a text message for its client, in place.
+ */
+static bool queue_text(websocket_message_t message) {
+	ESP_LOGD(TAG, ">queue_text");
+
+	uint32_t payload_length = message.payload_length;
+	char* payload = (char *) &message.buffer[WEBSOCKET_MESSAGE_OFFSET];
+	ESP_LOGD(TAG, "data: %u %.*s", payload_length, payload_length, payload);
+
+	// the header goes in front of the payload
+	websocket_send_t send;
+	uint8_t *frame;
+	send.buffer = message.buffer;
+	send.frame_length = websocket_message_frame(message.buffer, WEBSOCKET_OPCODE_TEXT, payload_length, &frame);
+	send.frame = frame;
+	send.client_id = message.client_id;
+	send.topic = 0;
+	bool queued = websocket_client_queue(message.client, &send);
+	if (!queued) {
+		ESP_LOGW(TAG, "client %u not queued", message.client);
+	}
+	ESP_LOGD(TAG, "<queue_text");
+	return queued;
+}
+
+/**
+ * Queue a message for every client, or only for the subscribers.
+ * @param subscription WEBSOCKET_SUBSCRIPTION_NONE for every client.
+ * @return Number of clients queued for.
+ */
+static uint8_t websocket_server_queue_all(websocket_opcode_t opcode, websocket_subscription_t subscription,
+		uint8_t topic, const void *data, uint16_t length) {
+	if (length > websocket_server_message_max_length) {
+		ESP_LOGE(TAG, "message too long: %u", length);
+		return 0;
+	}
+	uint8_t *buffer = websocket_buffer_take(0);
+	if (buffer == NULL) {
+		ESP_LOGW(TAG, "too busy, message dropped");
+		return 0;
+	}
+	// the frame is the same for every client, each queue holds a reference
+	memcpy(&buffer[WEBSOCKET_MESSAGE_OFFSET], data, length);
+	websocket_send_t send;
+	uint8_t *frame;
+	send.buffer = buffer;
+	send.frame_length = websocket_message_frame(buffer, opcode, length, &frame);
+	send.frame = frame;
+	send.client_id = 0;
+	send.topic = topic;
+	uint8_t queued = 0;
+	for (uint8_t index = 0; index < websocket_server_max_clients; index++) {
+		if ((subscription == WEBSOCKET_SUBSCRIPTION_NONE
+				|| websocket_server_clients[index].subscription == subscription)
+				&& websocket_client_queue(index, &send)) {
+			queued++;
+		}
+	}
+	websocket_buffer_release(buffer);
+	return queued;
+}
+
+uint8_t websocket_server_broadcast(uint8_t topic, const char *text, uint16_t length) {
+	ESP_LOGD(TAG, ">websocket_server_broadcast");
+	uint8_t queued = websocket_server_queue_all(WEBSOCKET_OPCODE_TEXT, WEBSOCKET_SUBSCRIPTION_NONE, topic, text,
+			length);
+	ESP_LOGD(TAG, "<websocket_server_broadcast %u", queued);
+	return queued;
+}
 
-	uint16_t payload_length = frame.payload_length;
-	char* payload = frame.payload;
-	struct netconn *connection = frame.connection;
+uint8_t websocket_server_publish(websocket_subscription_t subscription, uint8_t topic, const void *data,
+		uint16_t length) {
+	ESP_LOGD(TAG, ">websocket_server_publish");
+	assert(subscription != WEBSOCKET_SUBSCRIPTION_NONE);
+	websocket_opcode_t opcode =
+			subscription == WEBSOCKET_SUBSCRIPTION_BINARY ? WEBSOCKET_OPCODE_BINARY : WEBSOCKET_OPCODE_TEXT;
+	uint8_t queued = websocket_server_queue_all(opcode, subscription, topic, data, length);
+	ESP_LOGD(TAG, "<websocket_server_publish %u", queued);
+	return queued;
+}
 
-	// create header
-	unsigned char header[4];
-	int header_length;
-	// fin = true 0x80, rsv = not set 0x00, opcode = text 0x01
-	header[0] = 0x81;
-	if (payload_length < 126) {
-		// mask = false 0x00, payload_length < 7 bits
-		header[1] = (payload_length & 0x7F);
-		header_length = 2;
-		ESP_LOGD(TAG, "header: %02X %02X", header[0], header[1]);
+bool websocket_server_resync() {
+	portENTER_CRITICAL(&websocket_server_mux);
+	bool resync = websocket_server_resync_needed;
+	websocket_server_resync_needed = false;
+	portEXIT_CRITICAL(&websocket_server_mux);
+	return resync;
+}
+
+/**
+ * Change what a client receives, when the message is a subscription request.
+ * @return False when it is not.
+ */
+static bool websocket_subscribe(websocket_message_t message) {
+	const char *payload = (const char *) &message.buffer[WEBSOCKET_MESSAGE_OFFSET];
+	websocket_subscription_t subscription;
+	if (message.payload_length == sizeof(WEBSOCKET_SUBSCRIBE) - 1
+			&& memcmp(payload, WEBSOCKET_SUBSCRIBE, message.payload_length) == 0) {
+		subscription = WEBSOCKET_SUBSCRIPTION_JSON;
+	} else if (message.payload_length == sizeof(WEBSOCKET_SUBSCRIBE_BINARY) - 1
+			&& memcmp(payload, WEBSOCKET_SUBSCRIBE_BINARY, message.payload_length) == 0) {
+		subscription = WEBSOCKET_SUBSCRIPTION_BINARY;
+	} else if (message.payload_length == sizeof(WEBSOCKET_UNSUBSCRIBE) - 1
+			&& memcmp(payload, WEBSOCKET_UNSUBSCRIBE, message.payload_length) == 0) {
+		subscription = WEBSOCKET_SUBSCRIPTION_NONE;
 	} else {
-		// mask = false 0x00, payload_length > 7 bits
-		header[1] = 126;
-		// payload_length = 16 bits
-		header[2] = (payload_length >> 8) & 0xFF;
-		header[3] = payload_length & 0xFF;
-		header_length = 4;
-		ESP_LOGD(TAG, "header: %02X %02X %02X %02X", header[0], header[1], header[2], header[3]);
+		return false;
 	}
-	ESP_LOGD(TAG, "data: %u %.*s", payload_length, payload_length, payload);
+	websocket_client_t *client = &websocket_server_clients[message.client];
+	portENTER_CRITICAL(&websocket_server_mux);
+	if (client->id == message.client_id) {
+		client->subscription = subscription;
+		// a new subscriber needs everything, not only the changes
+		websocket_server_resync_needed = true;
+	}
+	portEXIT_CRITICAL(&websocket_server_mux);
+	ESP_LOGI(TAG, "client %u subscription: %d", message.client, subscription);
+	return true;
+}
+
+uint8_t websocket_server_clients_connected() {
+	uint8_t connected = 0;
+	for (uint8_t index = 0; index < websocket_server_max_clients; index++) {
+		// a snapshot, no need to lock
+		if (websocket_server_clients[index].conn != NULL) {
+			connected++;
+		}
+	}
+	return connected;
+}
 
-	err_t err = netconn_write(connection, header, header_length, NETCONN_COPY | NETCONN_MORE);
-	if (err == ERR_OK) {
-		err = netconn_write(connection, payload, payload_length, NETCONN_COPY);
+bool websocket_server_get_statistics(uint8_t index, websocket_client_statistics_t *statistics) {
+	if (websocket_server_clients == NULL || index >= websocket_server_max_clients) {
+		return false;
 	}
+	websocket_client_t *client = &websocket_server_clients[index];
+	portENTER_CRITICAL(&websocket_server_mux);
+	statistics->connected = client->conn != NULL;
+	statistics->queue_depth = client->send_count;
+	statistics->sent_count = client->sent_count;
+	statistics->drop_count = client->drop_count;
+	statistics->coalesce_count = client->coalesce_count;
+	statistics->lag_count = client->lag_count;
+	portEXIT_CRITICAL(&websocket_server_mux);
+	return true;
+}
 
-	if (err != ERR_OK) {
-		ESP_LOGE(TAG, "error: %d", err);
+/**
+ * Write the frames queued for a client, until the queue is empty.
+ */
+static void websocket_client_send_queued(uint8_t index) {
+	websocket_client_t *client = &websocket_server_clients[index];
+	websocket_send_t send;
+	while (websocket_client_next(index, &send)) {
+		err_t err = websocket_client_write(index, send.client_id, send.frame, send.frame_length);
+		portENTER_CRITICAL(&websocket_server_mux);
+		if (err == ERR_OK) {
+			client->sent_count++;
+		} else if (err != ERR_CONN && send.client_id == client->id) {
+			// too slow to take the frame, or gone
+			websocket_client_lag_locked(client);
+		}
+		portEXIT_CRITICAL(&websocket_server_mux);
+		websocket_buffer_release(send.buffer);
 	}
-	ESP_LOGD(TAG, "<write_text");
-	return err;
+}
+
+/**
+ * FreeRTOS WebSocket sender task, drains the send queue of a client.
+ * @param pvParameters Index of the client.
+ */
+static void websocket_sender_task(void *pvParameters) {
+	uint8_t index = (uint8_t) (uintptr_t) pvParameters;
+	ESP_LOGD(TAG, ">websocket_sender_task %u", index);
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		websocket_client_send_queued(index);
+	}
+	// should never be reached
+}
+
+/**
+ * FreeRTOS WebSocket worker task, serves accepted connections one at a time.
+ * @param pvParameters Index of the client state owned by this worker.
+ */
+static void websocket_worker_task(void *pvParameters) {
+	uint8_t index = (uint8_t) (uintptr_t) pvParameters;
+	ESP_LOGD(TAG, ">websocket_worker_task %u", index);
+	struct netconn *conn;
+	while (1) {
+		if (xQueueReceive(websocket_server_accept_queue, &conn, portMAX_DELAY) == pdTRUE) {
+			websocket_lifecycle(index, conn);
+			netconn_close(conn);
+			netconn_delete(conn);
+			portENTER_CRITICAL(&websocket_server_mux);
+			websocket_server_connections--;
+			portEXIT_CRITICAL(&websocket_server_mux);
+		}
+	}
+	// should never be reached
+}
+
+/**
+ * Hand over an accepted connection to a worker, refuse it when all are busy.
+ */
+static void websocket_server_dispatch(struct netconn *conn) {
+	bool accepted = false;
+	portENTER_CRITICAL(&websocket_server_mux);
+	if (websocket_server_connections < websocket_server_max_clients) {
+		websocket_server_connections++;
+		accepted = true;
+	}
+	portEXIT_CRITICAL(&websocket_server_mux);
+	if (!accepted) {
+		ESP_LOGW(TAG, "client limit reached: %u", websocket_server_max_clients);
+		netconn_write(conn, HTTP_SERVICE_UNAVAILABLE, sizeof(HTTP_SERVICE_UNAVAILABLE) - 1, NETCONN_NOCOPY);
+		netconn_close(conn);
+		netconn_delete(conn);
+		return;
+	}
+	// there is a worker for every connection allowed, this does not block
+	assert(xQueueSendToBack(websocket_server_accept_queue, &conn, 0) == pdTRUE);
+}
+
+static bool websocket_answer_output(void *context, const char *data, uint32_t length, bool more) {
+	websocket_answer_t *answer = (websocket_answer_t *) context;
+	if (answer->length + length > answer->size) {
+		return false;
+	}
+	memcpy(&answer->out[answer->length], data, length);
+	answer->length += length;
+	return true;
+}
+
+/**
+ * Execute a control command and answer the result in the same buffer, the
+ * command is parsed before it is overwritten.
+ */
+static void websocket_command(websocket_message_t message) {
+	char *payload = (char *) &message.buffer[WEBSOCKET_MESSAGE_OFFSET];
+	control_command_t command;
+	control_result_t result = control_parse(payload, message.payload_length, message.received_us, &command);
+	bool understood = (result == CONTROL_OK || result == CONTROL_INVALID);
+	if (result == CONTROL_OK) {
+		result = control_execute(websocket_server_control_handle, &command);
+	} else {
+		control_refused(websocket_server_control_handle);
+	}
+	websocket_answer_t answer;
+	answer.out = payload;
+	answer.size = websocket_server_message_max_length;
+	answer.length = 0;
+	json_writer_t writer;
+	json_writer_start(&writer, false, websocket_answer_output, &answer);
+	control_write_result(&writer, understood ? &command : NULL, result);
+	if (json_writer_finish(&writer)) {
+		message.payload_length = answer.length;
+		queue_text(message);
+	}
+}
+
+/**
+ * FreeRTOS WebSocket process task, answers the messages received.
+ */
+static void websocket_process_task(void *pvUnused) {
+	ESP_LOGI(TAG, ">websocket_process_task");
+
+	websocket_message_t message;
+
+	while (1) {
+		// get message from queue
+		if (xQueueReceive(websocket_server_receive_queue, &message, portMAX_DELAY) == pdTRUE) {
+
+			// other messages are commands
+			if (!websocket_subscribe(message)) {
+				websocket_command(message);
+			}
+
+			// the send queue holds its own reference
+			websocket_buffer_release(message.buffer);
+		}
+	}
+	// should never be reached
+}
+
+/**
+ * Message buffers, the receive queue and the client state, without tasks.
+ */
+static void websocket_server_state_create() {
+	// all message buffers are allocated once, with room for the frame header
+	message_pool_config_t pool_config;
+	pool_config.count = websocket_server_max_clients + websocket_server_message_buffers;
+	pool_config.size = WEBSOCKET_MESSAGE_OFFSET + websocket_server_message_max_length;
+	message_pool_begin(pool_config, &websocket_server_message_pool);
+	websocket_server_receive_queue = xQueueCreate(pool_config.count, sizeof(websocket_message_t));
+	assert(websocket_server_receive_queue != NULL);
+	websocket_server_clients = calloc(websocket_server_max_clients, sizeof(websocket_client_t));
+	assert(websocket_server_clients != NULL);
+	for (uint8_t index = 0; index < websocket_server_max_clients; index++) {
+		websocket_server_clients[index].mutex = xSemaphoreCreateMutex();
+		assert(websocket_server_clients[index].mutex != NULL);
+		websocket_server_clients[index].sends = calloc(websocket_server_send_queue_length, sizeof(websocket_send_t));
+		assert(websocket_server_clients[index].sends != NULL);
+	}
+}
+
+static void websocket_server_workers_create() {
+	ESP_LOGD(TAG, ">websocket_server_workers_create");
+	websocket_server_accept_queue = xQueueCreate(websocket_server_max_clients, sizeof(struct netconn *));
+	assert(websocket_server_accept_queue != NULL);
+	TaskHandle_t task;
+	for (uint8_t index = 0; index < websocket_server_max_clients; index++) {
+		char name[configMAX_TASK_NAME_LEN];
+		snprintf(name, sizeof(name), "websocket_tx_%u", index);
+		xTaskCreate(&websocket_sender_task, name, 3072, (void *) (uintptr_t) index, 1,
+				&websocket_server_clients[index].sender);
+		if (websocket_server_metrics_handle != NULL) {
+			metrics_add_task(websocket_server_metrics_handle, websocket_server_clients[index].sender);
+		}
+		snprintf(name, sizeof(name), "websocket_%u", index);
+		xTaskCreate(&websocket_worker_task, name, 4096, (void *) (uintptr_t) index, 1, &task);
+		if (websocket_server_metrics_handle != NULL) {
+			metrics_add_task(websocket_server_metrics_handle, task);
+		}
+	}
+	// created after the queues it uses
+	xTaskCreatePinnedToCore(&websocket_process_task, "websocket_process_task", 4096, NULL, 1, &task, 1);
+	if (websocket_server_metrics_handle != NULL) {
+		metrics_add_task(websocket_server_metrics_handle, task);
+	}
+	ESP_LOGD(TAG, "<websocket_server_workers_create");
+}
+
+void websocket_server_loopback_begin(uint32_t message_max_length, uint8_t *out, uint32_t size) {
+	ESP_LOGD(TAG, ">websocket_server_loopback_begin");
+	assert(websocket_server_clients == NULL);
+	websocket_server_max_clients = 1;
+	websocket_server_message_max_length = message_max_length;
+	websocket_server_message_buffers = 2;
+	websocket_server_send_queue_length = 4;
+	websocket_server_lag_timeout_ms = 1000;
+	websocket_server_state_create();
+	websocket_server_loopback_out.out = out;
+	websocket_server_loopback_out.size = size;
+	websocket_server_loopback_out.length = 0;
+	websocket_client_t *client = &websocket_server_clients[0];
+	client->loopback = &websocket_server_loopback_out;
+	// the queue notifies the sender, here that is the caller
+	client->sender = xTaskGetCurrentTaskHandle();
+	client->buffer = websocket_buffer_take(0);
+	assert(client->buffer != NULL);
+	websocket_frame_reset(&client->parser, &client->buffer[WEBSOCKET_MESSAGE_OFFSET], message_max_length);
+	client->conn = &websocket_server_loopback_conn;
+	client->id = ++websocket_server_next_id;
+	ESP_LOGD(TAG, "<websocket_server_loopback_begin");
+}
+
+uint32_t websocket_server_loopback(const uint8_t *data, uint32_t length) {
+	websocket_client_t *client = &websocket_server_clients[0];
+	while (length > 0) {
+		// as the worker does, a close ends a real connection but the loopback client stays
+		websocket_frame_result_t result;
+		uint32_t consumed = websocket_frame_parse(&client->parser, data, length, &result);
+		data += consumed;
+		length -= consumed;
+		websocket_client_receive(0, result);
+		// as the process task does, with an echo in place of the answer
+		websocket_message_t message;
+		while (xQueueReceive(websocket_server_receive_queue, &message, 0) == pdTRUE) {
+			queue_text(message);
+			websocket_buffer_release(message.buffer);
+		}
+		// as the sender does
+		websocket_client_send_queued(0);
+	}
+	ulTaskNotifyTake(pdTRUE, 0);
+	return client->loopback->length;
+}
+
+void websocket_server_loopback_end() {
+	ESP_LOGD(TAG, ">websocket_server_loopback_end");
+	websocket_client_t *client = &websocket_server_clients[0];
+	websocket_client_disconnect(0);
+	websocket_buffer_release(client->buffer);
+	vQueueDelete(websocket_server_receive_queue);
+	message_pool_end(websocket_server_message_pool);
+	vSemaphoreDelete(client->mutex);
+	free(client->sends);
+	free(websocket_server_clients);
+	websocket_server_clients = NULL;
+	ESP_LOGD(TAG, "<websocket_server_loopback_end");
+}
+
+void websocket_server_begin(websocket_server_config_t config) {
+	ESP_LOGD(TAG, ">websocket_server_begin");
+	assert(websocket_server_clients == NULL);
+	websocket_server_port = config.port;
+	websocket_server_max_clients = config.max_clients;
+	websocket_server_message_max_length = config.message_max_length;
+	websocket_server_message_buffers = config.message_buffers;
+	websocket_server_send_queue_length = config.send_queue_length;
+	websocket_server_lag_timeout_ms = config.lag_timeout_ms;
+	websocket_server_metrics_handle = config.metrics_handle;
+	websocket_server_control_handle = config.control_handle;
+	ESP_LOGD(TAG, "websocket_server_port: %u", websocket_server_port);
+	ESP_LOGD(TAG, "websocket_server_max_clients: %u", websocket_server_max_clients);
+	ESP_LOGD(TAG, "websocket_server_message_max_length: %u", websocket_server_message_max_length);
+	ESP_LOGD(TAG, "websocket_server_message_buffers: %u", websocket_server_message_buffers);
+	ESP_LOGD(TAG, "websocket_server_send_queue_length: %u", websocket_server_send_queue_length);
+	ESP_LOGD(TAG, "websocket_server_lag_timeout_ms: %u", websocket_server_lag_timeout_ms);
+	ESP_LOGD(TAG, "websocket_server_metrics_handle: %p", websocket_server_metrics_handle);
+	ESP_LOGD(TAG, "websocket_server_control_handle: %p", websocket_server_control_handle);
+	assert(websocket_server_max_clients > 0);
+	assert(websocket_server_send_queue_length > 0);
+	// before any task publishes
+	websocket_server_state_create();
+	ESP_LOGD(TAG, "<websocket_server_begin");
 }
 
 void websocket_server_task(void *pvParameters) {
 	ESP_LOGI(TAG, ">websocket_server_task");
 
-	websocket_server_config_t *config = (websocket_server_config_t *) pvParameters;
-	websocket_server_port = config->port;
-	ESP_LOGD(TAG, "websocket_server_port: %u", websocket_server_port);
+	assert(websocket_server_clients != NULL);
+	websocket_server_workers_create();
 
 	err_t err;
 	struct netconn *listening_conn = netconn_new(NETCONN_TCP);
@@ -321,9 +1070,7 @@ void websocket_server_task(void *pvParameters) {
 					if (err != ERR_OK) {
 						ESP_LOGE(TAG, "netconn_accept error: %d", err)
 					} else {
-						websocket_lifecycle(accepted_conn);
-						netconn_close(accepted_conn);
-						netconn_delete(accepted_conn);
+						websocket_server_dispatch(accepted_conn);
 					}
 				} while (err == ERR_OK);
 				netconn_close(listening_conn);
@@ -333,27 +1080,3 @@ void websocket_server_task(void *pvParameters) {
 	}
 	ESP_LOGE(TAG, "<websocket_server_task");
 }
-
-void websocket_process_task(void *pvUnused) {
-	ESP_LOGI(TAG, ">websocket_process_task");
-
-	websocket_frame_t frame;
-
-	websocket_server_receive_queue = xQueueCreate(10, sizeof(websocket_frame_t));
-
-	while (1) {
-		// get frame from queue
-		if (xQueueReceive(websocket_server_receive_queue, &frame, 3 * portTICK_PERIOD_MS) == pdTRUE) {
-
-			// echo frame to client (text, not masked, can be logged)
-			ESP_LOGD(TAG, "process length: %u, data:%.*s", frame.payload_length, frame.payload_length, frame.payload);
-			write_text(frame);
-
-			// free payload in frame
-			if (frame.payload != NULL) {
-				free(frame.payload);
-				frame.payload = NULL;
-			}
-		}
-	}
-}
@@ -0,0 +1,144 @@
+// The author disclaims copyright to this source code.
+#include "www_archive.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "www_archive";
+
+/** Partition type of the archive, see partitions.csv. */
+#define WWW_ARCHIVE_PARTITION_TYPE (0x40)
+#define WWW_ARCHIVE_PARTITION_SUBTYPE (0x00)
+
+uint32_t www_archive_hash(const char *text) {
+	uint32_t hash = 0x811c9dc5;
+	while (*text != 0) {
+		hash = (hash ^ (uint8_t) *text++) * 0x01000193;
+	}
+	return hash;
+}
+
+bool www_archive_find(www_archive_handle_t handle, const char *path, www_asset_t *asset) {
+	uint32_t hash = www_archive_hash(path);
+	uint32_t mask = handle->header->slots - 1;
+	for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+		uint16_t index = handle->slots[slot];
+		if (index == WWW_ARCHIVE_EMPTY) {
+			return false;
+		}
+		const www_archive_entry_t *entry = &handle->entries[index];
+		if (entry->hash == hash && strcmp((const char *) &handle->archive[entry->path], path) == 0) {
+			asset->path = (const char *) &handle->archive[entry->path];
+			asset->etag = (const char *) &handle->archive[entry->etag];
+			asset->content = &handle->archive[entry->content];
+			asset->content_length = entry->content_length;
+			asset->header_200 = (const char *) &handle->archive[entry->header_200];
+			asset->header_200_length = entry->header_200_length;
+			asset->header_304 = (const char *) &handle->archive[entry->header_304];
+			asset->header_304_length = entry->header_304_length;
+			return true;
+		}
+	}
+}
+
+/**
+ * @return True when the range lies within the archive, without overflow.
+ */
+static bool www_archive_in(uint32_t offset, uint32_t length, uint32_t size) {
+	return offset <= size && length <= size - offset;
+}
+
+bool www_archive_is_valid(const uint8_t *archive, uint32_t size) {
+	if (size < sizeof(www_archive_header_t)) {
+		return false;
+	}
+	const www_archive_header_t *header = (const www_archive_header_t *) archive;
+	if (header->magic != WWW_ARCHIVE_MAGIC || header->version != WWW_ARCHIVE_VERSION || header->size > size
+			|| header->size < sizeof(www_archive_header_t)) {
+		return false;
+	}
+	// every bound is checked before it is multiplied, nothing wraps
+	uint32_t room = header->size - sizeof(www_archive_header_t);
+	uint32_t slots = header->slots;
+	if (slots == 0 || slots > room / 2 || (slots & (slots - 1)) != 0) {
+		return false;
+	}
+	if (header->count >= slots || header->count >= WWW_ARCHIVE_EMPTY) {
+		// there must be an empty slot to end a search
+		return false;
+	}
+	uint32_t table_size = (2 * slots + 3) & ~3;
+	if (table_size > room || header->count > (room - table_size) / sizeof(www_archive_entry_t)) {
+		return false;
+	}
+	const uint16_t *table = (const uint16_t *) &archive[sizeof(www_archive_header_t)];
+	for (uint32_t slot = 0; slot < slots; slot++) {
+		if (table[slot] != WWW_ARCHIVE_EMPTY && table[slot] >= header->count) {
+			return false;
+		}
+	}
+	const www_archive_entry_t *entries = (const www_archive_entry_t *) &archive[sizeof(www_archive_header_t)
+			+ table_size];
+	for (uint32_t index = 0; index < header->count; index++) {
+		const www_archive_entry_t *entry = &entries[index];
+		if (entry->path >= header->size || entry->etag >= header->size
+				|| !www_archive_in(entry->content, entry->content_length, header->size)
+				|| !www_archive_in(entry->header_200, entry->header_200_length, header->size)
+				|| !www_archive_in(entry->header_304, entry->header_304_length, header->size)
+				|| memchr(&archive[entry->path], 0, header->size - entry->path) == NULL
+				|| memchr(&archive[entry->etag], 0, header->size - entry->etag) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+esp_err_t www_archive_begin(www_archive_config_t config, www_archive_handle_t *handle) {
+	ESP_LOGD(TAG, ">www_archive_begin");
+	ESP_LOGD(TAG, "label: %s", config.label);
+
+	const esp_partition_t *partition = esp_partition_find_first(WWW_ARCHIVE_PARTITION_TYPE,
+			WWW_ARCHIVE_PARTITION_SUBTYPE, config.label);
+	if (partition == NULL) {
+		ESP_LOGE(TAG, "partition not found: %s", config.label);
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	const void *archive;
+	spi_flash_mmap_handle_t mmap_handle;
+	esp_err_t err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &archive, &mmap_handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_partition_mmap error: %d", err);
+		return err;
+	}
+	if (!www_archive_is_valid(archive, partition->size)) {
+		ESP_LOGE(TAG, "no valid archive in partition: %s (make www-flash)", config.label);
+		spi_flash_munmap(mmap_handle);
+		return ESP_ERR_INVALID_VERSION;
+	}
+
+	www_archive_handle_t www_archive_handle = malloc(sizeof(struct www_archive_t));
+	assert(www_archive_handle != NULL);
+	www_archive_handle->mmap_handle = mmap_handle;
+	www_archive_handle->archive = archive;
+	www_archive_handle->header = archive;
+	www_archive_handle->slots = (const uint16_t *) &www_archive_handle->archive[sizeof(www_archive_header_t)];
+	www_archive_handle->entries = (const www_archive_entry_t *) &www_archive_handle->archive[sizeof(www_archive_header_t)
+			+ ((2 * www_archive_handle->header->slots + 3) & ~3)];
+	ESP_LOGI(TAG, "assets: %u, size: %u", www_archive_handle->header->count, www_archive_handle->header->size);
+
+	*handle = www_archive_handle;
+
+	ESP_LOGD(TAG, "<www_archive_begin");
+	return ESP_OK;
+}
+
+void www_archive_end(www_archive_handle_t handle) {
+	ESP_LOGD(TAG, ">www_archive_end");
+	spi_flash_munmap(handle->mmap_handle);
+	handle->archive = NULL;
+	free(handle);
+	ESP_LOGD(TAG, "<www_archive_end");
+}
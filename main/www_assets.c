@@ -0,0 +1,22 @@
+// The author disclaims copyright to this source code.
+#include "www_assets.h"
+#include <string.h>
+#include "sdkconfig.h"
+
+#if CONFIG_WEB_SERVER_ASSETS_EMBEDDED
+// generated, see component.mk
+#include "www_assets_data.h"
+
+static const www_asset_t www_assets[] = WWW_ASSETS_TABLE;
+
+#define WWW_ASSETS_COUNT (sizeof(www_assets) / sizeof(www_assets[0]))
+
+const www_asset_t *www_assets_find(const char *path) {
+	for (int i = 0; i < WWW_ASSETS_COUNT; i++) {
+		if (strcmp(www_assets[i].path, path) == 0) {
+			return &www_assets[i];
+		}
+	}
+	return NULL;
+}
+#endif
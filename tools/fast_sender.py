@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+# The author disclaims copyright to this source code.
+"""
+Fast sender, a radio station stand-in that sends as fast as it can.
+
+Runs on the host. Serves an endless stream (an MP3 file in a loop, or
+silent MPEG frames) without pacing, like a server burst that never ends.
+Point a favorite of the radio at it (http://host:8000/) and select it.
+
+With flow control the radio stops receiving when its buffer is full: the
+TCP window closes and sends block here. The sender settles at the play
+rate, the radio drops nothing and lwIP never runs out of pbufs. Reports
+the rate sent and the time sends were blocked each interval, and when the
+radio is given, its throttled time, dropped bytes and pbuf pool minimum
+from /metrics.
+
+    tools/fast_sender.py --radio net-radio.local
+"""
+
+import argparse
+import http.client
+import select
+import socket
+import time
+
+# MPEG 1 layer III, 128kbps, 44100Hz, no padding: 417 bytes of silence
+SILENT_FRAME = bytes([0xFF, 0xFB, 0x90, 0x00]) + bytes(417 - 4)
+
+METRICS = [
+    "netradio_reader_throttled_seconds_total",
+    "netradio_reader_throttles_total",
+    "netradio_buffer_overflow_bytes_total",
+    "netradio_lwip_pbuf_pool_minimum_free",
+]
+
+
+def radio_metrics(host, port):
+    """Selected metrics, empty when not available."""
+    try:
+        conn = http.client.HTTPConnection(host, port, timeout=10)
+        conn.request("GET", "/metrics")
+        text = conn.getresponse().read().decode("utf-8")
+        conn.close()
+    except (OSError, http.client.HTTPException):
+        return {}
+    values = {}
+    for line in text.splitlines():
+        parts = line.split()
+        if len(parts) == 2 and parts[0] in METRICS:
+            values[parts[0]] = float(parts[1])
+    return values
+
+
+def serve(client, data, args):
+    request = b""
+    while b"\r\n\r\n" not in request:
+        part = client.recv(1024)
+        if not part:
+            return
+        request += part
+    client.sendall(b"ICY 200 OK\r\ncontent-type: audio/mpeg\r\nicy-name: fast sender\r\n\r\n")
+    client.setblocking(False)
+    offset = 0
+    sent = 0
+    blocked = 0.0
+    start = time.monotonic()
+    while True:
+        chunk = data[offset:offset + 4096]
+        if len(chunk) < 4096:
+            chunk += data[:4096 - len(chunk)]
+        try:
+            length = client.send(chunk)
+            offset = (offset + length) % len(data)
+            sent += length
+        except BlockingIOError:
+            wait = time.monotonic()
+            select.select([], [client], [], 1.0)
+            blocked += time.monotonic() - wait
+        except OSError:
+            print("disconnected")
+            return
+        elapsed = time.monotonic() - start
+        if elapsed >= args.interval:
+            line = "sent %8.1f kB/s, blocked %5.1f%%" % (sent / elapsed / 1000, 100 * blocked / elapsed)
+            if args.radio:
+                metrics = radio_metrics(args.radio, args.http_port)
+                line += ", radio: " + ", ".join("%s %g" % (name[len("netradio_"):], metrics[name])
+                                                 for name in METRICS if name in metrics)
+            print(line)
+            sent = 0
+            blocked = 0.0
+            start = time.monotonic()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Fast sender, a radio station stand-in without pacing")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--file", help="MP3 file to send in a loop, silent frames when not given")
+    parser.add_argument("--radio", help="radio host name or address, for /metrics")
+    parser.add_argument("--http-port", type=int, default=80, help="web server port of the radio")
+    parser.add_argument("--interval", type=float, default=5.0, help="seconds per report")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = SILENT_FRAME * 64
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("", args.port))
+    server.listen(1)
+    print("listening on port %d" % args.port)
+    while True:
+        client, address = server.accept()
+        print("connected: %s:%d" % address)
+        serve(client, data, args)
+        client.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+# The author disclaims copyright to this source code.
+"""
+Mirror stand-in, a radio station with a playlist of mirrors on the host.
+
+Serves a playlist (/radio.pls or /radio.m3u) of mirrors on the following
+ports. Every mirror sends an endless stream (an MP3 file in a loop, or
+silent MPEG frames) paced at the bitrate, the first one slower (--slow) so
+the buffer of the radio drains. Point a favorite of the radio at the
+playlist and select it: it starts on the first mirror and has to fail over
+to another one before the buffer runs empty.
+
+Reports every connection and when the radio is given, its failovers and
+the buffered play time at the last one from /metrics.
+
+    tools/mirror_stand_in.py --host 192.168.1.10 --radio net-radio.local
+"""
+
+import argparse
+import http.client
+import socket
+import threading
+import time
+
+# MPEG 1 layer III, 128kbps, 44100Hz, no padding: 417 bytes of silence
+SILENT_FRAME = bytes([0xFF, 0xFB, 0x90, 0x00]) + bytes(417 - 4)
+
+METRICS = [
+    "netradio_reader_failovers_total",
+    "netradio_reader_failover_last_buffer_seconds",
+    "netradio_reader_failover_min_buffer_seconds",
+    "netradio_reader_mirror_active",
+    "netradio_buffer_duration_seconds",
+]
+
+
+def radio_metrics(host, port):
+    """Selected metrics, empty when not available."""
+    try:
+        conn = http.client.HTTPConnection(host, port, timeout=10)
+        conn.request("GET", "/metrics")
+        text = conn.getresponse().read().decode("utf-8")
+        conn.close()
+    except (OSError, http.client.HTTPException):
+        return {}
+    values = {}
+    for line in text.splitlines():
+        parts = line.split()
+        if len(parts) == 2 and parts[0] in METRICS:
+            values[parts[0][len("netradio_"):]] = float(parts[1])
+    return values
+
+
+def read_request(client):
+    request = b""
+    while b"\r\n\r\n" not in request:
+        part = client.recv(1024)
+        if not part:
+            return None
+        request += part
+    return request.split(b" ")[1].decode("utf-8", "replace")
+
+
+def playlist(args):
+    urls = ["http://%s:%d/stream" % (args.host, args.port + 1 + i) for i in range(args.mirrors)]
+    pls = "[playlist]\nNumberOfEntries=%d\n" % len(urls)
+    for i, url in enumerate(urls):
+        pls += "File%d=%s\nTitle%d=mirror %d\n" % (i + 1, url, i + 1, i)
+    m3u = "#EXTM3U\n" + "".join("#EXTINF:-1,mirror %d\n%s\n" % (i, url) for i, url in enumerate(urls))
+    return pls, m3u
+
+
+def serve_playlist(args):
+    pls, m3u = playlist(args)
+    server = socket.create_server(("", args.port), reuse_port=True)
+    print("playlist on port %d: /radio.pls /radio.m3u" % args.port)
+    while True:
+        client, address = server.accept()
+        path = read_request(client)
+        if path is not None:
+            if path.endswith(".m3u"):
+                body, content_type = m3u, "audio/x-mpegurl"
+            else:
+                body, content_type = pls, "audio/x-scpls"
+            client.sendall(("HTTP/1.0 200 OK\r\ncontent-type: %s\r\ncontent-length: %d\r\n\r\n%s"
+                            % (content_type, len(body), body)).encode("utf-8"))
+            print("playlist: %s:%d %s" % (address[0], address[1], path))
+        client.close()
+
+
+def serve_mirror(index, data, args):
+    # the first mirror is the slow one
+    rate = args.bitrate * (args.slow if index == 0 else 1.0)
+    server = socket.create_server(("", args.port + 1 + index), reuse_port=True)
+    while True:
+        client, address = server.accept()
+        print("mirror %d: %s:%d at %.0f kbit/s" % (index, address[0], address[1], rate))
+        start = time.monotonic()
+        try:
+            if read_request(client) is not None:
+                client.sendall(b"ICY 200 OK\r\ncontent-type: audio/mpeg\r\nicy-name: mirror stand-in\r\n\r\n")
+                # pace at the rate, 8 frames at a time
+                chunk = 8 * len(SILENT_FRAME)
+                interval = chunk * 8 / (rate * 1000)
+                offset = 0
+                sent = 0
+                while True:
+                    part = data[offset:offset + chunk]
+                    if len(part) < chunk:
+                        part += data[:chunk - len(part)]
+                    offset = (offset + chunk) % len(data)
+                    client.sendall(part)
+                    sent += 1
+                    delay = start + sent * interval - time.monotonic()
+                    if delay > 0:
+                        time.sleep(delay)
+        except OSError:
+            pass
+        client.close()
+        print("mirror %d: closed after %.0f s" % (index, time.monotonic() - start))
+        if args.radio:
+            metrics = radio_metrics(args.radio, args.http_port)
+            for name in sorted(metrics):
+                print("  radio %s %g" % (name, metrics[name]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Mirror stand-in, a playlist of mirrors on the host")
+    parser.add_argument("--host", required=True, help="address of this host, as the radio reaches it")
+    parser.add_argument("--port", type=int, default=8100, help="playlist port, the mirrors on the following ones")
+    parser.add_argument("--mirrors", type=int, default=3)
+    parser.add_argument("--file", help="MP3 file to send in a loop, silent frames when not given")
+    parser.add_argument("--bitrate", type=int, default=128, help="kbit/s of the stream")
+    parser.add_argument("--slow", type=float, default=0.7, help="rate of the first mirror, part of the bitrate")
+    parser.add_argument("--radio", help="radio host name or address, for /metrics")
+    parser.add_argument("--http-port", type=int, default=80, help="web server port of the radio")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = SILENT_FRAME * 64
+
+    for index in range(args.mirrors):
+        threading.Thread(target=serve_mirror, args=(index, data, args), daemon=True).start()
+    serve_playlist(args)
+
+
+if __name__ == "__main__":
+    main()
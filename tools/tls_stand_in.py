@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+# The author disclaims copyright to this source code.
+"""
+TLS stand-in, an https radio station on the host.
+
+Serves an endless stream (an MP3 file in a loop, or silent MPEG frames)
+over TLS 1.2, paced at the bitrate, with session tickets. Point a favorite
+of the radio at it (https://host:8443/) and select it. Without a
+certificate a self-signed one is made (openssl), the radio does not verify
+it.
+
+Drops every connection after a while (--drop) so the radio reconnects:
+the first handshake is full, the reconnects offer the kept session and
+are resumed. Reports each handshake (resumed or not, the time it took
+here) and when the radio is given, its handshake counts and times from
+/metrics.
+
+    tools/tls_stand_in.py --radio net-radio.local --drop 20
+"""
+
+import argparse
+import http.client
+import os
+import socket
+import ssl
+import subprocess
+import tempfile
+import time
+
+# MPEG 1 layer III, 128kbps, 44100Hz, no padding: 417 bytes of silence
+SILENT_FRAME = bytes([0xFF, 0xFB, 0x90, 0x00]) + bytes(417 - 4)
+
+METRICS = [
+    "netradio_stream_tls_handshakes_total",
+    "netradio_stream_tls_handshake_seconds_total",
+    "netradio_stream_tls_errors_total",
+    "netradio_reader_first_byte_last_seconds",
+]
+
+
+def radio_metrics(host, port):
+    """Selected metrics (with their labels), empty when not available."""
+    try:
+        conn = http.client.HTTPConnection(host, port, timeout=10)
+        conn.request("GET", "/metrics")
+        text = conn.getresponse().read().decode("utf-8")
+        conn.close()
+    except (OSError, http.client.HTTPException):
+        return {}
+    values = {}
+    for line in text.splitlines():
+        parts = line.split()
+        if len(parts) == 2 and parts[0].split("{")[0] in METRICS:
+            values[parts[0][len("netradio_"):]] = float(parts[1])
+    return values
+
+
+def self_signed(directory):
+    """Certificate and key files, made with openssl."""
+    cert = os.path.join(directory, "cert.pem")
+    key = os.path.join(directory, "key.pem")
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "1",
+                    "-subj", "/CN=tls-stand-in", "-keyout", key, "-out", cert],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+
+def serve(client, data, args):
+    request = b""
+    while b"\r\n\r\n" not in request:
+        part = client.recv(1024)
+        if not part:
+            return
+        request += part
+    client.sendall(b"ICY 200 OK\r\ncontent-type: audio/mpeg\r\nicy-name: tls stand-in\r\n\r\n")
+    # pace at the bitrate, 8 frames at a time
+    chunk = 8 * len(SILENT_FRAME)
+    interval = chunk * 8 / (args.bitrate * 1000)
+    offset = 0
+    start = time.monotonic()
+    sent = 0
+    while args.drop <= 0 or time.monotonic() - start < args.drop:
+        part = data[offset:offset + chunk]
+        if len(part) < chunk:
+            part += data[:chunk - len(part)]
+        offset = (offset + chunk) % len(data)
+        client.sendall(part)
+        sent += 1
+        delay = start + sent * interval - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+    print("dropped after %.0f s" % (time.monotonic() - start))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="TLS stand-in, an https radio station on the host")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--file", help="MP3 file to send in a loop, silent frames when not given")
+    parser.add_argument("--cert", help="certificate (PEM), self-signed when not given")
+    parser.add_argument("--key", help="key of the certificate (PEM)")
+    parser.add_argument("--bitrate", type=int, default=128, help="kbit/s to send at")
+    parser.add_argument("--drop", type=float, default=30.0, help="seconds per connection, 0 to keep it")
+    parser.add_argument("--radio", help="radio host name or address, for /metrics")
+    parser.add_argument("--http-port", type=int, default=80, help="web server port of the radio")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = SILENT_FRAME * 64
+
+    directory = tempfile.TemporaryDirectory()
+    cert, key = (args.cert, args.key) if args.cert else self_signed(directory.name)
+    # one context for all connections, its ticket key resumes the sessions
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    context.load_cert_chain(cert, key)
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("", args.port))
+    server.listen(1)
+    print("listening on port %d" % args.port)
+    while True:
+        client, address = server.accept()
+        start = time.monotonic()
+        try:
+            tls = context.wrap_socket(client, server_side=True)
+        except (ssl.SSLError, OSError) as e:
+            print("handshake failed: %s:%d %s" % (address[0], address[1], e))
+            client.close()
+            continue
+        duration = time.monotonic() - start
+        print("connected: %s:%d %s %s, %s in %.0f ms" % (address[0], address[1], tls.version(), tls.cipher()[0],
+                                                         "resumed" if tls.session_reused else "full",
+                                                         duration * 1000))
+        try:
+            serve(tls, data, args)
+        except OSError:
+            print("disconnected")
+        tls.close()
+        if args.radio:
+            metrics = radio_metrics(args.radio, args.http_port)
+            for name in sorted(metrics):
+                print("  radio %s %g" % (name, metrics[name]))
+
+
+if __name__ == "__main__":
+    main()
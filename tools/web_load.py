@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# The author disclaims copyright to this source code.
+"""
+Web server load test.
+
+Runs on the host against the radio on the network. For each number of
+concurrent clients, every client requests the pages in turn on a new
+connection for the given duration. Reports requests per second, refused
+requests (503) and latency percentiles.
+
+    tools/web_load.py net-radio.local --paths / /jquery-3.2.1.slim.min.js
+"""
+
+import argparse
+import http.client
+import threading
+import time
+
+
+def client(host, port, paths, deadline, latencies, statuses, lock):
+    index = 0
+    while time.monotonic() < deadline:
+        path = paths[index % len(paths)]
+        index += 1
+        start = time.monotonic()
+        try:
+            conn = http.client.HTTPConnection(host, port, timeout=10)
+            conn.request("GET", path)
+            response = conn.getresponse()
+            response.read()
+            status = response.status
+            conn.close()
+        except (OSError, http.client.HTTPException):
+            status = 0
+        elapsed = time.monotonic() - start
+        with lock:
+            latencies.append(elapsed)
+            statuses[status] = statuses.get(status, 0) + 1
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def run(host, port, paths, clients, duration):
+    latencies = []
+    statuses = {}
+    lock = threading.Lock()
+    deadline = time.monotonic() + duration
+    threads = [threading.Thread(target=client, args=(host, port, paths, deadline, latencies, statuses, lock))
+               for _ in range(clients)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    latencies.sort()
+    ok = statuses.get(200, 0)
+    print("clients %2d: %6.1f req/s, %5d ok, %4d refused, %4d failed, "
+          "latency p50 %6.1f ms, p95 %6.1f ms, p99 %6.1f ms, max %6.1f ms" % (
+              clients, len(latencies) / duration, ok, statuses.get(503, 0),
+              len(latencies) - ok - statuses.get(503, 0),
+              1000 * percentile(latencies, 0.50), 1000 * percentile(latencies, 0.95),
+              1000 * percentile(latencies, 0.99), 1000 * (latencies[-1] if latencies else 0)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Web server load test")
+    parser.add_argument("host", help="radio host name or address")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--paths", nargs="+", default=["/", "/title"])
+    parser.add_argument("--clients", type=int, nargs="+", default=[1, 4, 16])
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds per run")
+    args = parser.parse_args()
+    for clients in args.clients:
+        run(args.host, args.port, args.paths, clients, args.duration)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+# The author disclaims copyright to this source code.
+"""
+WebSocket server load test.
+
+Runs on the host against the radio on the network. For each number of
+concurrent clients, every client connects once and sends text messages for
+the given duration, waiting for each answer. Reports messages per second,
+refused connections (503), round trip percentiles and the heap used per
+connection (free heap from /metrics before and while connected).
+
+    tools/websocket_load.py net-radio.local --clients 1 2 3 4
+"""
+
+import argparse
+import base64
+import http.client
+import os
+import socket
+import struct
+import threading
+import time
+
+
+def heap_free(host, port):
+    """Free heap in bytes, None when the metrics are not available."""
+    try:
+        conn = http.client.HTTPConnection(host, port, timeout=10)
+        conn.request("GET", "/metrics")
+        text = conn.getresponse().read().decode("utf-8")
+        conn.close()
+    except (OSError, http.client.HTTPException):
+        return None
+    for line in text.splitlines():
+        if line.startswith("netradio_heap_free_bytes "):
+            return int(line.split()[1])
+    return None
+
+
+def receive_exactly(sock, length):
+    data = b""
+    while len(data) < length:
+        part = sock.recv(length - len(data))
+        if not part:
+            raise OSError("connection closed")
+        data += part
+    return data
+
+
+def connect(host, port):
+    """Open a WebSocket connection, None when refused."""
+    sock = socket.create_connection((host, port), timeout=10)
+    key = base64.b64encode(os.urandom(16)).decode("ascii")
+    sock.sendall(("GET / HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % (host, port, key)).encode("ascii"))
+    response = b""
+    while b"\r\n\r\n" not in response:
+        part = sock.recv(1024)
+        if not part:
+            break
+        response += part
+    if not response.startswith(b"HTTP/1.1 101"):
+        sock.close()
+        return None
+    return sock
+
+
+def send_text(sock, text):
+    payload = text.encode("utf-8")
+    mask = os.urandom(4)
+    masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+    if len(payload) < 126:
+        header = struct.pack("!BB", 0x81, 0x80 | len(payload))
+    else:
+        header = struct.pack("!BBH", 0x81, 0x80 | 126, len(payload))
+    sock.sendall(header + mask + masked)
+
+
+def receive_text(sock):
+    first, second = receive_exactly(sock, 2)
+    length = second & 0x7F
+    if length == 126:
+        length = struct.unpack("!H", receive_exactly(sock, 2))[0]
+    elif length == 127:
+        length = struct.unpack("!Q", receive_exactly(sock, 8))[0]
+    return receive_exactly(sock, length).decode("utf-8", "replace")
+
+
+def client(sock, message, deadline, latencies, lock):
+    try:
+        while time.monotonic() < deadline:
+            start = time.monotonic()
+            send_text(sock, message)
+            receive_text(sock)
+            elapsed = time.monotonic() - start
+            with lock:
+                latencies.append(elapsed)
+    except OSError:
+        pass
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def run(host, port, http_port, message, clients, duration):
+    heap_before = heap_free(host, http_port)
+    socks = []
+    refused = 0
+    for _ in range(clients):
+        try:
+            sock = connect(host, port)
+        except OSError:
+            sock = None
+        if sock is None:
+            refused += 1
+        else:
+            socks.append(sock)
+    heap_connected = heap_free(host, http_port)
+
+    latencies = []
+    lock = threading.Lock()
+    deadline = time.monotonic() + duration
+    threads = [threading.Thread(target=client, args=(sock, message, deadline, latencies, lock)) for sock in socks]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    for sock in socks:
+        sock.close()
+
+    latencies.sort()
+    if heap_before is not None and heap_connected is not None and socks:
+        memory = "%6d bytes/connection" % ((heap_before - heap_connected) // len(socks))
+    else:
+        memory = "memory unknown"
+    print("clients %2d: %7.1f msg/s, %2d connected, %2d refused, "
+          "round trip p50 %6.1f ms, p95 %6.1f ms, max %6.1f ms, %s" % (
+              clients, len(latencies) / duration, len(socks), refused,
+              1000 * percentile(latencies, 0.50), 1000 * percentile(latencies, 0.95),
+              1000 * (latencies[-1] if latencies else 0), memory))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="WebSocket server load test")
+    parser.add_argument("host", help="radio host name or address")
+    parser.add_argument("--port", type=int, default=9998)
+    parser.add_argument("--http-port", type=int, default=80, help="web server port, for /metrics")
+    parser.add_argument("--message", default='{"command":"echo"}')
+    parser.add_argument("--clients", type=int, nargs="+", default=[1, 2, 3, 4])
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds per run")
+    args = parser.parse_args()
+    for clients in args.clients:
+        run(args.host, args.port, args.http_port, args.message, clients, args.duration)
+
+
+if __name__ == "__main__":
+    main()
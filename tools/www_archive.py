@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+# The author disclaims copyright to this source code.
+"""
+Build the web server asset archive, flashed into the www data partition.
+
+Every file is compressed (gzip) with a strong ETag and ready to send
+response headers, like tools/www_assets.py does for embedded assets.
+The layout is described in main/include/www_archive.h, all numbers are
+little endian 32-bit unless stated otherwise:
+
+    header  magic, version, count, slots, size
+    slots   16-bit entry index per hash slot, 0xFFFF when empty
+    entries hash, path, etag, content, content length,
+            header 200, header 200 length, header 304, header 304 length
+    data    zero terminated strings and content
+
+Offsets are relative to the start of the archive. Paths are found by
+FNV-1a hash with linear probing.
+
+    tools/www_archive.py build/www.bin main/index.html=/ main/jquery-3.2.1.slim.min.js \\
+        --immutable "*.min.js"
+"""
+
+import argparse
+import fnmatch
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from www_assets import prepare  # noqa: E402
+
+MAGIC = 0x41575757  # "WWWA"
+VERSION = 1
+HEADER = struct.Struct("<5I")
+ENTRY = struct.Struct("<9I")
+EMPTY = 0xFFFF
+
+CONTENT_TYPES = {
+    ".html": "text/html; charset=utf-8",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".png": "image/png",
+    ".ico": "image/x-icon",
+    ".txt": "text/plain; charset=utf-8",
+}
+
+
+def fnv1a(text):
+    value = 0x811c9dc5
+    for byte in text.encode():
+        value = ((value ^ byte) * 0x01000193) & 0xFFFFFFFF
+    return value
+
+
+def align(data):
+    data.extend(b"\0" * (-len(data) % 4))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build the web server asset archive")
+    parser.add_argument("output", help="archive file")
+    parser.add_argument("files", nargs="+", metavar="FILE[=PATH]", help="file, served as /name unless PATH is given")
+    parser.add_argument("--immutable", action="append", default=[], metavar="GLOB",
+                        help="cache these files for a year (versioned names)")
+    args = parser.parse_args()
+
+    assets = []
+    for argument in args.files:
+        file, _, path = argument.partition("=")
+        name = os.path.basename(file)
+        path = path or "/" + name
+        content_type = CONTENT_TYPES.get(os.path.splitext(name)[1], "application/octet-stream")
+        immutable = any(fnmatch.fnmatch(name, pattern) for pattern in args.immutable)
+        cache_control = "max-age=31536000, immutable" if immutable else "no-cache"
+        with open(file, "rb") as f:
+            assets.append((path,) + prepare(f.read(), content_type, cache_control))
+
+    if len(assets) >= EMPTY:
+        sys.exit("too many files")
+    slots = 1
+    while slots < 2 * len(assets):
+        slots *= 2
+    table = [EMPTY] * slots
+    for index, (path, *_) in enumerate(assets):
+        slot = fnv1a(path) & (slots - 1)
+        while table[slot] != EMPTY:
+            if assets[table[slot]][0] == path:
+                sys.exit("duplicate path: %s" % path)
+            slot = (slot + 1) & (slots - 1)
+        table[slot] = index
+
+    data = bytearray()
+    data_offset = HEADER.size + ((2 * slots + 3) & ~3) + ENTRY.size * len(assets)
+
+    def add(blob):
+        offset = data_offset + len(data)
+        data.extend(blob)
+        align(data)
+        return offset
+
+    entries = bytearray()
+    for path, compressed, etag, header_200, header_304 in assets:
+        entries.extend(ENTRY.pack(fnv1a(path), add(path.encode() + b"\0"), add(etag.encode() + b"\0"),
+                                  add(compressed), len(compressed),
+                                  add(header_200.encode() + b"\0"), len(header_200),
+                                  add(header_304.encode() + b"\0"), len(header_304)))
+        print("%-32s %6d bytes %s" % (path, len(compressed), etag))
+
+    archive = bytearray(HEADER.pack(MAGIC, VERSION, len(assets), slots, data_offset + len(data)))
+    archive.extend(struct.pack("<%dH" % slots, *table))
+    align(archive)
+    archive.extend(entries)
+    archive.extend(data)
+    with open(args.output, "wb") as f:
+        f.write(archive)
+    print("%s: %d files, %d bytes" % (args.output, len(assets), len(archive)))
+
+
+if __name__ == "__main__":
+    main()
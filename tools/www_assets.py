@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# The author disclaims copyright to this source code.
+"""
+Generate the web server assets as a C header.
+
+Every asset is compressed (gzip) and gets a strong ETag (hash of the
+compressed content). The response header blocks are prepared here so the
+web server sends them as they are. Only the Connection header is left
+out, the web server decides about that.
+
+    tools/www_assets.py www_assets_data.h \\
+        --asset / main/index.html "text/html; charset=utf-8" "no-cache"
+"""
+
+import argparse
+import gzip
+import hashlib
+
+
+def c_string(text):
+    return '"' + text.replace("\\", "\\\\").replace('"', '\\"').replace("\r", "\\r").replace("\n", "\\n") + '"'
+
+
+def c_bytes(data):
+    lines = []
+    for offset in range(0, len(data), 16):
+        lines.append("\t" + ", ".join("0x%02x" % b for b in data[offset:offset + 16]) + ",")
+    return "\n".join(lines)
+
+
+def prepare(content, content_type, cache_control):
+    """Compress the content, return (compressed, etag, header_200, header_304)."""
+    # no time stamp, the same input gives the same output (and ETag)
+    compressed = gzip.compress(content, 9, mtime=0)
+    etag = '"%s"' % hashlib.sha256(compressed).hexdigest()[:16]
+    header_200 = ("HTTP/1.1 200 OK\r\n"
+                  "Content-Type: %s\r\n"
+                  "Content-Encoding: gzip\r\n"
+                  "Vary: Accept-Encoding\r\n"
+                  "Cache-Control: %s\r\n"
+                  "ETag: %s\r\n"
+                  "Content-Length: %d\r\n") % (content_type, cache_control, etag, len(compressed))
+    header_304 = ("HTTP/1.1 304 Not Modified\r\n"
+                  "Vary: Accept-Encoding\r\n"
+                  "Cache-Control: %s\r\n"
+                  "ETag: %s\r\n") % (cache_control, etag)
+    return compressed, etag, header_200, header_304
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate web server assets")
+    parser.add_argument("output", help="generated C header")
+    parser.add_argument("--asset", nargs=4, action="append", required=True,
+                        metavar=("PATH", "FILE", "CONTENT_TYPE", "CACHE_CONTROL"))
+    args = parser.parse_args()
+
+    out = ["// Generated by tools/www_assets.py, do not edit.", "#ifndef _WWW_ASSETS_DATA_H_",
+           "#define _WWW_ASSETS_DATA_H_", ""]
+    table = []
+    for index, (path, file, content_type, cache_control) in enumerate(args.asset):
+        with open(file, "rb") as f:
+            content = f.read()
+        compressed, etag, header_200, header_304 = prepare(content, content_type, cache_control)
+        out.append("// %s: %d bytes, gzip %d bytes" % (file.split("/")[-1], len(content), len(compressed)))
+        out.append("static const uint8_t www_asset_%d_content[] = {" % index)
+        out.append(c_bytes(compressed))
+        out.append("};")
+        out.append("static const char www_asset_%d_header_200[] = %s;" % (index, c_string(header_200)))
+        out.append("static const char www_asset_%d_header_304[] = %s;" % (index, c_string(header_304)))
+        out.append("")
+        table.append("\t{ %s, %s, www_asset_%d_content, sizeof(www_asset_%d_content), "
+                     "www_asset_%d_header_200, sizeof(www_asset_%d_header_200) - 1, "
+                     "www_asset_%d_header_304, sizeof(www_asset_%d_header_304) - 1 }, \\"
+                     % ((c_string(path), c_string(etag)) + (index,) * 6))
+    out.append("#define WWW_ASSETS_TABLE { \\")
+    out.extend(table)
+    out.append("}")
+    out.append("")
+    out.append("#endif")
+    with open(args.output, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
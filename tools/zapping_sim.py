@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+# The author disclaims copyright to this source code.
+"""
+Station switch simulation, time to audio.
+
+Runs on the host, no radio needed. Draws network conditions at random and
+compares a cold switch (resolve, connect, request, fill the buffer up to the
+start threshold) with a switch to a prefetched neighbour (take the
+connection, swap the buffer, cancel the decoder). Reports time to audio
+percentiles for both.
+
+A cold switch waits for the server burst (most servers send the first
+seconds at link speed) and then for the stream at its bit rate. A
+prefetched switch finds the latest seconds of the neighbour in its slot,
+it starts right away unless the slot holds less than the start threshold.
+
+    tools/zapping_sim.py --rtt-ms 40 --bitrate 128 --threshold-ms 2000
+"""
+
+import argparse
+import random
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def rtt(args):
+    """Round trip, log-normal around the median with a long tail."""
+    return args.rtt_ms * random.lognormvariate(0, args.rtt_spread)
+
+
+def cancel_ms(args):
+    """Cancel the decoder: end fill bytes over SCI/SDI, at worst a soft reset."""
+    if random.random() < args.cancel_reset:
+        return args.cancel_ms + args.reset_ms
+    return args.cancel_ms
+
+
+def fill_ms(args, needed_bytes):
+    """Receive the start threshold: the burst at link speed, the rest at the bit rate."""
+    link_bytes_ms = args.link_kbps * random.uniform(0.5, 1.0) / 8
+    stream_bytes_ms = args.bitrate / 8
+    burst = min(needed_bytes, args.burst_bytes)
+    return burst / link_bytes_ms + (needed_bytes - burst) / stream_bytes_ms
+
+
+def connect(args):
+    """Resolve, connect, request and fill the buffer up to the start threshold."""
+    threshold_bytes = args.threshold_ms * args.bitrate / 8
+    elapsed = 0.0
+    if random.random() >= args.dns_hit:
+        elapsed += rtt(args) + args.dns_ms
+    # connect, request and response header
+    elapsed += rtt(args) + rtt(args) + args.server_ms
+    elapsed += fill_ms(args, threshold_bytes)
+    return elapsed
+
+
+def cold(args):
+    return connect(args) + cancel_ms(args)
+
+
+def prefetched(args):
+    elapsed = args.swap_ms + cancel_ms(args)
+    if random.random() < args.prefetch_miss:
+        # the neighbour was not connected (yet), same as cold
+        return elapsed + connect(args)
+    slot_ms = args.slot_bytes * 8 / args.bitrate
+    missing_ms = args.threshold_ms - slot_ms
+    if missing_ms > 0:
+        elapsed += missing_ms
+    return elapsed
+
+
+def report(name, values):
+    values.sort()
+    print("%-10s p50 %7.1f ms, p90 %7.1f ms, p99 %7.1f ms, max %7.1f ms" % (
+        name, percentile(values, 0.50), percentile(values, 0.90), percentile(values, 0.99), values[-1]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Station switch simulation, time to audio")
+    parser.add_argument("--switches", type=int, default=10000)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--rtt-ms", type=float, default=40.0, help="median round trip to the server")
+    parser.add_argument("--rtt-spread", type=float, default=0.5, help="log-normal sigma of the round trip")
+    parser.add_argument("--dns-ms", type=float, default=20.0, help="resolver time on top of a round trip")
+    parser.add_argument("--dns-hit", type=float, default=0.5, help="fraction of lookups answered by the cache")
+    parser.add_argument("--server-ms", type=float, default=30.0, help="server time to start the stream")
+    parser.add_argument("--bitrate", type=float, default=128.0, help="stream bit rate (kbit/s)")
+    parser.add_argument("--link-kbps", type=float, default=4000.0, help="link speed (kbit/s)")
+    parser.add_argument("--burst-bytes", type=int, default=65536, help="server burst at link speed")
+    parser.add_argument("--threshold-ms", type=float, default=2000.0, help="player start threshold")
+    parser.add_argument("--slot-bytes", type=int, default=32768, help="prefetch memory per neighbour")
+    parser.add_argument("--prefetch-miss", type=float, default=0.0, help="fraction of switches not prefetched")
+    parser.add_argument("--swap-ms", type=float, default=0.1)
+    parser.add_argument("--cancel-ms", type=float, default=5.0, help="decoder cancel")
+    parser.add_argument("--cancel-reset", type=float, default=0.05, help="fraction of cancels ending in a reset")
+    parser.add_argument("--reset-ms", type=float, default=50.0, help="decoder soft reset")
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    report("cold", [cold(args) for _ in range(args.switches)])
+    report("prefetched", [prefetched(args) for _ in range(args.switches)])
+
+
+if __name__ == "__main__":
+    main()